@@ -0,0 +1,73 @@
+#!/usr/bin/env python3
+"""
+Compare midiverse_bench results against a stored baseline.
+
+Exits with status 1 if any benchmark lost more throughput than the tolerance
+allows, or allocates more than it used to.
+"""
+
+import argparse
+import json
+import sys
+
+# Settings that make two result files incomparable when they differ
+ENVIRONMENT_KEYS = ['version', 'compiler', 'optimized', 'hardwareThreads', 'kernels', 'sampleRate']
+
+
+def load_results(path):
+    with open(path) as f:
+        data = json.load(f)
+    return data, {result['name']: result for result in data['results']}
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Compare midiverse_bench results against a baseline')
+    parser.add_argument('baseline', help='Baseline JSON from midiverse_bench')
+    parser.add_argument('current', help='New JSON from midiverse_bench')
+    parser.add_argument('--tolerance', '-t', type=float, default=0.10,
+                        help='Allowed throughput loss as a fraction (default: 0.10)')
+    args = parser.parse_args()
+
+    baseline_data, baseline = load_results(args.baseline)
+    current_data, current = load_results(args.current)
+
+    for key in ENVIRONMENT_KEYS:
+        if baseline_data.get(key) != current_data.get(key):
+            print(f"warning: {key} differs: {baseline_data.get(key)} -> {current_data.get(key)}")
+
+    regressions = 0
+    print(f"{'benchmark':<28} {'baseline':>14} {'current':>14} {'change':>8}  allocations")
+    for name, base in baseline.items():
+        result = current.get(name)
+        if result is None:
+            print(f"{name:<28} missing from current results")
+            continue
+
+        ratio = result['throughput'] / base['throughput'] if base['throughput'] > 0 else 1.0
+        slower = ratio < 1.0 - args.tolerance
+        # Allocation counts are nearly deterministic; any growth from zero is a regression
+        more_allocations = (result['allocations'] > base['allocations'] * (1.0 + args.tolerance)
+                            if base['allocations'] > 0 else result['allocations'] > 0)
+        flag = ''
+        if slower or more_allocations:
+            flag = '  REGRESSION'
+            regressions += 1
+        elif ratio > 1.0 + args.tolerance:
+            flag = '  faster'
+
+        print(f"{name:<28} {base['throughput']:>14.4g} {result['throughput']:>14.4g} {(ratio - 1.0) * 100:>+7.1f}%"
+              f"  {base['allocations']:g} -> {result['allocations']:g}{flag}")
+
+    for name in current:
+        if name not in baseline:
+            print(f"{name:<28} new, no baseline")
+
+    if regressions:
+        print(f"{regressions} regression(s) beyond {args.tolerance * 100:g}% tolerance")
+        return 1
+    print("No regressions")
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,476 @@
+// Benchmarks MIDI parsing, rendering, PCM conversion, WAV/FLAC writing and full
+// CLI-equivalent renders over synthetic MIDI corpora, and reports the results as
+// JSON for comparison against a stored baseline (see compare_bench.py).
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "audio_buffer.h"
+#include "audio_writer.h"
+#include "flac_encoder.h"
+#include "logger.h"
+#include "midi_processor.h"
+#include "pcm_converter.h"
+#include "synthetic_midi.h"
+#include "track_mixer.h"
+#include "vst_renderer.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+    // Bump when results stop being comparable with older baselines
+    constexpr int kResultsVersion = 1;
+    constexpr int kWriteBlockFrames = VstRenderer::kDefaultBlockSize;
+
+    std::atomic<uint64_t> allocationCount(0);
+    std::atomic<uint64_t> allocatedBytes(0);
+
+    void* allocate(size_t size) {
+        allocationCount.fetch_add(1, std::memory_order_relaxed);
+        allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+        void* p = std::malloc(size ? size : 1);
+        if (!p) {
+            throw std::bad_alloc();
+        }
+        return p;
+    }
+
+    void* allocateAligned(size_t size, std::align_val_t alignment) {
+        size_t align = static_cast<size_t>(alignment);
+        allocationCount.fetch_add(1, std::memory_order_relaxed);
+        allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+        void* p = std::aligned_alloc(align, (std::max<size_t>(size, 1) + align - 1) / align * align);
+        if (!p) {
+            throw std::bad_alloc();
+        }
+        return p;
+    }
+
+    struct Corpus {
+        std::string name;
+        SyntheticMidiOptions options;
+        std::vector<uint8_t> smf;
+        size_t numEvents = 0;
+    };
+
+    struct Result {
+        std::string corpus;
+        std::string benchmark;
+        int iterations = 0;
+        double medianSeconds = 0.0;
+        double minSeconds = 0.0;
+        double audioSeconds = 0.0;
+        double throughput = 0.0;
+        const char* throughputUnit = "";
+        double allocations = 0.0;
+        double allocatedBytes = 0.0;
+
+        std::string getName() const { return corpus + "/" + benchmark; }
+        double getRealtimeFactor() const { return medianSeconds > 0.0 ? audioSeconds / medianSeconds : 0.0; }
+    };
+
+    struct Settings {
+        int iterations = 5;
+        float sampleRate = 44100;
+        std::string filter;
+    };
+
+    void printUsage(const char* programName) {
+        std::cout << "Usage: " << programName << " [options]" << std::endl;
+        std::cout << std::endl;
+        std::cout << "Options:" << std::endl;
+        std::cout << "  -o, --output <file>      Write the JSON results here (default: stdout)" << std::endl;
+        std::cout << "  -n, --iterations <n>     Timed runs per benchmark, after one warm-up (default: 5)" << std::endl;
+        std::cout << "      --duration <sec>     Length of the built-in corpora (default: 20)" << std::endl;
+        std::cout << "      --corpus <name:spec> Use this corpus instead of the built-in ones (repeatable)," << std::endl;
+        std::cout << "                           e.g. huge:duration=60,tracks=64,density=20,tempo-changes=100" << std::endl;
+        std::cout << "                           (other keys: ppq, seed)" << std::endl;
+        std::cout << "      --filter <text>      Only run benchmarks whose name contains text" << std::endl;
+        std::cout << "      --generate <dir>     Write the corpora to <dir>/<name>.mid and exit" << std::endl;
+        std::cout << "  -r, --rate <rate>        Sample rate in Hz (default: 44100)" << std::endl;
+        std::cout << "  -h, --help               Show this help message" << std::endl;
+    }
+
+    // Warm-up run, then timed runs; allocations are averaged over the timed runs
+    template <typename Run>
+    bool measure(const Settings& settings, const std::string& corpus, const std::string& benchmark,
+                 double audioSeconds, double workPerRun, const char* unit, Run run, std::vector<Result>& results) {
+        Result result;
+        result.corpus = corpus;
+        result.benchmark = benchmark;
+        if (!settings.filter.empty() && result.getName().find(settings.filter) == std::string::npos) {
+            return true;
+        }
+        if (!run()) {
+            std::cerr << "FAIL: " << result.getName() << std::endl;
+            return false;
+        }
+
+        std::vector<double> seconds;
+        uint64_t allocationsBefore = allocationCount;
+        uint64_t bytesBefore = allocatedBytes;
+        for (int i = 0; i < settings.iterations; ++i) {
+            auto start = std::chrono::steady_clock::now();
+            bool ok = run();
+            seconds.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+            if (!ok) {
+                std::cerr << "FAIL: " << result.getName() << std::endl;
+                return false;
+            }
+        }
+        std::sort(seconds.begin(), seconds.end());
+
+        result.iterations = settings.iterations;
+        result.medianSeconds = seconds[seconds.size() / 2];
+        result.minSeconds = seconds.front();
+        result.audioSeconds = audioSeconds;
+        result.throughput = result.medianSeconds > 0.0 ? workPerRun / result.medianSeconds : 0.0;
+        result.throughputUnit = unit;
+        result.allocations = static_cast<double>(allocationCount - allocationsBefore) / settings.iterations;
+        result.allocatedBytes = static_cast<double>(allocatedBytes - bytesBefore) / settings.iterations;
+
+        std::cerr << std::left << std::setw(28) << result.getName() << std::right << std::fixed
+                  << std::setprecision(4) << std::setw(10) << result.medianSeconds << " s  "
+                  << std::setprecision(1) << std::setw(9) << result.getRealtimeFactor() << "x realtime  "
+                  << std::setprecision(0) << std::setw(13) << result.throughput << " " << std::left << std::setw(10)
+                  << unit << std::right << std::setw(10) << result.allocations << " allocs" << std::endl;
+        std::cerr.unsetf(std::ios::floatfield);
+        results.push_back(result);
+        return true;
+    }
+
+    // Writes the audio in renderer-sized blocks, as a render would
+    bool writeAudio(AudioWriter& writer, const AudioBuffer& audio) {
+        const float* channels[2];
+        for (size_t frame = 0; frame < audio.getNumFrames(); frame += kWriteBlockFrames) {
+            for (int channel = 0; channel < audio.getNumChannels(); ++channel) {
+                channels[channel] = audio.getChannel(channel) + frame;
+            }
+            size_t numFrames = std::min<size_t>(kWriteBlockFrames, audio.getNumFrames() - frame);
+            if (!writer.appendBlock(channels, numFrames)) {
+                return false;
+            }
+        }
+        return writer.finalize();
+    }
+
+    bool runCorpus(const Settings& settings, Corpus& corpus, const fs::path& scratchDir, std::vector<Result>& results) {
+        const float rate = settings.sampleRate;
+        const int numChannels = 2;
+        bool ok = true;
+
+        MidiProcessor processor;
+        if (!processor.loadMidiData(corpus.smf.data(), corpus.smf.size())) {
+            std::cerr << "FAIL: could not parse corpus " << corpus.name << std::endl;
+            return false;
+        }
+        corpus.numEvents = processor.getSequence().size();
+        double midiSeconds = processor.getSequence().getDurationSeconds();
+
+        ok &= measure(settings, corpus.name, "parse", midiSeconds, static_cast<double>(corpus.numEvents), "events/s",
+            [&]() { return processor.loadMidiData(corpus.smf.data(), corpus.smf.size()); }, results);
+
+        // One render kept for the encoding benchmarks
+        VstRenderer renderer;
+        AudioBuffer audio(numChannels, 0);
+        if (!renderer.loadVst("bench.vst", rate, numChannels) ||
+            !renderer.renderMidi(processor.getSequence(), rate, numChannels,
+                [&audio](const float* const* channels, int numFrames) {
+                    audio.append(channels, static_cast<size_t>(numFrames));
+                    return true;
+                })) {
+            std::cerr << "FAIL: could not render corpus " << corpus.name << std::endl;
+            return false;
+        }
+        double frames = static_cast<double>(audio.getNumFrames());
+        double audioSeconds = frames / rate;
+
+        ok &= measure(settings, corpus.name, "render", audioSeconds, frames, "frames/s", [&]() {
+            return renderer.renderMidi(processor.getSequence(), rate, numChannels,
+                                       [](const float* const*, int) { return true; });
+        }, results);
+
+        std::vector<float> interleaved(audio.getNumFrames() * numChannels);
+        for (size_t i = 0; i < audio.getNumFrames(); ++i) {
+            for (int channel = 0; channel < numChannels; ++channel) {
+                interleaved[i * numChannels + channel] = audio.getChannel(channel)[i];
+            }
+        }
+        std::vector<uint8_t> pcm(interleaved.size() * 4);
+        for (SampleFormat format : {SampleFormat::Int16, SampleFormat::Int24}) {
+            PcmConverter converter(format);
+            std::string name = format == SampleFormat::Int16 ? "pcm_int16" : "pcm_int24";
+            ok &= measure(settings, corpus.name, name, audioSeconds, static_cast<double>(interleaved.size()),
+                          "samples/s", [&]() {
+                converter.convert(interleaved.data(), interleaved.size(), pcm.data());
+                return true;
+            }, results);
+        }
+
+        std::vector<uint8_t> encoded;
+        AudioWriter writer;
+        for (AudioFileFormat fileFormat : {AudioFileFormat::Wav, AudioFileFormat::Flac}) {
+            std::string name = fileFormat == AudioFileFormat::Wav ? "wav_write" : "flac_write";
+            writer.setFileFormat(fileFormat);
+            ok &= measure(settings, corpus.name, name, audioSeconds, frames, "frames/s", [&]() {
+                return writer.openMemory(encoded, rate, numChannels, SampleFormat::Int16) &&
+                       writeAudio(writer, audio);
+            }, results);
+        }
+
+        // What midiverse_cli does for one file, with fresh objects each time
+        fs::path midiPath = scratchDir / (corpus.name + ".mid");
+        fs::path wavPath = scratchDir / (corpus.name + ".wav");
+        std::ofstream(midiPath, std::ios::binary).write(reinterpret_cast<const char*>(corpus.smf.data()),
+                                                        static_cast<std::streamsize>(corpus.smf.size()));
+        ok &= measure(settings, corpus.name, "end_to_end", audioSeconds, frames, "frames/s", [&]() {
+            MidiProcessor fileProcessor;
+            VstRenderer fileRenderer;
+            AudioWriter fileWriter;
+            if (!fileProcessor.loadMidiFile(midiPath.string()) || !fileRenderer.loadVst("bench.vst", rate, numChannels) ||
+                !fileWriter.open(wavPath.string(), rate, numChannels, SampleFormat::Int16)) {
+                return false;
+            }
+            bool rendered = fileRenderer.renderMidi(fileProcessor.getSequence(), rate, numChannels,
+                [&fileWriter](const float* const* channels, int numFrames) {
+                    return fileWriter.appendBlock(channels, numFrames);
+                });
+            return fileWriter.finalize() && rendered;
+        }, results);
+
+        return ok;
+    }
+
+    std::string quoted(const std::string& text) {
+        std::string out = "\"";
+        for (char c : text) {
+            if (c == '"' || c == '\\') {
+                out += '\\';
+            }
+            out += c;
+        }
+        return out + "\"";
+    }
+
+    // One result per line, so baselines diff cleanly
+    void writeJson(std::ostream& out, const Settings& settings, const std::vector<Corpus>& corpora,
+                   const std::vector<Result>& results) {
+        out << std::setprecision(9);
+        out << "{" << std::endl;
+        out << "  \"version\": " << kResultsVersion << "," << std::endl;
+#if defined(__clang__)
+        out << "  \"compiler\": " << quoted(std::string("clang ") + __clang_version__) << "," << std::endl;
+#elif defined(__GNUC__)
+        out << "  \"compiler\": " << quoted(std::string("gcc ") + __VERSION__) << "," << std::endl;
+#endif
+#ifdef __OPTIMIZE__
+        out << "  \"optimized\": true," << std::endl;
+#else
+        out << "  \"optimized\": false," << std::endl;
+#endif
+        out << "  \"hardwareThreads\": " << std::thread::hardware_concurrency() << "," << std::endl;
+        out << "  \"kernels\": {\"pcm\": " << quoted(PcmConverter::getKernelName())
+            << ", \"flac\": " << quoted(FlacEncoder::getKernelName())
+            << ", \"mixer\": " << quoted(TrackMixer::getKernelName()) << "}," << std::endl;
+        out << "  \"iterations\": " << settings.iterations << "," << std::endl;
+        out << "  \"sampleRate\": " << settings.sampleRate << "," << std::endl;
+
+        out << "  \"corpora\": [" << std::endl;
+        for (size_t i = 0; i < corpora.size(); ++i) {
+            const Corpus& corpus = corpora[i];
+            out << "    {\"name\": " << quoted(corpus.name)
+                << ", \"durationSeconds\": " << corpus.options.durationSeconds
+                << ", \"tracks\": " << corpus.options.numTracks
+                << ", \"notesPerSecond\": " << corpus.options.notesPerSecond
+                << ", \"tempoChanges\": " << corpus.options.numTempoChanges
+                << ", \"ppq\": " << corpus.options.ticksPerQuarterNote
+                << ", \"seed\": " << corpus.options.seed
+                << ", \"bytes\": " << corpus.smf.size()
+                << ", \"events\": " << corpus.numEvents << "}" << (i + 1 < corpora.size() ? "," : "") << std::endl;
+        }
+        out << "  ]," << std::endl;
+
+        out << "  \"results\": [" << std::endl;
+        for (size_t i = 0; i < results.size(); ++i) {
+            const Result& result = results[i];
+            out << "    {\"name\": " << quoted(result.getName())
+                << ", \"corpus\": " << quoted(result.corpus)
+                << ", \"benchmark\": " << quoted(result.benchmark)
+                << ", \"iterations\": " << result.iterations
+                << ", \"medianSeconds\": " << result.medianSeconds
+                << ", \"minSeconds\": " << result.minSeconds
+                << ", \"audioSeconds\": " << result.audioSeconds
+                << ", \"realtimeFactor\": " << result.getRealtimeFactor()
+                << ", \"throughput\": " << result.throughput
+                << ", \"throughputUnit\": " << quoted(result.throughputUnit)
+                << ", \"allocations\": " << result.allocations
+                << ", \"allocatedBytes\": " << result.allocatedBytes << "}"
+                << (i + 1 < results.size() ? "," : "") << std::endl;
+        }
+        out << "  ]" << std::endl;
+        out << "}" << std::endl;
+    }
+}
+
+void* operator new(size_t size) {
+    return allocate(size);
+}
+
+void* operator new[](size_t size) {
+    return allocate(size);
+}
+
+void* operator new(size_t size, std::align_val_t alignment) {
+    return allocateAligned(size, alignment);
+}
+
+void* operator new[](size_t size, std::align_val_t alignment) {
+    return allocateAligned(size, alignment);
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::align_val_t) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p, std::align_val_t) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, size_t, std::align_val_t) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p, size_t, std::align_val_t) noexcept {
+    std::free(p);
+}
+
+int main(int argc, char* argv[]) {
+    Settings settings;
+    std::string outputFile;
+    std::string generateDir;
+    double duration = 20.0;
+    std::vector<std::string> corpusSpecs;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "-h" || arg == "--help") {
+            printUsage(argv[0]);
+            return 0;
+        } else if ((arg == "-o" || arg == "--output") && hasValue) {
+            outputFile = argv[++i];
+        } else if ((arg == "-n" || arg == "--iterations") && hasValue) {
+            settings.iterations = std::max(1, std::stoi(argv[++i]));
+        } else if (arg == "--duration" && hasValue) {
+            duration = std::stod(argv[++i]);
+        } else if (arg == "--corpus" && hasValue) {
+            corpusSpecs.push_back(argv[++i]);
+        } else if (arg == "--filter" && hasValue) {
+            settings.filter = argv[++i];
+        } else if (arg == "--generate" && hasValue) {
+            generateDir = argv[++i];
+        } else if ((arg == "-r" || arg == "--rate") && hasValue) {
+            settings.sampleRate = std::stof(argv[++i]);
+        } else {
+            std::cerr << "Unknown option or missing value: " << arg << std::endl;
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    // Built-in corpora: a sparse solo line, a dense ensemble, and a tempo map under stress
+    if (corpusSpecs.empty()) {
+        corpusSpecs = {"sparse:tracks=1,density=4", "dense:tracks=16,density=16",
+                       "tempo:tracks=4,density=8,tempo-changes=500"};
+    }
+    std::vector<Corpus> corpora;
+    for (const std::string& spec : corpusSpecs) {
+        Corpus corpus;
+        size_t colon = spec.find(':');
+        corpus.name = spec.substr(0, colon);
+        corpus.options.durationSeconds = duration;
+        std::string error;
+        if (corpus.name.empty() ||
+            (colon != std::string::npos && !parseSyntheticMidiOptions(spec.substr(colon + 1), corpus.options, error))) {
+            std::cerr << "Error: " << (error.empty() ? "corpus needs a name: " + spec : error) << std::endl;
+            return 1;
+        }
+        generateSyntheticMidi(corpus.options, corpus.smf);
+        corpora.push_back(std::move(corpus));
+    }
+
+    if (!generateDir.empty()) {
+        std::error_code ec;
+        fs::create_directories(generateDir, ec);
+        for (const Corpus& corpus : corpora) {
+            fs::path path = fs::path(generateDir) / (corpus.name + ".mid");
+            std::ofstream file(path, std::ios::binary);
+            file.write(reinterpret_cast<const char*>(corpus.smf.data()), static_cast<std::streamsize>(corpus.smf.size()));
+            if (!file) {
+                std::cerr << "Error: could not write " << path << std::endl;
+                return 1;
+            }
+            std::cout << "Wrote " << path.string() << " (" << corpus.smf.size() << " bytes)" << std::endl;
+        }
+        return 0;
+    }
+
+#ifndef __OPTIMIZE__
+    std::cerr << "Warning: this is an unoptimized build; timings will not be representative" << std::endl;
+#endif
+
+    fs::path scratchDir = fs::temp_directory_path() / ("midiverse_bench_" + std::to_string(getpid()));
+    fs::create_directories(scratchDir);
+
+    // Library progress isn't logged while timing; the report goes to stderr, JSON to stdout
+    Logger::setLevel(LogLevel::Warn);
+
+    std::vector<Result> results;
+    bool ok = true;
+    for (Corpus& corpus : corpora) {
+        ok &= runCorpus(settings, corpus, scratchDir, results);
+    }
+
+    Logger::flush();
+    std::error_code ec;
+    fs::remove_all(scratchDir, ec);
+
+    if (outputFile.empty()) {
+        writeJson(std::cout, settings, corpora, results);
+    } else {
+        std::ofstream file(outputFile);
+        writeJson(file, settings, corpora, results);
+        if (!file) {
+            std::cerr << "Error: could not write " << outputFile << std::endl;
+            return 1;
+        }
+        std::cerr << "Results written to " << outputFile << std::endl;
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,235 @@
+#include "synthetic_midi.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <random>
+#include <sstream>
+
+namespace {
+    constexpr uint32_t kDefaultMicrosecondsPerQuarter = 500000;   // 120 BPM
+    constexpr double kSustainPeriod = 2.0;
+    constexpr double kPitchBendPeriod = 0.5;
+
+    struct Event {
+        uint64_t tick;
+        uint32_t order;     // Note-offs sort before anything else on the same tick
+        uint8_t bytes[6];
+        uint8_t size;
+    };
+
+    // std:: distributions differ between standard libraries, so values are mapped by hand
+    class Random {
+    public:
+        explicit Random(uint32_t seed) : engine(seed) {}
+
+        double uniform() {
+            return engine() / 4294967296.0;
+        }
+
+        int range(int low, int high) {
+            return low + static_cast<int>(uniform() * (high - low + 1));
+        }
+
+    private:
+        std::mt19937 engine;
+    };
+
+    // Tempo map kept in seconds so events can be placed in real time
+    class SecondsToTicks {
+    public:
+        explicit SecondsToTicks(int ticksPerQuarter) : ticksPerQuarter(ticksPerQuarter) {
+            segments.push_back({0.0, 0, kDefaultMicrosecondsPerQuarter});
+        }
+
+        // Returns the tick the change was placed on
+        uint64_t addTempoChange(double seconds, uint32_t microsecondsPerQuarter) {
+            uint64_t tick = toTick(seconds);
+            const Segment& last = segments.back();
+            // Start time recomputed from the rounded tick, so later conversions don't drift
+            double start = last.seconds + (tick - last.tick) * (last.microsecondsPerQuarter / 1e6) / ticksPerQuarter;
+            segments.push_back({start, tick, microsecondsPerQuarter});
+            return tick;
+        }
+
+        uint64_t toTick(double seconds) const {
+            auto it = std::upper_bound(segments.begin(), segments.end(), seconds,
+                                       [](double t, const Segment& s) { return t < s.seconds; });
+            const Segment& segment = *std::prev(it);
+            double ticks = (seconds - segment.seconds) * 1e6 / segment.microsecondsPerQuarter * ticksPerQuarter;
+            return segment.tick + static_cast<uint64_t>(std::llround(std::max(0.0, ticks)));
+        }
+
+    private:
+        struct Segment {
+            double seconds;
+            uint64_t tick;
+            uint32_t microsecondsPerQuarter;
+        };
+
+        int ticksPerQuarter;
+        std::vector<Segment> segments;
+    };
+
+    void addEvent(std::vector<Event>& events, uint64_t tick, uint32_t order, std::initializer_list<uint8_t> bytes) {
+        Event event;
+        event.tick = tick;
+        event.order = order;
+        event.size = static_cast<uint8_t>(bytes.size());
+        std::copy(bytes.begin(), bytes.end(), event.bytes);
+        events.push_back(event);
+    }
+
+    void putVariableLength(std::vector<uint8_t>& out, uint64_t value) {
+        uint8_t buffer[10];
+        int count = 0;
+        buffer[count++] = value & 0x7F;
+        while (value >>= 7) {
+            buffer[count++] = static_cast<uint8_t>(0x80 | (value & 0x7F));
+        }
+        while (count > 0) {
+            out.push_back(buffer[--count]);
+        }
+    }
+
+    void putBigEndian(std::vector<uint8_t>& out, uint32_t value, int bytes) {
+        for (int i = bytes - 1; i >= 0; --i) {
+            out.push_back(static_cast<uint8_t>(value >> (8 * i)));
+        }
+    }
+
+    // Sorts the events and appends them as an MTrk chunk, using running status
+    void writeTrack(std::vector<Event>& events, uint64_t endTick, std::vector<uint8_t>& smf) {
+        std::stable_sort(events.begin(), events.end(), [](const Event& a, const Event& b) {
+            return a.tick != b.tick ? a.tick < b.tick : a.order < b.order;
+        });
+
+        smf.insert(smf.end(), {'M', 'T', 'r', 'k', 0, 0, 0, 0});
+        size_t lengthOffset = smf.size() - 4;
+        uint64_t lastTick = 0;
+        uint8_t runningStatus = 0;
+        for (const Event& event : events) {
+            putVariableLength(smf, event.tick - lastTick);
+            lastTick = event.tick;
+            bool isChannel = event.bytes[0] < 0xF0;
+            size_t first = isChannel && event.bytes[0] == runningStatus ? 1 : 0;
+            runningStatus = isChannel ? event.bytes[0] : 0;
+            smf.insert(smf.end(), event.bytes + first, event.bytes + event.size);
+        }
+        putVariableLength(smf, std::max(endTick, lastTick) - lastTick);
+        smf.insert(smf.end(), {0xFF, 0x2F, 0x00});
+
+        uint32_t length = static_cast<uint32_t>(smf.size() - lengthOffset - 4);
+        for (int i = 0; i < 4; ++i) {
+            smf[lengthOffset + i] = static_cast<uint8_t>(length >> (8 * (3 - i)));
+        }
+    }
+}
+
+void generateSyntheticMidi(const SyntheticMidiOptions& options, std::vector<uint8_t>& smf) {
+    Random random(options.seed);
+    SecondsToTicks timeline(options.ticksPerQuarterNote);
+    double duration = options.durationSeconds;
+    std::vector<Event> events;
+
+    smf.clear();
+    smf.insert(smf.end(), {'M', 'T', 'h', 'd', 0, 0, 0, 6, 0, 1});
+    putBigEndian(smf, static_cast<uint32_t>(options.numTracks + 1), 2);
+    putBigEndian(smf, static_cast<uint32_t>(options.ticksPerQuarterNote), 2);
+
+    // Conductor track: the initial tempo, then changes between 60 and 200 BPM
+    addEvent(events, 0, 1, {0xFF, 0x51, 0x03, 0x07, 0xA1, 0x20});
+    for (int i = 1; i <= options.numTempoChanges; ++i) {
+        uint32_t microseconds = static_cast<uint32_t>(60000000 / random.range(60, 200));
+        uint64_t tick = timeline.addTempoChange(duration * i / (options.numTempoChanges + 1), microseconds);
+        addEvent(events, tick, 1, {0xFF, 0x51, 0x03, static_cast<uint8_t>(microseconds >> 16),
+                                   static_cast<uint8_t>(microseconds >> 8), static_cast<uint8_t>(microseconds)});
+    }
+    uint64_t endTick = timeline.toTick(duration);
+    writeTrack(events, endTick, smf);
+
+    for (int track = 0; track < options.numTracks; ++track) {
+        events.clear();
+        uint8_t channel = static_cast<uint8_t>(track % 16);
+
+        // Setup: program, volume and a pan spread across the tracks
+        uint8_t pan = static_cast<uint8_t>(options.numTracks > 1 ? track * 127 / (options.numTracks - 1) : 64);
+        addEvent(events, 0, 1, {static_cast<uint8_t>(0xC0 | channel), static_cast<uint8_t>((track * 8) % 128)});
+        addEvent(events, 0, 1, {static_cast<uint8_t>(0xB0 | channel), 7, 100});
+        addEvent(events, 0, 1, {static_cast<uint8_t>(0xB0 | channel), 10, pan});
+
+        // Pedal held every other period, and a slowly wandering pitch bend
+        for (double t = 0.0; t < duration; t += kSustainPeriod) {
+            bool down = static_cast<int>(t / kSustainPeriod) % 2 == 0;
+            addEvent(events, timeline.toTick(t), 1, {static_cast<uint8_t>(0xB0 | channel), 64,
+                                                     static_cast<uint8_t>(down ? 127 : 0)});
+        }
+        for (double t = kPitchBendPeriod; t < duration; t += kPitchBendPeriod) {
+            int bend = random.range(8192 - 512, 8192 + 512);
+            addEvent(events, timeline.toTick(t), 1, {static_cast<uint8_t>(0xE0 | channel),
+                                                     static_cast<uint8_t>(bend & 0x7F),
+                                                     static_cast<uint8_t>(bend >> 7)});
+        }
+
+        // Notes on a random walk over five octaves
+        int pitch = 60;
+        double t = 0.0;
+        while (true) {
+            t += -std::log(1.0 - random.uniform()) / options.notesPerSecond;
+            if (t >= duration) {
+                break;
+            }
+            pitch = std::max(36, std::min(96, pitch + random.range(-7, 7)));
+            uint8_t velocity = static_cast<uint8_t>(random.range(40, 127));
+            double end = std::min(duration, t + 0.05 + random.uniform() * 0.95);
+            addEvent(events, timeline.toTick(t), 1, {static_cast<uint8_t>(0x90 | channel),
+                                                     static_cast<uint8_t>(pitch), velocity});
+            addEvent(events, timeline.toTick(end), 0, {static_cast<uint8_t>(0x80 | channel),
+                                                       static_cast<uint8_t>(pitch), 64});
+        }
+        writeTrack(events, endTick, smf);
+    }
+}
+
+bool parseSyntheticMidiOptions(const std::string& spec, SyntheticMidiOptions& options, std::string& error) {
+    std::stringstream items(spec);
+    std::string item;
+    while (std::getline(items, item, ',')) {
+        size_t equals = item.find('=');
+        std::string key = item.substr(0, equals);
+        std::string value = equals == std::string::npos ? "" : item.substr(equals + 1);
+        char* end = nullptr;
+        double number = strtod(value.c_str(), &end);
+        if (value.empty() || *end != '\0') {
+            error = "Expected <key>=<number> in corpus spec, got: " + item;
+            return false;
+        }
+
+        bool valid = true;
+        if (key == "duration") {
+            options.durationSeconds = number;
+            valid = number > 0 && number <= 86400;
+        } else if (key == "tracks") {
+            options.numTracks = static_cast<int>(number);
+            valid = number >= 1 && number <= 1024;
+        } else if (key == "density") {
+            options.notesPerSecond = number;
+            valid = number > 0 && number <= 10000;
+        } else if (key == "tempo-changes") {
+            options.numTempoChanges = static_cast<int>(number);
+            valid = number >= 0 && number <= 1000000;
+        } else if (key == "ppq") {
+            options.ticksPerQuarterNote = static_cast<int>(number);
+            valid = number >= 1 && number <= 32767;
+        } else if (key == "seed") {
+            options.seed = static_cast<uint32_t>(number);
+        } else {
+            error = "Unknown corpus setting: " + key;
+            return false;
+        }
+        if (!valid) {
+            error = "Corpus setting out of range: " + item;
+            return false;
+        }
+    }
+    return true;
+}
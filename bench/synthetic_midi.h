@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Shape of a generated Standard MIDI File
+struct SyntheticMidiOptions {
+    double durationSeconds = 30.0;
+    int numTracks = 4;              // Instrument tracks, besides the conductor track
+    double notesPerSecond = 8.0;    // Per track, on average
+    int numTempoChanges = 0;        // Spread evenly over the duration
+    int ticksPerQuarterNote = 480;
+    uint32_t seed = 1;
+};
+
+// Writes a format-1 SMF: a conductor track with the tempo map, then one track per
+// instrument with notes at random (exponentially distributed) intervals, plus
+// program, volume, pan, sustain pedal and pitch bend changes. Notes are placed in
+// seconds and converted through the tempo map, so density and duration hold
+// whatever the tempo changes. The output only depends on the options and seed.
+void generateSyntheticMidi(const SyntheticMidiOptions& options, std::vector<uint8_t>& smf);
+
+// Parses "duration=60,tracks=16,density=32,tempo-changes=100,ppq=960,seed=3" over
+// the given defaults; returns false with error set on an unknown key or bad value
+bool parseSyntheticMidiOptions(const std::string& spec, SyntheticMidiOptions& options, std::string& error);
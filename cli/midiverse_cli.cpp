@@ -1,26 +1,74 @@
 #include "../include/midi_processor.h"
 #include "../include/vst_renderer.h"
-#include "../include/audio_writer.h"
+#include "../include/multi_rate_writer.h"
+#include "../include/batch_renderer.h"
+#include "../include/logger.h"
+#include "../include/peak_pyramid.h"
+#include "../include/trace.h"
 
+#include <algorithm>
 #include <iostream>
 #include <string>
 #include <filesystem>
+#include <thread>
+
+#ifdef USE_JUCE
+#include <juce_events/juce_events.h>
+#endif
 
 namespace fs = std::filesystem;
 
 void printUsage(const char* programName) {
     std::cout << "Usage: " << programName << " <midi_file> <vst_plugin> [options]" << std::endl;
+    std::cout << "       " << programName << " --batch <dir|glob|manifest> <vst_plugin> [options]" << std::endl;
     std::cout << std::endl;
     std::cout << "Options:" << std::endl;
-    std::cout << "  -o, --output <file>      Output file path (default: output.wav)" << std::endl;
+    std::cout << "  -o, --output <file>      Output file path (default: output.wav or output.flac)," << std::endl;
+    std::cout << "                           or output directory in batch mode (default: output)" << std::endl;
+    std::cout << "  -j, --jobs <num>         Batch worker threads (default: one per CPU)" << std::endl;
+    std::cout << "  -t, --parallel-tracks <n> Render tracks on n threads, one instance each" << std::endl;
+    std::cout << "                           (0: one per CPU; default: off)" << std::endl;
+    std::cout << "  -s, --parallel-segments <n> Render the timeline as segments on n threads," << std::endl;
+    std::cout << "                           bit-identical to a serial render (built-in synth only;" << std::endl;
+    std::cout << "                           0: one per CPU; default: off)" << std::endl;
     std::cout << "  -r, --rate <rate>        Sample rate in Hz (default: 44100)" << std::endl;
+    std::cout << "      --render-rate <rate> Run the plugin at this rate and resample the output" << std::endl;
+    std::cout << "                           (default: the output rate)" << std::endl;
+    std::cout << "      --extra-rate <rate>  Also write <name>_<rate>.<ext>, resampled from the same" << std::endl;
+    std::cout << "                           render (repeatable)" << std::endl;
+    std::cout << "      --resample-quality <q> fast, standard or high (default: standard)" << std::endl;
     std::cout << "  -c, --channels <num>     Number of channels (default: 2)" << std::endl;
     std::cout << "  -b, --bit-depth <depth>  Bit depth (default: 16)" << std::endl;
+    std::cout << "  -f, --format <format>    wav or flac (16/24-bit only; default: wav)" << std::endl;
+    std::cout << "      --flac-level <n>     FLAC compression level, 0 (fastest) to 8 (smallest)" << std::endl;
+    std::cout << "                           (default: 5)" << std::endl;
+    std::cout << "      --block-size <n>     Frames per plugin process call (default: 512)" << std::endl;
+    std::cout << "      --tail <mode>        fixed: 2 s after the end (release time with the built-in" << std::endl;
+    std::cout << "                           synth); adaptive: until the output falls silent (default: fixed)" << std::endl;
+    std::cout << "      --tail-threshold <dB> Adaptive tail silence level in dBFS (default: -90)" << std::endl;
+    std::cout << "      --tail-hold <sec>    Silence that ends an adaptive tail (default: 0.5)" << std::endl;
+    std::cout << "      --tail-max <sec>     Longest adaptive tail (default: 30)" << std::endl;
+    std::cout << "      --float              Write 32-bit IEEE float samples" << std::endl;
+    std::cout << "      --dither             Apply TPDF dither to 16/24-bit output" << std::endl;
+    std::cout << "      --peaks              Also write <name>.peaks, a min/max/RMS waveform overview" << std::endl;
+    std::cout << "      --trace <file>       Write a Chrome/Perfetto trace of the render to <file>" << std::endl;
+    std::cout << "      --log-level <level>  debug, info, warn, error or off (default: info)" << std::endl;
+    std::cout << "      --log-format <fmt>   plain, text (timestamped) or json (default: plain)" << std::endl;
     std::cout << "  -h, --help               Show this help message" << std::endl;
 }
 
 int main(int argc, char* argv[]) {
-    if (argc < 3) {
+#ifdef USE_JUCE
+    // Owns the MessageManager plugins need; declared first so it outlives every
+    // plugin instance pool
+    juce::ScopedJuceInitialiser_GUI juceInitialiser;
+#endif
+
+    // Batch mode takes a directory, glob or manifest in place of the MIDI file
+    bool batchMode = argc > 1 && std::string(argv[1]) == "--batch";
+    int firstPositional = batchMode ? 2 : 1;
+    
+    if (argc < firstPositional + 2) {
         printUsage(argv[0]);
         return 1;
     }
@@ -28,17 +76,33 @@ int main(int argc, char* argv[]) {
     // Parse command line arguments
     std::string midiFile;
     std::string vstPath;
-    std::string outputFile = "output.wav";
+    std::string outputFile;
     float sampleRate = 44100;
     int numChannels = 2;
     int bitDepth = 16;
+    bool floatOutput = false;
+    bool dither = false;
+    bool writePeaks = false;
+    std::string traceFile;
+    LogLevel logLevel = LogLevel::Info;
+    LogFormat logFormat = LogFormat::Plain;
+    AudioFileFormat fileFormat = AudioFileFormat::Wav;
+    int flacLevel = FlacEncoder::kDefaultLevel;
+    int numJobs = 0;
+    int parallelTracks = 1;
+    int parallelSegments = 1;
+    int blockSize = VstRenderer::kDefaultBlockSize;
+    float renderRate = 0;
+    std::vector<float> extraRates;
+    ResamplerQuality resampleQuality = ResamplerQuality::Standard;
+    RenderTail tail;
     
     // First two arguments are midi file and vst plugin
-    midiFile = argv[1];
-    vstPath = argv[2];
+    midiFile = argv[firstPositional];
+    vstPath = argv[firstPositional + 1];
     
     // Parse optional arguments
-    for (int i = 3; i < argc; i++) {
+    for (int i = firstPositional + 2; i < argc; i++) {
         std::string arg = argv[i];
         
         if (arg == "-h" || arg == "--help") {
@@ -58,6 +122,31 @@ int main(int argc, char* argv[]) {
                 std::cerr << "Error: Sample rate required" << std::endl;
                 return 1;
             }
+        } else if (arg == "--render-rate") {
+            if (i + 1 < argc) {
+                renderRate = std::stof(argv[++i]);
+            } else {
+                std::cerr << "Error: Render rate required" << std::endl;
+                return 1;
+            }
+        } else if (arg == "--extra-rate") {
+            if (i + 1 < argc) {
+                extraRates.push_back(std::stof(argv[++i]));
+            } else {
+                std::cerr << "Error: Sample rate required" << std::endl;
+                return 1;
+            }
+        } else if (arg == "--resample-quality") {
+            if (i + 1 < argc) {
+                std::string quality = argv[++i];
+                if (!Resampler::parseQuality(quality, resampleQuality)) {
+                    std::cerr << "Error: Unknown resample quality: " << quality << std::endl;
+                    return 1;
+                }
+            } else {
+                std::cerr << "Error: Resample quality required" << std::endl;
+                return 1;
+            }
         } else if (arg == "-c" || arg == "--channels") {
             if (i + 1 < argc) {
                 numChannels = std::stoi(argv[++i]);
@@ -72,6 +161,127 @@ int main(int argc, char* argv[]) {
                 std::cerr << "Error: Bit depth required" << std::endl;
                 return 1;
             }
+        } else if (arg == "-f" || arg == "--format") {
+            if (i + 1 < argc) {
+                std::string name = argv[++i];
+                if (!AudioWriter::parseFileFormat(name, fileFormat)) {
+                    std::cerr << "Error: Unknown output format: " << name << std::endl;
+                    return 1;
+                }
+            } else {
+                std::cerr << "Error: Output format required" << std::endl;
+                return 1;
+            }
+        } else if (arg == "--flac-level") {
+            if (i + 1 < argc) {
+                flacLevel = std::stoi(argv[++i]);
+                if (flacLevel < FlacEncoder::kMinLevel || flacLevel > FlacEncoder::kMaxLevel) {
+                    std::cerr << "Error: FLAC level must be between " << FlacEncoder::kMinLevel << " and "
+                              << FlacEncoder::kMaxLevel << std::endl;
+                    return 1;
+                }
+            } else {
+                std::cerr << "Error: FLAC level required" << std::endl;
+                return 1;
+            }
+        } else if (arg == "-j" || arg == "--jobs") {
+            if (i + 1 < argc) {
+                numJobs = std::stoi(argv[++i]);
+            } else {
+                std::cerr << "Error: Number of jobs required" << std::endl;
+                return 1;
+            }
+        } else if (arg == "-t" || arg == "--parallel-tracks") {
+            if (i + 1 < argc) {
+                parallelTracks = std::stoi(argv[++i]);
+                if (parallelTracks <= 0) {
+                    parallelTracks = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+                }
+            } else {
+                std::cerr << "Error: Number of threads required" << std::endl;
+                return 1;
+            }
+        } else if (arg == "-s" || arg == "--parallel-segments") {
+            if (i + 1 < argc) {
+                parallelSegments = std::stoi(argv[++i]);
+                if (parallelSegments <= 0) {
+                    parallelSegments = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+                }
+            } else {
+                std::cerr << "Error: Number of threads required" << std::endl;
+                return 1;
+            }
+        } else if (arg == "--block-size") {
+            if (i + 1 < argc) {
+                blockSize = std::stoi(argv[++i]);
+            } else {
+                std::cerr << "Error: Block size required" << std::endl;
+                return 1;
+            }
+        } else if (arg == "--tail") {
+            if (i + 1 < argc) {
+                std::string mode = argv[++i];
+                if (mode == "fixed") {
+                    tail.mode = RenderTail::Mode::Fixed;
+                } else if (mode == "adaptive") {
+                    tail.mode = RenderTail::Mode::Adaptive;
+                } else {
+                    std::cerr << "Error: Unknown tail mode: " << mode << std::endl;
+                    return 1;
+                }
+            } else {
+                std::cerr << "Error: Tail mode required" << std::endl;
+                return 1;
+            }
+        } else if (arg == "--tail-threshold") {
+            if (i + 1 < argc) {
+                tail.thresholdDb = std::stof(argv[++i]);
+            } else {
+                std::cerr << "Error: Tail threshold required" << std::endl;
+                return 1;
+            }
+        } else if (arg == "--tail-hold") {
+            if (i + 1 < argc) {
+                tail.holdSeconds = std::stod(argv[++i]);
+            } else {
+                std::cerr << "Error: Tail hold time required" << std::endl;
+                return 1;
+            }
+        } else if (arg == "--tail-max") {
+            if (i + 1 < argc) {
+                tail.maxSeconds = std::stod(argv[++i]);
+            } else {
+                std::cerr << "Error: Maximum tail length required" << std::endl;
+                return 1;
+            }
+        } else if (arg == "--float") {
+            floatOutput = true;
+            bitDepth = 32;
+        } else if (arg == "--dither") {
+            dither = true;
+        } else if (arg == "--peaks") {
+            writePeaks = true;
+        } else if (arg == "--log-level") {
+            if (i + 1 < argc && Logger::parseLevel(argv[i + 1], logLevel)) {
+                ++i;
+            } else {
+                std::cerr << "Error: Log level must be debug, info, warn, error or off" << std::endl;
+                return 1;
+            }
+        } else if (arg == "--log-format") {
+            if (i + 1 < argc && Logger::parseFormat(argv[i + 1], logFormat)) {
+                ++i;
+            } else {
+                std::cerr << "Error: Log format must be plain, text or json" << std::endl;
+                return 1;
+            }
+        } else if (arg == "--trace") {
+            if (i + 1 < argc) {
+                traceFile = argv[++i];
+            } else {
+                std::cerr << "Error: Trace file path required" << std::endl;
+                return 1;
+            }
         } else {
             std::cerr << "Unknown option: " << arg << std::endl;
             printUsage(argv[0]);
@@ -79,14 +289,90 @@ int main(int argc, char* argv[]) {
         }
     }
     
+    Logger::setLevel(logLevel);
+    Logger::setFormat(logFormat);
+    
     // Validate inputs
-    if (!fs::exists(midiFile)) {
-        std::cerr << "Error: MIDI file not found: " << midiFile << std::endl;
+    if (blockSize <= 0) {
+        LOG_ERROR("Error: Invalid block size: " << blockSize);
         return 1;
     }
     
+    if (tail.holdSeconds < 0 || tail.maxSeconds < 0) {
+        LOG_ERROR("Error: Tail times must not be negative");
+        return 1;
+    }
+    
+    if (renderRate <= 0) {
+        renderRate = sampleRate;
+    }
+    for (float rate : extraRates) {
+        if (rate <= 0) {
+            LOG_ERROR("Error: Invalid sample rate: " << rate);
+            return 1;
+        }
+    }
+    
+    SampleFormat sampleFormat = SampleFormat::Float32;
+    if (!floatOutput && !PcmConverter::formatForBitDepth(bitDepth, sampleFormat)) {
+        LOG_ERROR("Error: Unsupported bit depth: " << bitDepth);
+        return 1;
+    }
+    if (fileFormat == AudioFileFormat::Flac && sampleFormat != SampleFormat::Int16 &&
+        sampleFormat != SampleFormat::Int24) {
+        LOG_ERROR("Error: FLAC output needs a bit depth of 16 or 24");
+        return 1;
+    }
+    
+    if (outputFile.empty()) {
+        outputFile = batchMode ? "output" : std::string("output") + AudioWriter::extensionFor(fileFormat);
+    }
+    
     if (!fs::exists(vstPath)) {
-        std::cerr << "Error: VST plugin not found: " << vstPath << std::endl;
+        LOG_ERROR("Error: VST plugin not found: " << vstPath);
+        return 1;
+    }
+    
+    if (!traceFile.empty()) {
+        Tracer::setThreadName("main");
+        Tracer::beginSession();
+    }
+    
+    if (batchMode) {
+        std::vector<BatchJob> jobs;
+        if (!BatchRenderer::collectJobs(midiFile, outputFile, AudioWriter::extensionFor(fileFormat), jobs)) {
+            return 1;
+        }
+        
+        BatchRenderer::Options options;
+        options.vstPath = vstPath;
+        options.sampleRate = sampleRate;
+        options.renderRate = renderRate;
+        options.extraRates = extraRates;
+        options.resampleQuality = resampleQuality;
+        options.tail = tail;
+        options.numChannels = numChannels;
+        options.sampleFormat = sampleFormat;
+        options.dither = dither;
+        options.fileFormat = fileFormat;
+        options.flacLevel = flacLevel;
+        options.writePeaks = writePeaks;
+        options.numWorkers = numJobs;
+        
+        std::vector<BatchResult> results;
+        double wallSeconds = 0.0;
+        bool allRendered = BatchRenderer::run(jobs, options, results, wallSeconds);
+        // The summary goes straight to stdout, after everything logged during the batch
+        Logger::flush();
+        BatchRenderer::printSummary(results, wallSeconds, std::cout);
+        if (!traceFile.empty() && Tracer::writeJson(traceFile)) {
+            LOG_INFO("Trace file: " << fs::absolute(traceFile));
+        }
+        return allRendered ? 0 : 1;
+    }
+    
+    if (!fs::exists(midiFile)) {
+        LOG_ERROR("Error: MIDI file not found: " << midiFile);
         return 1;
     }
     
@@ -95,7 +381,7 @@ int main(int argc, char* argv[]) {
     fs::path outputDir = outputPath.parent_path();
     if (!outputDir.empty() && !fs::exists(outputDir)) {
         if (!fs::create_directories(outputDir)) {
-            std::cerr << "Error: Failed to create output directory: " << outputDir << std::endl;
+            LOG_ERROR("Error: Failed to create output directory: " << outputDir);
             return 1;
         }
     }
@@ -103,47 +389,107 @@ int main(int argc, char* argv[]) {
     // Initialize components
     MidiProcessor midiProcessor;
     VstRenderer vstRenderer;
-    AudioWriter audioWriter;
+    MultiRateWriter audioWriter;
+    PeakPyramid peaks;
+    vstRenderer.setParallelTracks(parallelTracks);
+    vstRenderer.setParallelSegments(parallelSegments);
+    vstRenderer.setBlockSize(blockSize);
+    vstRenderer.setTail(tail);
     
     try {
         // Load and process MIDI file
-        std::cout << "Loading MIDI file: " << midiFile << std::endl;
+        LOG_INFO("Loading MIDI file: " << midiFile);
         if (!midiProcessor.loadMidiFile(midiFile)) {
-            std::cerr << "Error: Failed to load MIDI file" << std::endl;
+            LOG_ERROR("Error: Failed to load MIDI file");
             return 1;
         }
         
         // Load VST plugin
-        std::cout << "Loading VST plugin: " << vstPath << std::endl;
-        if (!vstRenderer.loadVst(vstPath)) {
-            std::cerr << "Error: Failed to load VST plugin" << std::endl;
+        LOG_INFO("Loading VST plugin: " << vstPath);
+        if (!vstRenderer.loadVst(vstPath, renderRate, numChannels)) {
+            LOG_ERROR("Error: Failed to load VST plugin");
             return 1;
         }
         
         // Render MIDI through VST
-        std::cout << "Rendering MIDI with VST plugin..." << std::endl;
-        std::cout << "Sample rate: " << sampleRate << " Hz" << std::endl;
-        std::cout << "Channels: " << numChannels << std::endl;
-        std::cout << "Bit depth: " << bitDepth << " bits" << std::endl;
+        LOG_INFO("Rendering MIDI with VST plugin...");
+        LOG_INFO("Sample rate: " << sampleRate << " Hz");
+        if (renderRate != sampleRate || !extraRates.empty()) {
+            LOG_INFO("Render rate: " << renderRate << " Hz (resampler: " << Resampler::getKernelName()
+                     << ")");
+        }
+        LOG_INFO("Channels: " << numChannels);
+        LOG_INFO("Bit depth: " << bitDepth << " bits" << (floatOutput ? " (float)" : ""));
+        if (fileFormat == AudioFileFormat::Flac) {
+            LOG_INFO("Format: FLAC, level " << flacLevel);
+        }
+        
+        // Stream blocks straight into the output file as they are rendered
+        std::vector<MultiRateWriter::Output> outputs = {{outputFile, sampleRate}};
+        for (float rate : extraRates) {
+            outputs.push_back({MultiRateWriter::pathForRate(outputFile, rate), rate});
+        }
+        for (const MultiRateWriter::Output& output : outputs) {
+            LOG_INFO("Writing to output file: " << output.filePath);
+        }
+        audioWriter.setDither(dither);
+        audioWriter.setQuality(resampleQuality);
+        audioWriter.setFileFormat(fileFormat);
+        audioWriter.setFlacLevel(flacLevel);
+        // A single render has the machine to itself, so FLAC frames are encoded on every core
+        audioWriter.setEncoderThreads(static_cast<int>(std::max(1u, std::thread::hardware_concurrency())));
+        if (!audioWriter.open(outputs, renderRate, numChannels, sampleFormat)) {
+            LOG_ERROR("Error: Failed to write audio file");
+            return 1;
+        }
+        // Peaks are taken at the render rate, before any resampling
+        if (writePeaks && !peaks.begin(numChannels, renderRate)) {
+            return 1;
+        }
         
-        if (!vstRenderer.renderMidi(midiProcessor.getMidiData(), sampleRate, numChannels)) {
-            std::cerr << "Error: Failed to render MIDI" << std::endl;
+        bool rendered = vstRenderer.renderMidi(midiProcessor.getSequence(), renderRate, numChannels,
+            [&audioWriter, &peaks, writePeaks](const float* const* channels, int numFrames) {
+                if (writePeaks) {
+                    peaks.addBlock(channels, static_cast<size_t>(numFrames));
+                }
+                return audioWriter.appendBlock(channels, numFrames);
+            });
+        
+        if (!rendered) {
+            audioWriter.finalize();
+            LOG_ERROR("Error: Failed to render MIDI");
             return 1;
         }
         
-        // Write to WAV file
-        std::cout << "Writing to output file: " << outputFile << std::endl;
-        if (!audioWriter.writeWavFile(outputFile, vstRenderer.getAudioData(), 
-                                     sampleRate, numChannels, bitDepth)) {
-            std::cerr << "Error: Failed to write audio file" << std::endl;
+        if (!audioWriter.finalize()) {
+            LOG_ERROR("Error: Failed to write audio file");
             return 1;
         }
         
-        std::cout << "Successfully rendered MIDI to audio!" << std::endl;
-        std::cout << "Output file: " << fs::absolute(outputFile) << std::endl;
+        std::string peaksFile = PeakPyramid::sidecarPath(outputFile);
+        if (writePeaks) {
+            peaks.finish();
+            if (!peaks.writeFile(peaksFile)) {
+                return 1;
+            }
+        }
+        
+        LOG_INFO("Successfully rendered MIDI to audio!");
+        for (const MultiRateWriter::Output& output : outputs) {
+            LOG_INFO("Output file: " << fs::absolute(output.filePath));
+        }
+        if (writePeaks) {
+            LOG_INFO("Peaks file: " << fs::absolute(peaksFile) << " (" << PeakPyramid::getKernelName() << ")");
+        }
+        if (!traceFile.empty()) {
+            if (!Tracer::writeJson(traceFile)) {
+                return 1;
+            }
+            LOG_INFO("Trace file: " << fs::absolute(traceFile));
+        }
         
     } catch (const std::exception& e) {
-        std::cerr << "Error: " << e.what() << std::endl;
+        LOG_ERROR("Error: " << e.what());
         return 1;
     }
     
@@ -0,0 +1,156 @@
+// Builds and queries the metadata index of a MIDI corpus (see midi_index.h)
+#include "../include/logger.h"
+#include "../include/midi_index.h"
+
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+void printUsage(const char* programName) {
+    std::cout << "Usage: " << programName << " build <index> <dir|midi_file>... [options]" << std::endl;
+    std::cout << "       " << programName << " list <index> [--invalid]" << std::endl;
+    std::cout << "       " << programName << " show <index> <midi_file>..." << std::endl;
+    std::cout << std::endl;
+    std::cout << "Commands:" << std::endl;
+    std::cout << "  build                    Index every .mid/.midi file under each directory and every" << std::endl;
+    std::cout << "                           file named; files unchanged since the last build are not read" << std::endl;
+    std::cout << "  list                     Print every entry, tab-separated, in path order" << std::endl;
+    std::cout << "  show                     Print the entries of the given files (exit status 1 if any" << std::endl;
+    std::cout << "                           is not indexed)" << std::endl;
+    std::cout << std::endl;
+    std::cout << "Options:" << std::endl;
+    std::cout << "  -j, --jobs <num>         Scanning threads (default: one per CPU)" << std::endl;
+    std::cout << "      --full               Rescan every file instead of reusing unchanged entries" << std::endl;
+    std::cout << "      --invalid            List only the files that are not valid MIDI files" << std::endl;
+    std::cout << "      --log-level <level>  debug, info, warn, error or off (default: info)" << std::endl;
+    std::cout << "  -h, --help               Show this help message" << std::endl;
+}
+
+void printHeader() {
+    std::cout << "path\tduration\tformat\ttracks\tevents\tnotes\tchannels\tvoices\ttempo_changes\tbytes" << std::endl;
+}
+
+void printEntry(std::string_view path, const MidiFileInfo& info) {
+    std::cout << path << '\t';
+    if (!info.valid) {
+        std::cout << "invalid\t-\t-\t-\t-\t-\t-\t-\t" << info.fileSize << '\n';
+        return;
+    }
+    std::string channels;
+    for (int channel = 0; channel < 16; ++channel) {
+        if (info.channelMask & (1u << channel)) {
+            channels += (channels.empty() ? "" : ",") + std::to_string(channel + 1);
+        }
+    }
+    std::cout << std::fixed << std::setprecision(3) << info.durationSeconds << '\t' << static_cast<int>(info.format)
+              << '\t' << info.trackCount << '\t' << info.eventCount << '\t' << info.noteCount << '\t'
+              << (channels.empty() ? "-" : channels) << '\t' << std::setprecision(2) << info.averageVoices << '\t'
+              << info.tempoChangeCount << '\t' << info.fileSize
+              << '\n';
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 1 && (std::string(argv[1]) == "-h" || std::string(argv[1]) == "--help")) {
+        printUsage(argv[0]);
+        return 0;
+    }
+    if (argc < 3) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    std::string command = argv[1];
+    std::string indexPath = argv[2];
+    std::vector<std::string> paths;
+    MidiIndexBuildOptions options;
+    bool invalidOnly = false;
+    LogLevel logLevel = LogLevel::Info;
+
+    for (int i = 3; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "-h" || arg == "--help") {
+            printUsage(argv[0]);
+            return 0;
+        } else if (arg == "-j" || arg == "--jobs") {
+            if (i + 1 < argc) {
+                options.numThreads = std::stoi(argv[++i]);
+            } else {
+                std::cerr << "Error: Number of jobs required" << std::endl;
+                return 1;
+            }
+        } else if (arg == "--full") {
+            options.rescanAll = true;
+        } else if (arg == "--invalid") {
+            invalidOnly = true;
+        } else if (arg == "--log-level") {
+            if (i + 1 < argc && Logger::parseLevel(argv[i + 1], logLevel)) {
+                ++i;
+            } else {
+                std::cerr << "Error: Log level must be debug, info, warn, error or off" << std::endl;
+                return 1;
+            }
+        } else if (!arg.empty() && arg[0] == '-') {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            printUsage(argv[0]);
+            return 1;
+        } else {
+            paths.push_back(arg);
+        }
+    }
+
+    Logger::setLevel(logLevel);
+
+    if (command == "build") {
+        if (paths.empty()) {
+            std::cerr << "Error: No MIDI files or directories given" << std::endl;
+            return 1;
+        }
+        MidiIndexBuildStats stats;
+        if (!MidiIndex::build(paths, indexPath, options, stats)) {
+            return 1;
+        }
+        LOG_INFO("Indexed " << stats.files << " files in " << stats.seconds << " s: " << stats.scanned
+                 << " scanned (" << stats.bytesScanned << " bytes), " << stats.reused << " unchanged, "
+                 << stats.removed << " removed, " << stats.invalid << " invalid");
+        return 0;
+    }
+
+    if (command != "list" && command != "show") {
+        std::cerr << "Unknown command: " << command << std::endl;
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    MidiIndex index;
+    if (!index.open(indexPath)) {
+        LOG_ERROR("Could not open index: " << indexPath);
+        return 1;
+    }
+
+    if (command == "list") {
+        printHeader();
+        for (size_t i = 0; i < index.size(); ++i) {
+            MidiFileInfo info = index.getInfo(i);
+            if (!invalidOnly || !info.valid) {
+                printEntry(index.getPath(i), info);
+            }
+        }
+        std::cout.flush();
+        return 0;
+    }
+
+    int status = 0;
+    printHeader();
+    for (const std::string& path : paths) {
+        size_t entry = index.find(path);
+        if (entry == MidiIndex::kNotFound) {
+            LOG_ERROR("Not indexed: " << path);
+            status = 1;
+        } else {
+            printEntry(index.getPath(entry), index.getInfo(entry));
+        }
+    }
+    std::cout.flush();
+    return status;
+}
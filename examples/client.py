@@ -9,9 +9,10 @@ import json
 import os
 import requests
 import sys
+import time
 
 def render_midi(url, midi_file, vst_path, sample_rate=44100, 
-               num_channels=2, bit_depth=16):
+               num_channels=2, bit_depth=16, poll_interval=0.5):
     """
     Request the Midiverse service to render a MIDI file using a VST plugin.
     
@@ -22,6 +23,7 @@ def render_midi(url, midi_file, vst_path, sample_rate=44100,
         sample_rate: Audio sample rate (default: 44100)
         num_channels: Number of audio channels (default: 2)
         bit_depth: Audio bit depth (default: 16)
+        poll_interval: Seconds between job status checks (default: 0.5)
         
     Returns:
         Path to the rendered audio file
@@ -43,10 +45,16 @@ def render_midi(url, midi_file, vst_path, sample_rate=44100,
         "bitDepth": bit_depth
     }
     
-    # Send request
+    # Send request; the server queues the render and answers with a job ID
+    # (202), or with the finished job (200) when the result was cached
     try:
         print(f"Sending render request to {endpoint}...")
-        response = requests.post(endpoint, json=payload)
+        while True:
+            response = requests.post(endpoint, json=payload)
+            if response.status_code != 429:
+                break
+            # Render queue is full
+            time.sleep(float(response.headers.get("Retry-After", 1)))
         response.raise_for_status()
     except requests.exceptions.RequestException as e:
         print(f"Error: {e}")
@@ -54,9 +62,29 @@ def render_midi(url, midi_file, vst_path, sample_rate=44100,
             print(f"Server response: {e.response.text}")
         sys.exit(1)
     
-    # Parse response
     data = response.json()
-    if data.get("status") != "success":
+    job_id = data.get("jobId")
+    if not job_id:
+        print(f"Error: Unexpected response - {data}")
+        sys.exit(1)
+    print(f"Render queued as job {job_id}")
+    
+    # Poll the job until it completes or fails
+    job_endpoint = f"{url}/jobs/{job_id}"
+    while data.get("status") not in ("success", "completed", "failed"):
+        time.sleep(poll_interval)
+        try:
+            response = requests.get(job_endpoint)
+            response.raise_for_status()
+        except requests.exceptions.RequestException as e:
+            print(f"\nError checking job status: {e}")
+            sys.exit(1)
+        data = response.json()
+        sys.stdout.write("\r%s: %d%%" % (data.get("status"), int(100 * data.get("progress", 0))))
+        sys.stdout.flush()
+    print()
+    
+    if data.get("status") == "failed":
         print(f"Error: Render failed - {data.get('error', 'Unknown error')}")
         sys.exit(1)
     
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+// Planar multichannel float audio. Every channel starts on a kAlignment boundary
+// so SIMD kernels can work on whole vectors. The buffer is move-only: handing a
+// render to the next stage moves the storage instead of copying the samples.
+class AudioBuffer {
+public:
+    static constexpr size_t kAlignment = 64;
+
+    AudioBuffer();
+    AudioBuffer(int numChannels, size_t numFrames);
+    ~AudioBuffer();
+
+    AudioBuffer(AudioBuffer&& other) noexcept;
+    AudioBuffer& operator=(AudioBuffer&& other) noexcept;
+    AudioBuffer(const AudioBuffer&) = delete;
+    AudioBuffer& operator=(const AudioBuffer&) = delete;
+
+    // Samples up to the new size are kept; frames added at the end are silent
+    void setSize(int numChannels, size_t numFrames);
+    // Makes room for numFrames per channel without changing the size
+    void reserve(size_t numFrames);
+    // Appends frames from planar channels, growing the storage geometrically
+    void append(const float* const* channels, size_t numFrames);
+    // Drops all frames but keeps the storage
+    void clear();
+
+    int getNumChannels() const;
+    size_t getNumFrames() const;
+    size_t getCapacity() const;
+
+    float* getChannel(int channel);
+    const float* getChannel(int channel) const;
+    float* const* getChannels();
+    const float* const* getChannels() const;
+
+private:
+    void reallocate(int numChannels, size_t capacity);
+
+    float* data;
+    int numChannels;
+    size_t numFrames;
+    size_t capacity;        // Frames per channel; also the distance between channels
+    std::vector<float*> channels;
+};
+
+// Interleaves numFrames frames of planar channels into output, with SIMD kernels
+// for the common mono and stereo layouts
+void interleaveChannels(const float* const* channels, int numChannels, size_t numFrames, float* output);
@@ -1,17 +1,94 @@
 #pragma once
 
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <memory>
 #include <string>
 #include <vector>
+#include "audio_buffer.h"
+#include "flac_encoder.h"
+#include "pcm_converter.h"
+
+enum class AudioFileFormat { Wav, Flac };
 
 class AudioWriter {
 public:
+    // Receives encoded bytes in order; returning false fails the write
+    using ByteSink = std::function<bool(const void* data, size_t size)>;
+
     AudioWriter();
     ~AudioWriter();
 
-    bool writeWavFile(const std::string& filePath, const std::vector<float>& audioData, 
-                     float sampleRate, int numChannels, int bitDepth = 16);
-    
+    bool writeWavFile(const std::string& filePath, const AudioBuffer& audio, float sampleRate, int bitDepth = 16);
+
+    // Incremental writing: open() writes a placeholder header, appendBlock() interleaves,
+    // converts and writes planar frames, finalize() patches the chunk sizes. Outputs that
+    // outgrow the 4 GB RIFF limit are turned into RF64 files on finalize().
+    bool open(const std::string& filePath, float sampleRate, int numChannels, int bitDepth = 16);
+    bool open(const std::string& filePath, float sampleRate, int numChannels, SampleFormat format);
+    // Writes to a sink that can't seek back, e.g. a socket. The header is written up
+    // front with unknown (0xFFFFFFFF) sizes, as is customary for streamed WAV.
+    bool openStream(const ByteSink& sink, float sampleRate, int numChannels, SampleFormat format);
+    // Writes a complete WAV image into buffer (replacing its contents); sizes are
+    // patched on finalize() like a file. The buffer must outlive the writer's use of it.
+    bool openMemory(std::vector<uint8_t>& buffer, float sampleRate, int numChannels, SampleFormat format);
+    // Same, into a string that can be moved into an HTTP response body without a copy
+    bool openMemory(std::string& buffer, float sampleRate, int numChannels, SampleFormat format);
+    bool appendBlock(const float* const* channels, size_t numFrames);
+    bool finalize();
+    bool isOpen() const;
+    uint64_t getFramesWritten() const;
+
+    // TPDF dither for 16 and 24-bit output; applies to files opened afterwards
+    void setDither(bool enabled);
+    // Container for files opened afterwards. FLAC takes 16 or 24-bit integer samples;
+    // the level and thread count are passed to FlacEncoder::begin().
+    void setFileFormat(AudioFileFormat fileFormat);
+    AudioFileFormat getFileFormat() const;
+    void setFlacLevel(int level);
+    void setEncoderThreads(int numThreads);
+
+    // "wav" or "flac"
+    static bool parseFileFormat(const std::string& name, AudioFileFormat& fileFormat);
+    // ".wav" or ".flac"
+    static const char* extensionFor(AudioFileFormat fileFormat);
+
 private:
-    bool writeWavHeader(FILE* file, int dataSize, float sampleRate, 
-                       int numChannels, int bitDepth);
-};
\ No newline at end of file
+    // Memory outputs can be patched like files
+    bool isSeekable() const;
+    // Exactly one output is set while open
+    FILE* file;
+    ByteSink sink;
+    std::vector<uint8_t>* memory;
+    std::string* memoryString;
+    std::string filePath;
+    float sampleRate;
+    int numChannels;
+    int bitDepth;
+    SampleFormat format;
+    bool dither;
+    AudioFileFormat fileFormat;
+    int flacLevel;
+    int encoderThreads;
+    PcmConverter converter;
+    // Set while a FLAC file is open; encoded frames collect in flacBytes before writing
+    std::unique_ptr<FlacEncoder> flacEncoder;
+    bool flacOutput;
+    std::vector<uint8_t> flacBytes;
+    // Chunk positions of the current file; the fact chunk only exists for float output
+    uint64_t factChunkOffset;
+    uint64_t dataChunkOffset;
+    uint64_t dataBytes;
+    uint64_t framesWritten;
+    bool failed;
+    std::vector<float> interleaveBuffer;
+    std::vector<uint8_t> conversionBuffer;
+
+    bool begin(float sampleRate, int numChannels, SampleFormat format);
+    bool writeWavHeader();
+    bool patchSizes();
+    bool writeFlacBytes();
+    bool writeBytes(const void* data, size_t size);
+    bool patchBytes(uint64_t offset, const void* data, size_t size);
+};
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <ostream>
+#include <string>
+#include <vector>
+#include "audio_writer.h"
+#include "pcm_converter.h"
+#include "render_tail.h"
+#include "resampler.h"
+
+// One MIDI file to render and where its audio goes
+struct BatchJob {
+    std::string midiFile;
+    std::string outputFile;
+};
+
+struct BatchResult {
+    std::string midiFile;
+    std::string outputFile;
+    bool ok = false;
+    std::string error;
+    double audioSeconds = 0.0;
+    double renderSeconds = 0.0;
+    int worker = -1;
+};
+
+// Renders many MIDI files with one plugin across a pool of worker threads. Each
+// worker keeps its MIDI processor, renderer and plugin instance for all of its jobs.
+class BatchRenderer {
+public:
+    struct Options {
+        std::string vstPath;
+        float sampleRate = 44100;
+        float renderRate = 0;   // Rate the plugin runs at; 0 = sampleRate
+        std::vector<float> extraRates;  // Also written as <name>_<rate>.<ext> from the same render
+        ResamplerQuality resampleQuality = ResamplerQuality::Standard;
+        RenderTail tail;
+        int numChannels = 2;
+        SampleFormat sampleFormat = SampleFormat::Int16;
+        bool dither = false;
+        AudioFileFormat fileFormat = AudioFileFormat::Wav;
+        int flacLevel = FlacEncoder::kDefaultLevel;
+        bool writePeaks = false;    // Also write <name>.peaks next to each output
+        int numWorkers = 0;     // 0 = one per hardware thread
+    };
+
+    // Expands a directory (searched recursively for .mid/.midi), a glob pattern or a
+    // manifest file (one MIDI path per line, optionally followed by a tab and an
+    // output path) into jobs writing <outputDir>/<name><extension>
+    static bool collectJobs(const std::string& input, const std::string& outputDir, const std::string& extension,
+                            std::vector<BatchJob>& jobs);
+
+    // Renders every job; results are in job order. Returns false if any job failed.
+    static bool run(const std::vector<BatchJob>& jobs, const Options& options, std::vector<BatchResult>& results,
+                    double& wallSeconds);
+
+    static void printSummary(const std::vector<BatchResult>& results, double wallSeconds, std::ostream& out);
+};
@@ -0,0 +1,11 @@
+#pragma once
+
+// Instruction set extensions detected at runtime, used to pick SIMD kernels
+struct CpuFeatures {
+    bool sse41 = false;
+    bool avx2 = false;
+    bool fma = false;
+    bool neon = false;
+
+    static const CpuFeatures& get();
+};
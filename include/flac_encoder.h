@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+class WorkStealingPool;
+
+// FLAC encoder for 16 and 24-bit integer PCM, without external libraries. Frames
+// have a fixed block size and are encoded independently: with more than one
+// thread, a batch of frames is encoded at a time on a thread pool, and the
+// output is the same whatever the thread count. Each subframe uses the smallest
+// of constant, verbatim, fixed and LPC prediction; autocorrelation and residuals
+// use SIMD kernels. Stereo frames also pick the cheapest of left/right,
+// left/side, side/right and mid/side.
+class FlacEncoder {
+public:
+    static constexpr int kMinLevel = 0;
+    static constexpr int kMaxLevel = 8;
+    static constexpr int kDefaultLevel = 5;
+    static constexpr int kMaxChannels = 8;
+    // "fLaC", the STREAMINFO block header and STREAMINFO
+    static constexpr size_t kHeaderSize = 42;
+    static constexpr size_t kStreamInfoOffset = 8;
+    static constexpr size_t kStreamInfoSize = 34;
+
+    FlacEncoder();
+    ~FlacEncoder();
+
+    FlacEncoder(const FlacEncoder&) = delete;
+    FlacEncoder& operator=(const FlacEncoder&) = delete;
+
+    // Starts a new stream. Levels run from 0 (fastest) to 8 (smallest), as with
+    // the reference encoder; numThreads <= 1 encodes on the calling thread.
+    bool begin(uint32_t sampleRate, int numChannels, int bitsPerSample, int level = kDefaultLevel,
+               int numThreads = 1);
+    // Writes kHeaderSize bytes; frame sizes and the sample count are 0 (unknown) until finish()
+    void writeHeader(uint8_t* output) const;
+    // Writes the kStreamInfoSize bytes of STREAMINFO, for patching the header afterwards
+    void writeStreamInfo(uint8_t* output) const;
+
+    // Adds interleaved little-endian PCM, as produced by PcmConverter. Frames that
+    // are complete (and, with threads, whole batches of them) are appended to output.
+    void addPcm(const uint8_t* pcm, size_t numFrames, std::vector<uint8_t>& output);
+    // Encodes what is left, the last frame possibly shorter than the block size
+    void finish(std::vector<uint8_t>& output);
+
+    uint64_t getTotalSamples() const;
+    int getBlockSize() const;
+
+    static const char* getKernelName();
+
+    struct Scratch;
+
+private:
+    void encodePending(bool final, std::vector<uint8_t>& output);
+
+    uint32_t sampleRate;
+    int numChannels;
+    int bitsPerSample;
+    int level;
+    int blockSize;
+    int framesPerBatch;
+    // Samples waiting to be encoded, per channel
+    std::vector<std::vector<int32_t>> pending;
+    size_t pendingFrames;
+    uint64_t frameNumber;
+    uint64_t totalSamples;
+    uint32_t minFrameBytes;
+    uint32_t maxFrameBytes;
+
+    std::unique_ptr<WorkStealingPool> pool;
+    std::vector<std::unique_ptr<Scratch>> scratch;
+    std::vector<std::vector<uint8_t>> frameOutputs;
+};
@@ -0,0 +1,7 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// XXH64 (xxHash, 64-bit variant). Fast non-cryptographic hash for content keys.
+uint64_t xxHash64(const void* data, size_t length, uint64_t seed = 0);
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+#include <ctime>
+#include <string>
+
+// Helpers for serving files over HTTP: byte ranges, validators and dates.
+namespace http_util {
+
+// Inclusive byte range within a file
+struct ByteRange {
+    uint64_t first = 0;
+    uint64_t last = 0;
+
+    uint64_t length() const { return last - first + 1; }
+};
+
+enum class RangeResult {
+    None,           // No usable Range header; serve the whole file
+    Satisfiable,    // Serve the returned range with 206
+    Unsatisfiable   // Answer 416
+};
+
+// Parses a single "bytes=" range against the file size. Multiple ranges and
+// unknown units are treated as no range, which RFC 9110 allows.
+RangeResult parseRange(const std::string& header, uint64_t fileSize, ByteRange& range);
+
+// IMF-fixdate, e.g. "Sun, 06 Nov 1994 08:49:37 GMT"
+std::string formatHttpDate(time_t time);
+bool parseHttpDate(const std::string& text, time_t& time);
+
+// Strong validator from the file's size and modification time
+std::string makeEtag(uint64_t size, int64_t modifiedNanoseconds);
+// True when an If-None-Match header value matches the ETag
+bool etagMatches(const std::string& ifNoneMatch, const std::string& etag);
+
+// MIME type from the file extension
+std::string contentTypeFor(const std::string& path);
+
+}  // namespace http_util
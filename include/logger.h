@@ -0,0 +1,77 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <ostream>
+#include <string>
+
+enum class LogLevel { Debug, Info, Warn, Error, Off };
+
+enum class LogFormat {
+    Plain,  // The message alone (warnings prefixed), as a command-line tool prints it
+    Text,   // Timestamp, level and thread before the message
+    Json    // One JSON object per line
+};
+
+// Process-wide logger. A record is formatted on the calling thread into that
+// thread's own fixed-size queue, which a background thread drains in batches,
+// so logging never takes a lock, flushes or allocates once a thread is warm.
+// Debug and info records go to stdout and warnings and errors to stderr; JSON
+// records all go to stdout. A full queue drops records, and the count of dropped
+// records is reported once there is room again.
+class Logger {
+public:
+    // Longer messages are truncated
+    static constexpr size_t kMaxMessageBytes = 1024;
+    // Records a thread can have waiting for the background thread
+    static constexpr size_t kRecordsPerThread = 256;
+
+    static bool isEnabled(LogLevel level) {
+        return static_cast<int>(level) >= minLevel.load(std::memory_order_relaxed);
+    }
+
+    static void setLevel(LogLevel level);
+    static LogLevel getLevel();
+    static void setFormat(LogFormat format);
+
+    static void write(LogLevel level, const char* message, size_t length);
+    // Blocks until every record logged before the call has been written, for
+    // callers about to print to stdout or stderr directly
+    static void flush();
+
+    static bool parseLevel(const std::string& name, LogLevel& level);
+    static bool parseFormat(const std::string& name, LogFormat& format);
+    static const char* levelName(LogLevel level);
+
+private:
+    static std::atomic<int> minLevel;
+};
+
+// Collects one record through operator<< and writes it when destroyed. Use the
+// LOG_* macros, which skip formatting entirely when the level is disabled.
+class LogLine {
+public:
+    explicit LogLine(LogLevel level);
+    ~LogLine();
+
+    LogLine(const LogLine&) = delete;
+    LogLine& operator=(const LogLine&) = delete;
+
+    std::ostream& stream();
+
+private:
+    LogLevel level;
+};
+
+#define MIDIVERSE_LOG(level, message)                      \
+    do {                                                   \
+        if (Logger::isEnabled(level)) {                    \
+            LogLine(level).stream() << message;            \
+        }                                                  \
+    } while (0)
+
+// LOG_INFO("Rendered " << frames << " frames");
+#define LOG_DEBUG(message) MIDIVERSE_LOG(LogLevel::Debug, message)
+#define LOG_INFO(message) MIDIVERSE_LOG(LogLevel::Info, message)
+#define LOG_WARN(message) MIDIVERSE_LOG(LogLevel::Warn, message)
+#define LOG_ERROR(message) MIDIVERSE_LOG(LogLevel::Error, message)
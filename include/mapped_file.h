@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Read-only memory mapping of a whole file. Pages are read in on first access,
+// so parsing a file in place costs no copy and touching part of a large file
+// only reads those pages.
+class MappedFile {
+public:
+    MappedFile();
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // sequential hints that the file will be read front to back once, so the
+    // kernel reads ahead aggressively. An empty file opens with no data.
+    bool open(const std::string& filePath, bool sequential = false);
+    void close();
+
+    bool isOpen() const;
+    const uint8_t* getData() const;
+    size_t getSize() const;
+
+private:
+    void* mapping;
+    size_t size;
+    bool opened;
+};
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Histogram with fixed bucket bounds. observe() is lock-free (a bucket search and
+// a few relaxed atomic adds), so it can sit on render paths; a scrape may see an
+// observation counted in one field but not yet another, which Prometheus tolerates.
+class Histogram {
+public:
+    // Upper bounds in increasing order; +Inf is implied
+    explicit Histogram(std::vector<double> upperBounds);
+
+    void observe(double value);
+
+    uint64_t getCount() const;
+    double getSum() const;
+
+    // Appends the _bucket, _sum and _count samples of this series. labels is
+    // either empty or pre-rendered pairs such as stage="render".
+    void write(std::string& out, const std::string& name, const std::string& labels) const;
+
+    // 1 ms to 5 minutes
+    static std::vector<double> latencyBounds();
+    // Realtime factors from 0.25x to 256x
+    static std::vector<double> ratioBounds();
+
+private:
+    std::vector<double> bounds;
+    // Per-bucket (not cumulative) counts; the last one is +Inf
+    std::unique_ptr<std::atomic<uint64_t>[]> buckets;
+    std::atomic<uint64_t> count;
+    std::atomic<double> sum;
+};
+
+// Prometheus text exposition format (version 0.0.4)
+namespace prometheus {
+
+constexpr const char* kContentType = "text/plain; version=0.0.4; charset=utf-8";
+
+// # HELP and # TYPE lines; type is counter, gauge or histogram
+void writeHeader(std::string& out, const std::string& name, const std::string& type, const std::string& help);
+void writeSample(std::string& out, const std::string& name, const std::string& labels, double value);
+// Header and a single unlabelled sample
+void writeMetric(std::string& out, const std::string& name, const std::string& type, const std::string& help,
+                 double value);
+// name="value" with the value escaped
+std::string label(const std::string& name, const std::string& value);
+
+}  // namespace prometheus
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "mapped_file.h"
+
+// Metadata of one MIDI file, as kept in a MidiIndex
+struct MidiFileInfo {
+    uint64_t fileSize = 0;
+    int64_t modifiedTime = 0;       // In ticks of the filesystem clock; only compared for equality
+    // False if the file could not be read or is not a MIDI file; the fields below are then zero
+    bool valid = false;
+    uint8_t format = 0;
+    uint16_t trackCount = 0;        // Track chunks found, not the count in the header
+    uint16_t division = 0;          // Time division exactly as in the header
+    uint16_t channelMask = 0;       // Bit n is set if channel n + 1 plays notes
+    uint32_t eventCount = 0;
+    uint32_t tempoChangeCount = 0;
+    uint64_t noteCount = 0;         // Note-ons with a non-zero velocity
+    double durationSeconds = 0.0;   // To the last event, through the tempo map
+    float averageVoices = 0.0f;     // Notes sounding at once, averaged over the ticks of the file
+};
+
+struct MidiIndexBuildOptions {
+    int numThreads = 0;             // <= 0: one per hardware thread
+    bool rescanAll = false;         // Ignore the existing index
+};
+
+struct MidiIndexBuildStats {
+    size_t files = 0;
+    size_t scanned = 0;
+    size_t reused = 0;              // Unchanged since the previous index
+    size_t removed = 0;             // In the previous index but gone
+    size_t invalid = 0;
+    uint64_t bytesScanned = 0;
+    double seconds = 0.0;
+};
+
+// Metadata index over a MIDI corpus, kept in one file that is memory-mapped to
+// query it, so looking files up never touches the files themselves and only
+// reads the entries a binary search visits. Building scans the files in
+// parallel with a parser that reads each memory-mapped file in place and keeps
+// only counts, and reuses the entries of files whose size and modification
+// time have not changed.
+//
+// Index layout (little-endian):
+//   "MVIX", u16 version, u16 entry size (64), u64 entries, u64 string table
+//   offset, u64 string table size, then the entries sorted by path bytes, then
+//   the paths. An entry is u64 file size, i64 modification time, u64 path offset,
+//   u32 path length, u32 events, u64 notes, f64 duration, u32 tempo changes,
+//   u16 tracks, u16 division, u16 channel mask, u8 format, u8 flags (bit 0:
+//   valid) and f32 average voices.
+class MidiIndex {
+public:
+    static constexpr uint16_t kVersion = 2;
+    static constexpr size_t kNotFound = static_cast<size_t>(-1);
+
+    MidiIndex();
+
+    // False if missing or malformed
+    bool open(const std::string& indexPath);
+    void close();
+    bool isOpen() const;
+
+    size_t size() const;
+    // Entries are in path order; paths are absolute and normalized
+    std::string_view getPath(size_t index) const;
+    MidiFileInfo getInfo(size_t index) const;
+    // Entry of a file, by any path that normalizes to the indexed one
+    size_t find(const std::string& filePath) const;
+
+    // Indexes every .mid/.midi file under the given directories, plus any file
+    // named directly, and writes the index through a temporary file. An
+    // existing index at indexPath supplies the entries of unchanged files.
+    static bool build(const std::vector<std::string>& inputs, const std::string& indexPath,
+                      const MidiIndexBuildOptions& options, MidiIndexBuildStats& stats);
+
+    // Reads the metadata of an SMF image in place; false if it is not one
+    static bool scanMidiData(const uint8_t* data, size_t size, MidiFileInfo& info);
+
+    // Absolute, with "." and ".." segments resolved; symlinks are kept
+    static std::string normalizePath(const std::string& filePath);
+
+private:
+    const uint8_t* getEntry(size_t index) const;
+
+    MappedFile file;
+    size_t numEntries;
+    const uint8_t* entries;
+    const char* strings;
+};
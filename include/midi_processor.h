@@ -1,7 +1,9 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
 #include <vector>
+#include "midi_sequence.h"
 
 class MidiProcessor {
 public:
@@ -9,12 +11,25 @@ public:
     ~MidiProcessor();
 
     bool loadMidiFile(const std::string& filePath);
+    // Parses an SMF image already in memory, e.g. a request body, without copying it;
+    // sourceName is only logged
+    bool loadMidiData(const uint8_t* data, size_t size, const std::string& sourceName = "<memory>");
+    // Bytes read by the last loadMidiFile(); empty after loadMidiData()
     const std::vector<uint8_t>& getMidiData() const;
+    // Events of all tracks, merged and sorted by tick, with the file's tempo map
+    const MidiSequence& getSequence() const;
+    int getFormat() const;
     int getTrackCount() const;
     int getTicksPerQuarterNote() const;
     
 private:
     std::vector<uint8_t> midiData;
+    MidiSequence sequence;
+    int format;
     int trackCount;
     int ticksPerQuarterNote;
+
+    // Parses an SMF image into the sequence
+    bool parseMidiData(const uint8_t* data, size_t fileSize, const std::string& sourceName);
+    bool decodeTrack(const uint8_t* data, size_t length, uint16_t trackIndex);
 };
\ No newline at end of file
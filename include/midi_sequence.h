@@ -0,0 +1,116 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Tempo map built from the Set Tempo meta events of a MIDI file.
+// Converts tick positions into seconds or absolute sample offsets.
+class TempoMap {
+public:
+    TempoMap();
+
+    // Metrical time division (ticks per quarter note), 120 BPM until the first tempo change
+    void reset(int ticksPerQuarterNote);
+    // SMPTE time division; tempo changes are ignored for SMPTE files
+    void resetSmpte(int framesPerSecond, int ticksPerFrame);
+
+    // Drops all tempo changes but keeps the time division
+    void clearTempoChanges();
+    // Tempo changes must be added in non-decreasing tick order
+    void addTempoChange(uint64_t tick, uint32_t microsecondsPerQuarter);
+
+    double tickToSeconds(uint64_t tick) const;
+    int64_t tickToSample(uint64_t tick, double sampleRate) const;
+
+    // Converts a sorted run of ticks in a single pass over the tempo segments
+    void ticksToSamples(const uint64_t* ticks, size_t count, double sampleRate, int64_t* samples) const;
+
+    size_t getNumTempoChanges() const;
+    bool isSmpte() const;
+
+private:
+    struct Segment {
+        uint64_t tick;
+        uint32_t microsecondsPerQuarter;
+        // Elapsed time at the segment start in microseconds * ticksPerQuarter,
+        // kept integral so conversions don't drift over many tempo changes
+        uint64_t scaledStartTime;
+    };
+
+    size_t findSegment(uint64_t tick) const;
+    uint64_t scaledTime(const Segment& segment, uint64_t tick) const;
+
+    std::vector<Segment> segments;
+    uint64_t ticksPerQuarter;
+    bool smpte;
+};
+
+// All events of a MIDI file merged into one tick-sorted list, stored as
+// parallel arrays so renderers can scan the columns they need.
+class MidiSequence {
+public:
+    // Status bytes used for non-channel events
+    static constexpr uint8_t kMetaStatus = 0xFF;
+    static constexpr uint8_t kSysExStatus = 0xF0;
+    static constexpr uint8_t kSysExEscapeStatus = 0xF7;
+
+    // Meta event types the renderers care about
+    static constexpr uint8_t kMetaEndOfTrack = 0x2F;
+    static constexpr uint8_t kMetaSetTempo = 0x51;
+
+    MidiSequence();
+
+    void clear();
+    void reserve(size_t numEvents);
+
+    // Channel voice message; data2 is ignored for program change and channel pressure
+    void addChannelEvent(uint64_t tick, uint16_t track, uint8_t status, uint8_t data1, uint8_t data2);
+    // Meta event with its raw payload
+    void addMetaEvent(uint64_t tick, uint16_t track, uint8_t type, const uint8_t* data, uint32_t size);
+    // SysEx (0xF0) or escape (0xF7) event; payload is stored exactly as found in the file
+    void addSysExEvent(uint64_t tick, uint16_t track, uint8_t status, const uint8_t* data, uint32_t size);
+
+    // Stable merge of the events by tick; events with equal ticks keep their insertion order
+    void sortByTick();
+    // Rebuilds the tempo map from the Set Tempo events; call after sortByTick()
+    void rebuildTempoMap();
+
+    size_t size() const;
+    bool empty() const;
+
+    const std::vector<uint64_t>& getTicks() const;
+    const std::vector<uint8_t>& getStatus() const;
+    const std::vector<uint8_t>& getData1() const;
+    const std::vector<uint8_t>& getData2() const;
+    const std::vector<uint16_t>& getTracks() const;
+
+    const uint8_t* getPayload(size_t index) const;
+    uint32_t getPayloadSize(size_t index) const;
+
+    static bool isChannelEvent(uint8_t status);
+    static bool isNoteOn(uint8_t status, uint8_t velocity);
+    static bool isNoteOff(uint8_t status, uint8_t velocity);
+
+    TempoMap& getTempoMap();
+    const TempoMap& getTempoMap() const;
+
+    uint64_t getEndTick() const;
+    double getDurationSeconds() const;
+    int64_t getLengthInSamples(double sampleRate) const;
+
+    // Absolute sample offset of every event; reuses the capacity of the output vector
+    void computeSampleOffsets(double sampleRate, std::vector<int64_t>& offsets) const;
+
+private:
+    std::vector<uint64_t> ticks;
+    std::vector<uint8_t> status;
+    std::vector<uint8_t> data1;
+    std::vector<uint8_t> data2;
+    std::vector<uint16_t> tracks;
+    std::vector<uint32_t> payloadOffsets;
+    std::vector<uint32_t> payloadSizes;
+    std::vector<uint8_t> payload;
+    TempoMap tempoMap;
+    uint64_t endTick;
+};
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "audio_writer.h"
+#include "resampler.h"
+
+// Writes one render to several files at different sample rates. Blocks arrive
+// at the render rate; outputs at another rate go through their own resampler,
+// so N delivery rates cost one render plus N conversions.
+class MultiRateWriter {
+public:
+    struct Output {
+        std::string filePath;
+        float sampleRate;
+    };
+
+    MultiRateWriter();
+
+    void setQuality(ResamplerQuality quality);
+    void setDither(bool enabled);
+    // Passed on to every output's AudioWriter
+    void setFileFormat(AudioFileFormat fileFormat);
+    void setFlacLevel(int level);
+    void setEncoderThreads(int numThreads);
+
+    bool open(const std::vector<Output>& outputs, float renderRate, int numChannels, SampleFormat format);
+    bool appendBlock(const float* const* channels, size_t numFrames);
+    // Flushes the resamplers and finalizes every file, even after a failure
+    bool finalize();
+    bool isOpen() const;
+
+    size_t getNumOutputs() const;
+    uint64_t getFramesWritten(size_t output) const;
+
+    // <dir>/<stem>_<rate><ext>, the name used for an extra delivery rate
+    static std::string pathForRate(const std::string& filePath, float sampleRate);
+
+private:
+    struct Target {
+        Resampler resampler;
+        AudioWriter writer;
+        bool resample = false;
+    };
+
+    // Targets are kept between files so their buffers are reused
+    std::vector<std::unique_ptr<Target>> targets;
+    size_t numOpen;
+    ResamplerQuality quality;
+    bool dither;
+    AudioFileFormat fileFormat;
+    int flacLevel;
+    int encoderThreads;
+};
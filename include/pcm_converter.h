@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Output sample encodings supported by the writers
+enum class SampleFormat {
+    Int16,
+    Int24,      // Packed, 3 bytes per sample
+    Int32,
+    Float32     // WAVE_FORMAT_IEEE_FLOAT
+};
+
+// Converts float samples in [-1, 1] to little-endian PCM. Each format has its own
+// kernel instantiated at compile time, and the SIMD variant is picked at runtime.
+// Integer formats are clamped and rounded to nearest; 16 and 24-bit output can
+// optionally get TPDF dither. NaN samples convert as silence with every kernel.
+class PcmConverter {
+public:
+    // Random state for the dither generator, one lane per SIMD lane
+    struct DitherState {
+        uint32_t lanes[8];
+    };
+
+    PcmConverter();
+    explicit PcmConverter(SampleFormat format, bool dither = false);
+
+    // Also restarts the dither sequence, so the same input always gives the same
+    // bytes however the converter was used before; call it for every new file
+    void setFormat(SampleFormat format);
+    void setDither(bool enabled);
+    SampleFormat getFormat() const;
+    bool isDitherEnabled() const;
+    int getBytesPerSample() const;
+
+    // Converts numSamples floats into getBytesPerSample() * numSamples bytes
+    void convert(const float* input, size_t numSamples, uint8_t* output);
+
+    static int bytesPerSample(SampleFormat format);
+    static int bitsPerSample(SampleFormat format);
+    // Maps a bit depth (16/24/32) to an integer format; returns false if unsupported
+    static bool formatForBitDepth(int bitDepth, SampleFormat& format);
+    static const char* getKernelName();
+
+    using Kernel = void (*)(const float* input, size_t numSamples, uint8_t* output, DitherState* dither);
+
+private:
+    void selectKernel();
+    void resetDither();
+
+    SampleFormat format;
+    bool dither;
+    DitherState ditherState;
+    Kernel kernel;
+};
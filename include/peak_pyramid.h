@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Min/max/RMS waveform overview of a render at several zoom levels, built from
+// the blocks as they are rendered so the audio is never read twice. Only the
+// finest level looks at samples; each coarser level is merged from the one below,
+// so bucket sizes must be whole multiples of each other.
+//
+// Sidecar layout (little-endian):
+//   "MVPK", u16 version, u16 channels, u32 sample rate, u64 frames, u32 levels,
+//   then per level u32 samples per bucket and u32 buckets, then the levels' data
+//   in the same order. A bucket is, per channel, i16 min, i16 max (full scale
+//   32767) and u16 RMS (full scale 65535).
+class PeakPyramid {
+public:
+    static constexpr const char* kExtension = ".peaks";
+    static constexpr uint16_t kVersion = 1;
+
+    PeakPyramid();
+
+    // Starts a new pyramid. bucketSizes must be increasing, each a multiple of the
+    // previous; empty uses the default levels of 256, 2048 and 16384 samples.
+    bool begin(int numChannels, float sampleRate, const std::vector<uint32_t>& bucketSizes = {});
+    void addBlock(const float* const* channels, size_t numFrames);
+    // Closes the partial last bucket of every level
+    void finish();
+
+    // Writes through a temporary file, so readers never see a partial sidecar
+    bool writeFile(const std::string& filePath) const;
+    void serialize(std::vector<uint8_t>& output) const;
+
+    uint64_t getNumFrames() const;
+    size_t getNumLevels() const;
+    uint32_t getBucketSize(size_t level) const;
+    size_t getNumBuckets(size_t level) const;
+
+    // <audio path without extension>.peaks
+    static std::string sidecarPath(const std::string& audioPath);
+    // Reads a sidecar, keeping only the level with the given bucket size (0 keeps
+    // them all); the result is itself a valid sidecar. False if missing or malformed.
+    static bool readFile(const std::string& filePath, uint32_t bucketSize, std::vector<uint8_t>& output);
+
+    static const char* getKernelName();
+
+private:
+    // Running statistics of one channel within the current bucket
+    struct Accumulator {
+        float min;
+        float max;
+        double sumSquares;
+    };
+
+    struct Level {
+        uint32_t bucketSize = 0;
+        uint32_t framesInBucket = 0;
+        std::vector<Accumulator> current;   // One per channel
+        std::vector<uint8_t> data;          // Finished buckets, already encoded
+    };
+
+    void resetAccumulators(Level& level);
+    // Adds finished statistics of the level below (or samples, for level 0)
+    void merge(size_t levelIndex, const Accumulator* stats, uint32_t frames);
+    void closeBucket(size_t levelIndex);
+
+    int numChannels;
+    float sampleRate;
+    uint64_t numFrames;
+    std::vector<Level> levels;
+};
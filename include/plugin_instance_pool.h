@@ -0,0 +1,126 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#ifdef USE_JUCE
+namespace juce {
+    class AudioPluginFormatManager;
+    class AudioPluginInstance;
+}
+using PluginInstance = juce::AudioPluginInstance;
+#else
+// Without JUCE the built-in synthesizer stands in for plugin instances
+class SynthEngine;
+using PluginInstance = SynthEngine;
+#endif
+
+// Everything an instance is prepared for; instances are only reused for an identical key
+struct PluginInstanceKey {
+    std::string path;
+    double sampleRate = 44100.0;
+    int blockSize = 512;
+    int numChannels = 2;
+
+    bool operator==(const PluginInstanceKey& other) const;
+    bool operator!=(const PluginInstanceKey& other) const;
+};
+
+// Keeps loaded, prepared plugin instances warm between render jobs. Instances are
+// checked out exclusively with acquire() and handed back with release(), which
+// resets them. Idle instances are evicted least recently used first once the pool
+// exceeds its instance count or memory budget.
+//
+// With JUCE, the process must keep a juce::ScopedJuceInitialiser_GUI alive for
+// as long as any pool exists (main() owns one); pools never create or destroy
+// the MessageManager themselves.
+class PluginInstancePool {
+public:
+    struct Config {
+        size_t maxInstances = 8;        // Idle plus checked-out instances
+        size_t maxMemoryBytes = 0;      // Estimated footprint budget (see Stats::memoryBytes), 0 = unlimited
+    };
+
+    struct Stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+        uint64_t loadFailures = 0;
+        double totalLoadSeconds = 0.0;
+        double maxLoadSeconds = 0.0;
+        size_t idleInstances = 0;
+        size_t activeInstances = 0;
+        // Estimated footprint of the pooled instances: the growth in process resident
+        // memory while each one was created and prepared. Allocations by renders on
+        // other threads during a load are counted too, so treat it as an upper bound.
+        size_t memoryBytes = 0;
+
+        double getHitRate() const;
+        double getAverageLoadSeconds() const;
+    };
+
+    PluginInstancePool();
+    explicit PluginInstancePool(const Config& config);
+    ~PluginInstancePool();
+
+    PluginInstancePool(const PluginInstancePool&) = delete;
+    PluginInstancePool& operator=(const PluginInstancePool&) = delete;
+
+    // Returns a prepared instance for the key, loading one on a miss; nullptr on failure
+    std::unique_ptr<PluginInstance> acquire(const PluginInstanceKey& key);
+    // Resets the instance and makes it available to later acquire() calls
+    void release(const PluginInstanceKey& key, std::unique_ptr<PluginInstance> instance);
+
+    void setConfig(const Config& config);
+    Config getConfig() const;
+    Stats getStats() const;
+    // Drops all idle instances
+    void clear();
+
+private:
+    struct IdleEntry {
+        PluginInstanceKey key;
+        std::unique_ptr<PluginInstance> instance;
+        size_t memoryBytes;
+    };
+
+    // Times a load and estimates its footprint from resident memory, over its own lifetime
+    class LoadMeasurement {
+    public:
+        LoadMeasurement(double& loadSeconds, size_t& memoryBytes);
+        ~LoadMeasurement();
+
+    private:
+        double& loadSeconds;
+        size_t& memoryBytes;
+        size_t residentBefore;
+        std::chrono::steady_clock::time_point start;
+    };
+
+    // Reports the time spent creating and preparing the instance and its estimated footprint
+    std::unique_ptr<PluginInstance> loadInstance(const PluginInstanceKey& key, double& loadSeconds,
+                                                 size_t& memoryBytes);
+    void resetInstance(PluginInstance& instance);
+    // Evicts idle entries until the limits hold; evicted instances are moved out so
+    // they can be destroyed without holding the lock
+    void enforceLimits(std::list<IdleEntry>& evicted);
+    static size_t currentResidentBytes();
+
+    mutable std::mutex mutex;
+    Config config;
+    Stats stats;
+    // Most recently used first
+    std::list<IdleEntry> idle;
+    // Estimated footprint of each instance currently checked out, by address
+    std::list<std::pair<const PluginInstance*, size_t>> active;
+
+#ifdef USE_JUCE
+    std::unique_ptr<juce::AudioPluginFormatManager> formatManager;
+    std::mutex loadMutex;
+#endif
+};
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "audio_writer.h"
+#include "pcm_converter.h"
+#include "render_tail.h"
+
+// Everything that determines the bytes of a rendered file
+struct RenderCacheKeyInput {
+    const std::vector<uint8_t>* midiData = nullptr;
+    std::string vstPath;
+    float sampleRate = 44100;
+    int numChannels = 2;
+    SampleFormat sampleFormat = SampleFormat::Int16;
+    bool dither = false;
+    RenderTail tail;
+    AudioFileFormat fileFormat = AudioFileFormat::Wav;
+    int flacLevel = FlacEncoder::kDefaultLevel;
+};
+
+// Persistent store of rendered files named by content key (<key>.wav or <key>.flac). The
+// index lives in memory and is rebuilt from a directory scan at startup; entries
+// are evicted least recently used first once the store exceeds its size budget.
+// Recency is not persisted, so after a restart files age from their write time.
+// A render's waveform peaks live beside it as <key>.peaks and go with it on
+// eviction; they are small enough not to count against the budget.
+class RenderCache {
+public:
+    struct Stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t insertions = 0;
+        uint64_t evictions = 0;
+        size_t entries = 0;
+        uint64_t totalBytes = 0;
+        uint64_t maxBytes = 0;
+    };
+
+    RenderCache(const std::string& directory, uint64_t maxBytes);
+
+    // Scans the directory and rebuilds the index
+    bool open();
+
+    // 128-bit key as 32 hex digits. Plugins are identified by path and the size and
+    // modification time of their binary (inside the bundle for .vst3/.component); a
+    // render version invalidates entries when rendering changes.
+    static std::string makeKey(const RenderCacheKeyInput& input);
+
+    // Returns true and the file path when the key is cached. Internal re-checks
+    // pass recordStats = false so a request isn't counted twice.
+    bool lookup(const std::string& key, std::string& filePath, bool recordStats = true);
+    // Moves a finished render into the store as <key><extension> and returns its final path
+    bool insert(const std::string& key, const std::string& renderedFile, const std::string& extension,
+                std::string& filePath);
+    // Path a render for this key should be written to before insert()
+    std::string getTempPath(const std::string& key, const std::string& suffix) const;
+    // Peaks sidecar of the render stored under key
+    std::string getPeaksPath(const std::string& key) const;
+
+    Stats getStats() const;
+
+private:
+    struct Entry {
+        std::string key;
+        std::string extension;
+        uint64_t bytes;
+    };
+
+    std::string pathFor(const Entry& entry) const;
+    // Deletes an entry's file and its peaks sidecar
+    void removeFiles(const Entry& entry) const;
+    // Removes least recently used entries until the budget holds; caller holds the lock
+    void evict();
+
+    std::string directory;
+    uint64_t maxBytes;
+    mutable std::mutex mutex;
+    Stats stats;
+    // Most recently used first
+    std::list<Entry> lru;
+    std::unordered_map<std::string, std::list<Entry>::iterator> index;
+};
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "midi_index.h"
+
+// Predicts how long a job will take to render, so the render queue can serve
+// short jobs first. A job's work is its MIDI duration times the notes sounding
+// at once, in voice-seconds. Each plugin's render seconds per voice-second are
+// learned from its completed jobs as a moving average; a plugin without any
+// uses the average over all plugins.
+class RenderCostModel {
+public:
+    // Render seconds per voice-second before any job has completed
+    static constexpr double kDefaultSecondsPerWork = 0.01;
+    // Weight of the newest job in the moving averages
+    static constexpr double kSmoothing = 0.2;
+    // Distinct plugins learned; later ones use the average over all plugins
+    static constexpr size_t kMaxPlugins = 256;
+
+    RenderCostModel();
+
+    // Voice-seconds of a scanned file, counting at least one voice throughout
+    static double workOf(const MidiFileInfo& info);
+
+    double estimateSeconds(const std::string& vstPath, double work) const;
+    // Learns from a completed render of work voice-seconds that took renderSeconds
+    void observe(const std::string& vstPath, double work, double renderSeconds);
+
+private:
+    mutable std::mutex mutex;
+    std::unordered_map<std::string, double> pluginSecondsPerWork;
+    double secondsPerWork;
+    bool learned;
+};
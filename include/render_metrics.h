@@ -0,0 +1,68 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include "metrics.h"
+
+// Stages of a render job, timed separately
+enum class RenderStage {
+    MidiLoad,       // Reading and parsing the MIDI file
+    PluginLoad,     // Taking a prepared instance from the pool, or loading one
+    Render,         // The plugin's processing, excluding time spent in the writer
+    Encode,         // PCM conversion or FLAC encoding and writing blocks, during the render
+    Write,          // Finalizing the file and storing it in the cache
+    Count
+};
+
+// Timings and counters of the render workers, exported on /metrics. Recording is
+// lock-free; only finding a plugin's series takes a short lock, once per job.
+class RenderMetrics {
+public:
+    enum class JobResult { Completed, Failed, Cached, Rejected };
+
+    // Per-plugin series; references stay valid for the lifetime of RenderMetrics
+    struct PluginMetrics {
+        Histogram realtimeFactor{Histogram::ratioBounds()};
+        std::atomic<uint64_t> jobs{0};
+        std::atomic<uint64_t> failures{0};
+        // Microseconds, so they can be added atomically
+        std::atomic<uint64_t> renderMicroseconds{0};
+        std::atomic<uint64_t> audioMicroseconds{0};
+    };
+
+    // Distinct plugins tracked; later ones share an "other" series
+    static constexpr size_t kMaxPlugins = 256;
+
+    RenderMetrics();
+
+    void observeStage(RenderStage stage, double seconds);
+    void observeQueueWait(double seconds);
+    void countJob(JobResult result);
+    void addBytesWritten(uint64_t bytes);
+    // Called around each job a worker runs
+    void jobStarted();
+    void jobFinished();
+
+    PluginMetrics& getPlugin(const std::string& vstPath);
+    // Counts a completed render of audioSeconds that took renderSeconds
+    void observeRender(PluginMetrics& plugin, double audioSeconds, double renderSeconds);
+
+    // Appends all series in Prometheus text format
+    void write(std::string& out) const;
+
+    static const char* stageName(RenderStage stage);
+
+private:
+    Histogram stageSeconds[static_cast<int>(RenderStage::Count)];
+    Histogram queueWaitSeconds;
+    std::atomic<uint64_t> jobCounts[static_cast<int>(JobResult::Rejected) + 1];
+    std::atomic<uint64_t> bytesWritten;
+    std::atomic<int64_t> activeJobs;
+
+    mutable std::mutex pluginMutex;
+    std::map<std::string, std::unique_ptr<PluginMetrics>> plugins;
+};
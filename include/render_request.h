@@ -0,0 +1,20 @@
+#pragma once
+
+#include <string>
+#include <crow.h>
+#include "render_scheduler.h"
+
+// Upper bounds on the output format accepted by every render endpoint
+constexpr double kMaxRequestSampleRate = 384000.0;
+constexpr int kMaxRequestChannels = 32;
+
+// Parses the JSON body shared by the render endpoints:
+// {"midiFile", "vstPath", "sampleRate", "numChannels", "bitDepth", "sampleFormat", "dither",
+//  "tail" ("fixed" or "adaptive"), "tailThresholdDb", "tailHoldSeconds", "tailMaxSeconds",
+//  "fileFormat" ("wav" or "flac"), "compressionLevel" (FLAC, 0-8)}
+// Returns false with a message suitable for a 400 response.
+bool parseRenderRequest(const std::string& body, RenderJobRequest& request, std::string& error);
+
+// Parses the same parameters from a query string, for endpoints whose body is the
+// MIDI file itself. midiFile is not used; only vstPath is required.
+bool parseRenderQuery(const crow::query_string& params, RenderJobRequest& request, std::string& error);
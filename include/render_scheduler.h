@@ -0,0 +1,170 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "audio_writer.h"
+#include "pcm_converter.h"
+#include "plugin_instance_pool.h"
+#include "render_cache.h"
+#include "render_cost.h"
+#include "render_metrics.h"
+#include "render_tail.h"
+
+// Parameters of one render job
+struct RenderJobRequest {
+    std::string midiFilePath;
+    std::string vstPath;
+    float sampleRate = 44100;
+    int numChannels = 2;
+    SampleFormat sampleFormat = SampleFormat::Int16;
+    bool dither = false;
+    RenderTail tail;
+    AudioFileFormat fileFormat = AudioFileFormat::Wav;
+    int flacLevel = FlacEncoder::kDefaultLevel;
+    // Record a Chrome trace of the job; traced jobs always render, bypassing the cache
+    bool trace = false;
+};
+
+enum class RenderJobStatus { Queued, Running, Completed, Failed };
+
+// Snapshot of a job as reported by getJob()
+struct RenderJobInfo {
+    std::string id;
+    RenderJobStatus status = RenderJobStatus::Queued;
+    double progress = 0.0;
+    std::string outputFile;
+    std::string error;
+    // Served from the render cache without rendering
+    bool cached = false;
+    // Seconds spent waiting in the queue and rendering so far
+    double queuedSeconds = 0.0;
+    double renderSeconds = 0.0;
+    // Predicted render time that ordered the queue; 0 if the MIDI file could not be read
+    double estimatedSeconds = 0.0;
+    // Trace-event JSON of a traced job once it has finished, else empty
+    std::string traceFile;
+
+    static const char* statusName(RenderJobStatus status);
+};
+
+// Runs render jobs on a fixed pool of worker threads. Each worker owns its own
+// MIDI processor, renderer and writer, so jobs never share buffers. Jobs wait in
+// a bounded queue; submit() refuses new jobs once it is full. By default the
+// queue serves the job with the shortest estimated render time first, with
+// waiting jobs aging towards the front so long ones are never starved. With a
+// render cache, repeated requests complete in submit() without reaching the queue.
+// With metrics, each job's stages, queue wait and outcome are recorded. Traced
+// jobs record spans under their own trace context, written out when they finish.
+//
+// numWorkers is the render budget of the whole server: renders run outside the
+// queue (on request or connection threads) take one of the same slots with
+// tryAcquireRenderSlot(), and queued jobs wait while all slots are in use.
+class RenderScheduler {
+public:
+    enum class QueuePolicy {
+        Fifo,           // In order of submission
+        ShortestFirst   // Smallest estimated render time, less agingRate times the time waited
+    };
+
+    struct Config {
+        int numWorkers = 0;             // 0 = one per hardware thread
+        size_t maxQueuedJobs = 64;      // Jobs waiting for a worker
+        QueuePolicy queuePolicy = QueuePolicy::ShortestFirst;
+        // Estimated seconds a queued job gains per second it waits, so it runs
+        // before any job submitted more than estimate / agingRate seconds later
+        double agingRate = 1.0;
+        size_t maxRetainedJobs = 1024;  // Finished jobs kept for status queries
+        std::string traceDirectory = "traces";  // Where traced jobs write their traces
+    };
+
+    RenderScheduler(const Config& config, std::shared_ptr<PluginInstancePool> pluginPool,
+                    std::shared_ptr<RenderCache> renderCache = nullptr,
+                    std::shared_ptr<RenderMetrics> metrics = nullptr);
+    ~RenderScheduler();
+
+    RenderScheduler(const RenderScheduler&) = delete;
+    RenderScheduler& operator=(const RenderScheduler&) = delete;
+
+    void start();
+    // Fails queued jobs, asks running ones to stop and joins the workers
+    void stop();
+
+    // Queues a job and returns its id through jobId; false when the queue is full
+    bool submit(const RenderJobRequest& request, std::string& jobId);
+    bool getJob(const std::string& jobId, RenderJobInfo& info) const;
+
+    // Takes a render slot for a render run outside the queue; false when all
+    // numWorkers slots are in use or the scheduler is stopping
+    bool tryAcquireRenderSlot();
+    void releaseRenderSlot();
+
+    int getNumWorkers() const;
+    size_t getQueueLength() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Job {
+        std::string id;
+        RenderJobRequest request;
+        RenderJobStatus status = RenderJobStatus::Queued;
+        std::atomic<double> progress{0.0};
+        std::string outputFile;
+        std::string error;
+        bool cached = false;
+        std::string traceFile;
+        // The MIDI file as read at submit time, parsed by the worker so the file is only
+        // read once; empty if it could not be read then. Released once the job has run.
+        std::vector<uint8_t> midiData;
+        // Voice-seconds of the MIDI file, and the render time predicted from them
+        double work = 0.0;
+        double estimatedSeconds = 0.0;
+        Clock::time_point submitTime;
+        Clock::time_point startTime;
+        Clock::time_point endTime;
+    };
+
+    // Processor, renderer and writer owned by one worker thread
+    struct WorkerContext;
+
+    void workerLoop(int workerIndex);
+    // Writes the spans of a traced job; returns the file, or empty on failure
+    std::string writeTrace(const Job& job, uint64_t traceContext);
+    // Renders one job; returns false with error set on failure. cached is set when
+    // another job stored the same render in the meantime.
+    bool runJob(Job& job, WorkerContext& context, std::string& outputFile, bool& cached, std::string& error);
+    static std::string makeCacheKey(const RenderJobRequest& request, const std::vector<uint8_t>& midiData);
+    // Position in the queue; lower runs sooner, equal keys in submission order
+    double queueKey(const Job& job) const;
+    // Drops the oldest finished jobs beyond maxRetainedJobs
+    void pruneFinishedJobs();
+
+    Config config;
+    std::shared_ptr<PluginInstancePool> pluginPool;
+    std::shared_ptr<RenderCache> renderCache;
+    std::shared_ptr<RenderMetrics> metrics;
+    std::vector<std::thread> workers;
+    std::atomic<bool> stopping;
+    uint64_t nextJobId;
+    RenderCostModel costModel;
+    Clock::time_point createdTime;
+
+    mutable std::mutex mutex;
+    std::condition_variable queueCondition;
+    std::multimap<double, std::shared_ptr<Job>> queue;
+    // Renders running now, on workers or through tryAcquireRenderSlot(); at most numWorkers
+    int activeRenders;
+    std::unordered_map<std::string, std::shared_ptr<Job>> jobs;
+    // Finished job ids, oldest first
+    std::deque<std::string> finishedJobs;
+};
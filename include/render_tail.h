@@ -0,0 +1,16 @@
+#pragma once
+
+// How long a render continues after the sequence ends. Fixed renders a set tail
+// (2 s through a plugin, the release time with the built-in synth). Adaptive keeps
+// rendering until the output has stayed below thresholdDb for holdSeconds, or
+// maxSeconds have passed, and drops the silence at the end.
+struct RenderTail {
+    enum class Mode { Fixed, Adaptive };
+
+    Mode mode = Mode::Fixed;
+    float thresholdDb = -90.0f;
+    double holdSeconds = 0.5;
+    double maxSeconds = 30.0;
+
+    bool isAdaptive() const { return mode == Mode::Adaptive; }
+};
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "audio_buffer.h"
+
+// Trade-off between filter length (cost) and passband width / stopband depth
+enum class ResamplerQuality {
+    Fast,       // 16 taps per phase
+    Standard,   // 32 taps per phase
+    High        // 64 taps per phase
+};
+
+// Streaming sample-rate converter for a rational ratio. A Kaiser-windowed sinc
+// lowpass is split into one polyphase branch per output phase, so each output
+// sample is a single dot product over the input history, computed with the
+// widest SIMD kernel the CPU supports. Output is aligned with the input (the
+// filter delay is compensated) and exactly ceil(inputFrames * outRate / inRate)
+// frames long once flushed.
+class Resampler {
+public:
+    Resampler();
+
+    // Returns false if the rates are invalid or their ratio needs too many phases
+    bool configure(double inputRate, double outputRate, int numChannels,
+                   ResamplerQuality quality = ResamplerQuality::Standard);
+    // Starts a new stream with the same configuration
+    void reset();
+
+    // Converts a block of planar input; the converted frames are in getOutput()
+    // until the next call. Returns the number of output frames.
+    size_t process(const float* const* input, size_t numFrames);
+    // Pads the end of the stream and converts what is left
+    size_t flush();
+    const AudioBuffer& getOutput() const;
+
+    bool isPassThrough() const;
+    int getUpFactor() const;
+    int getDownFactor() const;
+    int getTapsPerPhase() const;
+
+    static bool parseQuality(const std::string& name, ResamplerQuality& quality);
+    static const char* getKernelName();
+
+private:
+    // Converts every frame whose input window is complete, up to a total of maxOutputFrames
+    size_t convertAvailable(uint64_t maxOutputFrames);
+
+    int numChannels;
+    int upFactor;       // L: output rate / gcd
+    int downFactor;     // M: input rate / gcd
+    int tapsPerPhase;
+    // Coefficients per phase, stored reversed so they line up with the history
+    std::vector<float> coefficients;
+    // Per channel input history; the first sample is input index historyStart
+    std::vector<std::vector<float>> history;
+    int64_t historyStart;
+    // Position of the next output sample: input index and phase
+    int64_t nextInput;
+    int nextPhase;
+    uint64_t inputFrames;
+    uint64_t outputFrames;
+    AudioBuffer output;
+};
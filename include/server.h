@@ -1,14 +1,27 @@
 #pragma once
 
+#include <memory>
 #include <string>
 #include <crow.h>
-#include "midi_processor.h"
-#include "vst_renderer.h"
-#include "audio_writer.h"
+#include "plugin_instance_pool.h"
+#include "render_cache.h"
+#include "render_metrics.h"
+#include "render_scheduler.h"
+#include "stream_server.h"
+
+struct ServerConfig {
+    int port = 8080;
+    // Port of the chunked streaming listener, 0 = disabled
+    int streamPort = 8081;
+    RenderScheduler::Config render;
+    PluginInstancePool::Config pluginCache;
+    // Renders are cached in output/ up to this size, 0 = unlimited
+    uint64_t renderCacheBytes = 2048ULL * 1024 * 1024;
+};
 
 class Server {
 public:
-    Server(int port = 8080);
+    Server(const ServerConfig& config = ServerConfig());
     ~Server();
 
     void start();
@@ -16,15 +29,18 @@ public:
 
 private:
     int port;
-    MidiProcessor midiProcessor;
-    VstRenderer vstRenderer;
-    AudioWriter audioWriter;
+    int streamPort;
+    // Warm plugin instances shared by every render request
+    std::shared_ptr<PluginInstancePool> pluginPool;
+    // Finished renders keyed by content, shared with the workers
+    std::shared_ptr<RenderCache> renderCache;
+    // Stage timings and counters recorded by the workers, served on /metrics
+    std::shared_ptr<RenderMetrics> metrics;
+    // Renders are queued here and run on worker threads
+    RenderScheduler scheduler;
+    // Serves POST /render/stream on its own port
+    StreamServer streamServer;
     crow::SimpleApp app; // Store the app instance
     
     void setupRoutes();
-    std::string handleRenderRequest(const std::string& midiFilePath, 
-                                  const std::string& vstPath,
-                                  float sampleRate = 44100,
-                                  int numChannels = 2,
-                                  int bitDepth = 16);
 };
\ No newline at end of file
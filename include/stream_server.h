@@ -0,0 +1,67 @@
+#pragma once
+
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "plugin_instance_pool.h"
+#include "render_scheduler.h"
+
+// Minimal HTTP/1.1 listener for POST /render/stream. Crow only sends a response
+// once its body is complete, so streamed renders get their own socket loop that
+// writes the WAV header and then each rendered block as a chunk of a
+// Transfer-Encoding: chunked response.
+//
+// Streams render on their own connection threads but each takes one of the
+// scheduler's render slots, so they share the worker count with queued jobs;
+// with no slot free, or more connections open than workers, clients get 503.
+class StreamServer {
+public:
+    // Seconds a client may stall a read or write before its connection is dropped
+    static constexpr int kSocketTimeoutSeconds = 30;
+
+    StreamServer(int port, std::shared_ptr<PluginInstancePool> pluginPool, RenderScheduler& scheduler);
+    ~StreamServer();
+
+    StreamServer(const StreamServer&) = delete;
+    StreamServer& operator=(const StreamServer&) = delete;
+
+    bool start();
+    // Stops accepting, shuts down every client connection and joins the connection
+    // threads. Streams stop rendering at their next block, but a plugin still
+    // loading delays the return until it has loaded.
+    void stop();
+
+private:
+    struct Connection {
+        int socket;
+        std::thread thread;
+        bool finished = false;
+    };
+
+    void acceptLoop();
+    // Joins the threads of finished connections and forgets them
+    void reapConnections();
+    void handleConnection(int clientSocket);
+    // Reads the request line, headers and body; false on malformed or oversized requests
+    static bool readRequest(int clientSocket, std::string& method, std::string& target, std::string& body);
+    static bool sendAll(int clientSocket, const void* data, size_t size);
+    static void sendSimpleResponse(int clientSocket, int status, const std::string& message);
+
+    int port;
+    std::shared_ptr<PluginInstancePool> pluginPool;
+    RenderScheduler& scheduler;
+    // Connections served at once, whether reading their request or rendering
+    int maxStreams;
+    int listenSocket;
+    std::thread acceptThread;
+    std::atomic<bool> stopping;
+
+    std::mutex mutex;
+    int activeStreams;
+    // Every connection thread not yet joined, so stop() can shut the sockets down
+    // and wait for the threads before the server goes away
+    std::list<Connection> connections;
+};
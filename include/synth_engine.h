@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "synth_kernels.h"
+
+// Built-in polyphonic sine instrument used when no plugin host is available.
+// Voice state is kept as parallel arrays in a fixed pool allocated by prepare(),
+// and each block is rendered voice by voice with the best SIMD kernel for the CPU.
+class SynthEngine {
+public:
+    static constexpr int kDefaultMaxVoices = 128;
+
+    explicit SynthEngine(int maxVoices = kDefaultMaxVoices);
+    ~SynthEngine();
+
+    // Allocates all buffers; process() never allocates afterwards
+    void prepare(double sampleRate, int numChannels, int maxBlockSize);
+    // Silences all voices, resets controllers and rewinds to sample 0
+    void reset();
+
+    // Applies a channel voice message at the current position
+    void handleEvent(uint8_t status, uint8_t data1, uint8_t data2);
+
+    // Renders the next numFrames samples into planar outputs and advances the position
+    void process(float* const* outputs, int numFrames);
+    // Moves forward to a later sample without rendering. Handling the events before
+    // it along the way leaves the engine (or a copy of it) in the same state as a
+    // full render would, so rendering from there gives identical samples.
+    void advanceTo(int64_t sample);
+
+    int64_t getPosition() const;
+    int getActiveVoiceCount() const;
+    // Samples a released voice takes to fade out
+    int64_t getReleaseSamples() const;
+    const char* getKernelName() const;
+
+private:
+    static constexpr int kNumMidiChannels = 16;
+    static constexpr int64_t kNever = INT64_MAX;
+
+    int allocateVoice();
+    void startNote(int channel, int note, int velocity);
+    void stopNote(int channel, int note);
+    void releaseVoice(int voice);
+    void setPitchBend(int channel, int value);
+    void handleController(int channel, int controller, int value);
+    void updateChannelPan(int channel);
+    double envelopeLevel(int64_t elapsed) const;
+    double noteIncrement(int note, int channel) const;
+
+    int maxVoices;
+    int numChannels;
+    int maxBlockSize;
+    double sampleRate;
+    int64_t position;
+    SynthVoiceKernel voiceKernel;
+
+    // Envelope shape in samples
+    double attackSamples;
+    double decaySamples;
+    double releaseSamples;
+    float sustainLevel;
+
+    // Voice pool, one entry per slot
+    std::vector<uint8_t> voiceActive;
+    std::vector<uint8_t> voiceChannel;
+    std::vector<uint8_t> voiceNote;
+    std::vector<uint8_t> voiceSustained;   // Note-off arrived while the sustain pedal was down
+    std::vector<float> voiceVelocityGain;
+    std::vector<int64_t> voiceNoteStart;
+    std::vector<int64_t> voiceReleaseStart;
+    std::vector<int64_t> voiceEnd;
+    std::vector<float> voiceReleaseLevel;
+    // Phase is anchored at the last pitch change so it only depends on event times
+    std::vector<double> voicePhaseAnchor;
+    std::vector<int64_t> voiceAnchorSample;
+    std::vector<double> voiceIncrement;
+
+    // Per MIDI channel controller state
+    float channelVolume[kNumMidiChannels];
+    float channelExpression[kNumMidiChannels];
+    float channelPanLeft[kNumMidiChannels];
+    float channelPanRight[kNumMidiChannels];
+    uint8_t channelPan[kNumMidiChannels];
+    bool channelSustain[kNumMidiChannels];
+    double channelBend[kNumMidiChannels];   // In semitones
+
+    // Stereo mix bus for one block
+    std::vector<float> mixLeft;
+    std::vector<float> mixRight;
+};
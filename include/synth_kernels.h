@@ -0,0 +1,30 @@
+#pragma once
+
+// Per-voice state for one block, expressed in closed form so a block renders
+// the same samples no matter how the timeline before it was split up
+struct SynthVoiceArgs {
+    float phase;            // Oscillator phase at the first sample, in cycles [0, 1)
+    float increment;        // Cycles per sample
+    float elapsed;          // Samples since note-on (held) or since note-off (released)
+    bool released;
+
+    float attackSlope;      // Envelope rise per sample during attack
+    float decayStart;       // Attack length in samples
+    float decaySlope;       // Envelope fall per sample during decay
+    float sustainLevel;
+    float releaseLevel;     // Envelope level at note-off
+    float releaseSlope;     // Envelope fall per sample after note-off
+
+    float gainLeft;
+    float gainRight;
+};
+
+// Renders one voice and adds it to the left/right accumulators
+using SynthVoiceKernel = void (*)(const SynthVoiceArgs& args, float* left, float* right, int numFrames);
+
+// Picks the fastest kernel supported by this CPU
+SynthVoiceKernel selectSynthVoiceKernel();
+const char* getSynthVoiceKernelName();
+
+// Portable reference implementation
+void renderSynthVoiceScalar(const SynthVoiceArgs& args, float* left, float* right, int numFrames);
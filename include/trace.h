@@ -0,0 +1,89 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Scoped timing spans written as Chrome/Perfetto trace-event JSON. Each thread
+// records into its own ring buffer, so spans never contend with other threads;
+// while no session is active a span is a single relaxed atomic load.
+//
+// Spans carry the context of the thread that opened them, which lets the server
+// trace one job while others run: a job sets its context on its worker and the
+// render pools pass it on to the tasks they run.
+class Tracer {
+public:
+    // Spans kept per thread; older ones are overwritten and counted as dropped
+    static constexpr size_t kEventsPerThread = 1 << 16;
+
+    static bool isEnabled() {
+        return activeSessions.load(std::memory_order_relaxed) > 0;
+    }
+
+    // Sessions nest; spans are recorded while at least one is active
+    static void beginSession();
+    static void endSession();
+
+    // Nanoseconds on a steady clock
+    static int64_t now();
+    // name must be a string literal (or otherwise outlive the session)
+    static void record(const char* name, int64_t start, int64_t end);
+
+    // Shown as the thread's name in the trace viewer
+    static void setThreadName(const std::string& name);
+
+    // Context stamped on spans opened by this thread; 0 = none
+    static uint64_t getContext();
+    static void setContext(uint64_t context);
+    // A context no other caller has been given
+    static uint64_t newContext();
+
+    // Writes the recorded spans of one context, or all spans when context is 0
+    static bool writeJson(const std::string& filePath, uint64_t context = 0);
+
+private:
+    static std::atomic<int> activeSessions;
+};
+
+// Records the time from construction to destruction as a span
+class TraceScope {
+public:
+    explicit TraceScope(const char* spanName)
+        : name(spanName), start(Tracer::isEnabled() ? Tracer::now() : 0) {}
+
+    ~TraceScope() {
+        if (start != 0) {
+            Tracer::record(name, start, Tracer::now());
+        }
+    }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    const char* name;
+    int64_t start;
+};
+
+// Sets this thread's trace context for the lifetime of the scope
+class TraceContextScope {
+public:
+    explicit TraceContextScope(uint64_t context) : previous(Tracer::getContext()) {
+        Tracer::setContext(context);
+    }
+
+    ~TraceContextScope() {
+        Tracer::setContext(previous);
+    }
+
+    TraceContextScope(const TraceContextScope&) = delete;
+    TraceContextScope& operator=(const TraceContextScope&) = delete;
+
+private:
+    uint64_t previous;
+};
+
+#define MIDIVERSE_TRACE_CONCAT_INNER(a, b) a##b
+#define MIDIVERSE_TRACE_CONCAT(a, b) MIDIVERSE_TRACE_CONCAT_INNER(a, b)
+// Traces the rest of the enclosing block as a span named name
+#define TRACE_SCOPE(name) TraceScope MIDIVERSE_TRACE_CONCAT(traceScope, __LINE__)(name)
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "midi_sequence.h"
+
+// One instrument's share of a sequence in a parallel render: the events of one
+// MIDI channel, which in a format-1 file usually means one track. Volume (CC7)
+// and pan (CC10) are taken out of the events and applied by the mixer instead.
+struct TrackPart {
+    struct GainChange {
+        int64_t sample;
+        float left;     // Gain for even output channels (and mono)
+        float right;    // Gain for odd output channels
+    };
+
+    uint16_t track = 0;     // First track playing notes on the channel
+    uint8_t channel = 0;
+    MidiSequence sequence;
+    // Sorted by sample; the first entry is the gain at sample 0
+    std::vector<GainChange> gainChanges;
+};
+
+// Splits a sequence into parts that render independently and sum to the whole.
+// Existing parts are reused so repeated renders keep their capacity.
+void splitSequenceIntoParts(const MidiSequence& sequence, double sampleRate, int numChannels,
+                            std::vector<TrackPart>& parts);
+
+// Sums planar part buffers into a planar bus, following each part's gain
+// automation, with the widest SIMD kernel the CPU supports
+class TrackMixer {
+public:
+    // Zeroes the first numFrames samples of each output channel
+    static void clear(float* const* outputs, int numChannels, int numFrames);
+    // Adds numFrames of a part, rendered from timeline sample 'position', to the outputs
+    static void addPart(const TrackPart& part, const float* const* inputs, float* const* outputs, int numChannels,
+                        int64_t position, int numFrames);
+
+    static const char* getKernelName();
+};
@@ -1,41 +1,151 @@
 #pragma once
 
+#include <functional>
 #include <string>
 #include <vector>
 #include <memory>
+#include "audio_buffer.h"
+#include "midi_sequence.h"
+#include "plugin_instance_pool.h"
+#include "render_tail.h"
+#include "track_mixer.h"
+
+class WorkStealingPool;
 
 // Forward declarations for JUCE classes
 namespace juce {
-    class AudioPluginFormatManager;
-    class AudioPluginInstance;
-    class MidiFile;
     template <typename T> class AudioBuffer;
+    class MidiBuffer;
 }
 
 class VstRenderer {
 public:
+    // Receives each rendered block as planar channels; returning false stops the render
+    using BlockCallback = std::function<bool(const float* const* channels, int numFrames)>;
+
+    // Block size plugins are prepared for and driven with unless setBlockSize() says otherwise
+    static constexpr int kDefaultBlockSize = 512;
+    // Frames each part renders between mixes when rendering tracks in parallel
+    static constexpr int kPartWindow = 8192;
+    // Length of one segment when rendering the timeline in parallel, rounded down to whole blocks
+    static constexpr int kSegmentFrames = 1 << 18;
+
     VstRenderer();
     ~VstRenderer();
 
-    bool loadVst(const std::string& vstPath);
-    bool renderMidi(const std::vector<uint8_t>& midiData, float sampleRate, int numChannels);
-    const std::vector<float>& getAudioData() const;
+    // Instances come from a pool so repeated loads of the same plugin are cheap.
+    // Share one to reuse instances across renderers; a renderer that loads a
+    // plugin without one creates a private pool then.
+    void setInstancePool(std::shared_ptr<PluginInstancePool> pool);
+    // Null until a pool is set or the first plugin is loaded
+    std::shared_ptr<PluginInstancePool> getInstancePool() const;
+
+    // Frames per process call; takes effect with the next render. Events still land
+    // on their exact sample whatever the block size.
+    void setBlockSize(int numFrames);
+    int getBlockSize() const;
+
+    // Renders each MIDI channel (usually one track of a format-1 file) with its own
+    // instance, on up to numThreads threads, and sums them with CC7/CC10 applied as
+    // gain and pan. 0 or 1 renders everything through one instance.
+    void setParallelTracks(int numThreads);
+    int getParallelTracks() const;
+    // Splits the timeline into segments rendered on up to numThreads threads, each
+    // starting from the synth state chased from the events before it. The result is
+    // bit-identical to a serial render. Only the built-in synthesizer supports this;
+    // it takes precedence over parallel tracks. 0 or 1 renders serially.
+    void setParallelSegments(int numThreads);
+    int getParallelSegments() const;
+    // What to render after the sequence ends; takes effect with the next render
+    void setTail(const RenderTail& tail);
+    const RenderTail& getTail() const;
+
+    // Loads (or takes a warm instance of) the plugin prepared for the given configuration
+    bool loadVst(const std::string& vstPath, float sampleRate = 44100, int numChannels = 2);
+    // Renders the whole sequence into the buffer returned by getAudio()
+    bool renderMidi(const MidiSequence& sequence, float sampleRate, int numChannels);
+    // Streams the render block by block without keeping the audio in memory
+    bool renderMidi(const MidiSequence& sequence, float sampleRate, int numChannels,
+                    const BlockCallback& onBlock);
+    const AudioBuffer& getAudio() const;
+    // Hands over the rendered audio without copying it
+    AudioBuffer takeAudio();
     
 private:
     std::string vstPath;
-    std::vector<float> audioData;
+    std::shared_ptr<PluginInstancePool> instancePool;
+    PluginInstanceKey instanceKey;
+    std::unique_ptr<PluginInstance> vstInstance;
+    AudioBuffer audio;
+    // Absolute sample position of every event in the sequence being rendered
+    std::vector<int64_t> eventSamples;
+    // Render buffer, and scratch pointers into it for chunks and delivered blocks
+    AudioBuffer blockBuffer;
+    std::vector<float*> chunkChannels;
+    std::vector<const float*> deliverChannels;
+    
+    // Progress of the render started by beginRender()
+    const MidiSequence* renderSequence;
+    int renderChannels;
+    int64_t renderPosition;
+    int64_t renderLength;
+    size_t nextEvent;
+    int blockSize;
+    
+    // Parallel track and segment rendering
+    int parallelTracks;
+    int parallelSegments;
+    std::unique_ptr<WorkStealingPool> renderPool;
+    std::vector<TrackPart> trackParts;
+    std::vector<std::unique_ptr<VstRenderer>> trackRenderers;
+    
+    // Adaptive tail: frames from tailStart on are checked for silence. A silent run
+    // is held back until sound resumes, so a render that ends in it drops it.
+    RenderTail tail;
+    int64_t tailStart;
+    int64_t holdFrames;
+    float silenceLevel;
+    AudioBuffer pendingSilence;
+    std::vector<const float*> tailChannels;
+    int64_t processedFrames;
+    int64_t deliveredFrames;
+    bool tailFinished;
+    
+    // Makes sure the current instance matches the render configuration
+    bool acquireInstance(float sampleRate, int numChannels);
+    void releaseInstance();
+    // The shared pool, or a private one created on first use
+    PluginInstancePool& ensureInstancePool();
+    
+    // Prepares the instance and the buffers for rendering up to maxFrames at a time
+    bool beginRender(const MidiSequence& sequence, float sampleRate, int numChannels, int maxFrames);
+    // Renders the next frames into planar outputs; returns how many, 0 once the render is done
+    int renderNext(float* const* outputs, int maxFrames);
+    // Sets up the tail state for a render whose sequence ends at sequenceEnd
+    void beginTail(int64_t sequenceEnd, float sampleRate, int numChannels);
+    // Passes rendered frames through the tail check and on to onBlock
+    bool deliverFrames(const float* const* channels, int numChannels, int numFrames,
+                       const BlockCallback& onBlock);
+    // Hands planar frames on in blocks of at most blockSize
+    bool deliverBlocks(const float* const* channels, int numChannels, int numFrames,
+                       const BlockCallback& onBlock);
+    bool renderTracksInParallel(float sampleRate, int numChannels, const BlockCallback& onBlock);
+    WorkStealingPool& getRenderPool(int numThreads);
     
     // JUCE specific members (only used when built with JUCE)
     #ifdef USE_JUCE
-    std::unique_ptr<juce::AudioPluginFormatManager> formatManager;
-    std::unique_ptr<juce::AudioPluginInstance> vstInstance;
-    
-    bool loadVstWithJuce(const std::string& vstPath);
-    bool renderMidiWithJuce(const std::vector<uint8_t>& midiData, float sampleRate, int numChannels);
-    std::unique_ptr<juce::MidiFile> parseMidiData(const std::vector<uint8_t>& midiData);
+    // Preallocated so rendering a block doesn't touch the heap
+    std::unique_ptr<juce::MidiBuffer> blockMidi;
+    std::unique_ptr<juce::AudioBuffer<float>> processBuffer;
+    std::vector<uint8_t> sysExMessage;
     #else
-    void* vstInstance; // Dummy placeholder when not using JUCE
+    struct RenderSegment;
+    std::vector<std::unique_ptr<RenderSegment>> renderSegments;
     
-    bool renderDummyAudio(float sampleRate, int numChannels);
+    // Renders frames from 'start' with the given engine, handling events from eventIndex on.
+    // chunkChannels is scratch space for the output pointers of each chunk.
+    void renderSynthFrames(SynthEngine& engine, size_t& eventIndex, int64_t start, int numFrames,
+                           float* const* outputs, std::vector<float*>& chunkChannels) const;
+    bool renderSegmentsInParallel(float sampleRate, int numChannels, const BlockCallback& onBlock);
     #endif
 };
\ No newline at end of file
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads, each with its own task deque. Workers take tasks
+// from the front of their own deque and, when it runs dry, steal from the back
+// of another worker's, so uneven task sizes still keep every thread busy.
+class WorkStealingPool {
+public:
+    // Tasks receive the index of the worker running them, for per-worker state
+    using Task = std::function<void(int workerIndex)>;
+
+    // numWorkers <= 0 uses one worker per hardware thread
+    explicit WorkStealingPool(int numWorkers = 0);
+    ~WorkStealingPool();
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    // Queues a task on the next worker in round-robin order
+    void submit(Task task);
+    // Queues a task on a specific worker
+    void submit(int workerIndex, Task task);
+    // Blocks until every submitted task has finished
+    void wait();
+
+    int getNumWorkers() const;
+    uint64_t getStealCount() const;
+
+private:
+    struct WorkerQueue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    void workerLoop(int workerIndex);
+    bool popLocal(int workerIndex, Task& task);
+    bool steal(int workerIndex, Task& task);
+
+    std::vector<std::unique_ptr<WorkerQueue>> queues;
+    std::vector<std::thread> threads;
+    std::atomic<size_t> nextQueue;
+    std::atomic<uint64_t> steals;
+
+    std::mutex stateMutex;
+    std::condition_variable workAvailable;
+    std::condition_variable allDone;
+    // Tasks sitting in deques, and tasks not yet finished
+    size_t queuedTasks;
+    size_t pendingTasks;
+    bool stopping;
+};
@@ -0,0 +1,240 @@
+#include "audio_buffer.h"
+#include "cpu_features.h"
+#include <algorithm>
+#include <cstring>
+#include <new>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MIDIVERSE_X86_KERNELS 1
+#elif defined(__aarch64__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define MIDIVERSE_NEON_KERNELS 1
+#endif
+
+namespace {
+    constexpr size_t kFramesPerAlignment = AudioBuffer::kAlignment / sizeof(float);
+
+    size_t roundUpFrames(size_t numFrames) {
+        return (numFrames + kFramesPerAlignment - 1) / kFramesPerAlignment * kFramesPerAlignment;
+    }
+
+    float* allocateSamples(size_t numSamples) {
+        if (numSamples == 0) {
+            return nullptr;
+        }
+        return static_cast<float*>(::operator new(numSamples * sizeof(float), std::align_val_t(AudioBuffer::kAlignment)));
+    }
+
+    void freeSamples(float* samples) {
+        if (samples) {
+            ::operator delete(samples, std::align_val_t(AudioBuffer::kAlignment));
+        }
+    }
+
+    //===== Stereo interleave kernels =====
+
+    using StereoKernel = void (*)(const float* left, const float* right, size_t numFrames, float* output);
+
+    void interleaveStereoScalar(const float* left, const float* right, size_t numFrames, float* output) {
+        for (size_t i = 0; i < numFrames; ++i) {
+            output[2 * i] = left[i];
+            output[2 * i + 1] = right[i];
+        }
+    }
+
+#ifdef MIDIVERSE_X86_KERNELS
+    __attribute__((target("avx2")))
+    void interleaveStereoAvx2(const float* left, const float* right, size_t numFrames, float* output) {
+        size_t i = 0;
+        for (; i + 8 <= numFrames; i += 8) {
+            __m256 l = _mm256_loadu_ps(left + i);
+            __m256 r = _mm256_loadu_ps(right + i);
+            // unpack works within 128-bit lanes; the permutes put the halves back in order
+            __m256 low = _mm256_unpacklo_ps(l, r);
+            __m256 high = _mm256_unpackhi_ps(l, r);
+            _mm256_storeu_ps(output + 2 * i, _mm256_permute2f128_ps(low, high, 0x20));
+            _mm256_storeu_ps(output + 2 * i + 8, _mm256_permute2f128_ps(low, high, 0x31));
+        }
+        interleaveStereoScalar(left + i, right + i, numFrames - i, output + 2 * i);
+    }
+
+    __attribute__((target("sse4.1")))
+    void interleaveStereoSse41(const float* left, const float* right, size_t numFrames, float* output) {
+        size_t i = 0;
+        for (; i + 4 <= numFrames; i += 4) {
+            __m128 l = _mm_loadu_ps(left + i);
+            __m128 r = _mm_loadu_ps(right + i);
+            _mm_storeu_ps(output + 2 * i, _mm_unpacklo_ps(l, r));
+            _mm_storeu_ps(output + 2 * i + 4, _mm_unpackhi_ps(l, r));
+        }
+        interleaveStereoScalar(left + i, right + i, numFrames - i, output + 2 * i);
+    }
+#endif
+
+#ifdef MIDIVERSE_NEON_KERNELS
+    void interleaveStereoNeon(const float* left, const float* right, size_t numFrames, float* output) {
+        size_t i = 0;
+        for (; i + 4 <= numFrames; i += 4) {
+            float32x4x2_t pair = {{vld1q_f32(left + i), vld1q_f32(right + i)}};
+            vst2q_f32(output + 2 * i, pair);
+        }
+        interleaveStereoScalar(left + i, right + i, numFrames - i, output + 2 * i);
+    }
+#endif
+
+    StereoKernel chooseStereoKernel() {
+        const CpuFeatures& cpu = CpuFeatures::get();
+        (void)cpu;
+#ifdef MIDIVERSE_X86_KERNELS
+        if (cpu.avx2) return interleaveStereoAvx2;
+        if (cpu.sse41) return interleaveStereoSse41;
+#endif
+#ifdef MIDIVERSE_NEON_KERNELS
+        if (cpu.neon) return interleaveStereoNeon;
+#endif
+        return interleaveStereoScalar;
+    }
+}
+
+AudioBuffer::AudioBuffer() : data(nullptr), numChannels(0), numFrames(0), capacity(0) {
+}
+
+AudioBuffer::AudioBuffer(int numChannels, size_t numFrames) : AudioBuffer() {
+    setSize(numChannels, numFrames);
+}
+
+AudioBuffer::~AudioBuffer() {
+    freeSamples(data);
+}
+
+AudioBuffer::AudioBuffer(AudioBuffer&& other) noexcept
+    : data(other.data), numChannels(other.numChannels), numFrames(other.numFrames), capacity(other.capacity),
+      channels(std::move(other.channels)) {
+    other.data = nullptr;
+    other.numChannels = 0;
+    other.numFrames = 0;
+    other.capacity = 0;
+    other.channels.clear();
+}
+
+AudioBuffer& AudioBuffer::operator=(AudioBuffer&& other) noexcept {
+    if (this != &other) {
+        freeSamples(data);
+        data = other.data;
+        numChannels = other.numChannels;
+        numFrames = other.numFrames;
+        capacity = other.capacity;
+        channels = std::move(other.channels);
+        other.data = nullptr;
+        other.numChannels = 0;
+        other.numFrames = 0;
+        other.capacity = 0;
+        other.channels.clear();
+    }
+    return *this;
+}
+
+void AudioBuffer::setSize(int numChannels, size_t numFrames) {
+    numChannels = std::max(numChannels, 0);
+    if (numChannels != this->numChannels || numFrames > capacity) {
+        reallocate(numChannels, std::max(numFrames, capacity));
+    }
+    if (numFrames > this->numFrames) {
+        for (int channel = 0; channel < numChannels; ++channel) {
+            std::fill(channels[channel] + this->numFrames, channels[channel] + numFrames, 0.0f);
+        }
+    }
+    this->numFrames = numFrames;
+}
+
+void AudioBuffer::reserve(size_t numFrames) {
+    if (numFrames > capacity) {
+        reallocate(numChannels, numFrames);
+    }
+}
+
+void AudioBuffer::append(const float* const* source, size_t numSourceFrames) {
+    size_t needed = numFrames + numSourceFrames;
+    if (needed > capacity) {
+        reallocate(numChannels, std::max(needed, capacity * 2));
+    }
+    for (int channel = 0; channel < numChannels; ++channel) {
+        std::memcpy(channels[channel] + numFrames, source[channel], numSourceFrames * sizeof(float));
+    }
+    numFrames = needed;
+}
+
+void AudioBuffer::clear() {
+    numFrames = 0;
+}
+
+int AudioBuffer::getNumChannels() const {
+    return numChannels;
+}
+
+size_t AudioBuffer::getNumFrames() const {
+    return numFrames;
+}
+
+size_t AudioBuffer::getCapacity() const {
+    return capacity;
+}
+
+float* AudioBuffer::getChannel(int channel) {
+    return channels[channel];
+}
+
+const float* AudioBuffer::getChannel(int channel) const {
+    return channels[channel];
+}
+
+float* const* AudioBuffer::getChannels() {
+    return channels.data();
+}
+
+const float* const* AudioBuffer::getChannels() const {
+    return channels.data();
+}
+
+void AudioBuffer::reallocate(int newNumChannels, size_t newCapacity) {
+    newCapacity = roundUpFrames(newCapacity);
+    float* newData = allocateSamples(static_cast<size_t>(newNumChannels) * newCapacity);
+
+    // Channels that exist in both layouts keep their samples
+    size_t keepFrames = std::min(numFrames, newCapacity);
+    int keepChannels = std::min(numChannels, newNumChannels);
+    for (int channel = 0; channel < keepChannels; ++channel) {
+        std::memcpy(newData + channel * newCapacity, channels[channel], keepFrames * sizeof(float));
+    }
+    for (int channel = keepChannels; channel < newNumChannels; ++channel) {
+        std::fill(newData + channel * newCapacity, newData + channel * newCapacity + keepFrames, 0.0f);
+    }
+
+    freeSamples(data);
+    data = newData;
+    numChannels = newNumChannels;
+    numFrames = keepFrames;
+    capacity = newCapacity;
+    channels.resize(newNumChannels);
+    for (int channel = 0; channel < newNumChannels; ++channel) {
+        channels[channel] = data + channel * capacity;
+    }
+}
+
+void interleaveChannels(const float* const* channels, int numChannels, size_t numFrames, float* output) {
+    static const StereoKernel stereoKernel = chooseStereoKernel();
+
+    if (numChannels == 1) {
+        std::memcpy(output, channels[0], numFrames * sizeof(float));
+    } else if (numChannels == 2) {
+        stereoKernel(channels[0], channels[1], numFrames, output);
+    } else {
+        for (int channel = 0; channel < numChannels; ++channel) {
+            const float* source = channels[channel];
+            for (size_t frame = 0; frame < numFrames; ++frame) {
+                output[frame * numChannels + channel] = source[frame];
+            }
+        }
+    }
+}
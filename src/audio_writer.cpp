@@ -1,132 +1,484 @@
 #include "audio_writer.h"
-#include <iostream>
+#include "logger.h"
+#include "trace.h"
+#include <algorithm>
 #include <cstdio>
 #include <cstring>
 
-AudioWriter::AudioWriter() {
+namespace {
+    // Header layout written by open(). A JUNK chunk reserves room for the ds64
+    // chunk so the file can be converted to RF64 in place once the size is known.
+    // Float output uses the extended fmt chunk and adds a fact chunk.
+    constexpr uint64_t kJunkChunkOffset = 12;
+    constexpr uint32_t kDs64Size = 28;
+    constexpr uint64_t kFmtChunkOffset = kJunkChunkOffset + 8 + kDs64Size;
+    constexpr uint32_t kPcmFmtSize = 16;
+    constexpr uint32_t kExtendedFmtSize = 18;
+    constexpr uint32_t kFactSize = 4;
+    constexpr uint64_t kMaxHeaderSize = kFmtChunkOffset + 8 + kExtendedFmtSize + 8 + kFactSize + 8;
+
+    constexpr uint16_t kWaveFormatPcm = 1;
+    constexpr uint16_t kWaveFormatIeeeFloat = 3;
+
+    // Frames converted per write when writing a whole buffer at once
+    constexpr size_t kWriteChunkFrames = 8192;
+
+    void putLE16(uint8_t* out, uint16_t value) {
+        out[0] = value & 0xFF;
+        out[1] = (value >> 8) & 0xFF;
+    }
+
+    void putLE32(uint8_t* out, uint32_t value) {
+        for (int i = 0; i < 4; ++i) out[i] = (value >> (8 * i)) & 0xFF;
+    }
+
+    void putLE64(uint8_t* out, uint64_t value) {
+        for (int i = 0; i < 8; ++i) out[i] = (value >> (8 * i)) & 0xFF;
+    }
+}
+
+AudioWriter::AudioWriter()
+    : file(nullptr), memory(nullptr), memoryString(nullptr), sampleRate(0), numChannels(0), bitDepth(0), format(SampleFormat::Int16),
+      dither(false), fileFormat(AudioFileFormat::Wav), flacLevel(FlacEncoder::kDefaultLevel), encoderThreads(1),
+      flacOutput(false), factChunkOffset(0), dataChunkOffset(0), dataBytes(0), framesWritten(0), failed(false) {
 }
 
 AudioWriter::~AudioWriter() {
+    if (isOpen()) {
+        finalize();
+    }
+}
+
+bool AudioWriter::writeWavFile(const std::string& filePath, const AudioBuffer& audio, float sampleRate,
+                               int bitDepth) {
+    if (audio.getNumFrames() == 0) {
+        LOG_ERROR("No audio data to write");
+        return false;
+    }
+
+    if (!open(filePath, sampleRate, audio.getNumChannels(), bitDepth)) {
+        return false;
+    }
+
+    std::vector<const float*> channels(audio.getNumChannels());
+    size_t totalFrames = audio.getNumFrames();
+    for (size_t frame = 0; frame < totalFrames; frame += kWriteChunkFrames) {
+        size_t numFrames = std::min(kWriteChunkFrames, totalFrames - frame);
+        for (int channel = 0; channel < audio.getNumChannels(); ++channel) {
+            channels[channel] = audio.getChannel(channel) + frame;
+        }
+        if (!appendBlock(channels.data(), numFrames)) {
+            finalize();
+            return false;
+        }
+    }
+
+    return finalize();
+}
+
+bool AudioWriter::open(const std::string& filePath, float sampleRate, int numChannels, int bitDepth) {
+    SampleFormat format;
+    if (!PcmConverter::formatForBitDepth(bitDepth, format)) {
+        LOG_ERROR("Unsupported bit depth: " << bitDepth);
+        return false;
+    }
+    return open(filePath, sampleRate, numChannels, format);
 }
 
-bool AudioWriter::writeWavFile(const std::string& filePath, const std::vector<float>& audioData, 
-                             float sampleRate, int numChannels, int bitDepth) {
-    if (audioData.empty()) {
-        std::cerr << "No audio data to write" << std::endl;
+bool AudioWriter::open(const std::string& filePath, float sampleRate, int numChannels, SampleFormat format) {
+    if (isOpen()) {
+        LOG_ERROR("Audio writer is already open: " << this->filePath);
         return false;
     }
-    
-    FILE* file = fopen(filePath.c_str(), "wb");
+
+    if (numChannels < 1 || numChannels > 65535) {
+        LOG_ERROR("Unsupported channel count: " << numChannels);
+        return false;
+    }
+
+    file = fopen(filePath.c_str(), "wb");
     if (!file) {
-        std::cerr << "Could not open file for writing: " << filePath << std::endl;
+        LOG_ERROR("Could not open file for writing: " << filePath);
         return false;
     }
-    
-    // Calculate sizes
-    int bytesPerSample = bitDepth / 8;
-    int numSamples = static_cast<int>(audioData.size());
-    int dataSize = numSamples * bytesPerSample;
-    
-    // Write WAV header
-    if (!writeWavHeader(file, dataSize, sampleRate, numChannels, bitDepth)) {
+
+    this->filePath = filePath;
+    if (!begin(sampleRate, numChannels, format)) {
         fclose(file);
+        file = nullptr;
         return false;
     }
-    
-    // Convert float samples to the specified bit depth
-    std::vector<uint8_t> rawData(dataSize);
-    
-    for (int i = 0; i < numSamples; ++i) {
-        float sample = audioData[i];
-        
-        // Clamp sample to [-1.0, 1.0]
-        if (sample > 1.0f) sample = 1.0f;
-        if (sample < -1.0f) sample = -1.0f;
-        
-        // Convert to integer and write to buffer
-        if (bitDepth == 16) {
-            int16_t pcm = static_cast<int16_t>(sample * 32767.0f);
-            memcpy(&rawData[i * bytesPerSample], &pcm, bytesPerSample);
-        } else if (bitDepth == 24) {
-            int32_t pcm = static_cast<int32_t>(sample * 8388607.0f);
-            uint8_t bytes[3];
-            bytes[0] = pcm & 0xFF;
-            bytes[1] = (pcm >> 8) & 0xFF;
-            bytes[2] = (pcm >> 16) & 0xFF;
-            memcpy(&rawData[i * bytesPerSample], bytes, bytesPerSample);
-        } else if (bitDepth == 32) {
-            int32_t pcm = static_cast<int32_t>(sample * 2147483647.0f);
-            memcpy(&rawData[i * bytesPerSample], &pcm, bytesPerSample);
-        } else {
-            std::cerr << "Unsupported bit depth: " << bitDepth << std::endl;
-            fclose(file);
-            return false;
+
+    return true;
+}
+
+bool AudioWriter::openStream(const ByteSink& sink, float sampleRate, int numChannels, SampleFormat format) {
+    if (isOpen()) {
+        LOG_ERROR("Audio writer is already open: " << filePath);
+        return false;
+    }
+
+    if (numChannels < 1 || numChannels > 65535) {
+        LOG_ERROR("Unsupported channel count: " << numChannels);
+        return false;
+    }
+
+    this->sink = sink;
+    filePath = "<stream>";
+    if (!begin(sampleRate, numChannels, format)) {
+        this->sink = nullptr;
+        return false;
+    }
+
+    return true;
+}
+
+bool AudioWriter::openMemory(std::vector<uint8_t>& buffer, float sampleRate, int numChannels, SampleFormat format) {
+    if (isOpen()) {
+        LOG_ERROR("Audio writer is already open: " << filePath);
+        return false;
+    }
+
+    if (numChannels < 1 || numChannels > 65535) {
+        LOG_ERROR("Unsupported channel count: " << numChannels);
+        return false;
+    }
+
+    buffer.clear();
+    memory = &buffer;
+    filePath = "<memory>";
+    if (!begin(sampleRate, numChannels, format)) {
+        memory = nullptr;
+        return false;
+    }
+
+    return true;
+}
+
+bool AudioWriter::openMemory(std::string& buffer, float sampleRate, int numChannels, SampleFormat format) {
+    if (isOpen()) {
+        LOG_ERROR("Audio writer is already open: " << filePath);
+        return false;
+    }
+
+    if (numChannels < 1 || numChannels > 65535) {
+        LOG_ERROR("Unsupported channel count: " << numChannels);
+        return false;
+    }
+
+    buffer.clear();
+    memoryString = &buffer;
+    filePath = "<memory>";
+    if (!begin(sampleRate, numChannels, format)) {
+        memoryString = nullptr;
+        return false;
+    }
+
+    return true;
+}
+
+bool AudioWriter::begin(float sampleRate, int numChannels, SampleFormat format) {
+    this->sampleRate = sampleRate;
+    this->numChannels = numChannels;
+    this->format = format;
+    bitDepth = PcmConverter::bitsPerSample(format);
+    converter.setFormat(format);
+    converter.setDither(dither);
+    dataBytes = 0;
+    framesWritten = 0;
+    failed = false;
+    flacOutput = fileFormat == AudioFileFormat::Flac;
+
+    if (!flacOutput) {
+        return writeWavHeader();
+    }
+
+    if (format == SampleFormat::Float32) {
+        LOG_ERROR("FLAC output needs 16 or 24-bit samples");
+        return false;
+    }
+    if (!flacEncoder) {
+        flacEncoder = std::make_unique<FlacEncoder>();
+    }
+    if (!flacEncoder->begin(static_cast<uint32_t>(sampleRate), numChannels, bitDepth, flacLevel, encoderThreads)) {
+        return false;
+    }
+    uint8_t header[FlacEncoder::kHeaderSize];
+    flacEncoder->writeHeader(header);
+    return writeBytes(header, sizeof(header));
+}
+
+bool AudioWriter::appendBlock(const float* const* channels, size_t numFrames) {
+    if (!isOpen() || failed) {
+        return false;
+    }
+
+    size_t numSamples = numFrames * numChannels;
+    size_t blockBytes = numSamples * converter.getBytesPerSample();
+    if (conversionBuffer.size() < blockBytes) {
+        conversionBuffer.resize(blockBytes);
+    }
+    if (interleaveBuffer.size() < numSamples) {
+        interleaveBuffer.resize(numSamples);
+    }
+
+    {
+        // The only place samples get interleaved: right before encoding
+        TRACE_SCOPE("convert");
+        interleaveChannels(channels, numChannels, numFrames, interleaveBuffer.data());
+        converter.convert(interleaveBuffer.data(), numSamples, conversionBuffer.data());
+    }
+
+    bool written;
+    if (flacOutput) {
+        {
+            TRACE_SCOPE("flac encode");
+            flacEncoder->addPcm(conversionBuffer.data(), numFrames, flacBytes);
         }
+        written = writeFlacBytes();
+    } else {
+        written = writeBytes(conversionBuffer.data(), blockBytes);
     }
-    
-    // Write audio data
-    size_t written = fwrite(rawData.data(), 1, dataSize, file);
-    fclose(file);
-    
-    if (written != static_cast<size_t>(dataSize)) {
-        std::cerr << "Failed to write all audio data" << std::endl;
-        return false;
-    }
-    
-    std::cout << "Successfully wrote WAV file: " << filePath << std::endl;
-    std::cout << "  Sample rate: " << sampleRate << " Hz" << std::endl;
-    std::cout << "  Channels: " << numChannels << std::endl;
-    std::cout << "  Bit depth: " << bitDepth << " bits" << std::endl;
-    std::cout << "  Duration: " << numSamples / numChannels / sampleRate << " seconds" << std::endl;
-    
+    if (!written) {
+        LOG_ERROR("Failed to write all audio data");
+        failed = true;
+        return false;
+    }
+
+    dataBytes += blockBytes;
+    framesWritten += numFrames;
     return true;
 }
 
-bool AudioWriter::writeWavHeader(FILE* file, int dataSize, float sampleRate, 
-                               int numChannels, int bitDepth) {
-    // RIFF header
-    fwrite("RIFF", 1, 4, file);
-    
-    // File size (will be filled later)
-    int fileSizeMinusRiff = 36 + dataSize;  // 36 = size of the rest of the header
-    fwrite(&fileSizeMinusRiff, 4, 1, file);
-    
-    // WAV marker & format chunk
-    fwrite("WAVEfmt ", 1, 8, file);
-    
-    // Format chunk size
-    int formatChunkSize = 16;
-    fwrite(&formatChunkSize, 4, 1, file);
-    
-    // Audio format (1 = PCM)
-    short audioFormat = 1;
-    fwrite(&audioFormat, 2, 1, file);
-    
-    // Number of channels
-    short numChannelsShort = static_cast<short>(numChannels);
-    fwrite(&numChannelsShort, 2, 1, file);
-    
-    // Sample rate
-    int sampleRateInt = static_cast<int>(sampleRate);
-    fwrite(&sampleRateInt, 4, 1, file);
-    
-    // Byte rate
-    int byteRate = sampleRateInt * numChannels * (bitDepth / 8);
-    fwrite(&byteRate, 4, 1, file);
-    
-    // Block align
-    short blockAlign = numChannels * (bitDepth / 8);
-    fwrite(&blockAlign, 2, 1, file);
-    
-    // Bits per sample
-    short bitsPerSample = static_cast<short>(bitDepth);
-    fwrite(&bitsPerSample, 2, 1, file);
-    
-    // Data chunk marker
-    fwrite("data", 1, 4, file);
-    
-    // Data size
-    fwrite(&dataSize, 4, 1, file);
-    
+bool AudioWriter::finalize() {
+    if (!isOpen()) {
+        return false;
+    }
+    TRACE_SCOPE("finalize");
+
+    bool ok = !failed;
+
+    if (flacOutput) {
+        // Frame sizes and the sample count are only known now; streams keep them as unknown
+        if (ok) {
+            flacEncoder->finish(flacBytes);
+            ok = writeFlacBytes();
+        }
+        if (ok && isSeekable()) {
+            uint8_t streamInfo[FlacEncoder::kStreamInfoSize];
+            flacEncoder->writeStreamInfo(streamInfo);
+            ok = patchBytes(FlacEncoder::kStreamInfoOffset, streamInfo, sizeof(streamInfo));
+        }
+    }
+
+    // Chunks are word aligned; odd-sized data gets a pad byte. Streams have no known
+    // chunk end, so a pad byte would be read as audio.
+    bool seekable = isSeekable();
+    if (ok && !flacOutput && seekable && (dataBytes & 1)) {
+        uint8_t pad = 0;
+        ok = writeBytes(&pad, 1);
+    }
+
+    // Streamed headers can't be patched; readers go by the end of the stream
+    ok = ok && (flacOutput || !seekable || patchSizes());
+
+    if (file) {
+        ok = (fclose(file) == 0) && ok;
+        file = nullptr;
+    }
+    sink = nullptr;
+    memory = nullptr;
+    memoryString = nullptr;
+
+    const char* container = flacOutput ? "FLAC" : "WAV";
+    if (!ok) {
+        LOG_ERROR("Failed to finalize " << container << " file: " << filePath);
+        return false;
+    }
+
+    if (flacOutput) {
+        LOG_INFO("Successfully wrote FLAC file: " << filePath << " (" << sampleRate << " Hz, " << numChannels
+                 << " channels, " << bitDepth << " bits, " << framesWritten / sampleRate << " seconds, level "
+                 << flacLevel << ", " << FlacEncoder::getKernelName() << " kernels)");
+    } else {
+        LOG_INFO("Successfully wrote WAV file: " << filePath << " (" << sampleRate << " Hz, " << numChannels
+                 << " channels, " << bitDepth << " bits" << (format == SampleFormat::Float32 ? " float" : "")
+                 << ", " << framesWritten / sampleRate << " seconds)");
+    }
+
     return true;
-}
\ No newline at end of file
+}
+
+bool AudioWriter::isOpen() const {
+    return file != nullptr || sink != nullptr || memory != nullptr || memoryString != nullptr;
+}
+
+bool AudioWriter::isSeekable() const {
+    return file != nullptr || memory != nullptr || memoryString != nullptr;
+}
+
+uint64_t AudioWriter::getFramesWritten() const {
+    return framesWritten;
+}
+
+void AudioWriter::setDither(bool enabled) {
+    dither = enabled;
+}
+
+void AudioWriter::setFileFormat(AudioFileFormat fileFormat) {
+    this->fileFormat = fileFormat;
+}
+
+AudioFileFormat AudioWriter::getFileFormat() const {
+    return fileFormat;
+}
+
+void AudioWriter::setFlacLevel(int level) {
+    flacLevel = std::max(FlacEncoder::kMinLevel, std::min(FlacEncoder::kMaxLevel, level));
+}
+
+void AudioWriter::setEncoderThreads(int numThreads) {
+    encoderThreads = std::max(numThreads, 1);
+}
+
+bool AudioWriter::parseFileFormat(const std::string& name, AudioFileFormat& fileFormat) {
+    if (name == "wav") {
+        fileFormat = AudioFileFormat::Wav;
+        return true;
+    }
+    if (name == "flac") {
+        fileFormat = AudioFileFormat::Flac;
+        return true;
+    }
+    return false;
+}
+
+const char* AudioWriter::extensionFor(AudioFileFormat fileFormat) {
+    return fileFormat == AudioFileFormat::Flac ? ".flac" : ".wav";
+}
+
+bool AudioWriter::writeWavHeader() {
+    bool isFloat = format == SampleFormat::Float32;
+    uint32_t fmtSize = isFloat ? kExtendedFmtSize : kPcmFmtSize;
+    factChunkOffset = isFloat ? kFmtChunkOffset + 8 + fmtSize : 0;
+    dataChunkOffset = kFmtChunkOffset + 8 + fmtSize + (isFloat ? 8 + kFactSize : 0);
+
+    uint8_t header[kMaxHeaderSize] = {};
+
+    // RIFF header; sizes are patched by finalize(), or left unknown when streaming
+    uint32_t unknownSize = sink ? 0xFFFFFFFF : 0;
+    memcpy(header, "RIFF", 4);
+    putLE32(header + 4, unknownSize);
+    memcpy(header + 8, "WAVE", 4);
+
+    // Placeholder for the RF64 ds64 chunk
+    memcpy(header + kJunkChunkOffset, "JUNK", 4);
+    putLE32(header + kJunkChunkOffset + 4, kDs64Size);
+
+    // Format chunk
+    uint8_t* fmt = header + kFmtChunkOffset;
+    uint32_t sampleRateInt = static_cast<uint32_t>(sampleRate);
+    uint16_t blockAlign = static_cast<uint16_t>(numChannels * (bitDepth / 8));
+    memcpy(fmt, "fmt ", 4);
+    putLE32(fmt + 4, fmtSize);
+    putLE16(fmt + 8, isFloat ? kWaveFormatIeeeFloat : kWaveFormatPcm);
+    putLE16(fmt + 10, static_cast<uint16_t>(numChannels));
+    putLE32(fmt + 12, sampleRateInt);
+    putLE32(fmt + 16, sampleRateInt * blockAlign);
+    putLE16(fmt + 20, blockAlign);
+    putLE16(fmt + 22, static_cast<uint16_t>(bitDepth));
+    // The extended fmt chunk ends with an empty cbSize field
+
+    // Sample frame count required for non-PCM formats
+    if (factChunkOffset) {
+        memcpy(header + factChunkOffset, "fact", 4);
+        putLE32(header + factChunkOffset + 4, kFactSize);
+        putLE32(header + factChunkOffset + 8, unknownSize);
+    }
+
+    // Data chunk marker
+    memcpy(header + dataChunkOffset, "data", 4);
+    putLE32(header + dataChunkOffset + 4, unknownSize);
+
+    return writeBytes(header, dataChunkOffset + 8);
+}
+
+bool AudioWriter::patchSizes() {
+    uint64_t riffSize = dataChunkOffset + dataBytes + (dataBytes & 1);
+    uint8_t field[8];
+    bool rf64 = riffSize > 0xFFFFFFFFULL;
+
+    if (factChunkOffset) {
+        putLE32(field, (rf64 || framesWritten > 0xFFFFFFFFULL) ? 0xFFFFFFFF : static_cast<uint32_t>(framesWritten));
+        if (!patchBytes(factChunkOffset + 8, field, 4)) return false;
+    }
+
+    if (!rf64) {
+        putLE32(field, static_cast<uint32_t>(riffSize));
+        if (!patchBytes(4, field, 4)) return false;
+        putLE32(field, static_cast<uint32_t>(dataBytes));
+        return patchBytes(dataChunkOffset + 4, field, 4);
+    }
+
+    // Too large for RIFF: switch to RF64 and store the real sizes in ds64
+    uint8_t ds64[8 + kDs64Size] = {};
+    memcpy(ds64, "ds64", 4);
+    putLE32(ds64 + 4, kDs64Size);
+    putLE64(ds64 + 8, riffSize);
+    putLE64(ds64 + 16, dataBytes);
+    putLE64(ds64 + 24, framesWritten);
+    putLE32(ds64 + 32, 0);  // No table entries
+
+    putLE32(field, 0xFFFFFFFF);
+    return patchBytes(0, "RF64", 4) &&
+           patchBytes(4, field, 4) &&
+           patchBytes(kJunkChunkOffset, ds64, sizeof(ds64)) &&
+           patchBytes(dataChunkOffset + 4, field, 4);
+}
+
+bool AudioWriter::writeFlacBytes() {
+    if (flacBytes.empty()) {
+        return true;
+    }
+    bool ok = writeBytes(flacBytes.data(), flacBytes.size());
+    flacBytes.clear();
+    return ok;
+}
+
+bool AudioWriter::writeBytes(const void* data, size_t size) {
+    TRACE_SCOPE("write");
+    if (sink) {
+        return sink(data, size);
+    }
+    if (memory) {
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        memory->insert(memory->end(), bytes, bytes + size);
+        return true;
+    }
+    if (memoryString) {
+        memoryString->append(static_cast<const char*>(data), size);
+        return true;
+    }
+    return fwrite(data, 1, size, file) == size;
+}
+
+bool AudioWriter::patchBytes(uint64_t offset, const void* data, size_t size) {
+    if (memory) {
+        if (offset + size > memory->size()) {
+            return false;
+        }
+        memcpy(memory->data() + offset, data, size);
+        return true;
+    }
+    if (memoryString) {
+        if (offset + size > memoryString->size()) {
+            return false;
+        }
+        memcpy(&(*memoryString)[offset], data, size);
+        return true;
+    }
+    if (fseek(file, static_cast<long>(offset), SEEK_SET) != 0) {
+        return false;
+    }
+    return writeBytes(data, size);
+}
@@ -0,0 +1,271 @@
+#include "batch_renderer.h"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <glob.h>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <set>
+#include "logger.h"
+#include "midi_processor.h"
+#include "peak_pyramid.h"
+#include "multi_rate_writer.h"
+#include "plugin_instance_pool.h"
+#include "vst_renderer.h"
+#include "work_stealing_pool.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+    bool isMidiExtension(const fs::path& path) {
+        std::string extension = path.extension().string();
+        std::transform(extension.begin(), extension.end(), extension.begin(),
+                       [](unsigned char c) { return static_cast<char>(tolower(c)); });
+        return extension == ".mid" || extension == ".midi";
+    }
+
+    bool isMidiFile(const fs::path& path) {
+        std::ifstream file(path, std::ios::binary);
+        char magic[4] = {};
+        return file.read(magic, 4) && std::string(magic, 4) == "MThd";
+    }
+
+    bool isGlobPattern(const std::string& input) {
+        return input.find_first_of("*?[") != std::string::npos;
+    }
+
+    // Makes output paths unique by appending _2, _3, ... to repeated names
+    void disambiguateOutputs(std::vector<BatchJob>& jobs) {
+        std::set<std::string> used;
+        for (BatchJob& job : jobs) {
+            fs::path output(job.outputFile);
+            std::string candidate = job.outputFile;
+            for (int n = 2; used.count(candidate); n++) {
+                candidate = (output.parent_path() / (output.stem().string() + "_" + std::to_string(n) +
+                                                     output.extension().string())).string();
+            }
+            used.insert(candidate);
+            job.outputFile = candidate;
+        }
+    }
+
+    // Everything a worker reuses from job to job
+    struct WorkerContext {
+        MidiProcessor midiProcessor;
+        VstRenderer vstRenderer;
+        MultiRateWriter audioWriter;
+        PeakPyramid peaks;
+        bool pluginLoaded = false;
+    };
+}
+
+bool BatchRenderer::collectJobs(const std::string& input, const std::string& outputDir, const std::string& extension,
+                                std::vector<BatchJob>& jobs) {
+    jobs.clear();
+    fs::path outputRoot(outputDir);
+    std::error_code ec;
+
+    if (fs::is_directory(input, ec)) {
+        // Keep the directory structure so equal names in different folders don't collide
+        for (const fs::directory_entry& entry : fs::recursive_directory_iterator(input, ec)) {
+            if (entry.is_regular_file(ec) && isMidiExtension(entry.path())) {
+                fs::path relative = fs::relative(entry.path(), input, ec);
+                jobs.push_back({entry.path().string(), (outputRoot / relative).replace_extension(extension).string()});
+            }
+        }
+        std::sort(jobs.begin(), jobs.end(), [](const BatchJob& a, const BatchJob& b) { return a.midiFile < b.midiFile; });
+    } else if (isGlobPattern(input)) {
+        glob_t matches;
+        if (glob(input.c_str(), 0, nullptr, &matches) == 0) {
+            for (size_t i = 0; i < matches.gl_pathc; i++) {
+                fs::path path(matches.gl_pathv[i]);
+                if (fs::is_regular_file(path, ec)) {
+                    jobs.push_back({path.string(), (outputRoot / path.stem()).string() + extension});
+                }
+            }
+        }
+        globfree(&matches);
+    } else if (fs::is_regular_file(input, ec) && isMidiFile(input)) {
+        jobs.push_back({input, (outputRoot / fs::path(input).stem()).string() + extension});
+    } else if (fs::is_regular_file(input, ec)) {
+        // Manifest; relative MIDI paths are relative to the manifest itself
+        std::ifstream manifest(input);
+        fs::path baseDir = fs::path(input).parent_path();
+        std::string line;
+        while (std::getline(manifest, line)) {
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+            if (line.empty() || line[0] == '#') {
+                continue;
+            }
+
+            size_t tab = line.find('\t');
+            fs::path midiPath(line.substr(0, tab));
+            if (midiPath.is_relative()) {
+                midiPath = baseDir / midiPath;
+            }
+            std::string outputFile = tab != std::string::npos ? line.substr(tab + 1)
+                                                              : (outputRoot / midiPath.stem()).string() + extension;
+            jobs.push_back({midiPath.string(), outputFile});
+        }
+    } else {
+        LOG_ERROR("Batch input not found: " << input);
+        return false;
+    }
+
+    disambiguateOutputs(jobs);
+
+    if (jobs.empty()) {
+        LOG_ERROR("No MIDI files found in: " << input);
+        return false;
+    }
+    return true;
+}
+
+bool BatchRenderer::run(const std::vector<BatchJob>& jobs, const Options& options, std::vector<BatchResult>& results,
+                        double& wallSeconds) {
+    WorkStealingPool pool(options.numWorkers);
+    int numWorkers = pool.getNumWorkers();
+    // Every job renders once at this rate; the writers convert to the delivery rates
+    float renderRate = options.renderRate > 0 ? options.renderRate : options.sampleRate;
+
+    // One warm instance per worker
+    PluginInstancePool::Config poolConfig;
+    poolConfig.maxInstances = static_cast<size_t>(numWorkers);
+    auto pluginPool = std::make_shared<PluginInstancePool>(poolConfig);
+
+    std::vector<std::unique_ptr<WorkerContext>> contexts;
+    for (int i = 0; i < numWorkers; i++) {
+        contexts.push_back(std::make_unique<WorkerContext>());
+        contexts.back()->vstRenderer.setInstancePool(pluginPool);
+        contexts.back()->vstRenderer.setTail(options.tail);
+        contexts.back()->audioWriter.setDither(options.dither);
+        contexts.back()->audioWriter.setQuality(options.resampleQuality);
+        contexts.back()->audioWriter.setFileFormat(options.fileFormat);
+        contexts.back()->audioWriter.setFlacLevel(options.flacLevel);
+    }
+
+    // Largest files first so the long renders don't end up last; stealing
+    // evens out whatever imbalance is left
+    std::vector<size_t> order(jobs.size());
+    std::vector<uintmax_t> sizes(jobs.size());
+    for (size_t i = 0; i < jobs.size(); i++) {
+        std::error_code ec;
+        order[i] = i;
+        sizes[i] = fs::file_size(jobs[i].midiFile, ec);
+    }
+    std::stable_sort(order.begin(), order.end(), [&sizes](size_t a, size_t b) { return sizes[a] > sizes[b]; });
+
+    results.assign(jobs.size(), BatchResult());
+
+    LOG_INFO("Rendering " << jobs.size() << " files on " << numWorkers << " workers");
+    auto batchStart = std::chrono::steady_clock::now();
+
+    for (size_t index : order) {
+        pool.submit([&, index](int workerIndex) {
+            const BatchJob& job = jobs[index];
+            BatchResult& result = results[index];
+            WorkerContext& context = *contexts[workerIndex];
+            result.midiFile = job.midiFile;
+            result.outputFile = job.outputFile;
+            result.worker = workerIndex;
+
+            auto jobStart = std::chrono::steady_clock::now();
+            try {
+                if (!context.pluginLoaded) {
+                    context.pluginLoaded = context.vstRenderer.loadVst(options.vstPath, renderRate, options.numChannels);
+                }
+
+                std::vector<MultiRateWriter::Output> outputs = {{job.outputFile, options.sampleRate}};
+                for (float rate : options.extraRates) {
+                    outputs.push_back({MultiRateWriter::pathForRate(job.outputFile, rate), rate});
+                }
+
+                std::error_code ec;
+                fs::path outputDir = fs::path(job.outputFile).parent_path();
+                if (!outputDir.empty()) {
+                    fs::create_directories(outputDir, ec);
+                }
+
+                if (!context.pluginLoaded) {
+                    result.error = "Failed to load VST plugin";
+                } else if (!context.midiProcessor.loadMidiFile(job.midiFile)) {
+                    result.error = "Failed to load MIDI file";
+                } else if (!context.audioWriter.open(outputs, renderRate, options.numChannels,
+                                                     options.sampleFormat)) {
+                    result.error = "Failed to write audio file";
+                } else {
+                    MultiRateWriter& writer = context.audioWriter;
+                    PeakPyramid& peaks = context.peaks;
+                    bool writePeaks = options.writePeaks && peaks.begin(options.numChannels, renderRate);
+                    bool rendered = context.vstRenderer.renderMidi(context.midiProcessor.getSequence(),
+                        renderRate, options.numChannels,
+                        [&writer, &peaks, writePeaks](const float* const* channels, int numFrames) {
+                            if (writePeaks) {
+                                peaks.addBlock(channels, static_cast<size_t>(numFrames));
+                            }
+                            return writer.appendBlock(channels, numFrames);
+                        });
+                    bool written = writer.finalize();
+                    if (rendered && written && writePeaks) {
+                        peaks.finish();
+                        written = peaks.writeFile(PeakPyramid::sidecarPath(job.outputFile));
+                    }
+                    result.audioSeconds = writer.getFramesWritten(0) / static_cast<double>(options.sampleRate);
+                    result.ok = rendered && written;
+                    if (!result.ok) {
+                        result.error = rendered ? "Failed to write audio file" : "Failed to render MIDI";
+                    }
+                }
+            } catch (const std::exception& e) {
+                result.error = e.what();
+            }
+            result.renderSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - jobStart).count();
+        });
+    }
+
+    pool.wait();
+    wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - batchStart).count();
+    LOG_INFO("Batch finished; " << pool.getStealCount() << " jobs were stolen between workers");
+
+    return std::all_of(results.begin(), results.end(), [](const BatchResult& r) { return r.ok; });
+}
+
+void BatchRenderer::printSummary(const std::vector<BatchResult>& results, double wallSeconds, std::ostream& out) {
+    size_t succeeded = 0;
+    double totalAudioSeconds = 0.0;
+    double totalRenderSeconds = 0.0;
+
+    out << std::endl << "Per-file results:" << std::endl;
+    out << std::fixed << std::setprecision(3);
+    for (const BatchResult& result : results) {
+        if (result.ok) {
+            succeeded++;
+            totalAudioSeconds += result.audioSeconds;
+            double speed = result.renderSeconds > 0 ? result.audioSeconds / result.renderSeconds : 0.0;
+            out << "  ok    " << result.midiFile << " -> " << result.outputFile
+                << "  audio " << result.audioSeconds << " s, render " << result.renderSeconds << " s, "
+                << std::setprecision(1) << speed << "x realtime" << std::setprecision(3)
+                << " (worker " << result.worker << ")" << std::endl;
+        } else {
+            out << "  FAIL  " << result.midiFile << ": " << result.error << std::endl;
+        }
+        totalRenderSeconds += result.renderSeconds;
+    }
+
+    out << std::endl << "Summary:" << std::endl;
+    out << "  Files: " << succeeded << " rendered, " << results.size() - succeeded << " failed" << std::endl;
+    out << "  Wall time: " << wallSeconds << " s (" << totalRenderSeconds << " s of worker time)" << std::endl;
+    out << "  Audio rendered: " << totalAudioSeconds << " s" << std::endl;
+    if (wallSeconds > 0) {
+        out << std::setprecision(1);
+        out << "  Throughput: " << results.size() / wallSeconds << " files/s, "
+            << totalAudioSeconds / wallSeconds << "x realtime" << std::endl;
+    }
+    out.unsetf(std::ios::floatfield);
+    out << std::setprecision(6);
+}
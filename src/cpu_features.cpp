@@ -0,0 +1,22 @@
+#include "cpu_features.h"
+
+namespace {
+    CpuFeatures detectCpuFeatures() {
+        CpuFeatures features;
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+        __builtin_cpu_init();
+        features.sse41 = __builtin_cpu_supports("sse4.1");
+        features.avx2 = __builtin_cpu_supports("avx2");
+        features.fma = __builtin_cpu_supports("fma");
+#elif defined(__aarch64__) || defined(__ARM_NEON)
+        // NEON is mandatory on AArch64
+        features.neon = true;
+#endif
+        return features;
+    }
+}
+
+const CpuFeatures& CpuFeatures::get() {
+    static const CpuFeatures features = detectCpuFeatures();
+    return features;
+}
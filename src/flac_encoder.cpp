@@ -0,0 +1,1009 @@
+#include "flac_encoder.h"
+#include "cpu_features.h"
+#include "logger.h"
+#include "trace.h"
+#include "work_stealing_pool.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MIDIVERSE_X86_KERNELS 1
+#elif defined(__aarch64__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define MIDIVERSE_NEON_KERNELS 1
+#endif
+
+namespace {
+    constexpr int kMaxFixedOrder = 4;
+    constexpr int kMaxLpcOrder = 32;
+    constexpr int kMaxPartitionOrder = 8;
+    constexpr int kMaxRiceParameter = 30;
+    // Largest parameter of the 4-bit Rice coding method; 15 is the escape code
+    constexpr int kMaxRice4Parameter = 14;
+    constexpr int kMaxShift = 15;
+
+    enum class SubframeType { Constant, Verbatim, Fixed, Lpc };
+
+    struct LevelSettings {
+        int blockSize;
+        bool stereoDecorrelation;
+        int maxLpcOrder;            // 0: fixed predictors only
+        int maxPartitionOrder;
+        bool exhaustiveOrderSearch; // Encode every LPC order instead of estimating the best
+    };
+
+    // Modelled on the reference encoder's presets
+    const LevelSettings kLevels[FlacEncoder::kMaxLevel + 1] = {
+        {1152, false, 0, 3, false},
+        {1152, true, 0, 3, false},
+        {1152, true, 0, 4, false},
+        {4096, false, 6, 4, false},
+        {4096, true, 8, 4, false},
+        {4096, true, 8, 5, false},
+        {4096, true, 8, 6, false},
+        {4096, true, 12, 6, false},
+        {4096, true, 12, 6, true},
+    };
+
+    //===== CRCs =====
+
+    struct CrcTables {
+        uint8_t crc8[256];
+        uint16_t crc16[256];
+
+        CrcTables() {
+            for (int i = 0; i < 256; ++i) {
+                uint8_t c8 = static_cast<uint8_t>(i);
+                uint16_t c16 = static_cast<uint16_t>(i << 8);
+                for (int bit = 0; bit < 8; ++bit) {
+                    c8 = static_cast<uint8_t>((c8 & 0x80) ? (c8 << 1) ^ 0x07 : c8 << 1);
+                    c16 = static_cast<uint16_t>((c16 & 0x8000) ? (c16 << 1) ^ 0x8005 : c16 << 1);
+                }
+                crc8[i] = c8;
+                crc16[i] = c16;
+            }
+        }
+    };
+
+    const CrcTables& getCrcTables() {
+        static const CrcTables tables;
+        return tables;
+    }
+
+    uint8_t crc8(const uint8_t* data, size_t size) {
+        const CrcTables& tables = getCrcTables();
+        uint8_t crc = 0;
+        for (size_t i = 0; i < size; ++i) {
+            crc = tables.crc8[crc ^ data[i]];
+        }
+        return crc;
+    }
+
+    uint16_t crc16(const uint8_t* data, size_t size) {
+        const CrcTables& tables = getCrcTables();
+        uint16_t crc = 0;
+        for (size_t i = 0; i < size; ++i) {
+            crc = static_cast<uint16_t>((crc << 8) ^ tables.crc16[(crc >> 8) ^ data[i]]);
+        }
+        return crc;
+    }
+
+    //===== Bit writer =====
+
+    // MSB-first bit packer appending to a byte vector
+    class BitWriter {
+    public:
+        explicit BitWriter(std::vector<uint8_t>& output) : output(output), accumulator(0), numBits(0) {}
+
+        // Writes the low 'bits' bits of value, bits <= 32
+        void write(uint32_t value, int bits) {
+            if (bits == 0) {
+                return;
+            }
+            accumulator = (accumulator << bits) | (value & (0xFFFFFFFFu >> (32 - bits)));
+            numBits += bits;
+            while (numBits >= 8) {
+                numBits -= 8;
+                output.push_back(static_cast<uint8_t>(accumulator >> numBits));
+            }
+        }
+
+        void writeSigned(int32_t value, int bits) {
+            write(static_cast<uint32_t>(value), bits);
+        }
+
+        // 'zeros' zero bits followed by a one
+        void writeUnary(uint32_t zeros) {
+            while (zeros >= 32) {
+                write(0, 32);
+                zeros -= 32;
+            }
+            write(1, static_cast<int>(zeros) + 1);
+        }
+
+        void writeRice(int32_t value, int parameter) {
+            uint32_t folded = (static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31);
+            writeUnary(folded >> parameter);
+            write(folded, parameter);
+        }
+
+        void alignToByte() {
+            if (numBits > 0) {
+                write(0, 8 - numBits);
+            }
+        }
+
+    private:
+        std::vector<uint8_t>& output;
+        uint64_t accumulator;
+        int numBits;
+    };
+
+    //===== Autocorrelation kernels: r[lag] = sum x[i] * x[i - lag], lag 0..maxLag =====
+
+    using AutocorrelationKernel = void (*)(const float* x, int n, int maxLag, double* r);
+
+    void autocorrelationScalar(const float* x, int n, int maxLag, double* r) {
+        for (int lag = 0; lag <= maxLag; ++lag) {
+            double sum = 0.0;
+            for (int i = lag; i < n; ++i) {
+                sum += static_cast<double>(x[i]) * x[i - lag];
+            }
+            r[lag] = sum;
+        }
+    }
+
+#ifdef MIDIVERSE_X86_KERNELS
+    __attribute__((target("avx2,fma")))
+    void autocorrelationAvx2(const float* x, int n, int maxLag, double* r) {
+        for (int lag = 0; lag <= maxLag; ++lag) {
+            __m256d sum0 = _mm256_setzero_pd();
+            __m256d sum1 = _mm256_setzero_pd();
+            int i = lag;
+            for (; i + 8 <= n; i += 8) {
+                __m256 a = _mm256_loadu_ps(x + i);
+                __m256 b = _mm256_loadu_ps(x + i - lag);
+                sum0 = _mm256_fmadd_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(a)),
+                                       _mm256_cvtps_pd(_mm256_castps256_ps128(b)), sum0);
+                sum1 = _mm256_fmadd_pd(_mm256_cvtps_pd(_mm256_extractf128_ps(a, 1)),
+                                       _mm256_cvtps_pd(_mm256_extractf128_ps(b, 1)), sum1);
+            }
+            __m256d sum = _mm256_add_pd(sum0, sum1);
+            __m128d half = _mm_add_pd(_mm256_castpd256_pd128(sum), _mm256_extractf128_pd(sum, 1));
+            double total = _mm_cvtsd_f64(_mm_add_sd(half, _mm_unpackhi_pd(half, half)));
+            for (; i < n; ++i) {
+                total += static_cast<double>(x[i]) * x[i - lag];
+            }
+            r[lag] = total;
+        }
+    }
+#endif
+
+#ifdef MIDIVERSE_NEON_KERNELS
+#if defined(__aarch64__)
+    void autocorrelationNeon(const float* x, int n, int maxLag, double* r) {
+        for (int lag = 0; lag <= maxLag; ++lag) {
+            float64x2_t sum0 = vdupq_n_f64(0.0);
+            float64x2_t sum1 = vdupq_n_f64(0.0);
+            int i = lag;
+            for (; i + 4 <= n; i += 4) {
+                float32x4_t a = vld1q_f32(x + i);
+                float32x4_t b = vld1q_f32(x + i - lag);
+                sum0 = vfmaq_f64(sum0, vcvt_f64_f32(vget_low_f32(a)), vcvt_f64_f32(vget_low_f32(b)));
+                sum1 = vfmaq_f64(sum1, vcvt_high_f64_f32(a), vcvt_high_f64_f32(b));
+            }
+            double total = vaddvq_f64(vaddq_f64(sum0, sum1));
+            for (; i < n; ++i) {
+                total += static_cast<double>(x[i]) * x[i - lag];
+            }
+            r[lag] = total;
+        }
+    }
+#endif
+#endif
+
+    //===== LPC residual kernels: res[i - order] = x[i] - (sum q[j] * x[i - j - 1]) >> shift =====
+
+    // The 32-bit kernels need bitsPerSample + precision + ceil(log2(order)) <= 32
+    using ResidualKernel = void (*)(const int32_t* x, int n, const int32_t* q, int order, int shift,
+                                    int32_t* residual);
+
+    void residualScalar(const int32_t* x, int n, const int32_t* q, int order, int shift, int32_t* residual) {
+        for (int i = order; i < n; ++i) {
+            int32_t sum = 0;
+            for (int j = 0; j < order; ++j) {
+                sum += q[j] * x[i - j - 1];
+            }
+            residual[i - order] = x[i] - (sum >> shift);
+        }
+    }
+
+#ifdef MIDIVERSE_X86_KERNELS
+    __attribute__((target("avx2")))
+    void residualAvx2(const int32_t* x, int n, const int32_t* q, int order, int shift, int32_t* residual) {
+        const __m128i count = _mm_cvtsi32_si128(shift);
+        int i = order;
+        for (; i + 8 <= n; i += 8) {
+            __m256i sum = _mm256_setzero_si256();
+            for (int j = 0; j < order; ++j) {
+                __m256i samples = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(x + i - j - 1));
+                sum = _mm256_add_epi32(sum, _mm256_mullo_epi32(_mm256_set1_epi32(q[j]), samples));
+            }
+            __m256i current = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(x + i));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(residual + i - order),
+                                _mm256_sub_epi32(current, _mm256_sra_epi32(sum, count)));
+        }
+        residualScalar(x + i - order, n - i + order, q, order, shift, residual + i - order);
+    }
+
+    __attribute__((target("sse4.1")))
+    void residualSse41(const int32_t* x, int n, const int32_t* q, int order, int shift, int32_t* residual) {
+        const __m128i count = _mm_cvtsi32_si128(shift);
+        int i = order;
+        for (; i + 4 <= n; i += 4) {
+            __m128i sum = _mm_setzero_si128();
+            for (int j = 0; j < order; ++j) {
+                __m128i samples = _mm_loadu_si128(reinterpret_cast<const __m128i*>(x + i - j - 1));
+                sum = _mm_add_epi32(sum, _mm_mullo_epi32(_mm_set1_epi32(q[j]), samples));
+            }
+            __m128i current = _mm_loadu_si128(reinterpret_cast<const __m128i*>(x + i));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(residual + i - order),
+                             _mm_sub_epi32(current, _mm_sra_epi32(sum, count)));
+        }
+        residualScalar(x + i - order, n - i + order, q, order, shift, residual + i - order);
+    }
+#endif
+
+#ifdef MIDIVERSE_NEON_KERNELS
+    void residualNeon(const int32_t* x, int n, const int32_t* q, int order, int shift, int32_t* residual) {
+        // A negative left shift is an arithmetic right shift
+        const int32x4_t count = vdupq_n_s32(-shift);
+        int i = order;
+        for (; i + 4 <= n; i += 4) {
+            int32x4_t sum = vdupq_n_s32(0);
+            for (int j = 0; j < order; ++j) {
+                sum = vmlaq_n_s32(sum, vld1q_s32(x + i - j - 1), q[j]);
+            }
+            vst1q_s32(residual + i - order, vsubq_s32(vld1q_s32(x + i), vshlq_s32(sum, count)));
+        }
+        residualScalar(x + i - order, n - i + order, q, order, shift, residual + i - order);
+    }
+#endif
+
+    // For wide samples; returns false if a residual doesn't fit in 32 bits
+    bool residualWide(const int32_t* x, int n, const int32_t* q, int order, int shift, int32_t* residual) {
+        for (int i = order; i < n; ++i) {
+            int64_t sum = 0;
+            for (int j = 0; j < order; ++j) {
+                sum += static_cast<int64_t>(q[j]) * x[i - j - 1];
+            }
+            int64_t value = x[i] - (sum >> shift);
+            if (value < INT32_MIN || value > INT32_MAX) {
+                return false;
+            }
+            residual[i - order] = static_cast<int32_t>(value);
+        }
+        return true;
+    }
+
+    struct KernelChoice {
+        AutocorrelationKernel autocorrelation;
+        ResidualKernel residual;
+        const char* name;
+    };
+
+    KernelChoice chooseKernels() {
+        const CpuFeatures& cpu = CpuFeatures::get();
+        (void)cpu;
+#ifdef MIDIVERSE_X86_KERNELS
+        if (cpu.avx2 && cpu.fma) return {autocorrelationAvx2, residualAvx2, "avx2"};
+        if (cpu.sse41) return {autocorrelationScalar, residualSse41, "sse4.1"};
+#endif
+#ifdef MIDIVERSE_NEON_KERNELS
+#if defined(__aarch64__)
+        if (cpu.neon) return {autocorrelationNeon, residualNeon, "neon"};
+#else
+        if (cpu.neon) return {autocorrelationScalar, residualNeon, "neon"};
+#endif
+#endif
+        return {autocorrelationScalar, residualScalar, "scalar"};
+    }
+
+    const KernelChoice& getKernels() {
+        static const KernelChoice kernels = chooseKernels();
+        return kernels;
+    }
+
+    int ceilLog2(int value) {
+        int bits = 0;
+        while ((1 << bits) < value) {
+            ++bits;
+        }
+        return bits;
+    }
+
+    // Precision of quantized LPC coefficients, after the reference encoder
+    int basePrecision(int blockSize) {
+        if (blockSize <= 192) return 7;
+        if (blockSize <= 384) return 8;
+        if (blockSize <= 576) return 9;
+        if (blockSize <= 1152) return 10;
+        if (blockSize <= 2304) return 11;
+        if (blockSize <= 4608) return 12;
+        return 13;
+    }
+}
+
+//===== Subframe analysis =====
+
+struct FlacEncoder::Scratch {
+    // Rice coding of one residual
+    struct Rice {
+        int method = 0;
+        int partitionOrder = 0;
+        uint8_t parameters[1 << kMaxPartitionOrder] = {};
+    };
+
+    // The chosen encoding of one channel of a frame
+    struct Subframe {
+        SubframeType type = SubframeType::Verbatim;
+        int order = 0;
+        int precision = 0;
+        int shift = 0;
+        int32_t coefficients[kMaxLpcOrder] = {};
+        Rice rice;
+        uint64_t bits = 0;
+        std::vector<int32_t> residual;
+    };
+
+    // Mid and side signals for stereo frames
+    std::vector<int32_t> mid;
+    std::vector<int32_t> side;
+    std::vector<int32_t> residual;
+    std::vector<float> windowed;
+    std::vector<float> window;
+    std::vector<uint64_t> partitionSums;
+    Rice rice;
+    // Left, right, mid, side (or just one per channel without stereo decorrelation)
+    Subframe subframes[4];
+};
+
+namespace {
+    using Scratch = FlacEncoder::Scratch;
+
+    // Tukey(0.5) window, as the reference encoder uses by default
+    void makeWindow(std::vector<float>& window, int n) {
+        window.resize(n);
+        int taper = n / 4;
+        for (int i = 0; i < n; ++i) {
+            double w = 1.0;
+            if (i < taper) {
+                w = 0.5 - 0.5 * std::cos(M_PI * i / taper);
+            } else if (i >= n - taper) {
+                w = 0.5 - 0.5 * std::cos(M_PI * (n - 1 - i) / taper);
+            }
+            window[i] = static_cast<float>(w);
+        }
+    }
+
+    // Bits for a partition of 'count' folded values summing to 'sum', with the best parameter
+    uint64_t ricePartitionBits(uint64_t sum, uint64_t count, int& parameter) {
+        int k = 0;
+        while (k < kMaxRiceParameter && (count << (k + 1)) <= sum) {
+            ++k;
+        }
+        uint64_t best = count * (k + 1) + (sum >> k);
+        parameter = k;
+        if (k < kMaxRiceParameter) {
+            uint64_t next = count * (k + 2) + (sum >> (k + 1));
+            if (next < best) {
+                best = next;
+                parameter = k + 1;
+            }
+        }
+        return best;
+    }
+
+    // Picks the partition order and parameters for a residual of n - predictorOrder
+    // samples; returns the estimated size in bits
+    uint64_t chooseRice(const int32_t* residual, int n, int predictorOrder, int maxPartitionOrder,
+                        std::vector<uint64_t>& sums, Scratch::Rice& rice) {
+        int maxOrder = 0;
+        while (maxOrder < std::min(maxPartitionOrder, kMaxPartitionOrder) && n % (2 << maxOrder) == 0 && (n >> (maxOrder + 1)) > predictorOrder) {
+            ++maxOrder;
+        }
+
+        // Sums of folded residuals at the finest partitioning, merged pairwise for coarser ones
+        int numPartitions = 1 << maxOrder;
+        int partitionSize = n >> maxOrder;
+        sums.assign(numPartitions, 0);
+        int index = 0;
+        for (int p = 0; p < numPartitions; ++p) {
+            int end = (p + 1) * partitionSize - predictorOrder;
+            uint64_t sum = 0;
+            for (; index < end; ++index) {
+                int32_t value = residual[index];
+                sum += (static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31);
+            }
+            sums[p] = sum;
+        }
+
+        uint64_t bestBits = UINT64_MAX;
+        for (int order = maxOrder; order >= 0; --order) {
+            int partitions = 1 << order;
+            int size = n >> order;
+            uint64_t bits = 2 + 4;
+            uint8_t parameters[1 << kMaxPartitionOrder];
+            int largest = 0;
+            for (int p = 0; p < partitions; ++p) {
+                uint64_t count = static_cast<uint64_t>(p == 0 ? size - predictorOrder : size);
+                int parameter;
+                bits += ricePartitionBits(sums[p], count, parameter);
+                parameters[p] = static_cast<uint8_t>(parameter);
+                largest = std::max(largest, parameter);
+            }
+            int method = largest > kMaxRice4Parameter ? 1 : 0;
+            bits += static_cast<uint64_t>(partitions) * (method ? 5 : 4);
+
+            if (bits < bestBits) {
+                bestBits = bits;
+                rice.method = method;
+                rice.partitionOrder = order;
+                std::copy(parameters, parameters + partitions, rice.parameters);
+            }
+
+            for (int p = 0; p < partitions / 2; ++p) {
+                sums[p] = sums[2 * p] + sums[2 * p + 1];
+            }
+        }
+        return bestBits;
+    }
+
+    void computeFixedResidual(const int32_t* x, int n, int order, int32_t* residual) {
+        for (int i = order; i < n; ++i) {
+            int64_t value;
+            switch (order) {
+                case 0: value = x[i]; break;
+                case 1: value = static_cast<int64_t>(x[i]) - x[i - 1]; break;
+                case 2: value = static_cast<int64_t>(x[i]) - 2 * static_cast<int64_t>(x[i - 1]) + x[i - 2]; break;
+                case 3: value = static_cast<int64_t>(x[i]) - 3 * static_cast<int64_t>(x[i - 1]) +
+                                3 * static_cast<int64_t>(x[i - 2]) - x[i - 3]; break;
+                default: value = static_cast<int64_t>(x[i]) - 4 * static_cast<int64_t>(x[i - 1]) +
+                                 6 * static_cast<int64_t>(x[i - 2]) - 4 * static_cast<int64_t>(x[i - 3]) + x[i - 4]; break;
+            }
+            residual[i - order] = static_cast<int32_t>(value);
+        }
+    }
+
+    // The fixed predictor order with the smallest total absolute residual
+    int chooseFixedOrder(const int32_t* x, int n, int maxOrder) {
+        uint64_t totals[kMaxFixedOrder + 1] = {};
+        for (int i = maxOrder; i < n; ++i) {
+            int64_t e0 = x[i];
+            int64_t e1 = e0 - x[i - 1 < 0 ? 0 : i - 1];
+            totals[0] += static_cast<uint64_t>(std::llabs(e0));
+            if (maxOrder >= 1) totals[1] += static_cast<uint64_t>(std::llabs(e1));
+            if (maxOrder >= 2) {
+                int64_t e2 = e1 - (static_cast<int64_t>(x[i - 1]) - x[i - 2]);
+                totals[2] += static_cast<uint64_t>(std::llabs(e2));
+                if (maxOrder >= 3) {
+                    int64_t e3 = e2 - (static_cast<int64_t>(x[i - 1]) - 2 * static_cast<int64_t>(x[i - 2]) + x[i - 3]);
+                    totals[3] += static_cast<uint64_t>(std::llabs(e3));
+                    if (maxOrder >= 4) {
+                        int64_t e4 = e3 - (static_cast<int64_t>(x[i - 1]) - 3 * static_cast<int64_t>(x[i - 2]) +
+                                           3 * static_cast<int64_t>(x[i - 3]) - x[i - 4]);
+                        totals[4] += static_cast<uint64_t>(std::llabs(e4));
+                    }
+                }
+            }
+        }
+        int best = 0;
+        for (int order = 1; order <= maxOrder; ++order) {
+            if (totals[order] < totals[best]) {
+                best = order;
+            }
+        }
+        return best;
+    }
+
+    // Levinson-Durbin recursion: lpc[m - 1] holds the order-m predictor, error[m - 1] its error
+    void computeLpc(const double* r, int maxOrder, double lpc[][kMaxLpcOrder], double* error) {
+        double a[kMaxLpcOrder] = {};
+        double e = r[0];
+        for (int m = 0; m < maxOrder; ++m) {
+            double acc = r[m + 1];
+            for (int j = 0; j < m; ++j) {
+                acc -= a[j] * r[m - j];
+            }
+            double k = e > 0.0 ? acc / e : 0.0;
+            double previous[kMaxLpcOrder];
+            std::copy(a, a + m, previous);
+            a[m] = k;
+            for (int j = 0; j < m; ++j) {
+                a[j] = previous[j] - k * previous[m - 1 - j];
+            }
+            e *= 1.0 - k * k;
+            std::copy(a, a + m + 1, lpc[m]);
+            error[m] = std::max(e, 0.0);
+        }
+    }
+
+    // Quantizes coefficients to 'precision' bits with error feedback; false if they don't fit
+    bool quantizeLpc(const double* lpc, int order, int precision, int32_t* q, int& shift) {
+        double largest = 0.0;
+        for (int i = 0; i < order; ++i) {
+            largest = std::max(largest, std::fabs(lpc[i]));
+        }
+        if (largest <= 0.0) {
+            return false;
+        }
+        int exponent;
+        std::frexp(largest, &exponent);
+        shift = std::min(precision - 1 - exponent, kMaxShift);
+        if (shift < 0) {
+            return false;
+        }
+
+        const int32_t qMax = (1 << (precision - 1)) - 1;
+        const int32_t qMin = -(1 << (precision - 1));
+        double error = 0.0;
+        for (int i = 0; i < order; ++i) {
+            error += lpc[i] * (1 << shift);
+            int32_t value = static_cast<int32_t>(std::lround(error));
+            value = std::max(qMin, std::min(qMax, value));
+            error -= value;
+            q[i] = value;
+        }
+        return true;
+    }
+
+    void keepIfSmaller(Scratch::Subframe& subframe, Scratch& scratch, SubframeType type, int order, uint64_t bits) {
+        if (bits < subframe.bits) {
+            subframe.type = type;
+            subframe.order = order;
+            subframe.bits = bits;
+            subframe.rice = scratch.rice;
+            subframe.residual.swap(scratch.residual);
+        }
+    }
+
+    // Finds the smallest encoding of one channel of a frame
+    void analyzeSubframe(const int32_t* x, int n, int bitsPerSample, const LevelSettings& settings,
+                         Scratch& scratch, Scratch::Subframe& subframe) {
+        subframe.residual.resize(n);
+        scratch.residual.resize(n);
+
+        if (std::all_of(x + 1, x + n, [x](int32_t value) { return value == x[0]; })) {
+            subframe.type = SubframeType::Constant;
+            subframe.bits = 8 + bitsPerSample;
+            return;
+        }
+
+        subframe.type = SubframeType::Verbatim;
+        subframe.bits = 8 + static_cast<uint64_t>(n) * bitsPerSample;
+
+        // Fixed polynomial predictors
+        int fixedOrder = chooseFixedOrder(x, n, std::min(kMaxFixedOrder, n - 1));
+        computeFixedResidual(x, n, fixedOrder, scratch.residual.data());
+        uint64_t bits = 8 + static_cast<uint64_t>(fixedOrder) * bitsPerSample +
+                        chooseRice(scratch.residual.data(), n, fixedOrder, settings.maxPartitionOrder,
+                                   scratch.partitionSums, scratch.rice);
+        keepIfSmaller(subframe, scratch, SubframeType::Fixed, fixedOrder, bits);
+
+        int maxLpcOrder = std::min(settings.maxLpcOrder, n - 1);
+        if (maxLpcOrder <= 0) {
+            return;
+        }
+
+        // Linear prediction from the autocorrelation of the windowed signal
+        const KernelChoice& kernels = getKernels();
+        if (static_cast<int>(scratch.window.size()) != n) {
+            makeWindow(scratch.window, n);
+        }
+        scratch.windowed.resize(n);
+        for (int i = 0; i < n; ++i) {
+            scratch.windowed[i] = static_cast<float>(x[i]) * scratch.window[i];
+        }
+        double r[kMaxLpcOrder + 1];
+        kernels.autocorrelation(scratch.windowed.data(), n, maxLpcOrder, r);
+        if (r[0] <= 0.0) {
+            return;
+        }
+        double lpc[kMaxLpcOrder][kMaxLpcOrder];
+        double error[kMaxLpcOrder];
+        computeLpc(r, maxLpcOrder, lpc, error);
+
+        // Unless searching exhaustively, try only the order with the smallest estimated size
+        int firstOrder = 1;
+        int lastOrder = maxLpcOrder;
+        if (!settings.exhaustiveOrderSearch) {
+            double bestEstimate = 0.0;
+            int bestOrder = 1;
+            for (int order = 1; order <= maxLpcOrder; ++order) {
+                double bitsPerResidual = error[order - 1] > 0.0
+                    ? std::max(0.0, 0.5 * std::log2(0.5 * error[order - 1] / n)) : 0.0;
+                double estimate = bitsPerResidual * (n - order) +
+                                  order * (bitsPerSample + basePrecision(n));
+                if (order == 1 || estimate < bestEstimate) {
+                    bestEstimate = estimate;
+                    bestOrder = order;
+                }
+            }
+            firstOrder = lastOrder = bestOrder;
+        }
+
+        for (int order = firstOrder; order <= lastOrder; ++order) {
+            // Give up a bit of precision if it keeps the sums within 32 bits for the SIMD
+            // kernels; wider samples (24-bit) take the 64-bit path at full precision
+            int precision = basePrecision(n);
+            int narrowPrecision = 32 - bitsPerSample - ceilLog2(order);
+            bool narrow = narrowPrecision >= precision - 1;
+            if (narrow) {
+                precision = std::min(precision, narrowPrecision);
+            }
+
+            int32_t q[kMaxLpcOrder];
+            int shift;
+            if (!quantizeLpc(lpc[order - 1], order, precision, q, shift)) {
+                continue;
+            }
+            if (narrow) {
+                kernels.residual(x, n, q, order, shift, scratch.residual.data());
+            } else if (!residualWide(x, n, q, order, shift, scratch.residual.data())) {
+                continue;
+            }
+
+            bits = 8 + static_cast<uint64_t>(order) * bitsPerSample + 4 + 5 +
+                   static_cast<uint64_t>(order) * precision +
+                   chooseRice(scratch.residual.data(), n, order, settings.maxPartitionOrder,
+                              scratch.partitionSums, scratch.rice);
+            if (bits < subframe.bits) {
+                keepIfSmaller(subframe, scratch, SubframeType::Lpc, order, bits);
+                subframe.precision = precision;
+                subframe.shift = shift;
+                std::copy(q, q + order, subframe.coefficients);
+            }
+        }
+    }
+
+    void writeResidual(BitWriter& writer, const Scratch::Subframe& subframe, int n) {
+        const Scratch::Rice& rice = subframe.rice;
+        writer.write(static_cast<uint32_t>(rice.method), 2);
+        writer.write(static_cast<uint32_t>(rice.partitionOrder), 4);
+        int partitions = 1 << rice.partitionOrder;
+        int size = n >> rice.partitionOrder;
+        const int32_t* residual = subframe.residual.data();
+        for (int p = 0; p < partitions; ++p) {
+            int parameter = rice.parameters[p];
+            writer.write(static_cast<uint32_t>(parameter), rice.method ? 5 : 4);
+            int count = p == 0 ? size - subframe.order : size;
+            for (int i = 0; i < count; ++i) {
+                writer.writeRice(*residual++, parameter);
+            }
+        }
+    }
+
+    void writeSubframe(BitWriter& writer, const int32_t* x, int n, int bitsPerSample,
+                       const Scratch::Subframe& subframe) {
+        switch (subframe.type) {
+            case SubframeType::Constant:
+                writer.write(0x00, 8);
+                writer.writeSigned(x[0], bitsPerSample);
+                break;
+            case SubframeType::Verbatim:
+                writer.write(0x02, 8);
+                for (int i = 0; i < n; ++i) {
+                    writer.writeSigned(x[i], bitsPerSample);
+                }
+                break;
+            case SubframeType::Fixed:
+                writer.write(static_cast<uint32_t>((0x08 | subframe.order) << 1), 8);
+                for (int i = 0; i < subframe.order; ++i) {
+                    writer.writeSigned(x[i], bitsPerSample);
+                }
+                writeResidual(writer, subframe, n);
+                break;
+            case SubframeType::Lpc:
+                writer.write(static_cast<uint32_t>((0x20 | (subframe.order - 1)) << 1), 8);
+                for (int i = 0; i < subframe.order; ++i) {
+                    writer.writeSigned(x[i], bitsPerSample);
+                }
+                writer.write(static_cast<uint32_t>(subframe.precision - 1), 4);
+                writer.writeSigned(subframe.shift, 5);
+                for (int i = 0; i < subframe.order; ++i) {
+                    writer.writeSigned(subframe.coefficients[i], subframe.precision);
+                }
+                writeResidual(writer, subframe, n);
+                break;
+        }
+    }
+
+    // Frame numbers are coded like UTF-8, up to 31 bits
+    void writeFrameNumber(BitWriter& writer, uint32_t value) {
+        if (value < 0x80) {
+            writer.write(value, 8);
+            return;
+        }
+        int continuation = value < 0x800 ? 1 : value < 0x10000 ? 2 : value < 0x200000 ? 3 : value < 0x4000000 ? 4 : 5;
+        uint32_t lead = (0xFF00u >> (continuation + 1)) & 0xFF;
+        writer.write(lead | (value >> (6 * continuation)), 8);
+        for (int i = continuation - 1; i >= 0; --i) {
+            writer.write(0x80 | ((value >> (6 * i)) & 0x3F), 8);
+        }
+    }
+
+    uint32_t sampleSizeCode(int bitsPerSample) {
+        switch (bitsPerSample) {
+            case 8: return 1;
+            case 12: return 2;
+            case 16: return 4;
+            case 20: return 5;
+            case 24: return 6;
+            default: return 0;
+        }
+    }
+
+    void encodeFrame(const int32_t* const* channels, int numChannels, int n, int bitsPerSample, uint64_t frameNumber,
+                     const LevelSettings& settings, Scratch& scratch, std::vector<uint8_t>& output) {
+        output.clear();
+        BitWriter writer(output);
+
+        // Stereo: encode left, right, mid and side, then keep the cheapest pair
+        uint32_t channelAssignment = static_cast<uint32_t>(numChannels - 1);
+        const int32_t* signals[FlacEncoder::kMaxChannels];
+        int signalBits[FlacEncoder::kMaxChannels];
+        Scratch::Subframe* chosen[FlacEncoder::kMaxChannels];
+        if (numChannels == 2 && settings.stereoDecorrelation) {
+            scratch.mid.resize(n);
+            scratch.side.resize(n);
+            for (int i = 0; i < n; ++i) {
+                int64_t left = channels[0][i];
+                int64_t right = channels[1][i];
+                scratch.mid[i] = static_cast<int32_t>((left + right) >> 1);
+                scratch.side[i] = static_cast<int32_t>(left - right);
+            }
+            analyzeSubframe(channels[0], n, bitsPerSample, settings, scratch, scratch.subframes[0]);
+            analyzeSubframe(channels[1], n, bitsPerSample, settings, scratch, scratch.subframes[1]);
+            analyzeSubframe(scratch.mid.data(), n, bitsPerSample, settings, scratch, scratch.subframes[2]);
+            analyzeSubframe(scratch.side.data(), n, bitsPerSample + 1, settings, scratch, scratch.subframes[3]);
+
+            uint64_t left = scratch.subframes[0].bits;
+            uint64_t right = scratch.subframes[1].bits;
+            uint64_t mid = scratch.subframes[2].bits;
+            uint64_t side = scratch.subframes[3].bits;
+            // Independent, left/side, side/right, mid/side
+            const uint64_t costs[4] = {left + right, left + side, side + right, mid + side};
+            int best = static_cast<int>(std::min_element(costs, costs + 4) - costs);
+            const int pairs[4][2] = {{0, 1}, {0, 3}, {3, 1}, {2, 3}};
+            const int32_t* sources[4] = {channels[0], channels[1], scratch.mid.data(), scratch.side.data()};
+            for (int c = 0; c < 2; ++c) {
+                int index = pairs[best][c];
+                signals[c] = sources[index];
+                signalBits[c] = bitsPerSample + (index == 3 ? 1 : 0);
+                chosen[c] = &scratch.subframes[index];
+            }
+            channelAssignment = best == 0 ? 1 : 7 + static_cast<uint32_t>(best);
+        } else {
+            for (int c = 0; c < numChannels; ++c) {
+                // Subframe slots are reused per channel; analysis happens just before writing
+                signals[c] = channels[c];
+                signalBits[c] = bitsPerSample;
+                chosen[c] = nullptr;
+            }
+        }
+
+        // Frame header
+        uint32_t blockSizeCode;
+        switch (n) {
+            case 1152: blockSizeCode = 3; break;
+            case 4096: blockSizeCode = 12; break;
+            default: blockSizeCode = n <= 256 ? 6 : 7; break;
+        }
+        writer.write(0x3FFE, 14);                   // Sync code
+        writer.write(0, 1);                         // Reserved
+        writer.write(0, 1);                         // Fixed block size
+        writer.write(blockSizeCode, 4);
+        writer.write(0, 4);                         // Sample rate from STREAMINFO
+        writer.write(channelAssignment, 4);
+        writer.write(sampleSizeCode(bitsPerSample), 3);
+        writer.write(0, 1);                         // Reserved
+        writeFrameNumber(writer, static_cast<uint32_t>(frameNumber));
+        if (blockSizeCode == 6) {
+            writer.write(static_cast<uint32_t>(n - 1), 8);
+        } else if (blockSizeCode == 7) {
+            writer.write(static_cast<uint32_t>(n - 1), 16);
+        }
+        writer.write(crc8(output.data(), output.size()), 8);
+
+        for (int c = 0; c < numChannels; ++c) {
+            Scratch::Subframe* subframe = chosen[c];
+            if (!subframe) {
+                subframe = &scratch.subframes[0];
+                analyzeSubframe(signals[c], n, signalBits[c], settings, scratch, *subframe);
+            }
+            writeSubframe(writer, signals[c], n, signalBits[c], *subframe);
+        }
+
+        writer.alignToByte();
+        uint16_t crc = crc16(output.data(), output.size());
+        writer.write(crc, 16);
+    }
+}
+
+FlacEncoder::FlacEncoder()
+    : sampleRate(0), numChannels(0), bitsPerSample(0), level(kDefaultLevel), blockSize(0), framesPerBatch(1),
+      pendingFrames(0), frameNumber(0), totalSamples(0), minFrameBytes(0), maxFrameBytes(0) {
+}
+
+FlacEncoder::~FlacEncoder() = default;
+
+bool FlacEncoder::begin(uint32_t sampleRate, int numChannels, int bitsPerSample, int level, int numThreads) {
+    if (numChannels < 1 || numChannels > FlacEncoder::kMaxChannels) {
+        LOG_ERROR("FLAC supports 1 to " << FlacEncoder::kMaxChannels << " channels, not " << numChannels);
+        return false;
+    }
+    if (bitsPerSample != 16 && bitsPerSample != 24) {
+        LOG_ERROR("FLAC output supports 16 and 24-bit samples, not " << bitsPerSample);
+        return false;
+    }
+    if (sampleRate == 0 || sampleRate > 0xFFFFF) {
+        LOG_ERROR("Unsupported FLAC sample rate: " << sampleRate);
+        return false;
+    }
+
+    this->sampleRate = sampleRate;
+    this->numChannels = numChannels;
+    this->bitsPerSample = bitsPerSample;
+    this->level = std::max(kMinLevel, std::min(kMaxLevel, level));
+    blockSize = kLevels[this->level].blockSize;
+    pendingFrames = 0;
+    frameNumber = 0;
+    totalSamples = 0;
+    minFrameBytes = 0;
+    maxFrameBytes = 0;
+
+    // A few frames per thread per batch keeps every thread busy
+    numThreads = std::max(numThreads, 1);
+    if (numThreads > 1) {
+        if (!pool || pool->getNumWorkers() != numThreads) {
+            pool = std::make_unique<WorkStealingPool>(numThreads);
+        }
+    } else {
+        pool.reset();
+    }
+    framesPerBatch = numThreads > 1 ? numThreads * 4 : 1;
+    while (static_cast<int>(scratch.size()) < numThreads) {
+        scratch.push_back(std::make_unique<Scratch>());
+    }
+
+    pending.resize(numChannels);
+    for (std::vector<int32_t>& channel : pending) {
+        channel.resize(static_cast<size_t>(framesPerBatch) * blockSize);
+    }
+    frameOutputs.resize(framesPerBatch);
+    return true;
+}
+
+void FlacEncoder::writeHeader(uint8_t* output) const {
+    std::memcpy(output, "fLaC", 4);
+    // Last metadata block, type 0 (STREAMINFO)
+    output[4] = 0x80;
+    output[5] = 0;
+    output[6] = 0;
+    output[7] = static_cast<uint8_t>(kStreamInfoSize);
+    writeStreamInfo(output + kStreamInfoOffset);
+}
+
+void FlacEncoder::writeStreamInfo(uint8_t* output) const {
+    std::vector<uint8_t> bytes;
+    BitWriter writer(bytes);
+    writer.write(static_cast<uint32_t>(blockSize), 16);
+    writer.write(static_cast<uint32_t>(blockSize), 16);
+    writer.write(minFrameBytes, 24);
+    writer.write(maxFrameBytes, 24);
+    writer.write(sampleRate, 20);
+    writer.write(static_cast<uint32_t>(numChannels - 1), 3);
+    writer.write(static_cast<uint32_t>(bitsPerSample - 1), 5);
+    writer.write(static_cast<uint32_t>(totalSamples >> 32), 4);
+    writer.write(static_cast<uint32_t>(totalSamples), 32);
+    // An all-zero MD5 signature means it wasn't computed
+    for (int i = 0; i < 4; ++i) {
+        writer.write(0, 32);
+    }
+    std::memcpy(output, bytes.data(), kStreamInfoSize);
+}
+
+void FlacEncoder::addPcm(const uint8_t* pcm, size_t numFrames, std::vector<uint8_t>& output) {
+    const size_t capacity = static_cast<size_t>(framesPerBatch) * blockSize;
+    const int bytesPerSample = bitsPerSample / 8;
+    while (numFrames > 0) {
+        size_t count = std::min(numFrames, capacity - pendingFrames);
+        for (size_t frame = 0; frame < count; ++frame) {
+            for (int channel = 0; channel < numChannels; ++channel) {
+                int32_t value;
+                if (bytesPerSample == 2) {
+                    value = static_cast<int16_t>(pcm[0] | (pcm[1] << 8));
+                } else {
+                    // Sign-extend the packed 24-bit sample
+                    value = static_cast<int32_t>(static_cast<uint32_t>(pcm[0] << 8 | pcm[1] << 16 | pcm[2] << 24)) >> 8;
+                }
+                pending[channel][pendingFrames + frame] = value;
+                pcm += bytesPerSample;
+            }
+        }
+        pendingFrames += count;
+        numFrames -= count;
+        if (pendingFrames == capacity) {
+            encodePending(false, output);
+        }
+    }
+}
+
+void FlacEncoder::finish(std::vector<uint8_t>& output) {
+    encodePending(true, output);
+}
+
+void FlacEncoder::encodePending(bool final, std::vector<uint8_t>& output) {
+    size_t numFrames = pendingFrames / blockSize;
+    if (final && pendingFrames % blockSize != 0) {
+        ++numFrames;
+    }
+    if (numFrames == 0) {
+        return;
+    }
+
+    const LevelSettings& settings = kLevels[level];
+    auto encode = [this, &settings](size_t frame, int worker) {
+        TRACE_SCOPE("flac frame");
+        size_t start = frame * blockSize;
+        int n = static_cast<int>(std::min<size_t>(blockSize, pendingFrames - start));
+        const int32_t* channels[FlacEncoder::kMaxChannels];
+        for (int channel = 0; channel < numChannels; ++channel) {
+            channels[channel] = pending[channel].data() + start;
+        }
+        encodeFrame(channels, numChannels, n, bitsPerSample, frameNumber + frame, settings, *scratch[worker],
+                    frameOutputs[frame]);
+    };
+
+    if (pool) {
+        for (size_t frame = 0; frame < numFrames; ++frame) {
+            pool->submit([&encode, frame](int worker) { encode(frame, worker); });
+        }
+        pool->wait();
+    } else {
+        for (size_t frame = 0; frame < numFrames; ++frame) {
+            encode(frame, 0);
+        }
+    }
+
+    // Frames go out in order, whichever thread finished first
+    for (size_t frame = 0; frame < numFrames; ++frame) {
+        const std::vector<uint8_t>& bytes = frameOutputs[frame];
+        output.insert(output.end(), bytes.begin(), bytes.end());
+        uint32_t size = static_cast<uint32_t>(bytes.size());
+        minFrameBytes = minFrameBytes == 0 ? size : std::min(minFrameBytes, size);
+        maxFrameBytes = std::max(maxFrameBytes, size);
+    }
+
+    size_t consumed = std::min(pendingFrames, numFrames * blockSize);
+    frameNumber += numFrames;
+    totalSamples += consumed;
+    for (std::vector<int32_t>& channel : pending) {
+        std::copy(channel.begin() + consumed, channel.begin() + pendingFrames, channel.begin());
+    }
+    pendingFrames -= consumed;
+}
+
+uint64_t FlacEncoder::getTotalSamples() const {
+    return totalSamples;
+}
+
+int FlacEncoder::getBlockSize() const {
+    return blockSize;
+}
+
+const char* FlacEncoder::getKernelName() {
+    return getKernels().name;
+}
@@ -0,0 +1,149 @@
+#include "http_util.h"
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace http_util {
+
+namespace {
+    std::string trim(const std::string& text) {
+        size_t begin = text.find_first_not_of(" \t");
+        if (begin == std::string::npos) {
+            return std::string();
+        }
+        size_t end = text.find_last_not_of(" \t");
+        return text.substr(begin, end - begin + 1);
+    }
+
+    bool parseUnsigned(const std::string& text, uint64_t& value) {
+        if (text.empty() || text.size() > 19) {
+            return false;
+        }
+        value = 0;
+        for (char c : text) {
+            if (!isdigit(static_cast<unsigned char>(c))) {
+                return false;
+            }
+            value = value * 10 + static_cast<uint64_t>(c - '0');
+        }
+        return true;
+    }
+}
+
+RangeResult parseRange(const std::string& header, uint64_t fileSize, ByteRange& range) {
+    std::string value = trim(header);
+    if (value.compare(0, 6, "bytes=") != 0) {
+        return RangeResult::None;
+    }
+
+    std::string spec = trim(value.substr(6));
+    if (spec.find(',') != std::string::npos) {
+        return RangeResult::None;
+    }
+
+    size_t dash = spec.find('-');
+    if (dash == std::string::npos) {
+        return RangeResult::None;
+    }
+
+    std::string firstText = trim(spec.substr(0, dash));
+    std::string lastText = trim(spec.substr(dash + 1));
+    uint64_t first = 0;
+    uint64_t last = 0;
+
+    if (firstText.empty()) {
+        // Suffix range: the last N bytes
+        uint64_t suffixLength = 0;
+        if (!parseUnsigned(lastText, suffixLength)) {
+            return RangeResult::None;
+        }
+        if (suffixLength == 0 || fileSize == 0) {
+            return RangeResult::Unsatisfiable;
+        }
+        range.first = suffixLength >= fileSize ? 0 : fileSize - suffixLength;
+        range.last = fileSize - 1;
+        return RangeResult::Satisfiable;
+    }
+
+    if (!parseUnsigned(firstText, first)) {
+        return RangeResult::None;
+    }
+    if (lastText.empty()) {
+        last = fileSize > 0 ? fileSize - 1 : 0;
+    } else if (!parseUnsigned(lastText, last) || last < first) {
+        return RangeResult::None;
+    }
+
+    if (first >= fileSize) {
+        return RangeResult::Unsatisfiable;
+    }
+
+    range.first = first;
+    range.last = last < fileSize ? last : fileSize - 1;
+    return RangeResult::Satisfiable;
+}
+
+std::string formatHttpDate(time_t time) {
+    struct tm utc;
+    gmtime_r(&time, &utc);
+    char buffer[64];
+    strftime(buffer, sizeof(buffer), "%a, %d %b %Y %H:%M:%S GMT", &utc);
+    return buffer;
+}
+
+bool parseHttpDate(const std::string& text, time_t& time) {
+    struct tm utc;
+    memset(&utc, 0, sizeof(utc));
+    const char* end = strptime(text.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &utc);
+    if (end == nullptr) {
+        return false;
+    }
+    time = timegm(&utc);
+    return true;
+}
+
+std::string makeEtag(uint64_t size, int64_t modifiedNanoseconds) {
+    char buffer[48];
+    snprintf(buffer, sizeof(buffer), "\"%llx-%llx\"",
+             static_cast<unsigned long long>(size), static_cast<unsigned long long>(modifiedNanoseconds));
+    return buffer;
+}
+
+bool etagMatches(const std::string& ifNoneMatch, const std::string& etag) {
+    // Comma-separated list; weak comparison, so W/ prefixes are ignored
+    size_t start = 0;
+    while (start <= ifNoneMatch.size()) {
+        size_t comma = ifNoneMatch.find(',', start);
+        std::string candidate = trim(ifNoneMatch.substr(start, comma == std::string::npos ? std::string::npos : comma - start));
+        if (candidate == "*") {
+            return true;
+        }
+        if (candidate.compare(0, 2, "W/") == 0) {
+            candidate = candidate.substr(2);
+        }
+        if (candidate == etag) {
+            return true;
+        }
+        if (comma == std::string::npos) {
+            break;
+        }
+        start = comma + 1;
+    }
+    return false;
+}
+
+std::string contentTypeFor(const std::string& path) {
+    size_t dot = path.find_last_of('.');
+    std::string extension = dot == std::string::npos ? std::string() : path.substr(dot + 1);
+    for (char& c : extension) {
+        c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+    }
+
+    if (extension == "wav") return "audio/wav";
+    if (extension == "flac") return "audio/flac";
+    if (extension == "json") return "application/json";
+    return "application/octet-stream";
+}
+
+}  // namespace http_util
@@ -0,0 +1,432 @@
+#include "logger.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+    // How often the background thread looks for records when nobody flushes
+    constexpr std::chrono::milliseconds kDrainInterval(10);
+
+    struct Record {
+        uint64_t sequence;
+        int64_t microseconds;  // Wall clock, since the Unix epoch
+        LogLevel level;
+        int threadId;
+        uint32_t length;
+        char text[Logger::kMaxMessageBytes];
+    };
+
+    // Written by its own thread only and read by the background thread only, so
+    // the two indices are all the synchronization it needs
+    struct ThreadQueue {
+        std::unique_ptr<Record[]> records{new Record[Logger::kRecordsPerThread]};
+        std::atomic<uint64_t> head{0};  // Next record to drain
+        std::atomic<uint64_t> tail{0};  // Next record to fill
+        std::atomic<uint64_t> dropped{0};
+        std::atomic<bool> threadExited{false};
+        int threadId = 0;
+    };
+
+    struct LoggerState {
+        std::atomic<int> format{static_cast<int>(LogFormat::Plain)};
+        std::atomic<uint64_t> nextSequence{0};
+        // Set once the background thread is gone; records are then written directly
+        std::atomic<bool> synchronous{false};
+        std::atomic<bool> started{false};
+
+        std::mutex mutex;
+        std::vector<std::shared_ptr<ThreadQueue>> queues;
+        int nextThreadId = 1;
+        std::thread drainer;
+        std::condition_variable wake;
+        std::condition_variable drained;
+        bool stopping = false;
+        uint64_t flushRequests = 0;
+        uint64_t flushesDone = 0;
+
+        // Serializes direct writes
+        std::mutex outputMutex;
+    };
+
+    // Never destroyed, so threads can still log while the process exits
+    LoggerState& state() {
+        static LoggerState* loggerState = new LoggerState();
+        return *loggerState;
+    }
+
+    // Formats into a fixed buffer; output past the end is cut off
+    class FixedStreamBuffer : public std::streambuf {
+    public:
+        void reset() {
+            setp(data, data + sizeof(data));
+        }
+
+        size_t size() const {
+            return static_cast<size_t>(pptr() - pbase());
+        }
+
+        const char* begin() const {
+            return data;
+        }
+
+    private:
+        char data[Logger::kMaxMessageBytes];
+    };
+
+    struct LineBuffer {
+        FixedStreamBuffer buffer;
+        std::ostream stream{&buffer};
+    };
+
+    // Plain pointers, so they stay usable while the thread's other objects are
+    // destroyed; the owners below clean up when the thread exits
+    thread_local LineBuffer* lineBuffer = nullptr;
+    thread_local ThreadQueue* localQueue = nullptr;
+
+    struct ThreadOwner {
+        ~ThreadOwner() {
+            delete lineBuffer;
+            lineBuffer = nullptr;
+            if (localQueue) {
+                localQueue->threadExited.store(true, std::memory_order_release);
+                localQueue = nullptr;
+            }
+        }
+    };
+    thread_local ThreadOwner threadOwner;
+
+    LineBuffer& getLineBuffer() {
+        if (!lineBuffer) {
+            (void)&threadOwner;
+            lineBuffer = new LineBuffer();
+        }
+        return *lineBuffer;
+    }
+
+    ThreadQueue& getLocalQueue() {
+        if (!localQueue) {
+            (void)&threadOwner;
+            auto queue = std::make_shared<ThreadQueue>();
+            LoggerState& s = state();
+            std::lock_guard<std::mutex> lock(s.mutex);
+            queue->threadId = s.nextThreadId++;
+            s.queues.push_back(queue);
+            localQueue = queue.get();
+        }
+        return *localQueue;
+    }
+
+    int64_t wallMicroseconds() {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    // 2024-05-01T12:00:00.123Z
+    void appendTimestamp(std::string& out, int64_t microseconds) {
+        time_t seconds = static_cast<time_t>(microseconds / 1000000);
+        struct tm utc;
+        gmtime_r(&seconds, &utc);
+        char text[40];
+        size_t length = strftime(text, sizeof(text), "%Y-%m-%dT%H:%M:%S", &utc);
+        snprintf(text + length, sizeof(text) - length, ".%03dZ", static_cast<int>(microseconds / 1000 % 1000));
+        out += text;
+    }
+
+    void appendJsonString(std::string& out, const char* text, size_t length) {
+        out += '"';
+        for (size_t i = 0; i < length; ++i) {
+            char c = text[i];
+            if (c == '"' || c == '\\') {
+                out += '\\';
+                out += c;
+            } else if (c == '\n') {
+                out += "\\n";
+            } else if (c == '\t') {
+                out += "\\t";
+            } else if (static_cast<unsigned char>(c) < 0x20) {
+                char escape[8];
+                snprintf(escape, sizeof(escape), "\\u%04x", c);
+                out += escape;
+            } else {
+                out += c;
+            }
+        }
+        out += '"';
+    }
+
+    void formatRecord(std::string& out, LogFormat format, LogLevel level, int64_t microseconds, int threadId,
+                      const char* text, size_t length) {
+        switch (format) {
+            case LogFormat::Plain:
+                if (level == LogLevel::Warn) {
+                    out += "Warning: ";
+                }
+                out.append(text, length);
+                break;
+            case LogFormat::Text: {
+                appendTimestamp(out, microseconds);
+                char prefix[32];
+                snprintf(prefix, sizeof(prefix), " %-5s [t%d] ", Logger::levelName(level), threadId);
+                out += prefix;
+                out.append(text, length);
+                break;
+            }
+            case LogFormat::Json:
+                out += "{\"time\":\"";
+                appendTimestamp(out, microseconds);
+                out += "\",\"level\":\"";
+                out += Logger::levelName(level);
+                out += "\",\"thread\":";
+                out += std::to_string(threadId);
+                out += ",\"message\":";
+                appendJsonString(out, text, length);
+                out += '}';
+                break;
+        }
+        out += '\n';
+    }
+
+    bool toStderr(LogFormat format, LogLevel level) {
+        return format != LogFormat::Json && level >= LogLevel::Warn;
+    }
+
+    void writeOutput(const std::string& out, FILE* file) {
+        if (!out.empty()) {
+            fwrite(out.data(), 1, out.size(), file);
+            fflush(file);
+        }
+    }
+
+    // Buffers of the background thread, kept between passes so draining doesn't allocate
+    struct DrainBuffers {
+        std::vector<std::shared_ptr<ThreadQueue>> queues;
+        std::vector<uint64_t> tails;
+        std::vector<const Record*> batch;
+        std::string out;
+        std::string err;
+    };
+
+    // Writes every record queued so far, across threads in the order they were logged
+    void drainQueues(DrainBuffers& buffers) {
+        const auto& queues = buffers.queues;
+        std::vector<uint64_t>& tails = buffers.tails;
+        std::vector<const Record*>& batch = buffers.batch;
+        std::string& out = buffers.out;
+        std::string& err = buffers.err;
+        batch.clear();
+        tails.resize(queues.size());
+        for (size_t q = 0; q < queues.size(); ++q) {
+            ThreadQueue& queue = *queues[q];
+            uint64_t head = queue.head.load(std::memory_order_relaxed);
+            tails[q] = queue.tail.load(std::memory_order_acquire);
+            for (uint64_t i = head; i < tails[q]; ++i) {
+                batch.push_back(&queue.records[i % Logger::kRecordsPerThread]);
+            }
+        }
+        std::sort(batch.begin(), batch.end(),
+                  [](const Record* a, const Record* b) { return a->sequence < b->sequence; });
+
+        LogFormat format = static_cast<LogFormat>(state().format.load(std::memory_order_relaxed));
+        out.clear();
+        err.clear();
+        for (const Record* record : batch) {
+            formatRecord(toStderr(format, record->level) ? err : out, format, record->level, record->microseconds,
+                         record->threadId, record->text, record->length);
+        }
+        for (size_t q = 0; q < queues.size(); ++q) {
+            queues[q]->head.store(tails[q], std::memory_order_release);
+        }
+
+        for (const auto& queue : queues) {
+            uint64_t dropped = queue->dropped.exchange(0, std::memory_order_relaxed);
+            if (dropped > 0) {
+                std::string message = std::to_string(dropped) + " log records dropped: queue full";
+                formatRecord(toStderr(format, LogLevel::Warn) ? err : out, format, LogLevel::Warn,
+                             wallMicroseconds(), queue->threadId, message.data(), message.size());
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(state().outputMutex);
+        writeOutput(out, stdout);
+        writeOutput(err, stderr);
+    }
+
+    void drainLoop() {
+        LoggerState& s = state();
+        DrainBuffers buffers;
+
+        std::unique_lock<std::mutex> lock(s.mutex);
+        while (true) {
+            s.wake.wait_for(lock, kDrainInterval, [&s]() { return s.stopping || s.flushRequests > s.flushesDone; });
+            uint64_t target = s.flushRequests;
+            bool stop = s.stopping;
+            buffers.queues = s.queues;
+            lock.unlock();
+
+            drainQueues(buffers);
+            buffers.queues.clear();
+
+            lock.lock();
+            // Queues of finished threads go once they are empty
+            s.queues.erase(std::remove_if(s.queues.begin(), s.queues.end(),
+                                          [](const std::shared_ptr<ThreadQueue>& queue) {
+                                              return queue->threadExited.load(std::memory_order_acquire) &&
+                                                     queue->head.load() == queue->tail.load();
+                                          }),
+                           s.queues.end());
+            s.flushesDone = target;
+            s.drained.notify_all();
+            if (stop) {
+                return;
+            }
+        }
+    }
+
+    void stopDrainer() {
+        LoggerState& s = state();
+        s.synchronous.store(true);
+        {
+            std::lock_guard<std::mutex> lock(s.mutex);
+            s.stopping = true;
+        }
+        s.wake.notify_one();
+        if (s.drainer.joinable()) {
+            s.drainer.join();
+        }
+    }
+
+    void startDrainer() {
+        LoggerState& s = state();
+        std::lock_guard<std::mutex> lock(s.mutex);
+        if (s.started.load()) {
+            return;
+        }
+        s.drainer = std::thread(drainLoop);
+        // Whatever is still queued at exit gets written
+        std::atexit(stopDrainer);
+        s.started.store(true, std::memory_order_release);
+    }
+}
+
+std::atomic<int> Logger::minLevel(static_cast<int>(LogLevel::Info));
+
+void Logger::setLevel(LogLevel level) {
+    minLevel.store(static_cast<int>(level), std::memory_order_relaxed);
+}
+
+LogLevel Logger::getLevel() {
+    return static_cast<LogLevel>(minLevel.load(std::memory_order_relaxed));
+}
+
+void Logger::setFormat(LogFormat format) {
+    state().format.store(static_cast<int>(format), std::memory_order_relaxed);
+}
+
+void Logger::write(LogLevel level, const char* message, size_t length) {
+    LoggerState& s = state();
+    length = std::min(length, kMaxMessageBytes);
+
+    if (s.synchronous.load(std::memory_order_acquire)) {
+        LogFormat format = static_cast<LogFormat>(s.format.load(std::memory_order_relaxed));
+        std::string out;
+        formatRecord(out, format, level, wallMicroseconds(), localQueue ? localQueue->threadId : 0, message, length);
+        std::lock_guard<std::mutex> lock(s.outputMutex);
+        writeOutput(out, toStderr(format, level) ? stderr : stdout);
+        return;
+    }
+    if (!s.started.load(std::memory_order_acquire)) {
+        startDrainer();
+    }
+
+    ThreadQueue& queue = getLocalQueue();
+    uint64_t tail = queue.tail.load(std::memory_order_relaxed);
+    if (tail - queue.head.load(std::memory_order_acquire) >= kRecordsPerThread) {
+        queue.dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    Record& record = queue.records[tail % kRecordsPerThread];
+    record.sequence = s.nextSequence.fetch_add(1, std::memory_order_relaxed);
+    record.microseconds = wallMicroseconds();
+    record.level = level;
+    record.threadId = queue.threadId;
+    record.length = static_cast<uint32_t>(length);
+    memcpy(record.text, message, length);
+    queue.tail.store(tail + 1, std::memory_order_release);
+}
+
+void Logger::flush() {
+    LoggerState& s = state();
+    if (!s.started.load(std::memory_order_acquire) || s.synchronous.load()) {
+        return;
+    }
+    std::unique_lock<std::mutex> lock(s.mutex);
+    if (s.stopping) {
+        return;
+    }
+    uint64_t ticket = ++s.flushRequests;
+    s.wake.notify_one();
+    s.drained.wait(lock, [&s, ticket]() { return s.flushesDone >= ticket || s.stopping; });
+}
+
+bool Logger::parseLevel(const std::string& name, LogLevel& level) {
+    static const LogLevel levels[] = {LogLevel::Debug, LogLevel::Info, LogLevel::Warn, LogLevel::Error, LogLevel::Off};
+    for (LogLevel candidate : levels) {
+        if (name == levelName(candidate)) {
+            level = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Logger::parseFormat(const std::string& name, LogFormat& format) {
+    if (name == "plain") {
+        format = LogFormat::Plain;
+    } else if (name == "text") {
+        format = LogFormat::Text;
+    } else if (name == "json") {
+        format = LogFormat::Json;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+const char* Logger::levelName(LogLevel level) {
+    switch (level) {
+        case LogLevel::Debug: return "debug";
+        case LogLevel::Info: return "info";
+        case LogLevel::Warn: return "warn";
+        case LogLevel::Error: return "error";
+        case LogLevel::Off: return "off";
+    }
+    return "unknown";
+}
+
+LogLine::LogLine(LogLevel level) : level(level) {
+    LineBuffer& line = getLineBuffer();
+    line.buffer.reset();
+    // The stream is reused, so manipulators from the last record mustn't carry over
+    line.stream.clear();
+    line.stream.flags(std::ios_base::dec | std::ios_base::skipws);
+    line.stream.precision(6);
+    line.stream.fill(' ');
+}
+
+LogLine::~LogLine() {
+    LineBuffer& line = getLineBuffer();
+    Logger::write(level, line.buffer.begin(), line.buffer.size());
+}
+
+std::ostream& LogLine::stream() {
+    return getLineBuffer().stream;
+}
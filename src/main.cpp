@@ -1,13 +1,18 @@
 #include "server.h"
-#include <iostream>
 #include <signal.h>
+#include <algorithm>
 #include <cstdlib>
 #include <string>
+#include "logger.h"
+
+#ifdef USE_JUCE
+#include <juce_events/juce_events.h>
+#endif
 
 Server* serverInstance = nullptr;
 
 void signalHandler(int signal) {
-    std::cout << "Received signal " << signal << ", shutting down..." << std::endl;
+    LOG_INFO("Received signal " << signal << ", shutting down...");
     if (serverInstance) {
         serverInstance->stop();
     }
@@ -15,10 +20,67 @@ void signalHandler(int signal) {
 }
 
 int main(int argc, char* argv[]) {
-    // Parse command line arguments (port, etc.)
-    int port = 8080;
-    if (argc > 1) {
-        port = std::stoi(argv[1]);
+#ifdef USE_JUCE
+    // Owns the MessageManager plugins need; declared first so it outlives every
+    // plugin instance pool
+    juce::ScopedJuceInitialiser_GUI juceInitialiser;
+#endif
+
+    // Parse command line arguments: [port] [--stream-port N] [--workers N] [--queue-size N]
+    //                                [--queue-policy fifo|sjf] [--queue-aging RATE]
+    //                                [--cache-mb MB] [--plugin-cache-instances N] [--plugin-cache-mb MB]
+    //                                [--log-level LEVEL] [--log-format plain|text|json]
+    ServerConfig config;
+    LogLevel logLevel = LogLevel::Info;
+    LogFormat logFormat = LogFormat::Text;
+    bool streamPortSet = false;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--stream-port" && i + 1 < argc) {
+            config.streamPort = std::stoi(argv[++i]);
+            streamPortSet = true;
+        } else if (arg == "--workers" && i + 1 < argc) {
+            config.render.numWorkers = std::stoi(argv[++i]);
+        } else if (arg == "--queue-size" && i + 1 < argc) {
+            config.render.maxQueuedJobs = std::stoul(argv[++i]);
+        } else if (arg == "--queue-policy" && i + 1 < argc) {
+            std::string policy = argv[++i];
+            if (policy == "fifo") {
+                config.render.queuePolicy = RenderScheduler::QueuePolicy::Fifo;
+            } else if (policy == "sjf") {
+                config.render.queuePolicy = RenderScheduler::QueuePolicy::ShortestFirst;
+            } else {
+                LOG_ERROR("Unknown queue policy: " << policy);
+                return 1;
+            }
+        } else if (arg == "--queue-aging" && i + 1 < argc) {
+            config.render.agingRate = std::max(0.0, std::stod(argv[++i]));
+        } else if (arg == "--cache-mb" && i + 1 < argc) {
+            config.renderCacheBytes = std::stoull(argv[++i]) * 1024 * 1024;
+        } else if (arg == "--plugin-cache-instances" && i + 1 < argc) {
+            config.pluginCache.maxInstances = std::stoul(argv[++i]);
+        } else if (arg == "--plugin-cache-mb" && i + 1 < argc) {
+            config.pluginCache.maxMemoryBytes = std::stoul(argv[++i]) * 1024 * 1024;
+        } else if (arg == "--log-level" && i + 1 < argc) {
+            if (!Logger::parseLevel(argv[++i], logLevel)) {
+                LOG_ERROR("Unknown log level: " << argv[i]);
+                return 1;
+            }
+        } else if (arg == "--log-format" && i + 1 < argc) {
+            if (!Logger::parseFormat(argv[++i], logFormat)) {
+                LOG_ERROR("Unknown log format: " << argv[i]);
+                return 1;
+            }
+        } else {
+            config.port = std::stoi(arg);
+        }
+    }
+    Logger::setLevel(logLevel);
+    Logger::setFormat(logFormat);
+    
+    // Streaming listens next to the main port unless told otherwise
+    if (!streamPortSet) {
+        config.streamPort = config.port + 1;
     }
     
     // Set up signal handling
@@ -26,34 +88,41 @@ int main(int argc, char* argv[]) {
     signal(SIGTERM, signalHandler);
     
     // Print debug info
-    std::cout << "System information:" << std::endl;
-    std::cout << "----------------" << std::endl;
+    LOG_INFO("System information:");
+    LOG_INFO("----------------");
     
     // Check if we can bind to ports
     #ifdef _WIN32
-    std::cout << "Platform: Windows" << std::endl;
+    LOG_INFO("Platform: Windows");
     #elif __APPLE__
-    std::cout << "Platform: macOS" << std::endl;
+    LOG_INFO("Platform: macOS");
     #elif __linux__
-    std::cout << "Platform: Linux" << std::endl;
+    LOG_INFO("Platform: Linux");
     #else
-    std::cout << "Platform: Unknown" << std::endl;
+    LOG_INFO("Platform: Unknown");
     #endif
     
-    std::cout << "Port: " << port << std::endl;
-    std::cout << "----------------" << std::endl;
+    LOG_INFO("Port: " << config.port);
+    LOG_INFO("Stream port: " << (config.streamPort > 0 ? std::to_string(config.streamPort) : "disabled"));
+    if (config.pluginCache.maxMemoryBytes > 0) {
+        LOG_INFO("Plugin cache: " << config.pluginCache.maxInstances << " instances, "
+                 << config.pluginCache.maxMemoryBytes / (1024 * 1024) << " MB");
+    } else {
+        LOG_INFO("Plugin cache: " << config.pluginCache.maxInstances << " instances");
+    }
+    LOG_INFO("----------------");
     
     try {
-        Server server(port);
+        Server server(config);
         serverInstance = &server;
         
-        std::cout << "Midiverse server starting on port " << port << std::endl;
-        std::cout << "Press Ctrl+C to stop the server" << std::endl;
+        LOG_INFO("Midiverse server starting on port " << config.port);
+        LOG_INFO("Press Ctrl+C to stop the server");
         
         // Start the server
         server.start();
     } catch (const std::exception& e) {
-        std::cerr << "Error: " << e.what() << std::endl;
+        LOG_ERROR("Error: " << e.what());
         return 1;
     }
     
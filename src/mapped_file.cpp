@@ -0,0 +1,66 @@
+#include "mapped_file.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedFile::MappedFile() : mapping(nullptr), size(0), opened(false) {
+}
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+bool MappedFile::open(const std::string& filePath, bool sequential) {
+    close();
+
+    int fd = ::open(filePath.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0 || !S_ISREG(fileStat.st_mode)) {
+        ::close(fd);
+        return false;
+    }
+
+    size_t fileSize = static_cast<size_t>(fileStat.st_size);
+    if (fileSize > 0) {
+        void* address = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (address == MAP_FAILED) {
+            ::close(fd);
+            return false;
+        }
+        if (sequential) {
+            posix_madvise(address, fileSize, POSIX_MADV_SEQUENTIAL);
+        }
+        mapping = address;
+    }
+    // The mapping stays valid without the descriptor
+    ::close(fd);
+
+    size = fileSize;
+    opened = true;
+    return true;
+}
+
+void MappedFile::close() {
+    if (mapping) {
+        munmap(mapping, size);
+    }
+    mapping = nullptr;
+    size = 0;
+    opened = false;
+}
+
+bool MappedFile::isOpen() const {
+    return opened;
+}
+
+const uint8_t* MappedFile::getData() const {
+    return static_cast<const uint8_t*>(mapping);
+}
+
+size_t MappedFile::getSize() const {
+    return size;
+}
@@ -0,0 +1,101 @@
+#include "metrics.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+Histogram::Histogram(std::vector<double> upperBounds)
+    : bounds(std::move(upperBounds)), buckets(new std::atomic<uint64_t>[bounds.size() + 1]), count(0), sum(0.0) {
+    for (size_t i = 0; i <= bounds.size(); ++i) {
+        buckets[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+void Histogram::observe(double value) {
+    // Prometheus buckets are inclusive upper bounds
+    size_t bucket = std::lower_bound(bounds.begin(), bounds.end(), value) - bounds.begin();
+    buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    count.fetch_add(1, std::memory_order_relaxed);
+    double current = sum.load(std::memory_order_relaxed);
+    while (!sum.compare_exchange_weak(current, current + value, std::memory_order_relaxed)) {
+    }
+}
+
+uint64_t Histogram::getCount() const {
+    return count.load(std::memory_order_relaxed);
+}
+
+double Histogram::getSum() const {
+    return sum.load(std::memory_order_relaxed);
+}
+
+void Histogram::write(std::string& out, const std::string& name, const std::string& labels) const {
+    std::string prefix = labels.empty() ? "" : labels + ",";
+    uint64_t cumulative = 0;
+    char bound[32];
+    for (size_t i = 0; i < bounds.size(); ++i) {
+        cumulative += buckets[i].load(std::memory_order_relaxed);
+        snprintf(bound, sizeof(bound), "%g", bounds[i]);
+        prometheus::writeSample(out, name + "_bucket", prefix + prometheus::label("le", bound),
+                                static_cast<double>(cumulative));
+    }
+    cumulative += buckets[bounds.size()].load(std::memory_order_relaxed);
+    prometheus::writeSample(out, name + "_bucket", prefix + prometheus::label("le", "+Inf"),
+                            static_cast<double>(cumulative));
+    prometheus::writeSample(out, name + "_sum", labels, getSum());
+    // The count matches the +Inf bucket even while observations race the scrape
+    prometheus::writeSample(out, name + "_count", labels, static_cast<double>(cumulative));
+}
+
+std::vector<double> Histogram::latencyBounds() {
+    return {0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30, 60, 120, 300};
+}
+
+std::vector<double> Histogram::ratioBounds() {
+    return {0.25, 0.5, 1, 2, 4, 8, 16, 32, 64, 128, 256};
+}
+
+namespace prometheus {
+
+void writeHeader(std::string& out, const std::string& name, const std::string& type, const std::string& help) {
+    out += "# HELP " + name + " " + help + "\n";
+    out += "# TYPE " + name + " " + type + "\n";
+}
+
+void writeSample(std::string& out, const std::string& name, const std::string& labels, double value) {
+    out += name;
+    if (!labels.empty()) {
+        out += "{" + labels + "}";
+    }
+    char text[32];
+    if (std::isinf(value)) {
+        snprintf(text, sizeof(text), value > 0 ? "+Inf" : "-Inf");
+    } else {
+        snprintf(text, sizeof(text), "%.15g", value);
+    }
+    out += " ";
+    out += text;
+    out += "\n";
+}
+
+void writeMetric(std::string& out, const std::string& name, const std::string& type, const std::string& help,
+                 double value) {
+    writeHeader(out, name, type, help);
+    writeSample(out, name, "", value);
+}
+
+std::string label(const std::string& name, const std::string& value) {
+    std::string out = name + "=\"";
+    for (char c : value) {
+        if (c == '\\' || c == '"') {
+            out += '\\';
+            out += c;
+        } else if (c == '\n') {
+            out += "\\n";
+        } else {
+            out += c;
+        }
+    }
+    return out + "\"";
+}
+
+}  // namespace prometheus
@@ -0,0 +1,527 @@
+#include "midi_index.h"
+#include "logger.h"
+#include "midi_sequence.h"
+#include "work_stealing_pool.h"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+namespace {
+    const char kMagic[4] = {'M', 'V', 'I', 'X'};
+    constexpr size_t kHeaderSize = 32;
+    constexpr size_t kEntrySize = 64;
+    constexpr uint8_t kFlagValid = 1;
+    // Files per pool task; enough to amortize the task, small enough to balance
+    constexpr size_t kFilesPerTask = 16;
+
+    void putLE16(uint8_t* out, uint16_t value) {
+        out[0] = value & 0xFF;
+        out[1] = (value >> 8) & 0xFF;
+    }
+
+    void putLE32(uint8_t* out, uint32_t value) {
+        for (int i = 0; i < 4; ++i) out[i] = (value >> (8 * i)) & 0xFF;
+    }
+
+    void putLE64(uint8_t* out, uint64_t value) {
+        for (int i = 0; i < 8; ++i) out[i] = (value >> (8 * i)) & 0xFF;
+    }
+
+    uint16_t getLE16(const uint8_t* in) {
+        return static_cast<uint16_t>(in[0] | (in[1] << 8));
+    }
+
+    uint32_t getLE32(const uint8_t* in) {
+        return in[0] | (in[1] << 8) | (in[2] << 16) | (static_cast<uint32_t>(in[3]) << 24);
+    }
+
+    uint64_t getLE64(const uint8_t* in) {
+        uint64_t value = 0;
+        for (int i = 7; i >= 0; --i) value = (value << 8) | in[i];
+        return value;
+    }
+
+    uint32_t getBE32(const uint8_t* in) {
+        return (static_cast<uint32_t>(in[0]) << 24) | (in[1] << 16) | (in[2] << 8) | in[3];
+    }
+
+    bool isMidiExtension(const fs::path& path) {
+        std::string extension = path.extension().string();
+        std::transform(extension.begin(), extension.end(), extension.begin(),
+                       [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+        return extension == ".mid" || extension == ".midi";
+    }
+
+    // Reads a variable-length quantity; returns false if it runs past the end of the track
+    bool readVariableLength(const uint8_t* data, size_t length, size_t& pos, uint32_t& value) {
+        value = 0;
+        for (int i = 0; i < 4; ++i) {
+            if (pos >= length) {
+                return false;
+            }
+            uint8_t byte = data[pos++];
+            value = (value << 7) | (byte & 0x7F);
+            if ((byte & 0x80) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    struct TempoChange {
+        uint64_t tick;
+        uint32_t microsecondsPerQuarter;
+    };
+
+    // Reused by every file a thread scans
+    struct ScanScratch {
+        std::vector<TempoChange> tempoChanges;
+        TempoMap tempoMap;
+        // Notes sounding per channel and key in the current track
+        uint16_t activeNotes[16 * 128];
+        // Sum of the lengths of all notes in ticks, built as offs minus ons
+        int64_t voiceTicks;
+        // Notes still sounding at the end of their track, held to the end of the file
+        uint64_t heldNotes;
+    };
+
+    thread_local ScanScratch scanScratch;
+
+    // Follows MidiProcessor::decodeTrack, counting events instead of storing them.
+    // A track stops at the first malformed event, as it does there.
+    void scanTrackEvents(const uint8_t* data, size_t length, MidiFileInfo& info, uint64_t& endTick) {
+        uint64_t tick = 0;
+        uint8_t runningStatus = 0;
+        size_t pos = 0;
+
+        while (pos < length) {
+            uint32_t delta;
+            if (!readVariableLength(data, length, pos, delta) || pos >= length) {
+                return;
+            }
+            tick += delta;
+
+            uint8_t status = data[pos];
+            if (status < 0x80) {
+                if (runningStatus == 0) {
+                    return;
+                }
+                status = runningStatus;
+            } else {
+                ++pos;
+            }
+
+            if (status == MidiSequence::kMetaStatus) {
+                uint32_t size;
+                if (pos >= length) {
+                    return;
+                }
+                uint8_t type = data[pos++];
+                if (!readVariableLength(data, length, pos, size) || size > length - pos) {
+                    return;
+                }
+                if (type == MidiSequence::kMetaSetTempo && size >= 3) {
+                    uint32_t microsecondsPerQuarter = (data[pos] << 16) | (data[pos + 1] << 8) | data[pos + 2];
+                    scanScratch.tempoChanges.push_back({tick, microsecondsPerQuarter});
+                }
+                pos += size;
+                runningStatus = 0;
+                ++info.eventCount;
+                endTick = std::max(endTick, tick);
+                if (type == MidiSequence::kMetaEndOfTrack) {
+                    return;
+                }
+            } else if (status == MidiSequence::kSysExStatus || status == MidiSequence::kSysExEscapeStatus) {
+                uint32_t size;
+                if (!readVariableLength(data, length, pos, size) || size > length - pos) {
+                    return;
+                }
+                pos += size;
+                runningStatus = 0;
+                ++info.eventCount;
+                endTick = std::max(endTick, tick);
+            } else if (status >= 0xF0) {
+                return;
+            } else {
+                uint8_t type = status & 0xF0;
+                size_t dataBytes = (type == 0xC0 || type == 0xD0) ? 1 : 2;
+                if (pos + dataBytes > length) {
+                    return;
+                }
+                uint8_t velocity = dataBytes == 2 ? (data[pos + 1] & 0x7F) : 0;
+                uint16_t& active = scanScratch.activeNotes[(status & 0x0F) * 128 + (data[pos] & 0x7F)];
+                if (MidiSequence::isNoteOn(status, velocity)) {
+                    ++info.noteCount;
+                    info.channelMask |= static_cast<uint16_t>(1u << (status & 0x0F));
+                    if (active < UINT16_MAX) {
+                        ++active;
+                        scanScratch.voiceTicks -= static_cast<int64_t>(tick);
+                    }
+                } else if (MidiSequence::isNoteOff(status, velocity) && active > 0) {
+                    --active;
+                    scanScratch.voiceTicks += static_cast<int64_t>(tick);
+                }
+                pos += dataBytes;
+                runningStatus = status;
+                ++info.eventCount;
+                endTick = std::max(endTick, tick);
+            }
+        }
+    }
+
+    void scanTrack(const uint8_t* data, size_t length, MidiFileInfo& info, uint64_t& endTick) {
+        std::memset(scanScratch.activeNotes, 0, sizeof(scanScratch.activeNotes));
+        scanTrackEvents(data, length, info, endTick);
+        for (uint16_t active : scanScratch.activeNotes) {
+            scanScratch.heldNotes += active;
+        }
+    }
+
+    struct IndexedFile {
+        std::string path;
+        MidiFileInfo info;
+        bool needsScan = true;
+    };
+
+    void encodeEntry(uint8_t* out, const MidiFileInfo& info, uint64_t pathOffset, uint32_t pathLength) {
+        uint64_t durationBits;
+        std::memcpy(&durationBits, &info.durationSeconds, sizeof(durationBits));
+        putLE64(out, info.fileSize);
+        putLE64(out + 8, static_cast<uint64_t>(info.modifiedTime));
+        putLE64(out + 16, pathOffset);
+        putLE32(out + 24, pathLength);
+        putLE32(out + 28, info.eventCount);
+        putLE64(out + 32, info.noteCount);
+        putLE64(out + 40, durationBits);
+        putLE32(out + 48, info.tempoChangeCount);
+        putLE16(out + 52, info.trackCount);
+        putLE16(out + 54, info.division);
+        putLE16(out + 56, info.channelMask);
+        out[58] = info.format;
+        out[59] = info.valid ? kFlagValid : 0;
+        uint32_t voicesBits;
+        std::memcpy(&voicesBits, &info.averageVoices, sizeof(voicesBits));
+        putLE32(out + 60, voicesBits);
+    }
+
+    bool writeIndex(const std::vector<IndexedFile>& files, const std::string& indexPath) {
+        std::vector<uint8_t> table(kHeaderSize + files.size() * kEntrySize);
+        std::string strings;
+        for (size_t i = 0; i < files.size(); ++i) {
+            encodeEntry(&table[kHeaderSize + i * kEntrySize], files[i].info, strings.size(),
+                        static_cast<uint32_t>(files[i].path.size()));
+            strings += files[i].path;
+        }
+
+        uint8_t* header = table.data();
+        std::memcpy(header, kMagic, 4);
+        putLE16(header + 4, MidiIndex::kVersion);
+        putLE16(header + 6, kEntrySize);
+        putLE64(header + 8, files.size());
+        putLE64(header + 16, table.size());
+        putLE64(header + 24, strings.size());
+
+        std::string tempPath = indexPath + ".tmp";
+        FILE* file = fopen(tempPath.c_str(), "wb");
+        if (!file) {
+            LOG_ERROR("Could not open index file: " << tempPath);
+            return false;
+        }
+        bool ok = fwrite(table.data(), 1, table.size(), file) == table.size() &&
+                  fwrite(strings.data(), 1, strings.size(), file) == strings.size();
+        ok = (fclose(file) == 0) && ok;
+        if (!ok || std::rename(tempPath.c_str(), indexPath.c_str()) != 0) {
+            LOG_ERROR("Could not write index file: " << indexPath);
+            std::remove(tempPath.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    // Adds one file with its size and modification time, or nothing if it is unreadable
+    void addFile(const fs::directory_entry& entry, std::vector<IndexedFile>& files) {
+        std::error_code ec;
+        IndexedFile file;
+        file.info.fileSize = entry.file_size(ec);
+        if (ec) {
+            LOG_WARN("Could not stat " << entry.path().string() << ": " << ec.message());
+            return;
+        }
+        file.info.modifiedTime = entry.last_write_time(ec).time_since_epoch().count();
+        file.path = MidiIndex::normalizePath(entry.path().string());
+        files.push_back(std::move(file));
+    }
+}
+
+MidiIndex::MidiIndex() : numEntries(0), entries(nullptr), strings(nullptr) {
+}
+
+bool MidiIndex::open(const std::string& indexPath) {
+    close();
+    if (!file.open(indexPath)) {
+        return false;
+    }
+
+    const uint8_t* data = file.getData();
+    size_t fileSize = file.getSize();
+    if (fileSize < kHeaderSize || std::memcmp(data, kMagic, 4) != 0 || getLE16(data + 4) != kVersion ||
+        getLE16(data + 6) != kEntrySize) {
+        close();
+        return false;
+    }
+    uint64_t count = getLE64(data + 8);
+    uint64_t stringsOffset = getLE64(data + 16);
+    uint64_t stringsSize = getLE64(data + 24);
+    if (count > (fileSize - kHeaderSize) / kEntrySize || stringsOffset != kHeaderSize + count * kEntrySize ||
+        stringsSize > fileSize - stringsOffset) {
+        close();
+        return false;
+    }
+    // Checked once here so lookups can trust every path
+    for (uint64_t i = 0; i < count; ++i) {
+        const uint8_t* entry = data + kHeaderSize + i * kEntrySize;
+        uint64_t pathOffset = getLE64(entry + 16);
+        if (pathOffset > stringsSize || getLE32(entry + 24) > stringsSize - pathOffset) {
+            close();
+            return false;
+        }
+    }
+
+    numEntries = static_cast<size_t>(count);
+    entries = data + kHeaderSize;
+    strings = reinterpret_cast<const char*>(data + stringsOffset);
+    return true;
+}
+
+void MidiIndex::close() {
+    file.close();
+    numEntries = 0;
+    entries = nullptr;
+    strings = nullptr;
+}
+
+bool MidiIndex::isOpen() const {
+    return file.isOpen();
+}
+
+size_t MidiIndex::size() const {
+    return numEntries;
+}
+
+const uint8_t* MidiIndex::getEntry(size_t index) const {
+    return entries + index * kEntrySize;
+}
+
+std::string_view MidiIndex::getPath(size_t index) const {
+    const uint8_t* entry = getEntry(index);
+    return std::string_view(strings + getLE64(entry + 16), getLE32(entry + 24));
+}
+
+MidiFileInfo MidiIndex::getInfo(size_t index) const {
+    const uint8_t* entry = getEntry(index);
+    MidiFileInfo info;
+    uint64_t durationBits = getLE64(entry + 40);
+    info.fileSize = getLE64(entry);
+    info.modifiedTime = static_cast<int64_t>(getLE64(entry + 8));
+    info.eventCount = getLE32(entry + 28);
+    info.noteCount = getLE64(entry + 32);
+    std::memcpy(&info.durationSeconds, &durationBits, sizeof(durationBits));
+    info.tempoChangeCount = getLE32(entry + 48);
+    info.trackCount = getLE16(entry + 52);
+    info.division = getLE16(entry + 54);
+    info.channelMask = getLE16(entry + 56);
+    info.format = entry[58];
+    info.valid = (entry[59] & kFlagValid) != 0;
+    uint32_t voicesBits = getLE32(entry + 60);
+    std::memcpy(&info.averageVoices, &voicesBits, sizeof(voicesBits));
+    return info;
+}
+
+size_t MidiIndex::find(const std::string& filePath) const {
+    std::string key = normalizePath(filePath);
+    size_t low = 0;
+    size_t high = numEntries;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (getPath(middle) < key) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low < numEntries && getPath(low) == key ? low : kNotFound;
+}
+
+bool MidiIndex::build(const std::vector<std::string>& inputs, const std::string& indexPath,
+                      const MidiIndexBuildOptions& options, MidiIndexBuildStats& stats) {
+    auto start = std::chrono::steady_clock::now();
+    stats = MidiIndexBuildStats();
+
+    std::vector<IndexedFile> files;
+    for (const std::string& input : inputs) {
+        std::error_code ec;
+        fs::directory_entry inputEntry(input, ec);
+        if (!ec && inputEntry.is_directory(ec)) {
+            for (fs::recursive_directory_iterator it(input, fs::directory_options::skip_permission_denied, ec), end;
+                 !ec && it != end; it.increment(ec)) {
+                if (it->is_regular_file(ec) && isMidiExtension(it->path())) {
+                    addFile(*it, files);
+                }
+            }
+        } else if (!ec && inputEntry.is_regular_file(ec)) {
+            addFile(inputEntry, files);
+        } else {
+            LOG_ERROR("No such file or directory: " << input);
+            return false;
+        }
+        if (ec) {
+            LOG_ERROR("Could not read " << input << ": " << ec.message());
+            return false;
+        }
+    }
+    std::sort(files.begin(), files.end(), [](const IndexedFile& a, const IndexedFile& b) { return a.path < b.path; });
+    files.erase(std::unique(files.begin(), files.end(),
+                            [](const IndexedFile& a, const IndexedFile& b) { return a.path == b.path; }),
+                files.end());
+    stats.files = files.size();
+
+    // Both lists are in path order, so unchanged files are matched in one pass
+    MidiIndex previous;
+    if (!options.rescanAll && previous.open(indexPath)) {
+        size_t matched = 0;
+        size_t next = 0;
+        for (size_t i = 0; i < previous.size(); ++i) {
+            std::string_view path = previous.getPath(i);
+            while (next < files.size() && std::string_view(files[next].path) < path) {
+                ++next;
+            }
+            if (next == files.size() || std::string_view(files[next].path) != path) {
+                continue;
+            }
+            ++matched;
+            MidiFileInfo info = previous.getInfo(i);
+            if (info.fileSize == files[next].info.fileSize && info.modifiedTime == files[next].info.modifiedTime) {
+                files[next].info = info;
+                files[next].needsScan = false;
+                ++stats.reused;
+            }
+        }
+        stats.removed = previous.size() - matched;
+    }
+    previous.close();
+
+    std::vector<size_t> pending;
+    for (size_t i = 0; i < files.size(); ++i) {
+        if (files[i].needsScan) {
+            pending.push_back(i);
+        }
+    }
+    stats.scanned = pending.size();
+
+    if (!pending.empty()) {
+        WorkStealingPool pool(options.numThreads);
+        for (size_t first = 0; first < pending.size(); first += kFilesPerTask) {
+            size_t last = std::min(first + kFilesPerTask, pending.size());
+            pool.submit([&files, &pending, first, last](int) {
+                MappedFile mapped;
+                for (size_t i = first; i < last; ++i) {
+                    IndexedFile& file = files[pending[i]];
+                    // Keep the size and time seen when listing, so a file changed
+                    // since is scanned again next time
+                    MidiFileInfo scanned;
+                    if (mapped.open(file.path, true)) {
+                        scanMidiData(mapped.getData(), mapped.getSize(), scanned);
+                    }
+                    scanned.fileSize = file.info.fileSize;
+                    scanned.modifiedTime = file.info.modifiedTime;
+                    file.info = scanned;
+                    if (!scanned.valid) {
+                        LOG_WARN("Not a readable MIDI file: " << file.path);
+                    }
+                }
+            });
+        }
+        pool.wait();
+    }
+
+    for (size_t i : pending) {
+        stats.bytesScanned += files[i].info.fileSize;
+    }
+    for (const IndexedFile& file : files) {
+        if (!file.info.valid) {
+            ++stats.invalid;
+        }
+    }
+
+    bool written = writeIndex(files, indexPath);
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return written;
+}
+
+bool MidiIndex::scanMidiData(const uint8_t* data, size_t size, MidiFileInfo& info) {
+    info = MidiFileInfo();
+    if (size < 14 || std::memcmp(data, "MThd", 4) != 0) {
+        return false;
+    }
+    uint32_t headerLength = getBE32(data + 4);
+    uint16_t format = static_cast<uint16_t>((data[8] << 8) | data[9]);
+    if (format > 2) {
+        return false;
+    }
+    info.format = static_cast<uint8_t>(format);
+    info.division = static_cast<uint16_t>((data[12] << 8) | data[13]);
+
+    scanScratch.tempoChanges.clear();
+    scanScratch.voiceTicks = 0;
+    scanScratch.heldNotes = 0;
+    uint64_t endTick = 0;
+    uint64_t pos = 8 + static_cast<uint64_t>(headerLength);
+    while (pos + 8 <= size) {
+        uint32_t chunkLength = getBE32(data + pos + 4);
+        if (std::memcmp(data + pos, "MTrk", 4) == 0) {
+            if (pos + 8 + chunkLength > size) {
+                chunkLength = static_cast<uint32_t>(size - pos - 8);
+            }
+            scanTrack(data + pos + 8, chunkLength, info, endTick);
+            ++info.trackCount;
+        }
+        pos += 8 + static_cast<uint64_t>(chunkLength);
+    }
+    if (info.trackCount == 0) {
+        info = MidiFileInfo();
+        return false;
+    }
+
+    // Same tempo map MidiProcessor builds: changes of all tracks in tick order,
+    // tracks in file order at equal ticks
+    TempoMap& tempoMap = scanScratch.tempoMap;
+    if (data[12] & 0x80) {
+        tempoMap.resetSmpte(-static_cast<int8_t>(data[12]), data[13]);
+    } else {
+        tempoMap.reset(info.division);
+    }
+    std::stable_sort(scanScratch.tempoChanges.begin(), scanScratch.tempoChanges.end(),
+                     [](const TempoChange& a, const TempoChange& b) { return a.tick < b.tick; });
+    for (const TempoChange& change : scanScratch.tempoChanges) {
+        tempoMap.addTempoChange(change.tick, change.microsecondsPerQuarter);
+    }
+    info.tempoChangeCount = static_cast<uint32_t>(tempoMap.getNumTempoChanges());
+    info.durationSeconds = tempoMap.tickToSeconds(endTick);
+    if (endTick > 0) {
+        int64_t voiceTicks = scanScratch.voiceTicks + static_cast<int64_t>(scanScratch.heldNotes * endTick);
+        info.averageVoices = static_cast<float>(static_cast<double>(voiceTicks) / endTick);
+    }
+    info.valid = true;
+    return true;
+}
+
+std::string MidiIndex::normalizePath(const std::string& filePath) {
+    std::error_code ec;
+    fs::path path = fs::absolute(filePath, ec);
+    return (ec ? fs::path(filePath) : path).lexically_normal().string();
+}
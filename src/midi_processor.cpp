@@ -1,26 +1,45 @@
 #include "midi_processor.h"
+#include "logger.h"
+#include "trace.h"
 #include <fstream>
-#include <iostream>
 #include <stdexcept>
-#include <sstream>
 #include <algorithm>
-#include <iomanip>
 
-MidiProcessor::MidiProcessor() : trackCount(0), ticksPerQuarterNote(0) {
+namespace {
+    // Reads a variable-length quantity; returns false if it runs past the end of the track
+    bool readVariableLength(const uint8_t* data, size_t length, size_t& pos, uint32_t& value) {
+        value = 0;
+        for (int i = 0; i < 4; ++i) {
+            if (pos >= length) {
+                return false;
+            }
+            uint8_t byte = data[pos++];
+            value = (value << 7) | (byte & 0x7F);
+            if ((byte & 0x80) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+}
+
+MidiProcessor::MidiProcessor() : format(0), trackCount(0), ticksPerQuarterNote(0) {
 }
 
 MidiProcessor::~MidiProcessor() {
 }
 
 bool MidiProcessor::loadMidiFile(const std::string& filePath) {
+    TRACE_SCOPE("load midi");
     std::ifstream file(filePath, std::ios::binary);
     if (!file) {
-        std::cerr << "Could not open MIDI file: " << filePath << std::endl;
+        LOG_ERROR("Could not open MIDI file: " << filePath);
         return false;
     }
     
     // Clear previous data
     midiData.clear();
+    sequence.clear();
     
     // Read entire file into memory
     file.seekg(0, std::ios::end);
@@ -28,80 +47,110 @@ bool MidiProcessor::loadMidiFile(const std::string& filePath) {
     file.seekg(0, std::ios::beg);
     
     if (fileSize < 14) {
-        std::cerr << "MIDI file too small: " << filePath << std::endl;
+        LOG_ERROR("MIDI file too small: " << filePath);
         return false;
     }
     
     midiData.resize(fileSize);
     file.read(reinterpret_cast<char*>(midiData.data()), fileSize);
     
+    return parseMidiData(midiData.data(), midiData.size(), filePath);
+}
+
+bool MidiProcessor::loadMidiData(const uint8_t* data, size_t size, const std::string& sourceName) {
+    // Clear previous data
+    midiData.clear();
+    sequence.clear();
+    
+    if (size < 14) {
+        LOG_ERROR("MIDI data too small: " << sourceName << " (" << size << " bytes)");
+        return false;
+    }
+    
+    // Parsed in place; the events are copied into the sequence, so data need not outlive the call
+    return parseMidiData(data, size, sourceName);
+}
+
+bool MidiProcessor::parseMidiData(const uint8_t* data, size_t fileSize, const std::string& sourceName) {
+    TRACE_SCOPE("parse midi");
     // Basic validation of MIDI header
-    if (midiData[0] != 'M' || midiData[1] != 'T' || 
-        midiData[2] != 'h' || midiData[3] != 'd') {
-        std::cerr << "Invalid MIDI file format: Missing MThd header" << std::endl;
+    if (data[0] != 'M' || data[1] != 'T' || 
+        data[2] != 'h' || data[3] != 'd') {
+        LOG_ERROR("Invalid MIDI file format: Missing MThd header");
         midiData.clear();
         return false;
     }
     
     // Check header length (should be 6 for standard MIDI)
-    uint32_t headerLength = (midiData[4] << 24) | (midiData[5] << 16) |
-                           (midiData[6] << 8) | midiData[7];
+    uint32_t headerLength = (data[4] << 24) | (data[5] << 16) |
+                           (data[6] << 8) | data[7];
     if (headerLength != 6) {
-        std::cerr << "Warning: Unusual MIDI header length: " << headerLength << std::endl;
+        LOG_WARN("Unusual MIDI header length: " << headerLength);
     }
     
     // Parse format type (0 = single track, 1 = multiple tracks, synchronized, 2 = multiple tracks, independent)
-    uint16_t format = (midiData[8] << 8) | midiData[9];
-    trackCount = (midiData[10] << 8) | midiData[11];
-    ticksPerQuarterNote = (midiData[12] << 8) | midiData[13];
+    format = (data[8] << 8) | data[9];
+    trackCount = (data[10] << 8) | data[11];
+    ticksPerQuarterNote = (data[12] << 8) | data[13];
     
     // Validate MIDI format
     if (format > 2) {
-        std::cerr << "Invalid MIDI format type: " << format << std::endl;
+        LOG_ERROR("Invalid MIDI format type: " << format);
         midiData.clear();
         return false;
     }
     
     // Validate track count
     if (format == 0 && trackCount != 1) {
-        std::cerr << "Warning: Format 0 MIDI should have exactly 1 track, found " << trackCount << std::endl;
+        LOG_WARN("Format 0 MIDI should have exactly 1 track, found " << trackCount);
+    }
+    
+    // Time division: ticks per quarter note, or SMPTE frames/sec and ticks/frame if bit 15 is set
+    if (data[12] & 0x80) {
+        int framesPerSecond = -static_cast<int8_t>(data[12]);
+        sequence.getTempoMap().resetSmpte(framesPerSecond, data[13]);
+    } else {
+        sequence.getTempoMap().reset(ticksPerQuarterNote);
     }
     
     // Log MIDI file information
-    std::cout << "Loaded MIDI file: " << filePath << std::endl;
-    std::cout << "Format: " << format << std::endl;
-    std::cout << "Track count: " << trackCount << std::endl;
-    std::cout << "Ticks per quarter note: " << ticksPerQuarterNote << std::endl;
+    LOG_INFO("Loaded MIDI file: " << sourceName << " (format " << format << ", " << trackCount << " tracks, "
+             << ticksPerQuarterNote << " ticks per quarter note)");
     
     // Validate that we have at least one MTrk chunk
     bool foundTrack = false;
-    size_t pos = 14; // Skip the header
+    uint16_t trackIndex = 0;
+    size_t pos = 8 + headerLength; // Skip the header
     
     while (pos + 8 <= fileSize) {  // Need at least 8 bytes for chunk header
-        if (midiData[pos] == 'M' && midiData[pos+1] == 'T' && 
-            midiData[pos+2] == 'r' && midiData[pos+3] == 'k') {
+        if (data[pos] == 'M' && data[pos+1] == 'T' && 
+            data[pos+2] == 'r' && data[pos+3] == 'k') {
             foundTrack = true;
             
             // Get track length
-            uint32_t trackLength = (midiData[pos+4] << 24) | (midiData[pos+5] << 16) |
-                                  (midiData[pos+6] << 8) | midiData[pos+7];
+            uint32_t trackLength = (data[pos+4] << 24) | (data[pos+5] << 16) |
+                                  (data[pos+6] << 8) | data[pos+7];
+            
+            LOG_DEBUG("Found track of length " << trackLength << " bytes");
             
-            std::cout << "Found track of length " << trackLength << " bytes" << std::endl;
+            if (pos + 8 + trackLength > fileSize) {
+                LOG_WARN("Track " << trackIndex << " is truncated");
+                trackLength = static_cast<uint32_t>(fileSize - pos - 8);
+            }
+            
+            decodeTrack(&data[pos + 8], trackLength, trackIndex++);
             
             // Skip to next chunk
             pos += 8 + trackLength;
         } else {
             // Unknown chunk, try to skip it if we can read its length
             if (pos + 4 <= fileSize) {
-                uint32_t chunkLength = (midiData[pos+4] << 24) | (midiData[pos+5] << 16) |
-                                      (midiData[pos+6] << 8) | midiData[pos+7];
-                std::cerr << "Warning: Unknown chunk at position " << pos << 
-                          " with ID " << 
-                          static_cast<char>(midiData[pos]) << 
-                          static_cast<char>(midiData[pos+1]) << 
-                          static_cast<char>(midiData[pos+2]) << 
-                          static_cast<char>(midiData[pos+3]) << 
-                          " and length " << chunkLength << std::endl;
+                uint32_t chunkLength = (data[pos+4] << 24) | (data[pos+5] << 16) |
+                                      (data[pos+6] << 8) | data[pos+7];
+                LOG_WARN("Unknown chunk at position " << pos << " with ID "
+                         << static_cast<char>(data[pos]) << static_cast<char>(data[pos+1])
+                         << static_cast<char>(data[pos+2]) << static_cast<char>(data[pos+3])
+                         << " and length " << chunkLength);
                 pos += 8 + chunkLength;
             } else {
                 // Can't read length, just increment by 1 and hope for the best
@@ -111,19 +160,94 @@ bool MidiProcessor::loadMidiFile(const std::string& filePath) {
     }
     
     if (!foundTrack) {
-        std::cerr << "No track chunks found in MIDI file" << std::endl;
+        LOG_ERROR("No track chunks found in MIDI file");
         midiData.clear();
         return false;
     }
     
-    // Print a hexdump of the first few bytes for debugging
-    std::cout << "MIDI file header hexdump:" << std::endl;
-    std::stringstream ss;
-    for (size_t i = 0; i < std::min(size_t(32), fileSize); ++i) {
-        ss << std::setfill('0') << std::setw(2) << std::hex << static_cast<int>(midiData[i]) << " ";
-        if ((i + 1) % 16 == 0) ss << std::endl;
+    // Merge the tracks into one timeline and derive the tempo map from it
+    sequence.sortByTick();
+    sequence.rebuildTempoMap();
+    
+    LOG_INFO("Decoded " << sequence.size() << " events, " 
+             << sequence.getTempoMap().getNumTempoChanges() << " tempo changes, "
+             << sequence.getDurationSeconds() << " seconds");
+    
+    return true;
+}
+
+bool MidiProcessor::decodeTrack(const uint8_t* data, size_t length, uint16_t trackIndex) {
+    uint64_t tick = 0;
+    uint8_t runningStatus = 0;
+    size_t pos = 0;
+    
+    while (pos < length) {
+        uint32_t delta;
+        if (!readVariableLength(data, length, pos, delta) || pos >= length) {
+            LOG_WARN("Truncated event in track " << trackIndex);
+            return false;
+        }
+        tick += delta;
+        
+        uint8_t status = data[pos];
+        if (status < 0x80) {
+            // Running status: reuse the previous channel status byte
+            if (runningStatus == 0) {
+                LOG_WARN("Data byte without status in track " << trackIndex);
+                return false;
+            }
+            status = runningStatus;
+        } else {
+            ++pos;
+        }
+        
+        if (status == MidiSequence::kMetaStatus) {
+            uint32_t size;
+            if (pos >= length) {
+                LOG_WARN("Truncated meta event in track " << trackIndex);
+                return false;
+            }
+            uint8_t type = data[pos++];
+            if (!readVariableLength(data, length, pos, size) || size > length - pos) {
+                LOG_WARN("Truncated meta event in track " << trackIndex);
+                return false;
+            }
+            sequence.addMetaEvent(tick, trackIndex, type, data + pos, size);
+            pos += size;
+            runningStatus = 0;
+            
+            if (type == MidiSequence::kMetaEndOfTrack) {
+                return true;
+            }
+        } else if (status == MidiSequence::kSysExStatus || status == MidiSequence::kSysExEscapeStatus) {
+            uint32_t size;
+            if (!readVariableLength(data, length, pos, size) || size > length - pos) {
+                LOG_WARN("Truncated SysEx event in track " << trackIndex);
+                return false;
+            }
+            sequence.addSysExEvent(tick, trackIndex, status, data + pos, size);
+            pos += size;
+            runningStatus = 0;
+        } else if (status >= 0xF0) {
+            LOG_WARN("Unexpected system message 0x" << std::hex << static_cast<int>(status) 
+                     << std::dec << " in track " << trackIndex);
+            return false;
+        } else {
+            // Program change and channel pressure carry one data byte, everything else two
+            uint8_t type = status & 0xF0;
+            size_t dataBytes = (type == 0xC0 || type == 0xD0) ? 1 : 2;
+            if (pos + dataBytes > length) {
+                LOG_WARN("Truncated channel event in track " << trackIndex);
+                return false;
+            }
+            uint8_t data1 = data[pos] & 0x7F;
+            uint8_t data2 = dataBytes == 2 ? (data[pos + 1] & 0x7F) : 0;
+            pos += dataBytes;
+            runningStatus = status;
+            
+            sequence.addChannelEvent(tick, trackIndex, status, data1, data2);
+        }
     }
-    std::cout << ss.str() << std::endl;
     
     return true;
 }
@@ -132,6 +256,14 @@ const std::vector<uint8_t>& MidiProcessor::getMidiData() const {
     return midiData;
 }
 
+const MidiSequence& MidiProcessor::getSequence() const {
+    return sequence;
+}
+
+int MidiProcessor::getFormat() const {
+    return format;
+}
+
 int MidiProcessor::getTrackCount() const {
     return trackCount;
 }
@@ -0,0 +1,289 @@
+#include "midi_sequence.h"
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+namespace {
+    // Tempo assumed by the SMF spec until the first Set Tempo event (120 BPM)
+    constexpr uint32_t kDefaultMicrosecondsPerQuarter = 500000;
+
+    template <typename T>
+    void applyPermutation(std::vector<T>& column, const std::vector<uint32_t>& order) {
+        std::vector<T> sorted(column.size());
+        for (size_t i = 0; i < order.size(); ++i) {
+            sorted[i] = column[order[i]];
+        }
+        column.swap(sorted);
+    }
+}
+
+//===== TempoMap =====
+
+TempoMap::TempoMap() : ticksPerQuarter(480), smpte(false) {
+    reset(480);
+}
+
+void TempoMap::reset(int ticksPerQuarterNote) {
+    ticksPerQuarter = ticksPerQuarterNote > 0 ? static_cast<uint64_t>(ticksPerQuarterNote) : 480;
+    smpte = false;
+    segments.assign(1, Segment{0, kDefaultMicrosecondsPerQuarter, 0});
+}
+
+void TempoMap::resetSmpte(int framesPerSecond, int ticksPerFrame) {
+    if (ticksPerFrame <= 0) ticksPerFrame = 1;
+
+    // Express SMPTE time as a fixed "quarter note" of one second so the metrical
+    // conversion code applies unchanged; 29 means 29.97 fps drop-frame
+    uint32_t microsecondsPerQuarter = 1000000;
+    if (framesPerSecond == 29) {
+        ticksPerQuarter = 2997ULL * ticksPerFrame;
+        microsecondsPerQuarter = 100000000;
+    } else {
+        ticksPerQuarter = static_cast<uint64_t>(std::max(framesPerSecond, 1)) * ticksPerFrame;
+    }
+    smpte = true;
+    segments.assign(1, Segment{0, microsecondsPerQuarter, 0});
+}
+
+void TempoMap::clearTempoChanges() {
+    segments.resize(1);
+    if (!smpte) {
+        segments[0].microsecondsPerQuarter = kDefaultMicrosecondsPerQuarter;
+    }
+}
+
+void TempoMap::addTempoChange(uint64_t tick, uint32_t microsecondsPerQuarter) {
+    if (smpte || microsecondsPerQuarter == 0) {
+        return;
+    }
+
+    Segment& last = segments.back();
+    tick = std::max(tick, last.tick);
+    if (tick == last.tick) {
+        // Later events at the same tick win
+        last.microsecondsPerQuarter = microsecondsPerQuarter;
+        return;
+    }
+
+    segments.push_back(Segment{tick, microsecondsPerQuarter, scaledTime(last, tick)});
+}
+
+size_t TempoMap::findSegment(uint64_t tick) const {
+    auto it = std::upper_bound(segments.begin(), segments.end(), tick,
+                               [](uint64_t t, const Segment& segment) { return t < segment.tick; });
+    return static_cast<size_t>(it - segments.begin()) - 1;
+}
+
+uint64_t TempoMap::scaledTime(const Segment& segment, uint64_t tick) const {
+    return segment.scaledStartTime + (tick - segment.tick) * segment.microsecondsPerQuarter;
+}
+
+double TempoMap::tickToSeconds(uint64_t tick) const {
+    const Segment& segment = segments[findSegment(tick)];
+    return static_cast<double>(scaledTime(segment, tick)) / (1.0e6 * static_cast<double>(ticksPerQuarter));
+}
+
+int64_t TempoMap::tickToSample(uint64_t tick, double sampleRate) const {
+    const Segment& segment = segments[findSegment(tick)];
+    long double scale = static_cast<long double>(sampleRate) / (1.0e6L * static_cast<long double>(ticksPerQuarter));
+    return static_cast<int64_t>(std::floor(static_cast<long double>(scaledTime(segment, tick)) * scale));
+}
+
+void TempoMap::ticksToSamples(const uint64_t* ticks, size_t count, double sampleRate, int64_t* samples) const {
+    if (count == 0) {
+        return;
+    }
+
+    long double scale = static_cast<long double>(sampleRate) / (1.0e6L * static_cast<long double>(ticksPerQuarter));
+    size_t segmentIndex = findSegment(ticks[0]);
+
+    for (size_t i = 0; i < count; ++i) {
+        uint64_t tick = ticks[i];
+        while (segmentIndex + 1 < segments.size() && segments[segmentIndex + 1].tick <= tick) {
+            ++segmentIndex;
+        }
+        if (tick < segments[segmentIndex].tick) {
+            // Input wasn't sorted; fall back to a lookup
+            segmentIndex = findSegment(tick);
+        }
+        samples[i] = static_cast<int64_t>(
+            std::floor(static_cast<long double>(scaledTime(segments[segmentIndex], tick)) * scale));
+    }
+}
+
+size_t TempoMap::getNumTempoChanges() const {
+    return segments.size() - 1;
+}
+
+bool TempoMap::isSmpte() const {
+    return smpte;
+}
+
+//===== MidiSequence =====
+
+MidiSequence::MidiSequence() : endTick(0) {
+}
+
+void MidiSequence::clear() {
+    ticks.clear();
+    status.clear();
+    data1.clear();
+    data2.clear();
+    tracks.clear();
+    payloadOffsets.clear();
+    payloadSizes.clear();
+    payload.clear();
+    tempoMap.clearTempoChanges();
+    endTick = 0;
+}
+
+void MidiSequence::reserve(size_t numEvents) {
+    ticks.reserve(numEvents);
+    status.reserve(numEvents);
+    data1.reserve(numEvents);
+    data2.reserve(numEvents);
+    tracks.reserve(numEvents);
+    payloadOffsets.reserve(numEvents);
+    payloadSizes.reserve(numEvents);
+}
+
+void MidiSequence::addChannelEvent(uint64_t tick, uint16_t track, uint8_t statusByte, uint8_t d1, uint8_t d2) {
+    ticks.push_back(tick);
+    status.push_back(statusByte);
+    data1.push_back(d1);
+    data2.push_back(d2);
+    tracks.push_back(track);
+    payloadOffsets.push_back(0);
+    payloadSizes.push_back(0);
+    endTick = std::max(endTick, tick);
+}
+
+void MidiSequence::addMetaEvent(uint64_t tick, uint16_t track, uint8_t type, const uint8_t* data, uint32_t size) {
+    ticks.push_back(tick);
+    status.push_back(kMetaStatus);
+    data1.push_back(type);
+    data2.push_back(0);
+    tracks.push_back(track);
+    payloadOffsets.push_back(static_cast<uint32_t>(payload.size()));
+    payloadSizes.push_back(size);
+    payload.insert(payload.end(), data, data + size);
+    endTick = std::max(endTick, tick);
+}
+
+void MidiSequence::addSysExEvent(uint64_t tick, uint16_t track, uint8_t statusByte, const uint8_t* data, uint32_t size) {
+    ticks.push_back(tick);
+    status.push_back(statusByte);
+    data1.push_back(0);
+    data2.push_back(0);
+    tracks.push_back(track);
+    payloadOffsets.push_back(static_cast<uint32_t>(payload.size()));
+    payloadSizes.push_back(size);
+    payload.insert(payload.end(), data, data + size);
+    endTick = std::max(endTick, tick);
+}
+
+void MidiSequence::sortByTick() {
+    if (std::is_sorted(ticks.begin(), ticks.end())) {
+        return;
+    }
+
+    std::vector<uint32_t> order(ticks.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(),
+                     [this](uint32_t a, uint32_t b) { return ticks[a] < ticks[b]; });
+
+    applyPermutation(ticks, order);
+    applyPermutation(status, order);
+    applyPermutation(data1, order);
+    applyPermutation(data2, order);
+    applyPermutation(tracks, order);
+    applyPermutation(payloadOffsets, order);
+    applyPermutation(payloadSizes, order);
+}
+
+void MidiSequence::rebuildTempoMap() {
+    tempoMap.clearTempoChanges();
+    for (size_t i = 0; i < ticks.size(); ++i) {
+        if (status[i] == kMetaStatus && data1[i] == kMetaSetTempo && payloadSizes[i] >= 3) {
+            const uint8_t* data = &payload[payloadOffsets[i]];
+            uint32_t microsecondsPerQuarter = (data[0] << 16) | (data[1] << 8) | data[2];
+            tempoMap.addTempoChange(ticks[i], microsecondsPerQuarter);
+        }
+    }
+}
+
+size_t MidiSequence::size() const {
+    return ticks.size();
+}
+
+bool MidiSequence::empty() const {
+    return ticks.empty();
+}
+
+const std::vector<uint64_t>& MidiSequence::getTicks() const {
+    return ticks;
+}
+
+const std::vector<uint8_t>& MidiSequence::getStatus() const {
+    return status;
+}
+
+const std::vector<uint8_t>& MidiSequence::getData1() const {
+    return data1;
+}
+
+const std::vector<uint8_t>& MidiSequence::getData2() const {
+    return data2;
+}
+
+const std::vector<uint16_t>& MidiSequence::getTracks() const {
+    return tracks;
+}
+
+const uint8_t* MidiSequence::getPayload(size_t index) const {
+    if (payloadSizes[index] == 0) {
+        return nullptr;
+    }
+    return &payload[payloadOffsets[index]];
+}
+
+uint32_t MidiSequence::getPayloadSize(size_t index) const {
+    return payloadSizes[index];
+}
+
+bool MidiSequence::isChannelEvent(uint8_t statusByte) {
+    return statusByte >= 0x80 && statusByte < 0xF0;
+}
+
+bool MidiSequence::isNoteOn(uint8_t statusByte, uint8_t velocity) {
+    return (statusByte & 0xF0) == 0x90 && velocity > 0;
+}
+
+bool MidiSequence::isNoteOff(uint8_t statusByte, uint8_t velocity) {
+    return (statusByte & 0xF0) == 0x80 || ((statusByte & 0xF0) == 0x90 && velocity == 0);
+}
+
+TempoMap& MidiSequence::getTempoMap() {
+    return tempoMap;
+}
+
+const TempoMap& MidiSequence::getTempoMap() const {
+    return tempoMap;
+}
+
+uint64_t MidiSequence::getEndTick() const {
+    return endTick;
+}
+
+double MidiSequence::getDurationSeconds() const {
+    return tempoMap.tickToSeconds(endTick);
+}
+
+int64_t MidiSequence::getLengthInSamples(double sampleRate) const {
+    return tempoMap.tickToSample(endTick, sampleRate);
+}
+
+void MidiSequence::computeSampleOffsets(double sampleRate, std::vector<int64_t>& offsets) const {
+    offsets.resize(ticks.size());
+    tempoMap.ticksToSamples(ticks.data(), ticks.size(), sampleRate, offsets.data());
+}
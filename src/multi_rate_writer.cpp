@@ -0,0 +1,118 @@
+#include "multi_rate_writer.h"
+#include <cmath>
+#include <filesystem>
+#include "trace.h"
+
+namespace fs = std::filesystem;
+
+MultiRateWriter::MultiRateWriter()
+    : numOpen(0), quality(ResamplerQuality::Standard), dither(false), fileFormat(AudioFileFormat::Wav),
+      flacLevel(FlacEncoder::kDefaultLevel), encoderThreads(1) {
+}
+
+void MultiRateWriter::setQuality(ResamplerQuality quality) {
+    this->quality = quality;
+}
+
+void MultiRateWriter::setDither(bool enabled) {
+    dither = enabled;
+}
+
+void MultiRateWriter::setFileFormat(AudioFileFormat fileFormat) {
+    this->fileFormat = fileFormat;
+}
+
+void MultiRateWriter::setFlacLevel(int level) {
+    flacLevel = level;
+}
+
+void MultiRateWriter::setEncoderThreads(int numThreads) {
+    encoderThreads = numThreads;
+}
+
+bool MultiRateWriter::open(const std::vector<Output>& outputs, float renderRate, int numChannels,
+                           SampleFormat format) {
+    if (isOpen()) {
+        finalize();
+    }
+
+    while (targets.size() < outputs.size()) {
+        targets.push_back(std::make_unique<Target>());
+    }
+
+    for (size_t i = 0; i < outputs.size(); ++i) {
+        Target& target = *targets[i];
+        target.resample = std::lround(outputs[i].sampleRate) != std::lround(renderRate);
+        if (target.resample && !target.resampler.configure(renderRate, outputs[i].sampleRate, numChannels, quality)) {
+            finalize();
+            return false;
+        }
+        target.writer.setDither(dither);
+        target.writer.setFileFormat(fileFormat);
+        target.writer.setFlacLevel(flacLevel);
+        target.writer.setEncoderThreads(encoderThreads);
+        if (!target.writer.open(outputs[i].filePath, outputs[i].sampleRate, numChannels, format)) {
+            finalize();
+            return false;
+        }
+        numOpen = i + 1;
+    }
+    return true;
+}
+
+bool MultiRateWriter::appendBlock(const float* const* channels, size_t numFrames) {
+    for (size_t i = 0; i < numOpen; ++i) {
+        Target& target = *targets[i];
+        if (!target.resample) {
+            if (!target.writer.appendBlock(channels, numFrames)) {
+                return false;
+            }
+            continue;
+        }
+        size_t converted;
+        {
+            TRACE_SCOPE("resample");
+            converted = target.resampler.process(channels, numFrames);
+        }
+        if (converted > 0 && !target.writer.appendBlock(target.resampler.getOutput().getChannels(), converted)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool MultiRateWriter::finalize() {
+    bool ok = true;
+    for (size_t i = 0; i < numOpen; ++i) {
+        Target& target = *targets[i];
+        if (target.resample && target.writer.isOpen()) {
+            size_t converted = target.resampler.flush();
+            if (converted > 0) {
+                ok = target.writer.appendBlock(target.resampler.getOutput().getChannels(), converted) && ok;
+            }
+        }
+        if (target.writer.isOpen()) {
+            ok = target.writer.finalize() && ok;
+        }
+    }
+    numOpen = 0;
+    return ok;
+}
+
+bool MultiRateWriter::isOpen() const {
+    return numOpen > 0;
+}
+
+size_t MultiRateWriter::getNumOutputs() const {
+    return numOpen;
+}
+
+uint64_t MultiRateWriter::getFramesWritten(size_t output) const {
+    return output < targets.size() ? targets[output]->writer.getFramesWritten() : 0;
+}
+
+std::string MultiRateWriter::pathForRate(const std::string& filePath, float sampleRate) {
+    fs::path path(filePath);
+    std::string name = path.stem().string() + "_" + std::to_string(std::lround(sampleRate)) + path.extension().string();
+    return (path.parent_path() / name).string();
+}
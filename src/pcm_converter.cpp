@@ -0,0 +1,418 @@
+#include "pcm_converter.h"
+#include "cpu_features.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MIDIVERSE_X86_KERNELS 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define MIDIVERSE_NEON_KERNELS 1
+#endif
+
+namespace {
+    enum class Isa { Scalar, Sse41, Avx2, Neon };
+
+    // Scale and clamp range of each integer format. The upper bound of Int32 is the
+    // largest float below 2^31 so the float->int conversion can't overflow.
+    template <SampleFormat F> struct PcmTraits;
+    template <> struct PcmTraits<SampleFormat::Int16> {
+        static constexpr float scale = 32767.0f;
+        static constexpr float minValue = -32768.0f;
+        static constexpr float maxValue = 32767.0f;
+        static constexpr int bytes = 2;
+    };
+    template <> struct PcmTraits<SampleFormat::Int24> {
+        static constexpr float scale = 8388607.0f;
+        static constexpr float minValue = -8388608.0f;
+        static constexpr float maxValue = 8388607.0f;
+        static constexpr int bytes = 3;
+    };
+    template <> struct PcmTraits<SampleFormat::Int32> {
+        static constexpr float scale = 2147483648.0f;
+        static constexpr float minValue = -2147483648.0f;
+        static constexpr float maxValue = 2147483520.0f;
+        static constexpr int bytes = 4;
+    };
+    template <> struct PcmTraits<SampleFormat::Float32> {
+        static constexpr int bytes = 4;
+    };
+
+    inline uint32_t xorshift(uint32_t& state) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+
+    inline float unitFloat(uint32_t bits) {
+        uint32_t mantissa = (bits >> 9) | 0x3F800000u;
+        float value;
+        memcpy(&value, &mantissa, sizeof(value));
+        return value - 1.0f;
+    }
+
+    // Triangular noise in (-1, 1) LSB
+    inline float tpdfNoise(uint32_t& state) {
+        float a = unitFloat(xorshift(state));
+        float b = unitFloat(xorshift(state));
+        return a - b;
+    }
+
+    template <SampleFormat F, bool Dither>
+    void convertScalarRange(const float* input, size_t begin, size_t end, uint8_t* output,
+                            PcmConverter::DitherState* dither) {
+        using Traits = PcmTraits<F>;
+
+        if constexpr (F == SampleFormat::Float32) {
+            // A plain copy apart from NaN, which becomes silence as in the integer formats
+            for (size_t i = begin; i < end; ++i) {
+                float sample = std::isnan(input[i]) ? 0.0f : input[i];
+                memcpy(output + i * 4, &sample, sizeof(float));
+            }
+        } else {
+            for (size_t i = begin; i < end; ++i) {
+                // NaN becomes silence, as in the SIMD kernels
+                float sample = std::isnan(input[i]) ? 0.0f : input[i];
+                float scaled = sample * Traits::scale;
+                if constexpr (Dither) {
+                    scaled += tpdfNoise(dither->lanes[i & 7]);
+                }
+                scaled = std::min(std::max(scaled, Traits::minValue), Traits::maxValue);
+                int32_t value = static_cast<int32_t>(std::lrintf(scaled));
+
+                uint8_t* out = output + i * Traits::bytes;
+                for (int byte = 0; byte < Traits::bytes; ++byte) {
+                    out[byte] = static_cast<uint8_t>(static_cast<uint32_t>(value) >> (8 * byte));
+                }
+            }
+        }
+    }
+
+    template <SampleFormat F, bool Dither>
+    void convertScalar(const float* input, size_t numSamples, uint8_t* output, PcmConverter::DitherState* dither) {
+        convertScalarRange<F, Dither>(input, 0, numSamples, output, dither);
+    }
+
+#ifdef MIDIVERSE_X86_KERNELS
+    __attribute__((target("avx2")))
+    inline __m256 tpdfNoiseAvx2(__m256i& state) {
+        const __m256i one = _mm256_set1_epi32(0x3F800000);
+        __m256 noise[2];
+        for (int draw = 0; draw < 2; ++draw) {
+            state = _mm256_xor_si256(state, _mm256_slli_epi32(state, 13));
+            state = _mm256_xor_si256(state, _mm256_srli_epi32(state, 17));
+            state = _mm256_xor_si256(state, _mm256_slli_epi32(state, 5));
+            __m256i bits = _mm256_or_si256(_mm256_srli_epi32(state, 9), one);
+            noise[draw] = _mm256_sub_ps(_mm256_castsi256_ps(bits), _mm256_set1_ps(1.0f));
+        }
+        return _mm256_sub_ps(noise[0], noise[1]);
+    }
+
+    template <SampleFormat F, bool Dither>
+    __attribute__((target("avx2")))
+    inline __m256i quantizeAvx2(const float* input, __m256i& state) {
+        using Traits = PcmTraits<F>;
+        __m256 samples = _mm256_loadu_ps(input);
+        // Zero NaN lanes; min/max would otherwise turn them into full-scale negative
+        samples = _mm256_and_ps(samples, _mm256_cmp_ps(samples, samples, _CMP_ORD_Q));
+        __m256 scaled = _mm256_mul_ps(samples, _mm256_set1_ps(Traits::scale));
+        if constexpr (Dither) {
+            scaled = _mm256_add_ps(scaled, tpdfNoiseAvx2(state));
+        }
+        scaled = _mm256_min_ps(_mm256_max_ps(scaled, _mm256_set1_ps(Traits::minValue)),
+                               _mm256_set1_ps(Traits::maxValue));
+        return _mm256_cvtps_epi32(scaled);
+    }
+
+    template <SampleFormat F, bool Dither>
+    __attribute__((target("avx2")))
+    void convertAvx2(const float* input, size_t numSamples, uint8_t* output, PcmConverter::DitherState* dither) {
+        if constexpr (F == SampleFormat::Float32) {
+            convertScalarRange<F, Dither>(input, 0, numSamples, output, dither);
+        } else {
+            __m256i state = Dither ? _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dither->lanes))
+                                   : _mm256_setzero_si256();
+            size_t i = 0;
+
+            if constexpr (F == SampleFormat::Int16) {
+                for (; i + 16 <= numSamples; i += 16) {
+                    __m256i a = quantizeAvx2<F, Dither>(input + i, state);
+                    __m256i b = quantizeAvx2<F, Dither>(input + i + 8, state);
+                    // packs works per 128-bit lane; restore sample order afterwards
+                    __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), 0xD8);
+                    _mm256_storeu_si256(reinterpret_cast<__m256i*>(output + i * 2), packed);
+                }
+            } else if constexpr (F == SampleFormat::Int24) {
+                const __m256i pack = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+                                                      0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+                // Each 16-byte store spills 4 bytes that the next store overwrites,
+                // so keep two samples of slack before the scalar tail
+                for (; i + 10 <= numSamples; i += 8) {
+                    __m256i packed = _mm256_shuffle_epi8(quantizeAvx2<F, Dither>(input + i, state), pack);
+                    uint8_t* out = output + i * 3;
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm256_castsi256_si128(packed));
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 12), _mm256_extracti128_si256(packed, 1));
+                }
+            } else {
+                for (; i + 8 <= numSamples; i += 8) {
+                    _mm256_storeu_si256(reinterpret_cast<__m256i*>(output + i * 4),
+                                        quantizeAvx2<F, Dither>(input + i, state));
+                }
+            }
+
+            if constexpr (Dither) {
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(dither->lanes), state);
+            }
+            convertScalarRange<F, Dither>(input, i, numSamples, output, dither);
+        }
+    }
+
+    __attribute__((target("sse4.1")))
+    inline __m128 tpdfNoiseSse(__m128i& state) {
+        const __m128i one = _mm_set1_epi32(0x3F800000);
+        __m128 noise[2];
+        for (int draw = 0; draw < 2; ++draw) {
+            state = _mm_xor_si128(state, _mm_slli_epi32(state, 13));
+            state = _mm_xor_si128(state, _mm_srli_epi32(state, 17));
+            state = _mm_xor_si128(state, _mm_slli_epi32(state, 5));
+            __m128i bits = _mm_or_si128(_mm_srli_epi32(state, 9), one);
+            noise[draw] = _mm_sub_ps(_mm_castsi128_ps(bits), _mm_set1_ps(1.0f));
+        }
+        return _mm_sub_ps(noise[0], noise[1]);
+    }
+
+    template <SampleFormat F, bool Dither>
+    __attribute__((target("sse4.1")))
+    inline __m128i quantizeSse(const float* input, __m128i& state) {
+        using Traits = PcmTraits<F>;
+        __m128 samples = _mm_loadu_ps(input);
+        // Zero NaN lanes; min/max would otherwise turn them into full-scale negative
+        samples = _mm_and_ps(samples, _mm_cmpord_ps(samples, samples));
+        __m128 scaled = _mm_mul_ps(samples, _mm_set1_ps(Traits::scale));
+        if constexpr (Dither) {
+            scaled = _mm_add_ps(scaled, tpdfNoiseSse(state));
+        }
+        scaled = _mm_min_ps(_mm_max_ps(scaled, _mm_set1_ps(Traits::minValue)), _mm_set1_ps(Traits::maxValue));
+        return _mm_cvtps_epi32(scaled);
+    }
+
+    template <SampleFormat F, bool Dither>
+    __attribute__((target("sse4.1")))
+    void convertSse41(const float* input, size_t numSamples, uint8_t* output, PcmConverter::DitherState* dither) {
+        if constexpr (F == SampleFormat::Float32) {
+            convertScalarRange<F, Dither>(input, 0, numSamples, output, dither);
+        } else {
+            __m128i state = Dither ? _mm_loadu_si128(reinterpret_cast<const __m128i*>(dither->lanes))
+                                   : _mm_setzero_si128();
+            size_t i = 0;
+
+            if constexpr (F == SampleFormat::Int16) {
+                for (; i + 8 <= numSamples; i += 8) {
+                    __m128i a = quantizeSse<F, Dither>(input + i, state);
+                    __m128i b = quantizeSse<F, Dither>(input + i + 4, state);
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(output + i * 2), _mm_packs_epi32(a, b));
+                }
+            } else if constexpr (F == SampleFormat::Int24) {
+                const __m128i pack = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+                for (; i + 6 <= numSamples; i += 4) {
+                    __m128i packed = _mm_shuffle_epi8(quantizeSse<F, Dither>(input + i, state), pack);
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(output + i * 3), packed);
+                }
+            } else {
+                for (; i + 4 <= numSamples; i += 4) {
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(output + i * 4), quantizeSse<F, Dither>(input + i, state));
+                }
+            }
+
+            if constexpr (Dither) {
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dither->lanes), state);
+            }
+            convertScalarRange<F, Dither>(input, i, numSamples, output, dither);
+        }
+    }
+#endif
+
+#ifdef MIDIVERSE_NEON_KERNELS
+    inline float32x4_t tpdfNoiseNeon(uint32x4_t& state) {
+        float32x4_t noise[2];
+        for (int draw = 0; draw < 2; ++draw) {
+            state = veorq_u32(state, vshlq_n_u32(state, 13));
+            state = veorq_u32(state, vshrq_n_u32(state, 17));
+            state = veorq_u32(state, vshlq_n_u32(state, 5));
+            uint32x4_t bits = vorrq_u32(vshrq_n_u32(state, 9), vdupq_n_u32(0x3F800000));
+            noise[draw] = vsubq_f32(vreinterpretq_f32_u32(bits), vdupq_n_f32(1.0f));
+        }
+        return vsubq_f32(noise[0], noise[1]);
+    }
+
+    template <SampleFormat F, bool Dither>
+    inline int32x4_t quantizeNeon(const float* input, uint32x4_t& state) {
+        using Traits = PcmTraits<F>;
+        float32x4_t samples = vld1q_f32(input);
+        // Zero NaN lanes (only NaN compares unequal to itself)
+        samples = vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(samples), vceqq_f32(samples, samples)));
+        float32x4_t scaled = vmulq_n_f32(samples, Traits::scale);
+        if constexpr (Dither) {
+            scaled = vaddq_f32(scaled, tpdfNoiseNeon(state));
+        }
+        scaled = vminq_f32(vmaxq_f32(scaled, vdupq_n_f32(Traits::minValue)), vdupq_n_f32(Traits::maxValue));
+        return vcvtnq_s32_f32(scaled);
+    }
+
+    template <SampleFormat F, bool Dither>
+    void convertNeon(const float* input, size_t numSamples, uint8_t* output, PcmConverter::DitherState* dither) {
+        if constexpr (F == SampleFormat::Float32) {
+            convertScalarRange<F, Dither>(input, 0, numSamples, output, dither);
+        } else {
+            uint32x4_t state = Dither ? vld1q_u32(dither->lanes) : vdupq_n_u32(0);
+            size_t i = 0;
+
+            if constexpr (F == SampleFormat::Int16) {
+                for (; i + 8 <= numSamples; i += 8) {
+                    int16x8_t packed = vcombine_s16(vqmovn_s32(quantizeNeon<F, Dither>(input + i, state)),
+                                                    vqmovn_s32(quantizeNeon<F, Dither>(input + i + 4, state)));
+                    vst1q_s16(reinterpret_cast<int16_t*>(output + i * 2), packed);
+                }
+            } else if constexpr (F == SampleFormat::Int24) {
+                const uint8_t packIndices[16] = {0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, 255, 255, 255, 255};
+                const uint8x16_t pack = vld1q_u8(packIndices);
+                for (; i + 6 <= numSamples; i += 4) {
+                    uint8x16_t bytes = vreinterpretq_u8_s32(quantizeNeon<F, Dither>(input + i, state));
+                    vst1q_u8(output + i * 3, vqtbl1q_u8(bytes, pack));
+                }
+            } else {
+                for (; i + 4 <= numSamples; i += 4) {
+                    vst1q_s32(reinterpret_cast<int32_t*>(output + i * 4), quantizeNeon<F, Dither>(input + i, state));
+                }
+            }
+
+            if constexpr (Dither) {
+                vst1q_u32(dither->lanes, state);
+            }
+            convertScalarRange<F, Dither>(input, i, numSamples, output, dither);
+        }
+    }
+#endif
+
+    Isa detectIsa() {
+        const CpuFeatures& cpu = CpuFeatures::get();
+        if (cpu.avx2) return Isa::Avx2;
+        if (cpu.sse41) return Isa::Sse41;
+        if (cpu.neon) return Isa::Neon;
+        return Isa::Scalar;
+    }
+
+    Isa getIsa() {
+        static const Isa isa = detectIsa();
+        return isa;
+    }
+
+    template <SampleFormat F, bool Dither>
+    PcmConverter::Kernel kernelFor(Isa isa) {
+        switch (isa) {
+#ifdef MIDIVERSE_X86_KERNELS
+            case Isa::Avx2: return convertAvx2<F, Dither>;
+            case Isa::Sse41: return convertSse41<F, Dither>;
+#endif
+#ifdef MIDIVERSE_NEON_KERNELS
+            case Isa::Neon: return convertNeon<F, Dither>;
+#endif
+            default: return convertScalar<F, Dither>;
+        }
+    }
+
+    template <SampleFormat F>
+    PcmConverter::Kernel kernelFor(Isa isa, bool dither) {
+        return dither ? kernelFor<F, true>(isa) : kernelFor<F, false>(isa);
+    }
+}
+
+PcmConverter::PcmConverter() : PcmConverter(SampleFormat::Int16, false) {
+}
+
+PcmConverter::PcmConverter(SampleFormat format, bool dither) : format(format), dither(dither), kernel(nullptr) {
+    resetDither();
+    selectKernel();
+}
+
+void PcmConverter::setFormat(SampleFormat format) {
+    this->format = format;
+    resetDither();
+    selectKernel();
+}
+
+void PcmConverter::setDither(bool enabled) {
+    dither = enabled;
+    selectKernel();
+}
+
+SampleFormat PcmConverter::getFormat() const {
+    return format;
+}
+
+bool PcmConverter::isDitherEnabled() const {
+    return dither;
+}
+
+int PcmConverter::getBytesPerSample() const {
+    return bytesPerSample(format);
+}
+
+void PcmConverter::convert(const float* input, size_t numSamples, uint8_t* output) {
+    kernel(input, numSamples, output, &ditherState);
+}
+
+int PcmConverter::bytesPerSample(SampleFormat format) {
+    switch (format) {
+        case SampleFormat::Int16: return 2;
+        case SampleFormat::Int24: return 3;
+        default: return 4;
+    }
+}
+
+int PcmConverter::bitsPerSample(SampleFormat format) {
+    return bytesPerSample(format) * 8;
+}
+
+bool PcmConverter::formatForBitDepth(int bitDepth, SampleFormat& format) {
+    switch (bitDepth) {
+        case 16: format = SampleFormat::Int16; return true;
+        case 24: format = SampleFormat::Int24; return true;
+        case 32: format = SampleFormat::Int32; return true;
+        default: return false;
+    }
+}
+
+const char* PcmConverter::getKernelName() {
+    switch (getIsa()) {
+        case Isa::Avx2: return "avx2";
+        case Isa::Sse41: return "sse4.1";
+        case Isa::Neon: return "neon";
+        default: return "scalar";
+    }
+}
+
+void PcmConverter::resetDither() {
+    // Fixed seeds keep dithered output reproducible between runs
+    uint32_t seed = 0x9E3779B9u;
+    for (uint32_t& lane : ditherState.lanes) {
+        seed = seed * 1664525u + 1013904223u;
+        lane = seed | 1u;
+    }
+}
+
+void PcmConverter::selectKernel() {
+    // Dither only makes sense when quantizing to 16 or 24 bits
+    bool useDither = dither && (format == SampleFormat::Int16 || format == SampleFormat::Int24);
+    Isa isa = getIsa();
+
+    switch (format) {
+        case SampleFormat::Int16: kernel = kernelFor<SampleFormat::Int16>(isa, useDither); break;
+        case SampleFormat::Int24: kernel = kernelFor<SampleFormat::Int24>(isa, useDither); break;
+        case SampleFormat::Int32: kernel = kernelFor<SampleFormat::Int32>(isa, false); break;
+        case SampleFormat::Float32: kernel = kernelFor<SampleFormat::Float32>(isa, false); break;
+    }
+}
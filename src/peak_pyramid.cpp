@@ -0,0 +1,404 @@
+#include "peak_pyramid.h"
+#include "cpu_features.h"
+#include "logger.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MIDIVERSE_X86_KERNELS 1
+#elif defined(__aarch64__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define MIDIVERSE_NEON_KERNELS 1
+#endif
+
+namespace fs = std::filesystem;
+
+namespace {
+    const uint32_t kDefaultBucketSizes[] = {256, 2048, 16384};
+    constexpr size_t kFixedHeaderSize = 24;
+    constexpr size_t kLevelHeaderSize = 8;
+    constexpr size_t kBucketChannelSize = 6;
+
+    void putLE16(uint8_t* out, uint16_t value) {
+        out[0] = value & 0xFF;
+        out[1] = (value >> 8) & 0xFF;
+    }
+
+    void putLE32(uint8_t* out, uint32_t value) {
+        for (int i = 0; i < 4; ++i) out[i] = (value >> (8 * i)) & 0xFF;
+    }
+
+    void putLE64(uint8_t* out, uint64_t value) {
+        for (int i = 0; i < 8; ++i) out[i] = (value >> (8 * i)) & 0xFF;
+    }
+
+    uint32_t getLE32(const uint8_t* in) {
+        return in[0] | (in[1] << 8) | (in[2] << 16) | (static_cast<uint32_t>(in[3]) << 24);
+    }
+
+    uint16_t getLE16(const uint8_t* in) {
+        return static_cast<uint16_t>(in[0] | (in[1] << 8));
+    }
+
+    int16_t quantizePeak(float value) {
+        return static_cast<int16_t>(std::lround(std::max(-1.0f, std::min(1.0f, value)) * 32767.0f));
+    }
+
+    uint16_t quantizeRms(double value) {
+        return static_cast<uint16_t>(std::lround(std::max(0.0, std::min(1.0, value)) * 65535.0));
+    }
+
+    //===== Statistics kernels: min, max and sum of squares of a run of samples =====
+
+    using StatsKernel = void (*)(const float* x, size_t n, float& min, float& max, double& sumSquares);
+
+    void statsScalar(const float* x, size_t n, float& min, float& max, double& sumSquares) {
+        float lo = min;
+        float hi = max;
+        float sum = 0.0f;
+        for (size_t i = 0; i < n; ++i) {
+            lo = std::min(lo, x[i]);
+            hi = std::max(hi, x[i]);
+            sum += x[i] * x[i];
+        }
+        min = lo;
+        max = hi;
+        sumSquares += sum;
+    }
+
+#ifdef MIDIVERSE_X86_KERNELS
+    __attribute__((target("avx2")))
+    void statsAvx2(const float* x, size_t n, float& min, float& max, double& sumSquares) {
+        __m256 lo = _mm256_set1_ps(min);
+        __m256 hi = _mm256_set1_ps(max);
+        __m256 sum = _mm256_setzero_ps();
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8) {
+            __m256 v = _mm256_loadu_ps(x + i);
+            lo = _mm256_min_ps(lo, v);
+            hi = _mm256_max_ps(hi, v);
+            sum = _mm256_add_ps(sum, _mm256_mul_ps(v, v));
+        }
+        alignas(32) float los[8], his[8], sums[8];
+        _mm256_store_ps(los, lo);
+        _mm256_store_ps(his, hi);
+        _mm256_store_ps(sums, sum);
+        for (int lane = 0; lane < 8; ++lane) {
+            min = std::min(min, los[lane]);
+            max = std::max(max, his[lane]);
+            sumSquares += sums[lane];
+        }
+        statsScalar(x + i, n - i, min, max, sumSquares);
+    }
+
+    __attribute__((target("sse4.1")))
+    void statsSse41(const float* x, size_t n, float& min, float& max, double& sumSquares) {
+        __m128 lo = _mm_set1_ps(min);
+        __m128 hi = _mm_set1_ps(max);
+        __m128 sum = _mm_setzero_ps();
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            __m128 v = _mm_loadu_ps(x + i);
+            lo = _mm_min_ps(lo, v);
+            hi = _mm_max_ps(hi, v);
+            sum = _mm_add_ps(sum, _mm_mul_ps(v, v));
+        }
+        alignas(16) float los[4], his[4], sums[4];
+        _mm_store_ps(los, lo);
+        _mm_store_ps(his, hi);
+        _mm_store_ps(sums, sum);
+        for (int lane = 0; lane < 4; ++lane) {
+            min = std::min(min, los[lane]);
+            max = std::max(max, his[lane]);
+            sumSquares += sums[lane];
+        }
+        statsScalar(x + i, n - i, min, max, sumSquares);
+    }
+#endif
+
+#ifdef MIDIVERSE_NEON_KERNELS
+    void statsNeon(const float* x, size_t n, float& min, float& max, double& sumSquares) {
+        float32x4_t lo = vdupq_n_f32(min);
+        float32x4_t hi = vdupq_n_f32(max);
+        float32x4_t sum = vdupq_n_f32(0.0f);
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            float32x4_t v = vld1q_f32(x + i);
+            lo = vminq_f32(lo, v);
+            hi = vmaxq_f32(hi, v);
+            sum = vmlaq_f32(sum, v, v);
+        }
+        float los[4], his[4], sums[4];
+        vst1q_f32(los, lo);
+        vst1q_f32(his, hi);
+        vst1q_f32(sums, sum);
+        for (int lane = 0; lane < 4; ++lane) {
+            min = std::min(min, los[lane]);
+            max = std::max(max, his[lane]);
+            sumSquares += sums[lane];
+        }
+        statsScalar(x + i, n - i, min, max, sumSquares);
+    }
+#endif
+
+    struct KernelChoice {
+        StatsKernel kernel;
+        const char* name;
+    };
+
+    KernelChoice chooseKernel() {
+        const CpuFeatures& cpu = CpuFeatures::get();
+        (void)cpu;
+#ifdef MIDIVERSE_X86_KERNELS
+        if (cpu.avx2) return {statsAvx2, "avx2"};
+        if (cpu.sse41) return {statsSse41, "sse4.1"};
+#endif
+#ifdef MIDIVERSE_NEON_KERNELS
+        if (cpu.neon) return {statsNeon, "neon"};
+#endif
+        return {statsScalar, "scalar"};
+    }
+
+    const KernelChoice& getKernelChoice() {
+        static const KernelChoice choice = chooseKernel();
+        return choice;
+    }
+}
+
+PeakPyramid::PeakPyramid() : numChannels(0), sampleRate(0), numFrames(0) {
+}
+
+bool PeakPyramid::begin(int numChannels, float sampleRate, const std::vector<uint32_t>& bucketSizes) {
+    std::vector<uint32_t> sizes = bucketSizes;
+    if (sizes.empty()) {
+        sizes.assign(std::begin(kDefaultBucketSizes), std::end(kDefaultBucketSizes));
+    }
+    for (size_t i = 0; i < sizes.size(); ++i) {
+        if (sizes[i] == 0 || (i > 0 && (sizes[i] <= sizes[i - 1] || sizes[i] % sizes[i - 1] != 0))) {
+            LOG_ERROR("Peak bucket sizes must increase by whole multiples");
+            return false;
+        }
+    }
+    if (numChannels < 1 || numChannels > 65535) {
+        LOG_ERROR("Unsupported channel count for peaks: " << numChannels);
+        return false;
+    }
+
+    this->numChannels = numChannels;
+    this->sampleRate = sampleRate;
+    numFrames = 0;
+    // Levels are kept between renders so their buffers are reused
+    levels.resize(sizes.size());
+    for (size_t i = 0; i < sizes.size(); ++i) {
+        levels[i].bucketSize = sizes[i];
+        levels[i].data.clear();
+        resetAccumulators(levels[i]);
+    }
+    return true;
+}
+
+void PeakPyramid::addBlock(const float* const* channels, size_t numFrames) {
+    if (levels.empty()) {
+        return;
+    }
+
+    StatsKernel kernel = getKernelChoice().kernel;
+    Level& finest = levels[0];
+    size_t done = 0;
+    while (done < numFrames) {
+        size_t run = std::min<size_t>(numFrames - done, finest.bucketSize - finest.framesInBucket);
+        for (int channel = 0; channel < numChannels; ++channel) {
+            Accumulator& stats = finest.current[channel];
+            kernel(channels[channel] + done, run, stats.min, stats.max, stats.sumSquares);
+        }
+        finest.framesInBucket += static_cast<uint32_t>(run);
+        done += run;
+        if (finest.framesInBucket == finest.bucketSize) {
+            closeBucket(0);
+        }
+    }
+    this->numFrames += numFrames;
+}
+
+void PeakPyramid::finish() {
+    for (size_t i = 0; i < levels.size(); ++i) {
+        if (levels[i].framesInBucket > 0) {
+            closeBucket(i);
+        }
+    }
+}
+
+void PeakPyramid::resetAccumulators(Level& level) {
+    level.framesInBucket = 0;
+    level.current.assign(static_cast<size_t>(numChannels), {INFINITY, -INFINITY, 0.0});
+}
+
+void PeakPyramid::merge(size_t levelIndex, const Accumulator* stats, uint32_t frames) {
+    Level& level = levels[levelIndex];
+    for (int channel = 0; channel < numChannels; ++channel) {
+        Accumulator& target = level.current[channel];
+        target.min = std::min(target.min, stats[channel].min);
+        target.max = std::max(target.max, stats[channel].max);
+        target.sumSquares += stats[channel].sumSquares;
+    }
+    level.framesInBucket += frames;
+    if (level.framesInBucket == level.bucketSize) {
+        closeBucket(levelIndex);
+    }
+}
+
+void PeakPyramid::closeBucket(size_t levelIndex) {
+    Level& level = levels[levelIndex];
+    size_t offset = level.data.size();
+    level.data.resize(offset + static_cast<size_t>(numChannels) * kBucketChannelSize);
+    uint8_t* out = level.data.data() + offset;
+    for (int channel = 0; channel < numChannels; ++channel) {
+        const Accumulator& stats = level.current[channel];
+        putLE16(out, static_cast<uint16_t>(quantizePeak(stats.min)));
+        putLE16(out + 2, static_cast<uint16_t>(quantizePeak(stats.max)));
+        putLE16(out + 4, quantizeRms(std::sqrt(stats.sumSquares / level.framesInBucket)));
+        out += kBucketChannelSize;
+    }
+
+    if (levelIndex + 1 < levels.size()) {
+        merge(levelIndex + 1, level.current.data(), level.framesInBucket);
+    }
+    resetAccumulators(level);
+}
+
+bool PeakPyramid::writeFile(const std::string& filePath) const {
+    std::vector<uint8_t> bytes;
+    serialize(bytes);
+
+    std::string tempPath = filePath + ".tmp";
+    FILE* file = fopen(tempPath.c_str(), "wb");
+    if (!file) {
+        LOG_ERROR("Could not open file for writing: " << tempPath);
+        return false;
+    }
+    bool ok = fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+    ok = (fclose(file) == 0) && ok;
+
+    std::error_code ec;
+    if (ok) {
+        fs::rename(tempPath, filePath, ec);
+        ok = !ec;
+    }
+    if (!ok) {
+        fs::remove(tempPath, ec);
+        LOG_ERROR("Failed to write peaks: " << filePath);
+    }
+    return ok;
+}
+
+void PeakPyramid::serialize(std::vector<uint8_t>& output) const {
+    size_t size = kFixedHeaderSize + levels.size() * kLevelHeaderSize;
+    for (const Level& level : levels) {
+        size += level.data.size();
+    }
+    output.assign(size, 0);
+
+    uint8_t* out = output.data();
+    memcpy(out, "MVPK", 4);
+    putLE16(out + 4, kVersion);
+    putLE16(out + 6, static_cast<uint16_t>(numChannels));
+    putLE32(out + 8, static_cast<uint32_t>(std::lround(sampleRate)));
+    putLE64(out + 12, numFrames);
+    putLE32(out + 20, static_cast<uint32_t>(levels.size()));
+    out += kFixedHeaderSize;
+    for (const Level& level : levels) {
+        putLE32(out, level.bucketSize);
+        putLE32(out + 4, static_cast<uint32_t>(level.data.size() / (numChannels * kBucketChannelSize)));
+        out += kLevelHeaderSize;
+    }
+    for (const Level& level : levels) {
+        if (!level.data.empty()) {
+            memcpy(out, level.data.data(), level.data.size());
+            out += level.data.size();
+        }
+    }
+}
+
+uint64_t PeakPyramid::getNumFrames() const {
+    return numFrames;
+}
+
+size_t PeakPyramid::getNumLevels() const {
+    return levels.size();
+}
+
+uint32_t PeakPyramid::getBucketSize(size_t level) const {
+    return level < levels.size() ? levels[level].bucketSize : 0;
+}
+
+size_t PeakPyramid::getNumBuckets(size_t level) const {
+    return level < levels.size() ? levels[level].data.size() / (numChannels * kBucketChannelSize) : 0;
+}
+
+std::string PeakPyramid::sidecarPath(const std::string& audioPath) {
+    return fs::path(audioPath).replace_extension(kExtension).string();
+}
+
+bool PeakPyramid::readFile(const std::string& filePath, uint32_t bucketSize, std::vector<uint8_t>& output) {
+    std::ifstream file(filePath, std::ios::binary);
+    if (!file) {
+        return false;
+    }
+    std::vector<uint8_t> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    // Validate the header and that the levels add up to the file size
+    if (bytes.size() < kFixedHeaderSize || memcmp(bytes.data(), "MVPK", 4) != 0 ||
+        getLE16(bytes.data() + 4) != kVersion) {
+        return false;
+    }
+    uint16_t channels = getLE16(bytes.data() + 6);
+    uint32_t numLevels = getLE32(bytes.data() + 20);
+    size_t dataOffset = kFixedHeaderSize + static_cast<size_t>(numLevels) * kLevelHeaderSize;
+    if (channels == 0 || bytes.size() < dataOffset) {
+        return false;
+    }
+    size_t offset = dataOffset;
+    size_t selectedOffset = 0;
+    size_t selectedSize = 0;
+    size_t selectedLevel = numLevels;
+    for (uint32_t i = 0; i < numLevels; ++i) {
+        const uint8_t* entry = bytes.data() + kFixedHeaderSize + i * kLevelHeaderSize;
+        size_t levelSize = static_cast<size_t>(getLE32(entry + 4)) * channels * kBucketChannelSize;
+        if (getLE32(entry) == bucketSize) {
+            selectedLevel = i;
+            selectedOffset = offset;
+            selectedSize = levelSize;
+        }
+        offset += levelSize;
+    }
+    if (offset != bytes.size()) {
+        return false;
+    }
+
+    if (bucketSize == 0) {
+        output = std::move(bytes);
+        return true;
+    }
+    if (selectedLevel == numLevels) {
+        return false;
+    }
+
+    output.resize(kFixedHeaderSize + kLevelHeaderSize + selectedSize);
+    memcpy(output.data(), bytes.data(), kFixedHeaderSize);
+    putLE32(output.data() + 20, 1);
+    memcpy(output.data() + kFixedHeaderSize, bytes.data() + kFixedHeaderSize + selectedLevel * kLevelHeaderSize,
+           kLevelHeaderSize);
+    if (selectedSize > 0) {
+        memcpy(output.data() + kFixedHeaderSize + kLevelHeaderSize, bytes.data() + selectedOffset, selectedSize);
+    }
+    return true;
+}
+
+const char* PeakPyramid::getKernelName() {
+    return getKernelChoice().name;
+}
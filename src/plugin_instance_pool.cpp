@@ -0,0 +1,257 @@
+#include "plugin_instance_pool.h"
+#include "logger.h"
+#include <algorithm>
+#include <cstdio>
+
+#ifdef USE_JUCE
+#include <juce_audio_processors/juce_audio_processors.h>
+#else
+#include "synth_engine.h"
+#endif
+
+#if defined(__APPLE__)
+#include <mach/mach.h>
+#elif defined(__linux__)
+#include <unistd.h>
+#endif
+
+bool PluginInstanceKey::operator==(const PluginInstanceKey& other) const {
+    return path == other.path && sampleRate == other.sampleRate &&
+           blockSize == other.blockSize && numChannels == other.numChannels;
+}
+
+bool PluginInstanceKey::operator!=(const PluginInstanceKey& other) const {
+    return !(*this == other);
+}
+
+double PluginInstancePool::Stats::getHitRate() const {
+    uint64_t lookups = hits + misses;
+    return lookups > 0 ? static_cast<double>(hits) / lookups : 0.0;
+}
+
+double PluginInstancePool::Stats::getAverageLoadSeconds() const {
+    uint64_t loads = misses - std::min(misses, loadFailures);
+    return loads > 0 ? totalLoadSeconds / loads : 0.0;
+}
+
+PluginInstancePool::PluginInstancePool() : PluginInstancePool(Config()) {
+}
+
+PluginInstancePool::PluginInstancePool(const Config& config) : config(config) {
+#ifdef USE_JUCE
+    formatManager = std::make_unique<juce::AudioPluginFormatManager>();
+    formatManager->addDefaultFormats();
+#endif
+}
+
+PluginInstancePool::~PluginInstancePool() {
+    clear();
+#ifdef USE_JUCE
+    formatManager.reset();
+#endif
+}
+
+std::unique_ptr<PluginInstance> PluginInstancePool::acquire(const PluginInstanceKey& key) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto it = idle.begin(); it != idle.end(); ++it) {
+            if (it->key == key) {
+                std::unique_ptr<PluginInstance> instance = std::move(it->instance);
+                active.emplace_back(instance.get(), it->memoryBytes);
+                idle.erase(it);
+                ++stats.hits;
+                --stats.idleInstances;
+                ++stats.activeInstances;
+                return instance;
+            }
+        }
+        ++stats.misses;
+    }
+
+    // Load outside the lock; large instruments can take seconds
+    double loadSeconds = 0.0;
+    size_t memoryBytes = 0;
+    std::unique_ptr<PluginInstance> instance = loadInstance(key, loadSeconds, memoryBytes);
+
+    std::list<IdleEntry> evicted;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!instance) {
+            ++stats.loadFailures;
+            return nullptr;
+        }
+
+        stats.totalLoadSeconds += loadSeconds;
+        stats.maxLoadSeconds = std::max(stats.maxLoadSeconds, loadSeconds);
+        active.emplace_back(instance.get(), memoryBytes);
+        ++stats.activeInstances;
+        stats.memoryBytes += memoryBytes;
+        enforceLimits(evicted);
+    }
+
+    LOG_INFO("Loaded plugin instance for " << key.path << " in " << loadSeconds << " seconds");
+    return instance;
+}
+
+void PluginInstancePool::release(const PluginInstanceKey& key, std::unique_ptr<PluginInstance> instance) {
+    if (!instance) {
+        return;
+    }
+
+    resetInstance(*instance);
+
+    std::list<IdleEntry> evicted;
+    std::lock_guard<std::mutex> lock(mutex);
+
+    // Instances that didn't come from this pool are adopted with an unknown footprint
+    size_t memoryBytes = 0;
+    auto it = std::find_if(active.begin(), active.end(),
+                           [&instance](const auto& entry) { return entry.first == instance.get(); });
+    if (it != active.end()) {
+        memoryBytes = it->second;
+        active.erase(it);
+        --stats.activeInstances;
+    }
+
+    idle.push_front(IdleEntry{key, std::move(instance), memoryBytes});
+    ++stats.idleInstances;
+    enforceLimits(evicted);
+}
+
+void PluginInstancePool::setConfig(const Config& config) {
+    std::list<IdleEntry> evicted;
+    std::lock_guard<std::mutex> lock(mutex);
+    this->config = config;
+    enforceLimits(evicted);
+}
+
+PluginInstancePool::Config PluginInstancePool::getConfig() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return config;
+}
+
+PluginInstancePool::Stats PluginInstancePool::getStats() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return stats;
+}
+
+void PluginInstancePool::clear() {
+    std::list<IdleEntry> evicted;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const IdleEntry& entry : idle) {
+            stats.memoryBytes -= std::min(stats.memoryBytes, entry.memoryBytes);
+        }
+        evicted.swap(idle);
+        stats.idleInstances = 0;
+    }
+}
+
+void PluginInstancePool::enforceLimits(std::list<IdleEntry>& evicted) {
+    auto overLimit = [this]() {
+        size_t total = idle.size() + active.size();
+        return total > config.maxInstances ||
+               (config.maxMemoryBytes > 0 && stats.memoryBytes > config.maxMemoryBytes);
+    };
+
+    while (!idle.empty() && overLimit()) {
+        IdleEntry& victim = idle.back();
+        LOG_INFO("Evicting idle plugin instance for " << victim.key.path);
+        stats.memoryBytes -= std::min(stats.memoryBytes, victim.memoryBytes);
+        ++stats.evictions;
+        --stats.idleInstances;
+        evicted.splice(evicted.end(), idle, std::prev(idle.end()));
+    }
+}
+
+PluginInstancePool::LoadMeasurement::LoadMeasurement(double& loadSeconds, size_t& memoryBytes)
+    : loadSeconds(loadSeconds), memoryBytes(memoryBytes), residentBefore(currentResidentBytes()),
+      start(std::chrono::steady_clock::now()) {
+}
+
+PluginInstancePool::LoadMeasurement::~LoadMeasurement() {
+    loadSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    size_t residentAfter = currentResidentBytes();
+    memoryBytes = residentAfter > residentBefore ? residentAfter - residentBefore : 0;
+}
+
+#ifdef USE_JUCE
+std::unique_ptr<PluginInstance> PluginInstancePool::loadInstance(const PluginInstanceKey& key, double& loadSeconds,
+                                                                 size_t& memoryBytes) {
+    // Loads are serialized; measuring only once the lock is held keeps the wait
+    // for other loads out of this one's time and memory
+    std::lock_guard<std::mutex> lock(loadMutex);
+    LoadMeasurement measurement(loadSeconds, memoryBytes);
+    LOG_INFO("Loading VST plugin with JUCE: " << key.path);
+
+    juce::String errorMessage;
+    juce::String pluginPath = juce::String(key.path);
+    juce::AudioPluginFormat* format = nullptr;
+
+    // Look for the appropriate format
+    for (int i = 0; i < formatManager->getNumFormats(); ++i) {
+        format = formatManager->getFormat(i);
+        if (format->fileMightContainThisPluginType(pluginPath)) {
+            break;
+        }
+    }
+
+    if (format == nullptr) {
+        LOG_ERROR("No suitable plugin format found for: " << key.path);
+        return nullptr;
+    }
+
+    juce::PluginDescription description;
+    description.fileOrIdentifier = pluginPath;
+
+    std::unique_ptr<juce::AudioPluginInstance> instance(
+        format->createInstanceFromDescription(description, key.sampleRate, key.blockSize, errorMessage));
+
+    if (instance == nullptr) {
+        LOG_ERROR("Failed to load VST plugin: " << errorMessage.toStdString());
+        return nullptr;
+    }
+
+    // Prepare once; the instance stays prepared for as long as it is pooled
+    instance->prepareToPlay(key.sampleRate, key.blockSize);
+
+    LOG_INFO("Successfully loaded VST plugin: " << instance->getName().toStdString());
+    return instance;
+}
+#else
+std::unique_ptr<PluginInstance> PluginInstancePool::loadInstance(const PluginInstanceKey& key, double& loadSeconds,
+                                                                 size_t& memoryBytes) {
+    LoadMeasurement measurement(loadSeconds, memoryBytes);
+    auto instance = std::make_unique<SynthEngine>();
+    instance->prepare(key.sampleRate, key.numChannels, key.blockSize);
+    return instance;
+}
+#endif
+
+void PluginInstancePool::resetInstance(PluginInstance& instance) {
+    // Clears voices and effect tails so the next job starts from silence
+    instance.reset();
+}
+
+size_t PluginInstancePool::currentResidentBytes() {
+#if defined(__APPLE__)
+    mach_task_basic_info_data_t info;
+    mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+    if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, reinterpret_cast<task_info_t>(&info), &count) == KERN_SUCCESS) {
+        return static_cast<size_t>(info.resident_size);
+    }
+    return 0;
+#elif defined(__linux__)
+    FILE* statm = fopen("/proc/self/statm", "r");
+    if (!statm) {
+        return 0;
+    }
+    unsigned long totalPages = 0;
+    unsigned long residentPages = 0;
+    int fields = fscanf(statm, "%lu %lu", &totalPages, &residentPages);
+    fclose(statm);
+    return fields == 2 ? static_cast<size_t>(residentPages) * static_cast<size_t>(sysconf(_SC_PAGESIZE)) : 0;
+#else
+    return 0;
+#endif
+}
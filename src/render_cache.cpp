@@ -0,0 +1,290 @@
+#include "render_cache.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include "hash.h"
+#include "logger.h"
+#include "peak_pyramid.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+    // Part of every key. Bump it with any change that can alter the rendered or
+    // encoded bytes for the same inputs (rendering, conversion, dither, encoders),
+    // so entries from older builds are never served.
+    constexpr uint32_t kRenderVersion = 2;
+    // Seeds of the two halves of the 128-bit key
+    constexpr uint64_t kKeySeedLow = 0;
+    constexpr uint64_t kKeySeedHigh = 0x6D69646976657273ULL;
+
+    constexpr size_t kKeyLength = 32;
+
+    bool isRenderExtension(const fs::path& extension) {
+        return extension == ".wav" || extension == ".flac";
+    }
+
+    void appendBytes(std::vector<uint8_t>& out, const void* data, size_t size) {
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        out.insert(out.end(), bytes, bytes + size);
+    }
+
+    template <typename T>
+    void appendValue(std::vector<uint8_t>& out, T value) {
+        appendBytes(out, &value, sizeof(value));
+    }
+
+    // The file to stat for a plugin's identity. Bundles (.vst3, .component, macOS
+    // .vst) are directories whose timestamp does not change when the binary is
+    // replaced, so they resolve to the newest <name>, <name>.so or <name>.vst3
+    // under Contents/<platform>/. Anything else is the path itself.
+    fs::path pluginBinaryPath(const fs::path& pluginPath) {
+        std::error_code ec;
+        if (!fs::is_directory(pluginPath, ec)) {
+            return pluginPath;
+        }
+        fs::path stem = pluginPath.filename().stem();
+        fs::path binary = pluginPath;
+        fs::file_time_type newest = fs::file_time_type::min();
+        for (const auto& platform : fs::directory_iterator(pluginPath / "Contents", ec)) {
+            for (const fs::path& name : {stem, fs::path(stem).concat(".so"), fs::path(stem).concat(".vst3")}) {
+                fs::path candidate = platform.path() / name;
+                if (!fs::is_regular_file(candidate, ec)) {
+                    continue;
+                }
+                fs::file_time_type modified = fs::last_write_time(candidate, ec);
+                if (!ec && modified > newest) {
+                    newest = modified;
+                    binary = candidate;
+                }
+            }
+        }
+        return binary;
+    }
+
+    bool isKey(const std::string& name) {
+        return name.size() == kKeyLength &&
+               std::all_of(name.begin(), name.end(), [](char c) { return isxdigit(static_cast<unsigned char>(c)) && !isupper(static_cast<unsigned char>(c)); });
+    }
+}
+
+RenderCache::RenderCache(const std::string& directory, uint64_t maxBytes)
+    : directory(directory), maxBytes(maxBytes) {
+    stats.maxBytes = maxBytes;
+}
+
+bool RenderCache::open() {
+    std::error_code ec;
+    fs::create_directories(directory, ec);
+    if (!fs::is_directory(directory, ec)) {
+        LOG_ERROR("Could not create render cache directory: " << directory);
+        return false;
+    }
+
+    struct Found {
+        std::string key;
+        std::string extension;
+        uint64_t bytes;
+        fs::file_time_type modified;
+    };
+    std::vector<Found> found;
+
+    for (const fs::directory_entry& entry : fs::directory_iterator(directory, ec)) {
+        // Leftovers of renders interrupted by a crash
+        if (entry.path().extension() == ".tmp") {
+            std::error_code removeError;
+            fs::remove(entry.path(), removeError);
+            continue;
+        }
+        if (!entry.is_regular_file(ec) || !isRenderExtension(entry.path().extension())) {
+            continue;
+        }
+        std::string stem = entry.path().stem().string();
+        if (!isKey(stem)) {
+            continue;
+        }
+        found.push_back({stem, entry.path().extension().string(), static_cast<uint64_t>(entry.file_size(ec)),
+                         entry.last_write_time(ec)});
+    }
+
+    // Newest first, matching the LRU order
+    std::sort(found.begin(), found.end(), [](const Found& a, const Found& b) { return a.modified > b.modified; });
+
+    std::lock_guard<std::mutex> lock(mutex);
+    lru.clear();
+    index.clear();
+    stats.totalBytes = 0;
+    for (const Found& f : found) {
+        lru.push_back({f.key, f.extension, f.bytes});
+        index[f.key] = std::prev(lru.end());
+        stats.totalBytes += f.bytes;
+    }
+    stats.entries = lru.size();
+    evict();
+
+    // Peaks of renders that are no longer stored
+    for (const fs::directory_entry& entry : fs::directory_iterator(directory, ec)) {
+        if (entry.path().extension() == PeakPyramid::kExtension && !index.count(entry.path().stem().string())) {
+            std::error_code removeError;
+            fs::remove(entry.path(), removeError);
+        }
+    }
+
+    LOG_INFO("Render cache: " << stats.entries << " entries, " << stats.totalBytes / (1024 * 1024)
+             << " MB in " << directory);
+    return true;
+}
+
+std::string RenderCache::makeKey(const RenderCacheKeyInput& input) {
+    std::vector<uint8_t> keyData;
+    appendValue(keyData, kRenderVersion);
+
+    // The MIDI contents are hashed separately so the key buffer stays small
+    uint64_t midiHash = input.midiData ? xxHash64(input.midiData->data(), input.midiData->size()) : 0;
+    uint64_t midiSize = input.midiData ? input.midiData->size() : 0;
+    appendValue(keyData, midiHash);
+    appendValue(keyData, midiSize);
+
+    // Plugin identity; a missing path still keys on the name alone
+    std::error_code ec;
+    uint64_t pluginSize = 0;
+    int64_t pluginModified = 0;
+    fs::path pluginBinary = pluginBinaryPath(input.vstPath);
+    if (fs::exists(pluginBinary, ec)) {
+        if (fs::is_regular_file(pluginBinary, ec)) {
+            pluginSize = fs::file_size(pluginBinary, ec);
+        }
+        pluginModified = fs::last_write_time(pluginBinary, ec).time_since_epoch().count();
+    }
+    appendValue(keyData, static_cast<uint64_t>(input.vstPath.size()));
+    appendBytes(keyData, input.vstPath.data(), input.vstPath.size());
+    appendValue(keyData, pluginSize);
+    appendValue(keyData, pluginModified);
+
+    // Render parameters
+    appendValue(keyData, input.sampleRate);
+    appendValue(keyData, static_cast<int32_t>(input.numChannels));
+    appendValue(keyData, static_cast<int32_t>(input.sampleFormat));
+    appendValue(keyData, static_cast<uint8_t>(input.dither));
+    // Tail settings only affect adaptive tails, so fixed-tail renders share a key
+    if (input.tail.isAdaptive()) {
+        appendValue(keyData, input.tail.thresholdDb);
+        appendValue(keyData, input.tail.holdSeconds);
+        appendValue(keyData, input.tail.maxSeconds);
+    }
+    // The container is keyed for FLAC only, with its level; WAV is the default
+    if (input.fileFormat == AudioFileFormat::Flac) {
+        appendValue(keyData, static_cast<int32_t>(input.fileFormat));
+        appendValue(keyData, static_cast<int32_t>(input.flacLevel));
+    }
+
+    char hex[kKeyLength + 1];
+    snprintf(hex, sizeof(hex), "%016llx%016llx",
+             static_cast<unsigned long long>(xxHash64(keyData.data(), keyData.size(), kKeySeedHigh)),
+             static_cast<unsigned long long>(xxHash64(keyData.data(), keyData.size(), kKeySeedLow)));
+    return hex;
+}
+
+bool RenderCache::lookup(const std::string& key, std::string& filePath, bool recordStats) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = index.find(key);
+    if (it == index.end()) {
+        stats.misses += recordStats;
+        return false;
+    }
+
+    // The file may have been removed behind our back
+    std::error_code ec;
+    std::string path = pathFor(*it->second);
+    if (!fs::exists(path, ec)) {
+        fs::remove(getPeaksPath(key), ec);
+        stats.totalBytes -= std::min(stats.totalBytes, it->second->bytes);
+        lru.erase(it->second);
+        index.erase(it);
+        stats.entries = lru.size();
+        stats.misses += recordStats;
+        return false;
+    }
+
+    lru.splice(lru.begin(), lru, it->second);
+    stats.hits += recordStats;
+    filePath = path;
+    return true;
+}
+
+bool RenderCache::insert(const std::string& key, const std::string& renderedFile, const std::string& extension,
+                         std::string& filePath) {
+    std::string path = (fs::path(directory) / (key + extension)).string();
+    std::error_code ec;
+    uint64_t bytes = fs::file_size(renderedFile, ec);
+    if (ec) {
+        LOG_ERROR("Render cache: missing rendered file " << renderedFile);
+        return false;
+    }
+
+    // Rename is atomic, so readers never see a partially written entry
+    fs::rename(renderedFile, path, ec);
+    if (ec) {
+        LOG_ERROR("Render cache: could not store " << renderedFile << ": " << ec.message());
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = index.find(key);
+    if (it != index.end()) {
+        // Another job rendered the same key; the file was replaced with identical content
+        if (it->second->extension != extension) {
+            fs::remove(pathFor(*it->second), ec);
+        }
+        stats.totalBytes -= std::min(stats.totalBytes, it->second->bytes);
+        lru.erase(it->second);
+        index.erase(it);
+    }
+
+    lru.push_front({key, extension, bytes});
+    index[key] = lru.begin();
+    stats.totalBytes += bytes;
+    stats.entries = lru.size();
+    ++stats.insertions;
+
+    filePath = path;
+    evict();
+    return true;
+}
+
+std::string RenderCache::getTempPath(const std::string& key, const std::string& suffix) const {
+    return (fs::path(directory) / (key + "." + suffix + ".tmp")).string();
+}
+
+std::string RenderCache::getPeaksPath(const std::string& key) const {
+    return (fs::path(directory) / (key + PeakPyramid::kExtension)).string();
+}
+
+RenderCache::Stats RenderCache::getStats() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return stats;
+}
+
+std::string RenderCache::pathFor(const Entry& entry) const {
+    return (fs::path(directory) / (entry.key + entry.extension)).string();
+}
+
+void RenderCache::removeFiles(const Entry& entry) const {
+    std::error_code ec;
+    fs::remove(pathFor(entry), ec);
+    fs::remove(getPeaksPath(entry.key), ec);
+}
+
+void RenderCache::evict() {
+    // Always keep the most recent entry, even if it alone exceeds the budget
+    while (maxBytes > 0 && stats.totalBytes > maxBytes && lru.size() > 1) {
+        const Entry& victim = lru.back();
+        removeFiles(victim);
+        stats.totalBytes -= std::min(stats.totalBytes, victim.bytes);
+        ++stats.evictions;
+        index.erase(victim.key);
+        lru.pop_back();
+    }
+    stats.entries = lru.size();
+}
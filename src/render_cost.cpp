@@ -0,0 +1,40 @@
+#include "render_cost.h"
+#include <algorithm>
+
+namespace {
+    double smooth(double average, double sample) {
+        return average + RenderCostModel::kSmoothing * (sample - average);
+    }
+}
+
+RenderCostModel::RenderCostModel() : secondsPerWork(kDefaultSecondsPerWork), learned(false) {
+}
+
+double RenderCostModel::workOf(const MidiFileInfo& info) {
+    return info.durationSeconds * std::max(1.0, static_cast<double>(info.averageVoices));
+}
+
+double RenderCostModel::estimateSeconds(const std::string& vstPath, double work) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = pluginSecondsPerWork.find(vstPath);
+    return work * (it != pluginSecondsPerWork.end() ? it->second : secondsPerWork);
+}
+
+void RenderCostModel::observe(const std::string& vstPath, double work, double renderSeconds) {
+    if (work <= 0.0 || renderSeconds < 0.0) {
+        return;
+    }
+    double sample = renderSeconds / work;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    // The first job replaces the default outright, which may be far off
+    secondsPerWork = learned ? smooth(secondsPerWork, sample) : sample;
+    learned = true;
+
+    auto it = pluginSecondsPerWork.find(vstPath);
+    if (it != pluginSecondsPerWork.end()) {
+        it->second = smooth(it->second, sample);
+    } else if (pluginSecondsPerWork.size() < kMaxPlugins) {
+        pluginSecondsPerWork.emplace(vstPath, sample);
+    }
+}
@@ -0,0 +1,130 @@
+#include "render_metrics.h"
+
+namespace {
+    const char* const kJobResultNames[] = {"completed", "failed", "cached", "rejected"};
+    const char* const kOtherPlugin = "other";
+}
+
+RenderMetrics::RenderMetrics()
+    : stageSeconds{Histogram(Histogram::latencyBounds()), Histogram(Histogram::latencyBounds()),
+                   Histogram(Histogram::latencyBounds()), Histogram(Histogram::latencyBounds()),
+                   Histogram(Histogram::latencyBounds())},
+      queueWaitSeconds(Histogram::latencyBounds()), bytesWritten(0), activeJobs(0) {
+    for (std::atomic<uint64_t>& jobCount : jobCounts) {
+        jobCount.store(0, std::memory_order_relaxed);
+    }
+}
+
+void RenderMetrics::observeStage(RenderStage stage, double seconds) {
+    stageSeconds[static_cast<int>(stage)].observe(seconds);
+}
+
+void RenderMetrics::observeQueueWait(double seconds) {
+    queueWaitSeconds.observe(seconds);
+}
+
+void RenderMetrics::countJob(JobResult result) {
+    jobCounts[static_cast<int>(result)].fetch_add(1, std::memory_order_relaxed);
+}
+
+void RenderMetrics::addBytesWritten(uint64_t bytes) {
+    bytesWritten.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+void RenderMetrics::jobStarted() {
+    activeJobs.fetch_add(1, std::memory_order_relaxed);
+}
+
+void RenderMetrics::jobFinished() {
+    activeJobs.fetch_sub(1, std::memory_order_relaxed);
+}
+
+RenderMetrics::PluginMetrics& RenderMetrics::getPlugin(const std::string& vstPath) {
+    std::lock_guard<std::mutex> lock(pluginMutex);
+    auto it = plugins.find(vstPath);
+    if (it == plugins.end()) {
+        // Bounded so arbitrary request paths can't grow the scrape without limit
+        const std::string& key = plugins.size() < kMaxPlugins ? vstPath : kOtherPlugin;
+        it = plugins.find(key);
+        if (it == plugins.end()) {
+            it = plugins.emplace(key, std::make_unique<PluginMetrics>()).first;
+        }
+    }
+    return *it->second;
+}
+
+void RenderMetrics::observeRender(PluginMetrics& plugin, double audioSeconds, double renderSeconds) {
+    plugin.jobs.fetch_add(1, std::memory_order_relaxed);
+    plugin.renderMicroseconds.fetch_add(static_cast<uint64_t>(renderSeconds * 1e6), std::memory_order_relaxed);
+    plugin.audioMicroseconds.fetch_add(static_cast<uint64_t>(audioSeconds * 1e6), std::memory_order_relaxed);
+    if (renderSeconds > 0.0) {
+        plugin.realtimeFactor.observe(audioSeconds / renderSeconds);
+    }
+}
+
+void RenderMetrics::write(std::string& out) const {
+    prometheus::writeHeader(out, "midiverse_render_stage_seconds", "histogram",
+                            "Time spent in each stage of a render job");
+    for (int i = 0; i < static_cast<int>(RenderStage::Count); ++i) {
+        stageSeconds[i].write(out, "midiverse_render_stage_seconds",
+                              prometheus::label("stage", stageName(static_cast<RenderStage>(i))));
+    }
+
+    prometheus::writeHeader(out, "midiverse_queue_wait_seconds", "histogram",
+                            "Time render jobs waited for a worker");
+    queueWaitSeconds.write(out, "midiverse_queue_wait_seconds", "");
+
+    prometheus::writeHeader(out, "midiverse_jobs_total", "counter",
+                            "Render jobs by result; cached jobs were answered without rendering");
+    for (int i = 0; i <= static_cast<int>(JobResult::Rejected); ++i) {
+        prometheus::writeSample(out, "midiverse_jobs_total", prometheus::label("result", kJobResultNames[i]),
+                                static_cast<double>(jobCounts[i].load(std::memory_order_relaxed)));
+    }
+
+    prometheus::writeMetric(out, "midiverse_active_jobs", "gauge", "Render jobs running on a worker",
+                            static_cast<double>(activeJobs.load(std::memory_order_relaxed)));
+    prometheus::writeMetric(out, "midiverse_written_bytes_total", "counter", "Bytes of rendered audio files written",
+                            static_cast<double>(bytesWritten.load(std::memory_order_relaxed)));
+
+    std::lock_guard<std::mutex> lock(pluginMutex);
+    prometheus::writeHeader(out, "midiverse_plugin_realtime_factor", "histogram",
+                            "Seconds of audio rendered per second of wall time, per job");
+    for (const auto& entry : plugins) {
+        entry.second->realtimeFactor.write(out, "midiverse_plugin_realtime_factor",
+                                           prometheus::label("plugin", entry.first));
+    }
+    prometheus::writeHeader(out, "midiverse_plugin_render_seconds_total", "counter",
+                            "Wall time spent rendering, per plugin");
+    for (const auto& entry : plugins) {
+        prometheus::writeSample(out, "midiverse_plugin_render_seconds_total", prometheus::label("plugin", entry.first),
+                                entry.second->renderMicroseconds.load(std::memory_order_relaxed) / 1e6);
+    }
+    prometheus::writeHeader(out, "midiverse_plugin_audio_seconds_total", "counter",
+                            "Seconds of audio rendered, per plugin");
+    for (const auto& entry : plugins) {
+        prometheus::writeSample(out, "midiverse_plugin_audio_seconds_total", prometheus::label("plugin", entry.first),
+                                entry.second->audioMicroseconds.load(std::memory_order_relaxed) / 1e6);
+    }
+    prometheus::writeHeader(out, "midiverse_plugin_jobs_total", "counter", "Render jobs completed, per plugin");
+    for (const auto& entry : plugins) {
+        prometheus::writeSample(out, "midiverse_plugin_jobs_total", prometheus::label("plugin", entry.first),
+                                static_cast<double>(entry.second->jobs.load(std::memory_order_relaxed)));
+    }
+    prometheus::writeHeader(out, "midiverse_plugin_failures_total", "counter", "Failed render jobs, per plugin");
+    for (const auto& entry : plugins) {
+        prometheus::writeSample(out, "midiverse_plugin_failures_total", prometheus::label("plugin", entry.first),
+                                static_cast<double>(entry.second->failures.load(std::memory_order_relaxed)));
+    }
+}
+
+const char* RenderMetrics::stageName(RenderStage stage) {
+    switch (stage) {
+        case RenderStage::MidiLoad: return "midi_load";
+        case RenderStage::PluginLoad: return "plugin_load";
+        case RenderStage::Render: return "render";
+        case RenderStage::Encode: return "encode";
+        case RenderStage::Write: return "write";
+        case RenderStage::Count: break;
+    }
+    return "unknown";
+}
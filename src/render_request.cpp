@@ -0,0 +1,154 @@
+#include "render_request.h"
+#include <cstdlib>
+
+namespace {
+    // Rejects NaN too; the upper bounds keep output buffers to a sane size
+    bool validateOutputFormat(const RenderJobRequest& request, std::string& error) {
+        if (!(request.sampleRate > 0 && request.sampleRate <= kMaxRequestSampleRate) ||
+            request.numChannels < 1 || request.numChannels > kMaxRequestChannels) {
+            error = "Invalid sampleRate or numChannels (up to " + std::to_string(static_cast<int>(kMaxRequestSampleRate)) +
+                    " Hz and " + std::to_string(kMaxRequestChannels) + " channels)";
+            return false;
+        }
+        return true;
+    }
+
+    bool parseTail(const std::string& mode, RenderTail& tail, std::string& error) {
+        if (mode == "fixed") {
+            tail.mode = RenderTail::Mode::Fixed;
+        } else if (mode == "adaptive") {
+            tail.mode = RenderTail::Mode::Adaptive;
+        } else {
+            error = "Unknown tail mode: " + mode;
+            return false;
+        }
+        if (tail.holdSeconds < 0 || tail.maxSeconds < 0) {
+            error = "Invalid tailHoldSeconds or tailMaxSeconds";
+            return false;
+        }
+        return true;
+    }
+
+    // Needs the sample format, so runs after it is known
+    bool parseFileFormat(const std::string& name, int level, RenderJobRequest& request, std::string& error) {
+        if (!AudioWriter::parseFileFormat(name, request.fileFormat)) {
+            error = "Unknown fileFormat: " + name;
+            return false;
+        }
+        if (request.fileFormat != AudioFileFormat::Flac) {
+            return true;
+        }
+        if (request.sampleFormat != SampleFormat::Int16 && request.sampleFormat != SampleFormat::Int24) {
+            error = "FLAC output needs a bitDepth of 16 or 24";
+            return false;
+        }
+        if (request.numChannels > FlacEncoder::kMaxChannels) {
+            error = "FLAC output supports up to " + std::to_string(FlacEncoder::kMaxChannels) + " channels";
+            return false;
+        }
+        if (level < FlacEncoder::kMinLevel || level > FlacEncoder::kMaxLevel) {
+            error = "Invalid compressionLevel: " + std::to_string(level);
+            return false;
+        }
+        request.flacLevel = level;
+        return true;
+    }
+}
+
+bool parseRenderRequest(const std::string& body, RenderJobRequest& request, std::string& error) {
+    crow::json::rvalue json_body = crow::json::load(body);
+    
+    if (!json_body) {
+        error = "Invalid JSON body";
+        return false;
+    }
+    
+    // Extract parameters
+    int bitDepth = 16;
+    bool floatOutput = false;
+    std::string tailMode = "fixed";
+    std::string fileFormat = "wav";
+    int compressionLevel = FlacEncoder::kDefaultLevel;
+    
+    try {
+        if (json_body.has("midiFile")) request.midiFilePath = json_body["midiFile"].s();
+        if (json_body.has("vstPath")) request.vstPath = json_body["vstPath"].s();
+        if (json_body.has("sampleRate")) request.sampleRate = json_body["sampleRate"].d();
+        if (json_body.has("numChannels")) request.numChannels = json_body["numChannels"].i();
+        if (json_body.has("bitDepth")) bitDepth = json_body["bitDepth"].i();
+        if (json_body.has("sampleFormat")) floatOutput = json_body["sampleFormat"].s() == "float";
+        if (json_body.has("dither")) request.dither = json_body["dither"].b();
+        if (json_body.has("tail")) tailMode = json_body["tail"].s();
+        if (json_body.has("tailThresholdDb")) request.tail.thresholdDb = static_cast<float>(json_body["tailThresholdDb"].d());
+        if (json_body.has("tailHoldSeconds")) request.tail.holdSeconds = json_body["tailHoldSeconds"].d();
+        if (json_body.has("tailMaxSeconds")) request.tail.maxSeconds = json_body["tailMaxSeconds"].d();
+        if (json_body.has("fileFormat")) fileFormat = json_body["fileFormat"].s();
+        if (json_body.has("compressionLevel")) compressionLevel = json_body["compressionLevel"].i();
+        if (json_body.has("trace")) request.trace = json_body["trace"].b();
+    } catch (const std::exception& e) {
+        error = std::string("Invalid parameters: ") + e.what();
+        return false;
+    }
+    
+    // Validate required parameters
+    if (request.midiFilePath.empty() || request.vstPath.empty()) {
+        error = "Missing required parameters: midiFile and vstPath";
+        return false;
+    }
+    if (!validateOutputFormat(request, error)) {
+        return false;
+    }
+    if (!parseTail(tailMode, request.tail, error)) {
+        return false;
+    }
+    
+    request.sampleFormat = SampleFormat::Float32;
+    if (!floatOutput && !PcmConverter::formatForBitDepth(bitDepth, request.sampleFormat)) {
+        error = "Unsupported bit depth: " + std::to_string(bitDepth);
+        return false;
+    }
+    
+    return parseFileFormat(fileFormat, compressionLevel, request, error);
+}
+
+bool parseRenderQuery(const crow::query_string& params, RenderJobRequest& request, std::string& error) {
+    int bitDepth = 16;
+    bool floatOutput = false;
+    std::string tailMode = "fixed";
+    std::string fileFormat = "wav";
+    int compressionLevel = FlacEncoder::kDefaultLevel;
+    
+    // Extract parameters
+    if (const char* value = params.get("vstPath")) request.vstPath = value;
+    if (const char* value = params.get("sampleRate")) request.sampleRate = static_cast<float>(atof(value));
+    if (const char* value = params.get("numChannels")) request.numChannels = atoi(value);
+    if (const char* value = params.get("bitDepth")) bitDepth = atoi(value);
+    if (const char* value = params.get("sampleFormat")) floatOutput = std::string(value) == "float";
+    if (const char* value = params.get("dither")) request.dither = std::string(value) == "true" || std::string(value) == "1";
+    if (const char* value = params.get("tail")) tailMode = value;
+    if (const char* value = params.get("tailThresholdDb")) request.tail.thresholdDb = static_cast<float>(atof(value));
+    if (const char* value = params.get("tailHoldSeconds")) request.tail.holdSeconds = atof(value);
+    if (const char* value = params.get("tailMaxSeconds")) request.tail.maxSeconds = atof(value);
+    if (const char* value = params.get("fileFormat")) fileFormat = value;
+    if (const char* value = params.get("compressionLevel")) compressionLevel = atoi(value);
+    
+    // Validate required parameters
+    if (request.vstPath.empty()) {
+        error = "Missing required parameter: vstPath";
+        return false;
+    }
+    if (!validateOutputFormat(request, error)) {
+        return false;
+    }
+    if (!parseTail(tailMode, request.tail, error)) {
+        return false;
+    }
+    
+    request.sampleFormat = SampleFormat::Float32;
+    if (!floatOutput && !PcmConverter::formatForBitDepth(bitDepth, request.sampleFormat)) {
+        error = "Unsupported bit depth: " + std::to_string(bitDepth);
+        return false;
+    }
+    
+    return parseFileFormat(fileFormat, compressionLevel, request, error);
+}
@@ -0,0 +1,467 @@
+#include "render_scheduler.h"
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include "audio_writer.h"
+#include "logger.h"
+#include "midi_index.h"
+#include "midi_processor.h"
+#include "peak_pyramid.h"
+#include "trace.h"
+#include "vst_renderer.h"
+
+namespace fs = std::filesystem;
+
+struct RenderScheduler::WorkerContext {
+    MidiProcessor midiProcessor;
+    VstRenderer vstRenderer;
+    AudioWriter audioWriter;
+    PeakPyramid peaks;
+};
+
+const char* RenderJobInfo::statusName(RenderJobStatus status) {
+    switch (status) {
+        case RenderJobStatus::Queued: return "queued";
+        case RenderJobStatus::Running: return "running";
+        case RenderJobStatus::Completed: return "completed";
+        case RenderJobStatus::Failed: return "failed";
+    }
+    return "unknown";
+}
+
+RenderScheduler::RenderScheduler(const Config& config, std::shared_ptr<PluginInstancePool> pluginPool,
+                                 std::shared_ptr<RenderCache> renderCache, std::shared_ptr<RenderMetrics> metrics)
+    : config(config), pluginPool(std::move(pluginPool)), renderCache(std::move(renderCache)),
+      metrics(std::move(metrics)), stopping(false), nextJobId(0), createdTime(Clock::now()), activeRenders(0) {
+    if (this->config.numWorkers <= 0) {
+        this->config.numWorkers = std::max(1u, std::thread::hardware_concurrency());
+    }
+}
+
+RenderScheduler::~RenderScheduler() {
+    stop();
+}
+
+void RenderScheduler::start() {
+    if (!workers.empty()) {
+        return;
+    }
+
+    stopping = false;
+    for (int i = 0; i < config.numWorkers; i++) {
+        workers.emplace_back(&RenderScheduler::workerLoop, this, i);
+    }
+
+    LOG_INFO("Started " << config.numWorkers << " render workers (queue size "
+             << config.maxQueuedJobs << ")");
+}
+
+void RenderScheduler::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+        for (const auto& entry : queue) {
+            const std::shared_ptr<Job>& job = entry.second;
+            job->status = RenderJobStatus::Failed;
+            job->error = "Server shutting down";
+            job->endTime = Clock::now();
+            finishedJobs.push_back(job->id);
+        }
+        queue.clear();
+    }
+    queueCondition.notify_all();
+
+    for (std::thread& worker : workers) {
+        if (worker.joinable()) {
+            worker.join();
+        }
+    }
+    workers.clear();
+}
+
+bool RenderScheduler::submit(const RenderJobRequest& request, std::string& jobId) {
+    std::string cachedFile;
+    bool cached = false;
+    double work = 0.0;
+    std::vector<uint8_t> midiData;
+    std::ifstream file(request.midiFilePath, std::ios::binary);
+    if (file) {
+        midiData.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        // The cost estimate only needs counts, not the parsed events
+        MidiFileInfo info;
+        if (MidiIndex::scanMidiData(midiData.data(), midiData.size(), info)) {
+            work = RenderCostModel::workOf(info);
+        }
+        // Repeated requests are answered from the cache without queueing
+        if (renderCache && !request.trace) {
+            cached = renderCache->lookup(makeCacheKey(request, midiData), cachedFile);
+        }
+    }
+    double estimatedSeconds = costModel.estimateSeconds(request.vstPath, work);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (stopping || (!cached && queue.size() >= config.maxQueuedJobs)) {
+            if (metrics) {
+                metrics->countJob(RenderMetrics::JobResult::Rejected);
+            }
+            return false;
+        }
+
+        auto job = std::make_shared<Job>();
+        job->id = std::to_string(++nextJobId);
+        job->request = request;
+        job->work = work;
+        job->estimatedSeconds = estimatedSeconds;
+        job->submitTime = Clock::now();
+        jobs[job->id] = job;
+        jobId = job->id;
+
+        if (cached) {
+            job->status = RenderJobStatus::Completed;
+            job->cached = true;
+            job->outputFile = cachedFile;
+            job->progress = 1.0;
+            job->startTime = job->submitTime;
+            job->endTime = job->submitTime;
+            finishedJobs.push_back(job->id);
+            pruneFinishedJobs();
+            if (metrics) {
+                metrics->countJob(RenderMetrics::JobResult::Cached);
+            }
+            return true;
+        }
+
+        job->midiData = std::move(midiData);
+        queue.emplace(queueKey(*job), job);
+        LOG_DEBUG("Job " << job->id << ": estimated " << estimatedSeconds << " s to render (" << work
+                  << " voice-seconds)");
+    }
+    queueCondition.notify_one();
+    return true;
+}
+
+bool RenderScheduler::getJob(const std::string& jobId, RenderJobInfo& info) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = jobs.find(jobId);
+    if (it == jobs.end()) {
+        return false;
+    }
+
+    const Job& job = *it->second;
+    Clock::time_point now = Clock::now();
+    bool started = job.status != RenderJobStatus::Queued;
+    bool finished = job.status == RenderJobStatus::Completed || job.status == RenderJobStatus::Failed;
+
+    info.id = job.id;
+    info.status = job.status;
+    info.progress = job.progress.load();
+    info.outputFile = job.outputFile;
+    info.error = job.error;
+    info.cached = job.cached;
+    info.traceFile = job.traceFile;
+    info.estimatedSeconds = job.estimatedSeconds;
+    info.queuedSeconds = std::chrono::duration<double>((started ? job.startTime : now) - job.submitTime).count();
+    info.renderSeconds = started ? std::chrono::duration<double>((finished ? job.endTime : now) - job.startTime).count() : 0.0;
+    return true;
+}
+
+bool RenderScheduler::tryAcquireRenderSlot() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (stopping || activeRenders >= config.numWorkers) {
+        return false;
+    }
+    ++activeRenders;
+    return true;
+}
+
+void RenderScheduler::releaseRenderSlot() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        --activeRenders;
+    }
+    // A queued job may have been waiting for the slot
+    queueCondition.notify_one();
+}
+
+int RenderScheduler::getNumWorkers() const {
+    return config.numWorkers;
+}
+
+size_t RenderScheduler::getQueueLength() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return queue.size();
+}
+
+void RenderScheduler::workerLoop(int workerIndex) {
+    Tracer::setThreadName("render worker " + std::to_string(workerIndex));
+    WorkerContext context;
+    context.vstRenderer.setInstancePool(pluginPool);
+
+    while (true) {
+        std::shared_ptr<Job> job;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            queueCondition.wait(lock, [this]() {
+                return stopping || (!queue.empty() && activeRenders < config.numWorkers);
+            });
+            if (stopping) {
+                return;
+            }
+            ++activeRenders;
+            job = queue.begin()->second;
+            queue.erase(queue.begin());
+            job->status = RenderJobStatus::Running;
+            job->startTime = Clock::now();
+        }
+        if (metrics) {
+            metrics->observeQueueWait(std::chrono::duration<double>(job->startTime - job->submitTime).count());
+            metrics->jobStarted();
+        }
+
+        std::string outputFile;
+        std::string error;
+        bool ok = false;
+        bool cached = false;
+        uint64_t traceContext = 0;
+        if (job->request.trace) {
+            traceContext = Tracer::newContext();
+            Tracer::beginSession();
+        }
+        try {
+            TraceContextScope traceScope(traceContext);
+            TRACE_SCOPE("job");
+            ok = runJob(*job, context, outputFile, cached, error);
+        } catch (const std::exception& e) {
+            error = e.what();
+        }
+        // Finished jobs are kept for status queries; their MIDI bytes are not needed
+        std::vector<uint8_t>().swap(job->midiData);
+        std::string traceFile;
+        if (traceContext != 0) {
+            traceFile = writeTrace(*job, traceContext);
+            Tracer::endSession();
+        }
+        if (metrics) {
+            metrics->jobFinished();
+            metrics->countJob(!ok ? RenderMetrics::JobResult::Failed
+                              : cached ? RenderMetrics::JobResult::Cached : RenderMetrics::JobResult::Completed);
+            if (!ok) {
+                metrics->getPlugin(job->request.vstPath).failures.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        --activeRenders;
+        job->status = ok ? RenderJobStatus::Completed : RenderJobStatus::Failed;
+        job->outputFile = outputFile;
+        job->error = error;
+        job->cached = cached;
+        job->traceFile = traceFile;
+        job->endTime = Clock::now();
+        if (ok) {
+            job->progress = 1.0;
+        }
+        finishedJobs.push_back(job->id);
+        pruneFinishedJobs();
+    }
+}
+
+bool RenderScheduler::runJob(Job& job, WorkerContext& context, std::string& outputFile, bool& cached,
+                             std::string& error) {
+    const RenderJobRequest& request = job.request;
+
+    LOG_INFO("Job " << job.id << ": rendering " << request.midiFilePath << " with " << request.vstPath);
+
+    // Each stage is timed from the end of the previous one
+    Clock::time_point stageStart = Clock::now();
+    auto endStage = [this, &stageStart](RenderStage stage) {
+        Clock::time_point now = Clock::now();
+        if (metrics) {
+            metrics->observeStage(stage, std::chrono::duration<double>(now - stageStart).count());
+        }
+        stageStart = now;
+    };
+
+    // Parse the bytes read at submit time; read the file only if that failed
+    MidiProcessor& midiProcessor = context.midiProcessor;
+    bool midiLoaded = job.midiData.empty() ? midiProcessor.loadMidiFile(request.midiFilePath)
+                                           : midiProcessor.loadMidiData(job.midiData.data(), job.midiData.size(),
+                                                                        request.midiFilePath);
+    endStage(RenderStage::MidiLoad);
+    if (!midiLoaded) {
+        error = "Failed to load MIDI file";
+        return false;
+    }
+
+    // Key on the bytes actually rendered; an identical job may have finished while this one waited
+    std::string cacheKey;
+    if (renderCache) {
+        cacheKey = makeCacheKey(request, job.midiData.empty() ? midiProcessor.getMidiData() : job.midiData);
+        if (!request.trace && renderCache->lookup(cacheKey, outputFile, false)) {
+            cached = true;
+            return true;
+        }
+    }
+
+    std::string outputPath;
+    if (renderCache) {
+        // Rendered next to the cache and moved in once complete
+        outputPath = renderCache->getTempPath(cacheKey, "job" + job.id);
+    } else {
+        // Create output directory if it doesn't exist
+        fs::path outputDir = "output";
+        if (!fs::exists(outputDir)) {
+            fs::create_directories(outputDir);
+        }
+
+        // The job id keeps concurrent renders of the same file from colliding
+        std::string outputFileName = fs::path(request.midiFilePath).stem().string() + "_" +
+                                     fs::path(request.vstPath).stem().string() + "_" +
+                                     std::to_string(static_cast<int>(request.sampleRate)) + "hz_" +
+                                     job.id + AudioWriter::extensionFor(request.fileFormat);
+        outputPath = (outputDir / outputFileName).string();
+    }
+
+    // Load VST plugin
+    context.vstRenderer.setTail(request.tail);
+    stageStart = Clock::now();
+    bool pluginLoaded = context.vstRenderer.loadVst(request.vstPath, request.sampleRate, request.numChannels);
+    endStage(RenderStage::PluginLoad);
+    if (!pluginLoaded) {
+        error = "Failed to load VST plugin";
+        return false;
+    }
+
+    // Render MIDI through VST, streaming each block into the output file
+    AudioWriter& writer = context.audioWriter;
+    writer.setDither(request.dither);
+    writer.setFileFormat(request.fileFormat);
+    writer.setFlacLevel(request.flacLevel);
+    if (!writer.open(outputPath, request.sampleRate, request.numChannels, request.sampleFormat)) {
+        error = "Failed to write audio file";
+        return false;
+    }
+    // Waveform overview built from the same blocks
+    PeakPyramid& peaks = context.peaks;
+    peaks.begin(request.numChannels, request.sampleRate);
+
+    // Progress is measured against the sequence length; the release tail is not known up front
+    const MidiSequence& sequence = context.midiProcessor.getSequence();
+    double expectedFrames = static_cast<double>(std::max<int64_t>(1, sequence.getLengthInSamples(request.sampleRate)));
+
+    // Time in the writer is taken out of the render and reported as encoding
+    Clock::duration encodeTime = Clock::duration::zero();
+    Clock::time_point renderStart = Clock::now();
+    bool rendered = context.vstRenderer.renderMidi(sequence, request.sampleRate, request.numChannels,
+        [this, &job, &writer, &peaks, &encodeTime, expectedFrames](const float* const* channels, int numFrames) {
+            Clock::time_point blockStart = Clock::now();
+            if (stopping || !writer.appendBlock(channels, numFrames)) {
+                return false;
+            }
+            peaks.addBlock(channels, static_cast<size_t>(numFrames));
+            encodeTime += Clock::now() - blockStart;
+            job.progress = std::min(0.99, writer.getFramesWritten() / expectedFrames);
+            return true;
+        });
+    double renderSeconds = std::chrono::duration<double>(Clock::now() - renderStart - encodeTime).count();
+    if (metrics) {
+        metrics->observeStage(RenderStage::Render, renderSeconds);
+        metrics->observeStage(RenderStage::Encode, std::chrono::duration<double>(encodeTime).count());
+    }
+
+    if (!rendered) {
+        writer.finalize();
+        std::error_code ec;
+        fs::remove(outputPath, ec);
+        error = stopping ? "Server shutting down" : "Failed to render MIDI through VST";
+        return false;
+    }
+
+    stageStart = Clock::now();
+    if (!writer.finalize()) {
+        std::error_code ec;
+        fs::remove(outputPath, ec);
+        error = "Failed to write audio file";
+        return false;
+    }
+
+    if (metrics) {
+        std::error_code ec;
+        metrics->addBytesWritten(fs::file_size(outputPath, ec));
+        metrics->observeRender(metrics->getPlugin(request.vstPath), writer.getFramesWritten() / request.sampleRate,
+                               renderSeconds);
+    }
+    costModel.observe(request.vstPath, job.work, renderSeconds);
+
+    // Written before the render is visible, so a completed job always has its peaks.
+    // Missing peaks only cost the /peaks endpoint, never the job.
+    {
+        TRACE_SCOPE("write peaks");
+        peaks.finish();
+        peaks.writeFile(renderCache ? renderCache->getPeaksPath(cacheKey) : PeakPyramid::sidecarPath(outputPath));
+    }
+
+    if (renderCache) {
+        TRACE_SCOPE("cache insert");
+        if (!renderCache->insert(cacheKey, outputPath, AudioWriter::extensionFor(request.fileFormat), outputFile)) {
+            error = "Failed to store render in cache";
+            return false;
+        }
+        endStage(RenderStage::Write);
+        return true;
+    }
+
+    outputFile = outputPath;
+    endStage(RenderStage::Write);
+    return true;
+}
+
+std::string RenderScheduler::makeCacheKey(const RenderJobRequest& request, const std::vector<uint8_t>& midiData) {
+    RenderCacheKeyInput keyInput;
+    keyInput.midiData = &midiData;
+    keyInput.vstPath = request.vstPath;
+    keyInput.sampleRate = request.sampleRate;
+    keyInput.numChannels = request.numChannels;
+    keyInput.sampleFormat = request.sampleFormat;
+    keyInput.dither = request.dither;
+    keyInput.tail = request.tail;
+    keyInput.fileFormat = request.fileFormat;
+    keyInput.flacLevel = request.flacLevel;
+    return RenderCache::makeKey(keyInput);
+}
+
+double RenderScheduler::queueKey(const Job& job) const {
+    // Every queued job ages at the same rate, so ordering by estimate less aging
+    // times waited is ordering by estimate plus aging times submit time, which
+    // never changes while the job waits
+    double submitSeconds = std::chrono::duration<double>(job.submitTime - createdTime).count();
+    if (config.queuePolicy == QueuePolicy::Fifo) {
+        return submitSeconds;
+    }
+    return job.estimatedSeconds + config.agingRate * submitSeconds;
+}
+
+std::string RenderScheduler::writeTrace(const Job& job, uint64_t traceContext) {
+    std::error_code ec;
+    fs::create_directories(config.traceDirectory, ec);
+    std::string tracePath = (fs::path(config.traceDirectory) / ("job" + job.id + ".json")).string();
+    if (!Tracer::writeJson(tracePath, traceContext)) {
+        return "";
+    }
+    LOG_INFO("Job " << job.id << ": trace written to " << tracePath);
+    return tracePath;
+}
+
+void RenderScheduler::pruneFinishedJobs() {
+    while (finishedJobs.size() > config.maxRetainedJobs) {
+        auto it = jobs.find(finishedJobs.front());
+        if (it != jobs.end() && !it->second->traceFile.empty()) {
+            std::error_code ec;
+            fs::remove(it->second->traceFile, ec);
+        }
+        jobs.erase(finishedJobs.front());
+        finishedJobs.pop_front();
+    }
+}
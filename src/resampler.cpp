@@ -0,0 +1,344 @@
+#include "resampler.h"
+#include "cpu_features.h"
+#include "logger.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MIDIVERSE_X86_KERNELS 1
+#elif defined(__aarch64__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define MIDIVERSE_NEON_KERNELS 1
+#endif
+
+namespace {
+    // 44.1k <-> 48k needs 160 phases; this leaves room for odd rates
+    constexpr int kMaxPhases = 4096;
+
+    struct QualitySettings {
+        int tapsPerPhase;
+        double kaiserBeta;
+        double passband;    // Cutoff as a fraction of the lower Nyquist frequency
+    };
+
+    QualitySettings getQualitySettings(ResamplerQuality quality) {
+        switch (quality) {
+            case ResamplerQuality::Fast: return {16, 6.0, 0.90};
+            case ResamplerQuality::High: return {64, 11.0, 0.97};
+            case ResamplerQuality::Standard:
+            default: return {32, 9.0, 0.94};
+        }
+    }
+
+    // Zeroth-order modified Bessel function of the first kind, for the Kaiser window
+    double besselI0(double x) {
+        double sum = 1.0;
+        double term = 1.0;
+        for (int k = 1; k < 50; ++k) {
+            term *= (x / (2.0 * k)) * (x / (2.0 * k));
+            sum += term;
+            if (term < sum * 1e-12) {
+                break;
+            }
+        }
+        return sum;
+    }
+
+    //===== Dot product kernels =====
+
+    using DotKernel = float (*)(const float* a, const float* b, int n);
+
+    float dotScalar(const float* a, const float* b, int n) {
+        float sum = 0.0f;
+        for (int i = 0; i < n; ++i) {
+            sum += a[i] * b[i];
+        }
+        return sum;
+    }
+
+#ifdef MIDIVERSE_X86_KERNELS
+    __attribute__((target("avx2,fma")))
+    float dotAvx2(const float* a, const float* b, int n) {
+        __m256 sum0 = _mm256_setzero_ps();
+        __m256 sum1 = _mm256_setzero_ps();
+        int i = 0;
+        for (; i + 16 <= n; i += 16) {
+            sum0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), sum0);
+            sum1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), sum1);
+        }
+        __m256 sum = _mm256_add_ps(sum0, sum1);
+        __m128 half = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+        half = _mm_add_ps(half, _mm_movehl_ps(half, half));
+        half = _mm_add_ss(half, _mm_shuffle_ps(half, half, 1));
+        return _mm_cvtss_f32(half) + dotScalar(a + i, b + i, n - i);
+    }
+
+    __attribute__((target("sse4.1")))
+    float dotSse41(const float* a, const float* b, int n) {
+        __m128 sum0 = _mm_setzero_ps();
+        __m128 sum1 = _mm_setzero_ps();
+        int i = 0;
+        for (; i + 8 <= n; i += 8) {
+            sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+            sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+        }
+        __m128 sum = _mm_add_ps(sum0, sum1);
+        sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+        sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+        return _mm_cvtss_f32(sum) + dotScalar(a + i, b + i, n - i);
+    }
+#endif
+
+#ifdef MIDIVERSE_NEON_KERNELS
+    float dotNeon(const float* a, const float* b, int n) {
+        float32x4_t sum0 = vdupq_n_f32(0.0f);
+        float32x4_t sum1 = vdupq_n_f32(0.0f);
+        int i = 0;
+        for (; i + 8 <= n; i += 8) {
+            sum0 = vmlaq_f32(sum0, vld1q_f32(a + i), vld1q_f32(b + i));
+            sum1 = vmlaq_f32(sum1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+        }
+        float32x4_t sum = vaddq_f32(sum0, sum1);
+        float32x2_t pair = vadd_f32(vget_low_f32(sum), vget_high_f32(sum));
+        return vget_lane_f32(vpadd_f32(pair, pair), 0) + dotScalar(a + i, b + i, n - i);
+    }
+#endif
+
+    struct KernelChoice {
+        DotKernel kernel;
+        const char* name;
+    };
+
+    KernelChoice chooseKernel() {
+        const CpuFeatures& cpu = CpuFeatures::get();
+        (void)cpu;
+#ifdef MIDIVERSE_X86_KERNELS
+        if (cpu.avx2 && cpu.fma) return {dotAvx2, "avx2"};
+        if (cpu.sse41) return {dotSse41, "sse4.1"};
+#endif
+#ifdef MIDIVERSE_NEON_KERNELS
+        if (cpu.neon) return {dotNeon, "neon"};
+#endif
+        return {dotScalar, "scalar"};
+    }
+
+    const KernelChoice& getKernelChoice() {
+        static const KernelChoice choice = chooseKernel();
+        return choice;
+    }
+}
+
+Resampler::Resampler()
+    : numChannels(0), upFactor(1), downFactor(1), tapsPerPhase(0), historyStart(0), nextInput(0), nextPhase(0),
+      inputFrames(0), outputFrames(0) {
+}
+
+bool Resampler::configure(double inputRate, double outputRate, int numChannels, ResamplerQuality quality) {
+    int64_t inRate = std::llround(inputRate);
+    int64_t outRate = std::llround(outputRate);
+    if (inRate <= 0 || outRate <= 0 || numChannels <= 0) {
+        LOG_ERROR("Invalid resampler configuration: " << inputRate << " Hz -> " << outputRate << " Hz, "
+                  << numChannels << " channels");
+        return false;
+    }
+
+    int64_t divisor = std::gcd(inRate, outRate);
+    if (outRate / divisor > kMaxPhases) {
+        LOG_ERROR("Unsupported resampling ratio: " << inRate << " Hz -> " << outRate << " Hz");
+        return false;
+    }
+
+    this->numChannels = numChannels;
+    upFactor = static_cast<int>(outRate / divisor);
+    downFactor = static_cast<int>(inRate / divisor);
+
+    QualitySettings settings = getQualitySettings(quality);
+    tapsPerPhase = settings.tapsPerPhase;
+    coefficients.clear();
+
+    if (!isPassThrough()) {
+        // Prototype lowpass at the upsampled rate, cut off below the lower of the
+        // two Nyquist frequencies and centred on tap (length / 2)
+        const int length = tapsPerPhase * upFactor;
+        const double centre = length / 2.0;
+        const double cutoff = settings.passband * 0.5 / std::max(upFactor, downFactor);
+        const double windowScale = 1.0 / besselI0(settings.kaiserBeta);
+
+        std::vector<double> prototype(length);
+        double sum = 0.0;
+        for (int n = 0; n < length; ++n) {
+            double x = n - centre;
+            double sinc = x == 0.0 ? 1.0 : std::sin(2.0 * M_PI * cutoff * x) / (2.0 * M_PI * cutoff * x);
+            double r = x / centre;
+            double window = besselI0(settings.kaiserBeta * std::sqrt(std::max(0.0, 1.0 - r * r))) * windowScale;
+            prototype[n] = sinc * window;
+            sum += prototype[n];
+        }
+
+        // Zero-stuffing divides the level by upFactor; the filter gain restores it
+        double gain = upFactor / sum;
+        coefficients.resize(length);
+        for (int phase = 0; phase < upFactor; ++phase) {
+            float* row = coefficients.data() + static_cast<size_t>(phase) * tapsPerPhase;
+            for (int i = 0; i < tapsPerPhase; ++i) {
+                row[i] = static_cast<float>(prototype[phase + (tapsPerPhase - 1 - i) * upFactor] * gain);
+            }
+        }
+    }
+
+    history.resize(numChannels);
+    reset();
+    return true;
+}
+
+void Resampler::reset() {
+    inputFrames = 0;
+    outputFrames = 0;
+    output.setSize(numChannels, 0);
+    if (isPassThrough()) {
+        return;
+    }
+
+    // Output frame j sits at upsampled position j * downFactor + centre, which
+    // compensates for the filter delay. The history starts far enough back to
+    // cover the first window; input before the stream is silence.
+    int64_t centre = static_cast<int64_t>(tapsPerPhase) * upFactor / 2;
+    nextInput = centre / upFactor;
+    nextPhase = static_cast<int>(centre % upFactor);
+    historyStart = std::min<int64_t>(0, nextInput - tapsPerPhase + 1);
+    for (std::vector<float>& line : history) {
+        line.assign(static_cast<size_t>(-historyStart), 0.0f);
+    }
+}
+
+size_t Resampler::process(const float* const* input, size_t numFrames) {
+    inputFrames += numFrames;
+    if (isPassThrough()) {
+        output.clear();
+        output.append(input, numFrames);
+        outputFrames += numFrames;
+        return numFrames;
+    }
+
+    for (int channel = 0; channel < numChannels; ++channel) {
+        history[channel].insert(history[channel].end(), input[channel], input[channel] + numFrames);
+    }
+    return convertAvailable(UINT64_MAX);
+}
+
+size_t Resampler::flush() {
+    if (isPassThrough()) {
+        output.clear();
+        return 0;
+    }
+
+    // Pad with silence until the window of the last output frame is complete
+    uint64_t totalOutput = (inputFrames * upFactor + downFactor - 1) / downFactor;
+    if (outputFrames < totalOutput) {
+        int64_t lastPosition = static_cast<int64_t>(totalOutput - 1) * downFactor +
+                               static_cast<int64_t>(tapsPerPhase) * upFactor / 2;
+        int64_t lastInput = lastPosition / upFactor;
+        int64_t available = historyStart + static_cast<int64_t>(history[0].size());
+        if (lastInput >= available) {
+            for (std::vector<float>& line : history) {
+                line.resize(line.size() + static_cast<size_t>(lastInput - available + 1), 0.0f);
+            }
+        }
+    }
+
+    // The padding can complete more windows than the stream has frames
+    return convertAvailable(totalOutput);
+}
+
+size_t Resampler::convertAvailable(uint64_t maxOutputFrames) {
+    const int64_t available = historyStart + static_cast<int64_t>(history[0].size());
+    if (nextInput >= available || outputFrames >= maxOutputFrames) {
+        output.setSize(numChannels, 0);
+        return 0;
+    }
+
+    // Count the frames whose windows are complete
+    size_t numOutput = 0;
+    {
+        int64_t input = nextInput;
+        int phase = nextPhase;
+        while (input < available && outputFrames + numOutput < maxOutputFrames) {
+            ++numOutput;
+            phase += downFactor;
+            input += phase / upFactor;
+            phase %= upFactor;
+        }
+    }
+
+    output.setSize(numChannels, numOutput);
+    DotKernel dot = getKernelChoice().kernel;
+    int64_t input = nextInput;
+    int phase = nextPhase;
+    for (int channel = 0; channel < numChannels; ++channel) {
+        const float* line = history[channel].data();
+        float* out = output.getChannel(channel);
+        input = nextInput;
+        phase = nextPhase;
+        for (size_t frame = 0; frame < numOutput; ++frame) {
+            const float* window = line + (input - tapsPerPhase + 1 - historyStart);
+            out[frame] = dot(window, coefficients.data() + static_cast<size_t>(phase) * tapsPerPhase, tapsPerPhase);
+            phase += downFactor;
+            input += phase / upFactor;
+            phase %= upFactor;
+        }
+    }
+    nextInput = input;
+    nextPhase = phase;
+    outputFrames += numOutput;
+
+    // Keep only what the next window needs
+    int64_t keepFrom = std::min(nextInput - tapsPerPhase + 1, available);
+    if (keepFrom > historyStart) {
+        size_t drop = static_cast<size_t>(keepFrom - historyStart);
+        for (std::vector<float>& line : history) {
+            line.erase(line.begin(), line.begin() + drop);
+        }
+        historyStart = keepFrom;
+    }
+    return numOutput;
+}
+
+const AudioBuffer& Resampler::getOutput() const {
+    return output;
+}
+
+bool Resampler::isPassThrough() const {
+    return upFactor == downFactor;
+}
+
+int Resampler::getUpFactor() const {
+    return upFactor;
+}
+
+int Resampler::getDownFactor() const {
+    return downFactor;
+}
+
+int Resampler::getTapsPerPhase() const {
+    return tapsPerPhase;
+}
+
+bool Resampler::parseQuality(const std::string& name, ResamplerQuality& quality) {
+    if (name == "fast") {
+        quality = ResamplerQuality::Fast;
+    } else if (name == "standard") {
+        quality = ResamplerQuality::Standard;
+    } else if (name == "high") {
+        quality = ResamplerQuality::High;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+const char* Resampler::getKernelName() {
+    return getKernelChoice().name;
+}
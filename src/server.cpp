@@ -1,12 +1,81 @@
 #include "server.h"
 #include <crow.h>
-#include <filesystem>
-#include <fstream>
-#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "audio_writer.h"
+#include "http_util.h"
+#include "logger.h"
+#include "midi_processor.h"
+#include "peak_pyramid.h"
+#include "render_request.h"
+#include "vst_renderer.h"
 
-namespace fs = std::filesystem;
+namespace {
+    // Longest byte range served in one response
+    constexpr uint64_t kMaxRangeBytes = 16ULL * 1024 * 1024;
+    // Most memory reserved up front for a /render/raw response; longer renders grow it
+    constexpr size_t kMaxRawReserveBytes = 256 * 1024 * 1024;
 
-Server::Server(int port) : port(port) {
+    // Holds one of the scheduler's render slots for a /render/raw request while
+    // admitted, and counts the render in the metrics the way a worker counts its jobs
+    class RawRenderSlot {
+    public:
+        RawRenderSlot(RenderScheduler& scheduler, RenderMetrics& metrics, const std::string& vstPath)
+            : scheduler(scheduler), metrics(metrics), vstPath(vstPath), succeeded(false) {
+            admitted = scheduler.tryAcquireRenderSlot();
+            if (!admitted) {
+                metrics.countJob(RenderMetrics::JobResult::Rejected);
+                return;
+            }
+            metrics.jobStarted();
+        }
+
+        ~RawRenderSlot() {
+            if (!admitted) {
+                return;
+            }
+            metrics.jobFinished();
+            metrics.countJob(succeeded ? RenderMetrics::JobResult::Completed : RenderMetrics::JobResult::Failed);
+            if (!succeeded) {
+                metrics.getPlugin(vstPath).failures.fetch_add(1, std::memory_order_relaxed);
+            }
+            scheduler.releaseRenderSlot();
+        }
+
+        RawRenderSlot(const RawRenderSlot&) = delete;
+        RawRenderSlot& operator=(const RawRenderSlot&) = delete;
+
+        bool isAdmitted() const { return admitted; }
+        void succeed() { succeeded = true; }
+
+    private:
+        RenderScheduler& scheduler;
+        RenderMetrics& metrics;
+        const std::string& vstPath;
+        bool admitted;
+        bool succeeded;
+    };
+
+    int64_t modifiedNanoseconds(const struct stat& fileStat) {
+#ifdef __APPLE__
+        return static_cast<int64_t>(fileStat.st_mtimespec.tv_sec) * 1000000000LL + fileStat.st_mtimespec.tv_nsec;
+#else
+        return static_cast<int64_t>(fileStat.st_mtim.tv_sec) * 1000000000LL + fileStat.st_mtim.tv_nsec;
+#endif
+    }
+}
+
+Server::Server(const ServerConfig& config)
+    : port(config.port), streamPort(config.streamPort),
+      pluginPool(std::make_shared<PluginInstancePool>(config.pluginCache)),
+      renderCache(std::make_shared<RenderCache>("output", config.renderCacheBytes)),
+      metrics(std::make_shared<RenderMetrics>()),
+      scheduler(config.render, pluginPool, renderCache, metrics),
+      streamServer(config.streamPort, pluginPool, scheduler) {
 }
 
 Server::~Server() {
@@ -17,16 +86,27 @@ void Server::start() {
     // Setup API routes
     setupRoutes();
     
-    // Make output directory if it doesn't exist
-    std::filesystem::path outputDir = "output";
-    if (!std::filesystem::exists(outputDir)) {
-        std::filesystem::create_directory(outputDir);
+    // Make output directory if it doesn't exist and index the renders already in it
+    if (!renderCache->open()) {
+        throw std::runtime_error("Failed to open render cache");
     }
     
-    std::cout << "Starting server on port " << port << std::endl;
+    // Start render workers before accepting requests
+    scheduler.start();
+    if (streamPort > 0 && !streamServer.start()) {
+        throw std::runtime_error("Failed to start streaming listener on port " + std::to_string(streamPort));
+    }
+    
+    LOG_INFO("Starting server on port " << port);
     
-    // Set higher log level
-    app.loglevel(crow::LogLevel::INFO);
+    // Crow's own request log follows the logger's level
+    switch (Logger::getLevel()) {
+        case LogLevel::Debug: app.loglevel(crow::LogLevel::DEBUG); break;
+        case LogLevel::Info: app.loglevel(crow::LogLevel::INFO); break;
+        case LogLevel::Warn: app.loglevel(crow::LogLevel::WARNING); break;
+        case LogLevel::Error: app.loglevel(crow::LogLevel::ERROR); break;
+        case LogLevel::Off: app.loglevel(crow::LogLevel::CRITICAL); break;
+    }
     
     // Explicitly bind to 0.0.0.0 to accept connections from any interface
     app.bindaddr("0.0.0.0").port(port).multithreaded().run();
@@ -35,6 +115,8 @@ void Server::start() {
 void Server::stop() {
     // Shutdown logic here
     // In a real-world app, you would use app.stop() here
+    streamServer.stop();
+    scheduler.stop();
 }
 
 void Server::setupRoutes() {
@@ -46,111 +128,382 @@ void Server::setupRoutes() {
     CROW_ROUTE(app, "/render")
     .methods(crow::HTTPMethod::POST)
     ([this](const crow::request& req) {
-        crow::json::rvalue json_body = crow::json::load(req.body);
-        
-        if (!json_body) {
-            return crow::response(400, "Invalid JSON body");
-        }
-        
-        // Extract parameters
-        std::string midiFilePath;
-        std::string vstPath;
-        float sampleRate = 44100;
-        int numChannels = 2;
-        int bitDepth = 16;
-        
-        try {
-            if (json_body.has("midiFile")) midiFilePath = json_body["midiFile"].s();
-            if (json_body.has("vstPath")) vstPath = json_body["vstPath"].s();
-            if (json_body.has("sampleRate")) sampleRate = json_body["sampleRate"].d();
-            if (json_body.has("numChannels")) numChannels = json_body["numChannels"].i();
-            if (json_body.has("bitDepth")) bitDepth = json_body["bitDepth"].i();
-        } catch (const std::exception& e) {
-            return crow::response(400, std::string("Invalid parameters: ") + e.what());
+        RenderJobRequest request;
+        std::string error;
+        if (!parseRenderRequest(req.body, request, error)) {
+            return crow::response(400, error);
         }
         
-        // Validate required parameters
-        if (midiFilePath.empty() || vstPath.empty()) {
-            return crow::response(400, "Missing required parameters: midiFile and vstPath");
+        // Queue the render and answer right away; clients poll /jobs/<id>
+        std::string jobId;
+        if (!scheduler.submit(request, jobId)) {
+            crow::response res(429, "Render queue is full, try again later");
+            res.set_header("Retry-After", "1");
+            return res;
         }
         
-        // Process the render request
-        try {
-            std::string outputPath = handleRenderRequest(midiFilePath, vstPath, sampleRate, numChannels, bitDepth);
-            
+        // Cache hits are complete before the response goes out
+        RenderJobInfo info;
+        if (scheduler.getJob(jobId, info) && info.status == RenderJobStatus::Completed) {
             crow::json::wvalue result;
             result["status"] = "success";
-            result["outputFile"] = outputPath;
+            result["jobId"] = jobId;
+            result["outputFile"] = info.outputFile;
+            result["cached"] = info.cached;
             return crow::response(result);
-        } catch (const std::exception& e) {
-            return crow::response(500, std::string("Render failed: ") + e.what());
         }
+        
+        crow::json::wvalue result;
+        result["status"] = "queued";
+        result["jobId"] = jobId;
+        return crow::response(202, result);
     });
     
-    // Add route for downloading rendered files
-    CROW_ROUTE(app, "/download/<string>")
-    ([](const std::string& filename) {
-        // Security: Ensure the file exists and is within our output directory
-        fs::path filePath = "output/" + filename;
-        if (!fs::exists(filePath)) {
-            return crow::response(404);
+    // Renders MIDI bytes from the request body and answers with the WAV or FLAC, without
+    // touching the filesystem. Parameters come from the query string. Renders run on the
+    // request thread in one of the scheduler's render slots; with none free they get 429.
+    CROW_ROUTE(app, "/render/raw")
+    .methods(crow::HTTPMethod::POST)
+    ([this](const crow::request& req) {
+        RenderJobRequest request;
+        std::string error;
+        if (!parseRenderQuery(req.url_params, request, error)) {
+            return crow::response(400, error);
         }
         
-        // Set appropriate headers for file download
-        crow::response res;
-        res.set_header("Content-Disposition", "attachment; filename=\"" + filename + "\"");
-        res.set_header("Content-Type", "audio/wav");
+        RawRenderSlot slot(scheduler, *metrics, request.vstPath);
+        if (!slot.isAdmitted()) {
+            crow::response res(429, "All render workers are busy, try again later");
+            res.set_header("Retry-After", "1");
+            return res;
+        }
         
-        // Read file content
-        std::ifstream file(filePath.string(), std::ios::binary);
-        if (!file) {
-            return crow::response(500, "Failed to open file");
+        // Each stage is timed from the end of the previous one
+        using Clock = std::chrono::steady_clock;
+        Clock::time_point stageStart = Clock::now();
+        auto endStage = [this, &stageStart](RenderStage stage) {
+            Clock::time_point now = Clock::now();
+            metrics->observeStage(stage, std::chrono::duration<double>(now - stageStart).count());
+            stageStart = now;
+        };
+        
+        MidiProcessor midiProcessor;
+        bool midiLoaded = midiProcessor.loadMidiData(reinterpret_cast<const uint8_t*>(req.body.data()), req.body.size());
+        endStage(RenderStage::MidiLoad);
+        if (!midiLoaded) {
+            return crow::response(400, "Failed to parse MIDI data");
+        }
+        
+        VstRenderer vstRenderer;
+        vstRenderer.setInstancePool(pluginPool);
+        vstRenderer.setTail(request.tail);
+        bool pluginLoaded = vstRenderer.loadVst(request.vstPath, request.sampleRate, request.numChannels);
+        endStage(RenderStage::PluginLoad);
+        if (!pluginLoaded) {
+            return crow::response(500, "Failed to load VST plugin");
         }
         
-        std::string fileContent((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
-        res.body = fileContent;
+        // Encode straight into the response body, sized for the expected (uncompressed) length
+        std::string wavData;
+        int64_t expectedFrames = midiProcessor.getSequence().getLengthInSamples(request.sampleRate) +
+                                 static_cast<int64_t>(request.sampleRate);
+        wavData.reserve(std::min(static_cast<size_t>(expectedFrames) * request.numChannels *
+                                 PcmConverter::bytesPerSample(request.sampleFormat) + 64, kMaxRawReserveBytes));
         
+        AudioWriter audioWriter;
+        audioWriter.setDither(request.dither);
+        audioWriter.setFileFormat(request.fileFormat);
+        audioWriter.setFlacLevel(request.flacLevel);
+        if (!audioWriter.openMemory(wavData, request.sampleRate, request.numChannels, request.sampleFormat)) {
+            return crow::response(500, "Failed to encode audio");
+        }
+        
+        // Time in the writer is taken out of the render and reported as encoding
+        Clock::duration encodeTime = Clock::duration::zero();
+        Clock::time_point renderStart = Clock::now();
+        bool rendered = vstRenderer.renderMidi(midiProcessor.getSequence(), request.sampleRate, request.numChannels,
+            [&audioWriter, &encodeTime](const float* const* channels, int numFrames) {
+                Clock::time_point blockStart = Clock::now();
+                bool appended = audioWriter.appendBlock(channels, numFrames);
+                encodeTime += Clock::now() - blockStart;
+                return appended;
+            });
+        double renderSeconds = std::chrono::duration<double>(Clock::now() - renderStart - encodeTime).count();
+        metrics->observeStage(RenderStage::Render, renderSeconds);
+        metrics->observeStage(RenderStage::Encode, std::chrono::duration<double>(encodeTime).count());
+        
+        stageStart = Clock::now();
+        bool finished = audioWriter.finalize();
+        endStage(RenderStage::Write);
+        if (!finished || !rendered) {
+            return crow::response(500, "Failed to render MIDI through VST");
+        }
+        
+        metrics->addBytesWritten(wavData.size());
+        metrics->observeRender(metrics->getPlugin(request.vstPath), audioWriter.getFramesWritten() / request.sampleRate,
+                               renderSeconds);
+        slot.succeed();
+        
+        crow::response res(200);
+        res.set_header("Content-Type", http_util::contentTypeFor(AudioWriter::extensionFor(request.fileFormat)));
+        res.body = std::move(wavData);
         return res;
     });
-}
-
-std::string Server::handleRenderRequest(const std::string& midiFilePath, 
-                                     const std::string& vstPath,
-                                     float sampleRate,
-                                     int numChannels,
-                                     int bitDepth) {
-    // Create output directory if it doesn't exist
-    fs::path outputDir = "output";
-    if (!fs::exists(outputDir)) {
-        fs::create_directory(outputDir);
-    }
     
-    // Generate a unique output filename
-    std::string outputFileName = fs::path(midiFilePath).stem().string() + "_" + 
-                                 fs::path(vstPath).stem().string() + "_" +
-                                 std::to_string(static_cast<int>(sampleRate)) + "hz.wav";
-    std::string outputPath = (outputDir / outputFileName).string();
+    // Job status and progress
+    CROW_ROUTE(app, "/jobs/<string>")
+    ([this](const std::string& jobId) {
+        RenderJobInfo info;
+        if (!scheduler.getJob(jobId, info)) {
+            return crow::response(404, "Unknown job: " + jobId);
+        }
+        
+        crow::json::wvalue result;
+        result["jobId"] = info.id;
+        result["status"] = RenderJobInfo::statusName(info.status);
+        result["progress"] = info.progress;
+        result["queuedSeconds"] = info.queuedSeconds;
+        result["renderSeconds"] = info.renderSeconds;
+        result["estimatedSeconds"] = info.estimatedSeconds;
+        if (info.status == RenderJobStatus::Completed) {
+            result["outputFile"] = info.outputFile;
+            result["cached"] = info.cached;
+        } else if (info.status == RenderJobStatus::Failed) {
+            result["error"] = info.error;
+        }
+        if (!info.traceFile.empty()) {
+            result["traceUrl"] = "/jobs/" + info.id + "/trace";
+        }
+        return crow::response(result);
+    });
     
-    // Load and process MIDI file
-    if (!midiProcessor.loadMidiFile(midiFilePath)) {
-        throw std::runtime_error("Failed to load MIDI file");
-    }
+    // Chrome/Perfetto trace of a job submitted with "trace": true, once it has finished
+    CROW_ROUTE(app, "/jobs/<string>/trace")
+    ([this](const std::string& jobId) {
+        RenderJobInfo info;
+        if (!scheduler.getJob(jobId, info) || info.traceFile.empty()) {
+            return crow::response(404, "No trace for job: " + jobId);
+        }
+        
+        crow::response res;
+        res.set_static_file_info(info.traceFile);
+        res.set_header("Content-Type", "application/json");
+        return res;
+    });
     
-    // Load VST plugin
-    if (!vstRenderer.loadVst(vstPath)) {
-        throw std::runtime_error("Failed to load VST plugin");
-    }
+    // Waveform peaks of a completed job; ?level=<samples per bucket> picks one zoom level
+    CROW_ROUTE(app, "/peaks/<string>")
+    ([this](const crow::request& req, const std::string& jobId) {
+        RenderJobInfo info;
+        if (!scheduler.getJob(jobId, info) || info.status != RenderJobStatus::Completed) {
+            return crow::response(404, "No completed job: " + jobId);
+        }
+        
+        uint32_t level = 0;
+        if (const char* levelParam = req.url_params.get("level")) {
+            char* end = nullptr;
+            unsigned long value = strtoul(levelParam, &end, 10);
+            if (*levelParam == '\0' || *end != '\0' || value == 0 || value > UINT32_MAX) {
+                return crow::response(400, "level must be a bucket size in samples");
+            }
+            level = static_cast<uint32_t>(value);
+        }
+        
+        // Renders cached before peaks existed have no sidecar
+        std::string peaksPath = PeakPyramid::sidecarPath(info.outputFile);
+        struct stat fileStat;
+        std::vector<uint8_t> peaks;
+        if (stat(peaksPath.c_str(), &fileStat) != 0 || !PeakPyramid::readFile(peaksPath, level, peaks)) {
+            return crow::response(404, "No peaks for job: " + jobId);
+        }
+        
+        // Each level has its own URL, so the sidecar's validator serves them all
+        std::string etag = http_util::makeEtag(static_cast<uint64_t>(fileStat.st_size), modifiedNanoseconds(fileStat));
+        if (http_util::etagMatches(req.get_header_value("If-None-Match"), etag)) {
+            crow::response res(304);
+            res.set_header("ETag", etag);
+            return res;
+        }
+        
+        crow::response res(200);
+        res.set_header("Content-Type", "application/octet-stream");
+        res.set_header("ETag", etag);
+        res.body.assign(reinterpret_cast<const char*>(peaks.data()), peaks.size());
+        return res;
+    });
     
-    // Render MIDI through VST
-    if (!vstRenderer.renderMidi(midiProcessor.getMidiData(), sampleRate, numChannels)) {
-        throw std::runtime_error("Failed to render MIDI through VST");
-    }
+    // Plugin instance cache statistics
+    CROW_ROUTE(app, "/plugins/stats")
+    ([this]() {
+        PluginInstancePool::Stats stats = pluginPool->getStats();
+        PluginInstancePool::Config config = pluginPool->getConfig();
+        
+        crow::json::wvalue result;
+        result["hits"] = stats.hits;
+        result["misses"] = stats.misses;
+        result["hitRate"] = stats.getHitRate();
+        result["evictions"] = stats.evictions;
+        result["loadFailures"] = stats.loadFailures;
+        result["averageLoadSeconds"] = stats.getAverageLoadSeconds();
+        result["maxLoadSeconds"] = stats.maxLoadSeconds;
+        result["idleInstances"] = stats.idleInstances;
+        result["activeInstances"] = stats.activeInstances;
+        result["memoryBytes"] = stats.memoryBytes;
+        result["maxInstances"] = config.maxInstances;
+        result["maxMemoryBytes"] = config.maxMemoryBytes;
+        return crow::response(result);
+    });
     
-    // Write audio to file
-    if (!audioWriter.writeWavFile(outputPath, vstRenderer.getAudioData(), 
-                                 sampleRate, numChannels, bitDepth)) {
-        throw std::runtime_error("Failed to write audio file");
-    }
+    // Render cache statistics
+    CROW_ROUTE(app, "/cache/stats")
+    ([this]() {
+        RenderCache::Stats stats = renderCache->getStats();
+        
+        crow::json::wvalue result;
+        result["hits"] = stats.hits;
+        result["misses"] = stats.misses;
+        result["insertions"] = stats.insertions;
+        result["evictions"] = stats.evictions;
+        result["entries"] = stats.entries;
+        result["totalBytes"] = stats.totalBytes;
+        result["maxBytes"] = stats.maxBytes;
+        return crow::response(result);
+    });
     
-    return outputPath;
-}
\ No newline at end of file
+    // Prometheus scrape target: worker metrics plus the queue, cache and plugin pool state
+    CROW_ROUTE(app, "/metrics")
+    ([this]() {
+        std::string out;
+        metrics->write(out);
+        
+        prometheus::writeMetric(out, "midiverse_queue_depth", "gauge", "Render jobs waiting for a worker",
+                                static_cast<double>(scheduler.getQueueLength()));
+        prometheus::writeMetric(out, "midiverse_workers", "gauge", "Render worker threads",
+                                scheduler.getNumWorkers());
+        
+        RenderCache::Stats cache = renderCache->getStats();
+        prometheus::writeMetric(out, "midiverse_cache_hits_total", "counter", "Render cache hits",
+                                static_cast<double>(cache.hits));
+        prometheus::writeMetric(out, "midiverse_cache_misses_total", "counter", "Render cache misses",
+                                static_cast<double>(cache.misses));
+        prometheus::writeMetric(out, "midiverse_cache_evictions_total", "counter", "Renders evicted from the cache",
+                                static_cast<double>(cache.evictions));
+        prometheus::writeMetric(out, "midiverse_cache_entries", "gauge", "Renders in the cache",
+                                static_cast<double>(cache.entries));
+        prometheus::writeMetric(out, "midiverse_cache_bytes", "gauge", "Size of the render cache",
+                                static_cast<double>(cache.totalBytes));
+        
+        PluginInstancePool::Stats pool = pluginPool->getStats();
+        prometheus::writeMetric(out, "midiverse_plugin_pool_hits_total", "counter",
+                                "Plugin loads served by a warm instance", static_cast<double>(pool.hits));
+        prometheus::writeMetric(out, "midiverse_plugin_pool_misses_total", "counter",
+                                "Plugin loads that created an instance", static_cast<double>(pool.misses));
+        prometheus::writeMetric(out, "midiverse_plugin_pool_active_instances", "gauge",
+                                "Plugin instances in use", static_cast<double>(pool.activeInstances));
+        prometheus::writeMetric(out, "midiverse_plugin_pool_idle_instances", "gauge",
+                                "Plugin instances kept warm", static_cast<double>(pool.idleInstances));
+        
+        crow::response res(200);
+        res.set_header("Content-Type", prometheus::kContentType);
+        res.body = std::move(out);
+        return res;
+    });
+    
+    // Add route for downloading rendered files. Whole files are streamed by Crow from
+    // disk; byte ranges are read with pread, so memory per download stays bounded.
+    CROW_ROUTE(app, "/download/<string>")
+    ([](const crow::request& req, const std::string& filename) {
+        // Security: Ensure the file exists and is within our output directory
+        if (filename.find("..") != std::string::npos) {
+            return crow::response(404);
+        }
+        std::string filePath = "output/" + filename;
+        
+        struct stat fileStat;
+        if (stat(filePath.c_str(), &fileStat) != 0 || !S_ISREG(fileStat.st_mode)) {
+            return crow::response(404);
+        }
+        
+        uint64_t fileSize = static_cast<uint64_t>(fileStat.st_size);
+        std::string etag = http_util::makeEtag(fileSize, modifiedNanoseconds(fileStat));
+        std::string lastModified = http_util::formatHttpDate(fileStat.st_mtime);
+        
+        auto setValidators = [&](crow::response& res) {
+            res.set_header("ETag", etag);
+            res.set_header("Last-Modified", lastModified);
+            res.set_header("Accept-Ranges", "bytes");
+        };
+        
+        // Conditional GET; If-None-Match takes precedence over If-Modified-Since
+        std::string ifNoneMatch = req.get_header_value("If-None-Match");
+        std::string ifModifiedSince = req.get_header_value("If-Modified-Since");
+        time_t since = 0;
+        bool notModified = !ifNoneMatch.empty() ? http_util::etagMatches(ifNoneMatch, etag)
+                         : !ifModifiedSince.empty() && http_util::parseHttpDate(ifModifiedSince, since) &&
+                           fileStat.st_mtime <= since;
+        if (notModified) {
+            crow::response res(304);
+            setValidators(res);
+            return res;
+        }
+        
+        // A Range only applies if If-Range still matches the file
+        http_util::ByteRange range;
+        http_util::RangeResult rangeResult = http_util::RangeResult::None;
+        std::string rangeHeader = req.get_header_value("Range");
+        std::string ifRange = req.get_header_value("If-Range");
+        time_t ifRangeTime = 0;
+        bool rangeValid = ifRange.empty() || ifRange == etag ||
+                          (http_util::parseHttpDate(ifRange, ifRangeTime) && fileStat.st_mtime <= ifRangeTime);
+        if (!rangeHeader.empty() && rangeValid) {
+            rangeResult = http_util::parseRange(rangeHeader, fileSize, range);
+        }
+        
+        if (rangeResult == http_util::RangeResult::Unsatisfiable) {
+            crow::response res(416);
+            setValidators(res);
+            res.set_header("Content-Range", "bytes */" + std::to_string(fileSize));
+            return res;
+        }
+        
+        if (rangeResult == http_util::RangeResult::None) {
+            crow::response res;
+            res.set_static_file_info(filePath);
+            setValidators(res);
+            res.set_header("Content-Type", http_util::contentTypeFor(filename));
+            res.set_header("Content-Disposition", "attachment; filename=\"" + filename + "\"");
+            return res;
+        }
+        
+        // Large ranges are shortened; Content-Range tells the client what it got
+        range.last = std::min(range.last, range.first + kMaxRangeBytes - 1);
+        
+        int fd = ::open(filePath.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return crow::response(500, "Failed to open file");
+        }
+        
+        std::string body(static_cast<size_t>(range.length()), '\0');
+        size_t bytesRead = 0;
+        while (bytesRead < body.size()) {
+            ssize_t n = pread(fd, &body[bytesRead], body.size() - bytesRead, static_cast<off_t>(range.first + bytesRead));
+            if (n <= 0) {
+                break;
+            }
+            bytesRead += static_cast<size_t>(n);
+        }
+        close(fd);
+        
+        if (bytesRead != body.size()) {
+            return crow::response(500, "Failed to read file");
+        }
+        
+        crow::response res(206);
+        setValidators(res);
+        res.set_header("Content-Type", http_util::contentTypeFor(filename));
+        res.set_header("Content-Range", "bytes " + std::to_string(range.first) + "-" + 
+                       std::to_string(range.last) + "/" + std::to_string(fileSize));
+        res.body = std::move(body);
+        return res;
+    });
+}
@@ -0,0 +1,383 @@
+#include "stream_server.h"
+#include <arpa/inet.h>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include "audio_writer.h"
+#include "http_util.h"
+#include "logger.h"
+#include "midi_processor.h"
+#include "render_request.h"
+#include "vst_renderer.h"
+
+namespace {
+    constexpr size_t kMaxHeaderBytes = 16 * 1024;
+    constexpr size_t kMaxBodyBytes = 64 * 1024;
+
+#ifdef MSG_NOSIGNAL
+    constexpr int kSendFlags = MSG_NOSIGNAL;
+#else
+    constexpr int kSendFlags = 0;
+#endif
+
+    const char* statusText(int status) {
+        switch (status) {
+            case 400: return "Bad Request";
+            case 404: return "Not Found";
+            case 405: return "Method Not Allowed";
+            case 413: return "Payload Too Large";
+            case 500: return "Internal Server Error";
+            case 503: return "Service Unavailable";
+            default: return "Error";
+        }
+    }
+
+    // Holds a scheduler render slot for the rest of the stream
+    class RenderSlotGuard {
+    public:
+        explicit RenderSlotGuard(RenderScheduler& scheduler) : scheduler(scheduler) {}
+        ~RenderSlotGuard() { scheduler.releaseRenderSlot(); }
+
+        RenderSlotGuard(const RenderSlotGuard&) = delete;
+        RenderSlotGuard& operator=(const RenderSlotGuard&) = delete;
+
+    private:
+        RenderScheduler& scheduler;
+    };
+}
+
+StreamServer::StreamServer(int port, std::shared_ptr<PluginInstancePool> pluginPool, RenderScheduler& scheduler)
+    : port(port), pluginPool(std::move(pluginPool)), scheduler(scheduler), maxStreams(scheduler.getNumWorkers()),
+      listenSocket(-1),
+      stopping(false), activeStreams(0) {
+}
+
+StreamServer::~StreamServer() {
+    stop();
+}
+
+bool StreamServer::start() {
+    listenSocket = socket(AF_INET, SOCK_STREAM, 0);
+    if (listenSocket < 0) {
+        LOG_ERROR("Stream server: could not create socket: " << strerror(errno));
+        return false;
+    }
+
+    int reuse = 1;
+    setsockopt(listenSocket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(static_cast<uint16_t>(port));
+
+    if (bind(listenSocket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+        listen(listenSocket, 64) != 0) {
+        LOG_ERROR("Stream server: could not listen on port " << port << ": " << strerror(errno));
+        close(listenSocket);
+        listenSocket = -1;
+        return false;
+    }
+
+    stopping = false;
+    acceptThread = std::thread(&StreamServer::acceptLoop, this);
+    LOG_INFO("Streaming renders on port " << port << " (POST /render/stream)");
+    return true;
+}
+
+void StreamServer::stop() {
+    stopping = true;
+    if (listenSocket >= 0) {
+        // Unblocks accept(); the socket is closed once the accept thread is done with it
+        shutdown(listenSocket, SHUT_RDWR);
+    }
+    if (acceptThread.joinable()) {
+        acceptThread.join();
+    }
+    if (listenSocket >= 0) {
+        close(listenSocket);
+        listenSocket = -1;
+    }
+
+    std::list<Connection> stopped;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        // Fails blocked reads and writes, so streams end at their next socket call
+        for (const Connection& connection : connections) {
+            if (!connection.finished) {
+                shutdown(connection.socket, SHUT_RDWR);
+            }
+        }
+        stopped.swap(connections);
+    }
+    // No thread may outlive the members it uses
+    for (Connection& connection : stopped) {
+        connection.thread.join();
+    }
+}
+
+void StreamServer::reapConnections() {
+    std::list<Connection> finished;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto it = connections.begin(); it != connections.end();) {
+            auto next = std::next(it);
+            if (it->finished) {
+                finished.splice(finished.end(), connections, it);
+            }
+            it = next;
+        }
+    }
+    for (Connection& connection : finished) {
+        connection.thread.join();
+    }
+}
+
+void StreamServer::acceptLoop() {
+    while (!stopping) {
+        int clientSocket = accept(listenSocket, nullptr, nullptr);
+        if (clientSocket < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+#ifdef SO_NOSIGPIPE
+        int noSigPipe = 1;
+        setsockopt(clientSocket, SOL_SOCKET, SO_NOSIGPIPE, &noSigPipe, sizeof(noSigPipe));
+#endif
+        // Idle or stalled clients must not hold a stream slot indefinitely
+        timeval timeout;
+        timeout.tv_sec = kSocketTimeoutSeconds;
+        timeout.tv_usec = 0;
+        setsockopt(clientSocket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(clientSocket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+        reapConnections();
+
+        bool accepted = false;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (activeStreams < maxStreams && !stopping) {
+                ++activeStreams;
+                // The thread waits for this lock before touching its entry
+                auto connection = connections.insert(connections.end(), Connection{clientSocket, std::thread()});
+                connection->thread = std::thread([this, connection]() {
+                    handleConnection(connection->socket);
+
+                    // Closed under the lock so stop() never shuts down a reused descriptor
+                    std::lock_guard<std::mutex> lock(mutex);
+                    close(connection->socket);
+                    connection->finished = true;
+                    --activeStreams;
+                });
+                accepted = true;
+            }
+        }
+        if (!accepted) {
+            sendSimpleResponse(clientSocket, 503, "Too many concurrent streams");
+            close(clientSocket);
+        }
+    }
+}
+
+void StreamServer::handleConnection(int clientSocket) {
+    std::string method;
+    std::string target;
+    std::string body;
+    if (!readRequest(clientSocket, method, target, body)) {
+        sendSimpleResponse(clientSocket, 400, "Malformed request");
+        return;
+    }
+
+    if (target != "/render/stream") {
+        sendSimpleResponse(clientSocket, 404, "Not found");
+        return;
+    }
+    if (method != "POST") {
+        sendSimpleResponse(clientSocket, 405, "Use POST");
+        return;
+    }
+
+    RenderJobRequest request;
+    std::string error;
+    if (!parseRenderRequest(body, request, error)) {
+        sendSimpleResponse(clientSocket, 400, error);
+        return;
+    }
+    if (stopping) {
+        sendSimpleResponse(clientSocket, 503, "Server shutting down");
+        return;
+    }
+    if (!scheduler.tryAcquireRenderSlot()) {
+        sendSimpleResponse(clientSocket, 503, "All render workers are busy");
+        return;
+    }
+    RenderSlotGuard renderSlot(scheduler);
+
+    MidiProcessor midiProcessor;
+    VstRenderer vstRenderer;
+    AudioWriter audioWriter;
+    vstRenderer.setInstancePool(pluginPool);
+    vstRenderer.setTail(request.tail);
+
+    if (!midiProcessor.loadMidiFile(request.midiFilePath)) {
+        sendSimpleResponse(clientSocket, 500, "Failed to load MIDI file");
+        return;
+    }
+    if (!vstRenderer.loadVst(request.vstPath, request.sampleRate, request.numChannels)) {
+        sendSimpleResponse(clientSocket, 500, "Failed to load VST plugin");
+        return;
+    }
+
+    // Small blocks go out as soon as they are rendered
+    int noDelay = 1;
+    setsockopt(clientSocket, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+    std::string headers = std::string(
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Type: ") + http_util::contentTypeFor(AudioWriter::extensionFor(request.fileFormat)) + "\r\n"
+        "Transfer-Encoding: chunked\r\n"
+        "Cache-Control: no-store\r\n"
+        "Connection: close\r\n"
+        "\r\n";
+    if (!sendAll(clientSocket, headers.data(), headers.size())) {
+        return;
+    }
+
+    // Each write from the encoder becomes one chunk
+    auto sendChunk = [this, clientSocket](const void* data, size_t size) {
+        if (stopping) {
+            return false;
+        }
+        char sizeLine[24];
+        int sizeLength = snprintf(sizeLine, sizeof(sizeLine), "%zx\r\n", size);
+        return sendAll(clientSocket, sizeLine, sizeLength) &&
+               sendAll(clientSocket, data, size) &&
+               sendAll(clientSocket, "\r\n", 2);
+    };
+
+    audioWriter.setDither(request.dither);
+    audioWriter.setFileFormat(request.fileFormat);
+    audioWriter.setFlacLevel(request.flacLevel);
+    if (!audioWriter.openStream(sendChunk, request.sampleRate, request.numChannels, request.sampleFormat)) {
+        return;
+    }
+
+    bool rendered = vstRenderer.renderMidi(midiProcessor.getSequence(), request.sampleRate, request.numChannels,
+        [&audioWriter](const float* const* channels, int numFrames) {
+            return audioWriter.appendBlock(channels, numFrames);
+        });
+    bool finished = audioWriter.finalize();
+
+    // A stream cut short has no terminating chunk, so clients can tell it is incomplete
+    if (rendered && finished) {
+        sendAll(clientSocket, "0\r\n\r\n", 5);
+    } else {
+        LOG_ERROR("Stream of " << request.midiFilePath << " ended early");
+    }
+}
+
+bool StreamServer::readRequest(int clientSocket, std::string& method, std::string& target, std::string& body) {
+    std::string data;
+    size_t headerEnd = std::string::npos;
+    char buffer[4096];
+
+    while ((headerEnd = data.find("\r\n\r\n")) == std::string::npos) {
+        if (data.size() > kMaxHeaderBytes) {
+            return false;
+        }
+        ssize_t n = recv(clientSocket, buffer, sizeof(buffer), 0);
+        if (n <= 0) {
+            return false;
+        }
+        data.append(buffer, static_cast<size_t>(n));
+    }
+
+    // Request line: METHOD SP TARGET SP VERSION
+    size_t lineEnd = data.find("\r\n");
+    std::string requestLine = data.substr(0, lineEnd);
+    size_t firstSpace = requestLine.find(' ');
+    size_t secondSpace = requestLine.find(' ', firstSpace + 1);
+    if (firstSpace == std::string::npos || secondSpace == std::string::npos) {
+        return false;
+    }
+    method = requestLine.substr(0, firstSpace);
+    target = requestLine.substr(firstSpace + 1, secondSpace - firstSpace - 1);
+    size_t query = target.find('?');
+    if (query != std::string::npos) {
+        target.resize(query);
+    }
+
+    // Only Content-Length bodies are accepted
+    size_t contentLength = 0;
+    size_t pos = lineEnd + 2;
+    while (pos < headerEnd) {
+        size_t end = data.find("\r\n", pos);
+        std::string line = data.substr(pos, end - pos);
+        pos = end + 2;
+
+        size_t colon = line.find(':');
+        if (colon == std::string::npos) {
+            continue;
+        }
+        std::string name = line.substr(0, colon);
+        for (char& c : name) {
+            c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+        }
+        if (name == "content-length") {
+            contentLength = strtoul(line.c_str() + colon + 1, nullptr, 10);
+        } else if (name == "transfer-encoding") {
+            return false;
+        }
+    }
+
+    if (contentLength > kMaxBodyBytes) {
+        return false;
+    }
+
+    body = data.substr(headerEnd + 4);
+    while (body.size() < contentLength) {
+        ssize_t n = recv(clientSocket, buffer, sizeof(buffer), 0);
+        if (n <= 0) {
+            return false;
+        }
+        body.append(buffer, static_cast<size_t>(n));
+    }
+    body.resize(contentLength);
+    return true;
+}
+
+bool StreamServer::sendAll(int clientSocket, const void* data, size_t size) {
+    const char* bytes = static_cast<const char*>(data);
+    while (size > 0) {
+        ssize_t n = send(clientSocket, bytes, size, kSendFlags);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        bytes += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+void StreamServer::sendSimpleResponse(int clientSocket, int status, const std::string& message) {
+    std::string response = "HTTP/1.1 " + std::to_string(status) + " " + statusText(status) + "\r\n" +
+                           "Content-Type: text/plain\r\n" +
+                           "Content-Length: " + std::to_string(message.size()) + "\r\n" +
+                           "Connection: close\r\n\r\n" + message;
+    sendAll(clientSocket, response.data(), response.size());
+}
@@ -0,0 +1,339 @@
+#include "synth_engine.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+    // Headroom so dense chords don't clip straight away
+    constexpr float kMasterGain = 0.35f;
+
+    constexpr double kAttackSeconds = 0.005;
+    constexpr double kDecaySeconds = 0.25;
+    constexpr double kReleaseSeconds = 0.12;
+    constexpr float kSustainLevel = 0.6f;
+
+    // Pitch bend range in semitones
+    constexpr double kBendRange = 2.0;
+
+    inline double fractionalPart(double value) {
+        return value - std::floor(value);
+    }
+}
+
+SynthEngine::SynthEngine(int maxVoices)
+    : maxVoices(std::max(maxVoices, 1)), numChannels(2), maxBlockSize(0), sampleRate(44100.0),
+      position(0), voiceKernel(selectSynthVoiceKernel()),
+      attackSamples(0), decaySamples(0), releaseSamples(0), sustainLevel(kSustainLevel) {
+    voiceActive.assign(this->maxVoices, 0);
+    voiceChannel.assign(this->maxVoices, 0);
+    voiceNote.assign(this->maxVoices, 0);
+    voiceSustained.assign(this->maxVoices, 0);
+    voiceVelocityGain.assign(this->maxVoices, 0.0f);
+    voiceNoteStart.assign(this->maxVoices, 0);
+    voiceReleaseStart.assign(this->maxVoices, kNever);
+    voiceEnd.assign(this->maxVoices, kNever);
+    voiceReleaseLevel.assign(this->maxVoices, 0.0f);
+    voicePhaseAnchor.assign(this->maxVoices, 0.0);
+    voiceAnchorSample.assign(this->maxVoices, 0);
+    voiceIncrement.assign(this->maxVoices, 0.0);
+
+    prepare(sampleRate, numChannels, 512);
+}
+
+SynthEngine::~SynthEngine() {
+}
+
+void SynthEngine::prepare(double sampleRate, int numChannels, int maxBlockSize) {
+    this->sampleRate = sampleRate > 0 ? sampleRate : 44100.0;
+    this->numChannels = std::max(numChannels, 1);
+    this->maxBlockSize = std::max(maxBlockSize, 1);
+
+    attackSamples = std::max(1.0, kAttackSeconds * this->sampleRate);
+    decaySamples = std::max(1.0, kDecaySeconds * this->sampleRate);
+    releaseSamples = std::max(1.0, kReleaseSeconds * this->sampleRate);
+
+    mixLeft.assign(this->maxBlockSize, 0.0f);
+    mixRight.assign(this->maxBlockSize, 0.0f);
+
+    reset();
+}
+
+void SynthEngine::reset() {
+    position = 0;
+    std::fill(voiceActive.begin(), voiceActive.end(), 0);
+    std::fill(voiceSustained.begin(), voiceSustained.end(), 0);
+
+    for (int channel = 0; channel < kNumMidiChannels; ++channel) {
+        channelVolume[channel] = (100.0f / 127.0f) * (100.0f / 127.0f);
+        channelExpression[channel] = 1.0f;
+        channelPan[channel] = 64;
+        channelSustain[channel] = false;
+        channelBend[channel] = 0.0;
+        updateChannelPan(channel);
+    }
+}
+
+void SynthEngine::handleEvent(uint8_t status, uint8_t data1, uint8_t data2) {
+    int channel = status & 0x0F;
+
+    switch (status & 0xF0) {
+        case 0x90:
+            if (data2 > 0) {
+                startNote(channel, data1, data2);
+            } else {
+                stopNote(channel, data1);
+            }
+            break;
+        case 0x80:
+            stopNote(channel, data1);
+            break;
+        case 0xB0:
+            handleController(channel, data1, data2);
+            break;
+        case 0xE0:
+            setPitchBend(channel, ((data2 << 7) | data1) - 8192);
+            break;
+        default:
+            // Program changes, aftertouch etc. don't affect the sine voice
+            break;
+    }
+}
+
+void SynthEngine::process(float* const* outputs, int numFrames) {
+    int offset = 0;
+    while (offset < numFrames) {
+        int blockSize = std::min(maxBlockSize, numFrames - offset);
+        float* left = mixLeft.data();
+        float* right = mixRight.data();
+        std::fill(left, left + blockSize, 0.0f);
+        std::fill(right, right + blockSize, 0.0f);
+
+        for (int voice = 0; voice < maxVoices; ++voice) {
+            if (!voiceActive[voice]) {
+                continue;
+            }
+            if (voiceEnd[voice] <= position) {
+                voiceActive[voice] = 0;
+                continue;
+            }
+
+            int channel = voiceChannel[voice];
+            bool released = voiceReleaseStart[voice] <= position;
+            float gain = kMasterGain * voiceVelocityGain[voice] * channelVolume[channel] * channelExpression[channel];
+
+            SynthVoiceArgs args;
+            args.phase = static_cast<float>(fractionalPart(
+                voicePhaseAnchor[voice] + static_cast<double>(position - voiceAnchorSample[voice]) * voiceIncrement[voice]));
+            args.increment = static_cast<float>(voiceIncrement[voice]);
+            args.elapsed = static_cast<float>(released ? position - voiceReleaseStart[voice] : position - voiceNoteStart[voice]);
+            args.released = released;
+            args.attackSlope = static_cast<float>(1.0 / attackSamples);
+            args.decayStart = static_cast<float>(attackSamples);
+            args.decaySlope = static_cast<float>((1.0 - sustainLevel) / decaySamples);
+            args.sustainLevel = sustainLevel;
+            args.releaseLevel = voiceReleaseLevel[voice];
+            args.releaseSlope = static_cast<float>(1.0 / releaseSamples);
+            if (numChannels == 1) {
+                args.gainLeft = gain;
+                args.gainRight = 0.0f;
+            } else {
+                args.gainLeft = gain * channelPanLeft[channel];
+                args.gainRight = gain * channelPanRight[channel];
+            }
+
+            voiceKernel(args, left, right, blockSize);
+        }
+
+        // Even outputs carry the left bus, odd outputs the right bus
+        for (int channel = 0; channel < numChannels; ++channel) {
+            const float* source = (numChannels == 1 || channel % 2 == 0) ? left : right;
+            std::copy(source, source + blockSize, outputs[channel] + offset);
+        }
+
+        position += blockSize;
+        offset += blockSize;
+    }
+}
+
+void SynthEngine::advanceTo(int64_t sample) {
+    for (int voice = 0; voice < maxVoices; ++voice) {
+        if (voiceActive[voice] && voiceEnd[voice] <= sample) {
+            voiceActive[voice] = 0;
+        }
+    }
+    position = std::max(position, sample);
+}
+
+int64_t SynthEngine::getPosition() const {
+    return position;
+}
+
+int SynthEngine::getActiveVoiceCount() const {
+    int count = 0;
+    for (int voice = 0; voice < maxVoices; ++voice) {
+        if (voiceActive[voice] && voiceEnd[voice] > position) {
+            ++count;
+        }
+    }
+    return count;
+}
+
+int64_t SynthEngine::getReleaseSamples() const {
+    return static_cast<int64_t>(std::ceil(releaseSamples)) + 1;
+}
+
+const char* SynthEngine::getKernelName() const {
+    return getSynthVoiceKernelName();
+}
+
+int SynthEngine::allocateVoice() {
+    for (int voice = 0; voice < maxVoices; ++voice) {
+        if (!voiceActive[voice] || voiceEnd[voice] <= position) {
+            return voice;
+        }
+    }
+
+    // Pool is full: steal the voice that has been releasing longest, else the oldest note
+    int best = 0;
+    for (int voice = 1; voice < maxVoices; ++voice) {
+        bool releasedVoice = voiceReleaseStart[voice] != kNever;
+        bool releasedBest = voiceReleaseStart[best] != kNever;
+        if (releasedVoice != releasedBest) {
+            if (releasedVoice) best = voice;
+        } else if (releasedVoice ? voiceReleaseStart[voice] < voiceReleaseStart[best]
+                                 : voiceNoteStart[voice] < voiceNoteStart[best]) {
+            best = voice;
+        }
+    }
+    return best;
+}
+
+void SynthEngine::startNote(int channel, int note, int velocity) {
+    int voice = allocateVoice();
+    voiceActive[voice] = 1;
+    voiceChannel[voice] = static_cast<uint8_t>(channel);
+    voiceNote[voice] = static_cast<uint8_t>(note);
+    voiceSustained[voice] = 0;
+    voiceVelocityGain[voice] = velocity / 127.0f;
+    voiceNoteStart[voice] = position;
+    voiceReleaseStart[voice] = kNever;
+    voiceEnd[voice] = kNever;
+    voiceReleaseLevel[voice] = 0.0f;
+    voicePhaseAnchor[voice] = 0.0;
+    voiceAnchorSample[voice] = position;
+    voiceIncrement[voice] = noteIncrement(note, channel);
+}
+
+void SynthEngine::stopNote(int channel, int note) {
+    // Release the oldest held instance of this note
+    int target = -1;
+    for (int voice = 0; voice < maxVoices; ++voice) {
+        if (voiceActive[voice] && voiceChannel[voice] == channel && voiceNote[voice] == note &&
+            voiceReleaseStart[voice] == kNever && !voiceSustained[voice] &&
+            (target < 0 || voiceNoteStart[voice] < voiceNoteStart[target])) {
+            target = voice;
+        }
+    }
+    if (target < 0) {
+        return;
+    }
+
+    if (channelSustain[channel]) {
+        voiceSustained[target] = 1;
+    } else {
+        releaseVoice(target);
+    }
+}
+
+void SynthEngine::releaseVoice(int voice) {
+    double level = envelopeLevel(position - voiceNoteStart[voice]);
+    voiceReleaseStart[voice] = position;
+    voiceReleaseLevel[voice] = static_cast<float>(level);
+    voiceEnd[voice] = position + static_cast<int64_t>(std::ceil(level * releaseSamples)) + 1;
+    voiceSustained[voice] = 0;
+}
+
+void SynthEngine::setPitchBend(int channel, int value) {
+    channelBend[channel] = kBendRange * value / 8192.0;
+
+    for (int voice = 0; voice < maxVoices; ++voice) {
+        if (voiceActive[voice] && voiceChannel[voice] == channel) {
+            // Re-anchor so the phase stays continuous across the pitch change
+            voicePhaseAnchor[voice] = fractionalPart(
+                voicePhaseAnchor[voice] + static_cast<double>(position - voiceAnchorSample[voice]) * voiceIncrement[voice]);
+            voiceAnchorSample[voice] = position;
+            voiceIncrement[voice] = noteIncrement(voiceNote[voice], channel);
+        }
+    }
+}
+
+void SynthEngine::handleController(int channel, int controller, int value) {
+    switch (controller) {
+        case 7: {
+            float volume = value / 127.0f;
+            channelVolume[channel] = volume * volume;
+            break;
+        }
+        case 10:
+            channelPan[channel] = static_cast<uint8_t>(value);
+            updateChannelPan(channel);
+            break;
+        case 11:
+            channelExpression[channel] = value / 127.0f;
+            break;
+        case 64: {
+            bool down = value >= 64;
+            if (channelSustain[channel] && !down) {
+                for (int voice = 0; voice < maxVoices; ++voice) {
+                    if (voiceActive[voice] && voiceChannel[voice] == channel && voiceSustained[voice]) {
+                        releaseVoice(voice);
+                    }
+                }
+            }
+            channelSustain[channel] = down;
+            break;
+        }
+        case 120:
+            // All sound off
+            for (int voice = 0; voice < maxVoices; ++voice) {
+                if (voiceChannel[voice] == channel) {
+                    voiceActive[voice] = 0;
+                }
+            }
+            break;
+        case 121:
+            // Reset all controllers
+            channelExpression[channel] = 1.0f;
+            handleController(channel, 64, 0);
+            setPitchBend(channel, 0);
+            break;
+        case 123:
+            // All notes off
+            for (int voice = 0; voice < maxVoices; ++voice) {
+                if (voiceActive[voice] && voiceChannel[voice] == channel && voiceReleaseStart[voice] == kNever) {
+                    releaseVoice(voice);
+                }
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+void SynthEngine::updateChannelPan(int channel) {
+    // Equal-power pan law
+    double angle = (channelPan[channel] / 127.0) * (M_PI / 2.0);
+    channelPanLeft[channel] = static_cast<float>(std::cos(angle));
+    channelPanRight[channel] = static_cast<float>(std::sin(angle));
+}
+
+double SynthEngine::envelopeLevel(int64_t elapsed) const {
+    double t = static_cast<double>(elapsed);
+    double attack = t / attackSamples;
+    double decay = 1.0 - (t - attackSamples) * (1.0 - sustainLevel) / decaySamples;
+    return std::min(attack, std::max(decay, static_cast<double>(sustainLevel)));
+}
+
+double SynthEngine::noteIncrement(int note, int channel) const {
+    double frequency = 440.0 * std::pow(2.0, (note - 69 + channelBend[channel]) / 12.0);
+    return frequency / sampleRate;
+}
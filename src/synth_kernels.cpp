@@ -0,0 +1,221 @@
+#include "synth_kernels.h"
+#include "cpu_features.h"
+#include <algorithm>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MIDIVERSE_X86_KERNELS 1
+#elif defined(__aarch64__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define MIDIVERSE_NEON_KERNELS 1
+#endif
+
+// All kernels evaluate the same expressions per sample:
+//   phase    = frac(phase0 + i * increment)
+//   osc      = parabolic sine approximation of phase (max error ~0.001)
+//   held     = min(t * attackSlope, max(1 - (t - decayStart) * decaySlope, sustain))
+//   released = max(releaseLevel - t * releaseSlope, 0)
+// so a released voice reaches exactly zero and stays there.
+
+namespace {
+    inline float sineApprox(float phase) {
+        // sin(2*pi*p) == -sin(2*pi*(p - 0.5)); approximate on [-0.5, 0.5) with a refined parabola
+        float x = phase - 0.5f;
+        float y = x * (8.0f - 16.0f * std::fabs(x));
+        y = y + 0.225f * (y * std::fabs(y) - y);
+        return -y;
+    }
+
+    inline void renderScalarRange(const SynthVoiceArgs& a, float* left, float* right, int begin, int end) {
+        for (int i = begin; i < end; ++i) {
+            float index = static_cast<float>(i);
+            float p = a.phase + index * a.increment;
+            p -= std::floor(p);
+            float osc = sineApprox(p);
+
+            float t = a.elapsed + index;
+            float env;
+            if (a.released) {
+                env = std::max(a.releaseLevel - t * a.releaseSlope, 0.0f);
+            } else {
+                env = std::min(t * a.attackSlope, std::max(1.0f - (t - a.decayStart) * a.decaySlope, a.sustainLevel));
+            }
+
+            float v = env * osc;
+            left[i] += v * a.gainLeft;
+            right[i] += v * a.gainRight;
+        }
+    }
+
+#ifdef MIDIVERSE_X86_KERNELS
+    __attribute__((target("sse4.1")))
+    inline __m128 sineApproxSse(__m128 phase, __m128 absMask) {
+        __m128 x = _mm_sub_ps(phase, _mm_set1_ps(0.5f));
+        __m128 ax = _mm_and_ps(x, absMask);
+        __m128 y = _mm_mul_ps(x, _mm_sub_ps(_mm_set1_ps(8.0f), _mm_mul_ps(_mm_set1_ps(16.0f), ax)));
+        __m128 ay = _mm_and_ps(y, absMask);
+        y = _mm_add_ps(y, _mm_mul_ps(_mm_set1_ps(0.225f), _mm_sub_ps(_mm_mul_ps(y, ay), y)));
+        return _mm_sub_ps(_mm_setzero_ps(), y);
+    }
+
+    __attribute__((target("sse4.1")))
+    void renderSynthVoiceSse41(const SynthVoiceArgs& a, float* left, float* right, int numFrames) {
+        const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+        const __m128 lanes = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+        const __m128 phase0 = _mm_set1_ps(a.phase);
+        const __m128 increment = _mm_set1_ps(a.increment);
+        const __m128 elapsed = _mm_set1_ps(a.elapsed);
+        const __m128 gainLeft = _mm_set1_ps(a.gainLeft);
+        const __m128 gainRight = _mm_set1_ps(a.gainRight);
+        const __m128 one = _mm_set1_ps(1.0f);
+        const __m128 zero = _mm_setzero_ps();
+
+        int i = 0;
+        for (; i + 4 <= numFrames; i += 4) {
+            __m128 index = _mm_add_ps(_mm_set1_ps(static_cast<float>(i)), lanes);
+            __m128 p = _mm_add_ps(phase0, _mm_mul_ps(index, increment));
+            p = _mm_sub_ps(p, _mm_floor_ps(p));
+            __m128 osc = sineApproxSse(p, absMask);
+
+            __m128 t = _mm_add_ps(elapsed, index);
+            __m128 env;
+            if (a.released) {
+                env = _mm_max_ps(_mm_sub_ps(_mm_set1_ps(a.releaseLevel), _mm_mul_ps(t, _mm_set1_ps(a.releaseSlope))), zero);
+            } else {
+                __m128 attack = _mm_mul_ps(t, _mm_set1_ps(a.attackSlope));
+                __m128 decay = _mm_sub_ps(one, _mm_mul_ps(_mm_sub_ps(t, _mm_set1_ps(a.decayStart)), _mm_set1_ps(a.decaySlope)));
+                env = _mm_min_ps(attack, _mm_max_ps(decay, _mm_set1_ps(a.sustainLevel)));
+            }
+
+            __m128 v = _mm_mul_ps(env, osc);
+            _mm_storeu_ps(left + i, _mm_add_ps(_mm_loadu_ps(left + i), _mm_mul_ps(v, gainLeft)));
+            _mm_storeu_ps(right + i, _mm_add_ps(_mm_loadu_ps(right + i), _mm_mul_ps(v, gainRight)));
+        }
+        renderScalarRange(a, left, right, i, numFrames);
+    }
+
+    __attribute__((target("avx2,fma")))
+    inline __m256 sineApproxAvx2(__m256 phase, __m256 absMask) {
+        __m256 x = _mm256_sub_ps(phase, _mm256_set1_ps(0.5f));
+        __m256 ax = _mm256_and_ps(x, absMask);
+        __m256 y = _mm256_mul_ps(x, _mm256_fnmadd_ps(_mm256_set1_ps(16.0f), ax, _mm256_set1_ps(8.0f)));
+        __m256 ay = _mm256_and_ps(y, absMask);
+        y = _mm256_fmadd_ps(_mm256_set1_ps(0.225f), _mm256_fmsub_ps(y, ay, y), y);
+        return _mm256_sub_ps(_mm256_setzero_ps(), y);
+    }
+
+    __attribute__((target("avx2,fma")))
+    void renderSynthVoiceAvx2(const SynthVoiceArgs& a, float* left, float* right, int numFrames) {
+        const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF));
+        const __m256 lanes = _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f);
+        const __m256 phase0 = _mm256_set1_ps(a.phase);
+        const __m256 increment = _mm256_set1_ps(a.increment);
+        const __m256 elapsed = _mm256_set1_ps(a.elapsed);
+        const __m256 gainLeft = _mm256_set1_ps(a.gainLeft);
+        const __m256 gainRight = _mm256_set1_ps(a.gainRight);
+        const __m256 one = _mm256_set1_ps(1.0f);
+        const __m256 zero = _mm256_setzero_ps();
+
+        int i = 0;
+        for (; i + 8 <= numFrames; i += 8) {
+            __m256 index = _mm256_add_ps(_mm256_set1_ps(static_cast<float>(i)), lanes);
+            __m256 p = _mm256_fmadd_ps(index, increment, phase0);
+            p = _mm256_sub_ps(p, _mm256_floor_ps(p));
+            __m256 osc = sineApproxAvx2(p, absMask);
+
+            __m256 t = _mm256_add_ps(elapsed, index);
+            __m256 env;
+            if (a.released) {
+                env = _mm256_max_ps(_mm256_fnmadd_ps(t, _mm256_set1_ps(a.releaseSlope), _mm256_set1_ps(a.releaseLevel)), zero);
+            } else {
+                __m256 attack = _mm256_mul_ps(t, _mm256_set1_ps(a.attackSlope));
+                __m256 decay = _mm256_fnmadd_ps(_mm256_sub_ps(t, _mm256_set1_ps(a.decayStart)), _mm256_set1_ps(a.decaySlope), one);
+                env = _mm256_min_ps(attack, _mm256_max_ps(decay, _mm256_set1_ps(a.sustainLevel)));
+            }
+
+            __m256 v = _mm256_mul_ps(env, osc);
+            _mm256_storeu_ps(left + i, _mm256_fmadd_ps(v, gainLeft, _mm256_loadu_ps(left + i)));
+            _mm256_storeu_ps(right + i, _mm256_fmadd_ps(v, gainRight, _mm256_loadu_ps(right + i)));
+        }
+        renderScalarRange(a, left, right, i, numFrames);
+    }
+#endif
+
+#ifdef MIDIVERSE_NEON_KERNELS
+    inline float32x4_t sineApproxNeon(float32x4_t phase) {
+        float32x4_t x = vsubq_f32(phase, vdupq_n_f32(0.5f));
+        float32x4_t y = vmulq_f32(x, vmlsq_f32(vdupq_n_f32(8.0f), vdupq_n_f32(16.0f), vabsq_f32(x)));
+        y = vmlaq_f32(y, vdupq_n_f32(0.225f), vsubq_f32(vmulq_f32(y, vabsq_f32(y)), y));
+        return vnegq_f32(y);
+    }
+
+    void renderSynthVoiceNeon(const SynthVoiceArgs& a, float* left, float* right, int numFrames) {
+        const float laneValues[4] = {0.0f, 1.0f, 2.0f, 3.0f};
+        const float32x4_t lanes = vld1q_f32(laneValues);
+        const float32x4_t phase0 = vdupq_n_f32(a.phase);
+        const float32x4_t increment = vdupq_n_f32(a.increment);
+        const float32x4_t elapsed = vdupq_n_f32(a.elapsed);
+        const float32x4_t one = vdupq_n_f32(1.0f);
+        const float32x4_t zero = vdupq_n_f32(0.0f);
+
+        int i = 0;
+        for (; i + 4 <= numFrames; i += 4) {
+            float32x4_t index = vaddq_f32(vdupq_n_f32(static_cast<float>(i)), lanes);
+            float32x4_t p = vmlaq_f32(phase0, index, increment);
+            p = vsubq_f32(p, vrndmq_f32(p));
+            float32x4_t osc = sineApproxNeon(p);
+
+            float32x4_t t = vaddq_f32(elapsed, index);
+            float32x4_t env;
+            if (a.released) {
+                env = vmaxq_f32(vmlsq_f32(vdupq_n_f32(a.releaseLevel), t, vdupq_n_f32(a.releaseSlope)), zero);
+            } else {
+                float32x4_t attack = vmulq_f32(t, vdupq_n_f32(a.attackSlope));
+                float32x4_t decay = vmlsq_f32(one, vsubq_f32(t, vdupq_n_f32(a.decayStart)), vdupq_n_f32(a.decaySlope));
+                env = vminq_f32(attack, vmaxq_f32(decay, vdupq_n_f32(a.sustainLevel)));
+            }
+
+            float32x4_t v = vmulq_f32(env, osc);
+            vst1q_f32(left + i, vmlaq_n_f32(vld1q_f32(left + i), v, a.gainLeft));
+            vst1q_f32(right + i, vmlaq_n_f32(vld1q_f32(right + i), v, a.gainRight));
+        }
+        renderScalarRange(a, left, right, i, numFrames);
+    }
+#endif
+
+    struct KernelChoice {
+        SynthVoiceKernel kernel;
+        const char* name;
+    };
+
+    KernelChoice chooseKernel() {
+        const CpuFeatures& cpu = CpuFeatures::get();
+        (void)cpu;
+#ifdef MIDIVERSE_X86_KERNELS
+        if (cpu.avx2 && cpu.fma) return {renderSynthVoiceAvx2, "avx2"};
+        if (cpu.sse41) return {renderSynthVoiceSse41, "sse4.1"};
+#endif
+#ifdef MIDIVERSE_NEON_KERNELS
+        if (cpu.neon) return {renderSynthVoiceNeon, "neon"};
+#endif
+        return {renderSynthVoiceScalar, "scalar"};
+    }
+
+    const KernelChoice& getKernelChoice() {
+        static const KernelChoice choice = chooseKernel();
+        return choice;
+    }
+}
+
+void renderSynthVoiceScalar(const SynthVoiceArgs& args, float* left, float* right, int numFrames) {
+    renderScalarRange(args, left, right, 0, numFrames);
+}
+
+SynthVoiceKernel selectSynthVoiceKernel() {
+    return getKernelChoice().kernel;
+}
+
+const char* getSynthVoiceKernelName() {
+    return getKernelChoice().name;
+}
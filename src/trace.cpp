@@ -0,0 +1,185 @@
+#include "trace.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "logger.h"
+
+namespace {
+    struct TraceEvent {
+        const char* name;
+        int64_t start;
+        int64_t duration;
+        uint64_t context;
+    };
+
+    // One thread's spans. Only its thread writes; the mutex is for the dump,
+    // so recording never waits on another recorder.
+    struct ThreadBuffer {
+        std::mutex mutex;
+        std::vector<TraceEvent> events;
+        uint64_t written = 0;
+        std::string name;
+        int tid = 0;
+    };
+
+    std::mutex registryMutex;
+    std::vector<std::shared_ptr<ThreadBuffer>> registry;
+    int nextTid = 1;
+    std::atomic<uint64_t> nextContext(1);
+
+    thread_local std::shared_ptr<ThreadBuffer> localBuffer;
+    thread_local std::string localName;
+    thread_local uint64_t localContext = 0;
+
+    ThreadBuffer& getLocalBuffer() {
+        if (!localBuffer) {
+            auto buffer = std::make_shared<ThreadBuffer>();
+            buffer->events.resize(Tracer::kEventsPerThread);
+            buffer->name = localName;
+            std::lock_guard<std::mutex> lock(registryMutex);
+            buffer->tid = nextTid++;
+            registry.push_back(buffer);
+            localBuffer = std::move(buffer);
+        }
+        return *localBuffer;
+    }
+
+    void writeEscaped(FILE* file, const std::string& text) {
+        for (char c : text) {
+            if (c == '"' || c == '\\') {
+                fputc('\\', file);
+                fputc(c, file);
+            } else if (static_cast<unsigned char>(c) >= 0x20) {
+                fputc(c, file);
+            }
+        }
+    }
+}
+
+std::atomic<int> Tracer::activeSessions(0);
+
+void Tracer::beginSession() {
+    activeSessions.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Tracer::endSession() {
+    if (activeSessions.fetch_sub(1, std::memory_order_relaxed) != 1) {
+        return;
+    }
+    // Last session: forget the spans, and the buffers of threads that have exited
+    std::lock_guard<std::mutex> lock(registryMutex);
+    registry.erase(std::remove_if(registry.begin(), registry.end(),
+                                  [](const std::shared_ptr<ThreadBuffer>& buffer) { return buffer.use_count() == 1; }),
+                   registry.end());
+    for (const auto& buffer : registry) {
+        std::lock_guard<std::mutex> bufferLock(buffer->mutex);
+        buffer->written = 0;
+    }
+}
+
+int64_t Tracer::now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void Tracer::record(const char* name, int64_t start, int64_t end) {
+    ThreadBuffer& buffer = getLocalBuffer();
+    std::lock_guard<std::mutex> lock(buffer.mutex);
+    buffer.events[buffer.written % kEventsPerThread] = {name, start, end - start, localContext};
+    ++buffer.written;
+}
+
+void Tracer::setThreadName(const std::string& name) {
+    localName = name;
+    if (localBuffer) {
+        std::lock_guard<std::mutex> lock(localBuffer->mutex);
+        localBuffer->name = name;
+    }
+}
+
+uint64_t Tracer::getContext() {
+    return localContext;
+}
+
+void Tracer::setContext(uint64_t context) {
+    localContext = context;
+}
+
+uint64_t Tracer::newContext() {
+    return nextContext.fetch_add(1, std::memory_order_relaxed);
+}
+
+bool Tracer::writeJson(const std::string& filePath, uint64_t context) {
+    struct ThreadEvents {
+        int tid;
+        std::string name;
+        std::vector<TraceEvent> events;
+    };
+    std::vector<ThreadEvents> threads;
+    uint64_t dropped = 0;
+    {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        for (const auto& buffer : registry) {
+            std::lock_guard<std::mutex> bufferLock(buffer->mutex);
+            size_t count = static_cast<size_t>(std::min<uint64_t>(buffer->written, kEventsPerThread));
+            dropped += buffer->written - count;
+            ThreadEvents thread{buffer->tid, buffer->name, {}};
+            for (size_t i = 0; i < count; ++i) {
+                const TraceEvent& event = buffer->events[i];
+                if (context == 0 || event.context == context) {
+                    thread.events.push_back(event);
+                }
+            }
+            if (!thread.events.empty()) {
+                threads.push_back(std::move(thread));
+            }
+        }
+    }
+
+    // Timestamps start at the first span so the viewer opens on the trace
+    int64_t origin = INT64_MAX;
+    for (const ThreadEvents& thread : threads) {
+        for (const TraceEvent& event : thread.events) {
+            origin = std::min(origin, event.start);
+        }
+    }
+
+    std::string tempPath = filePath + ".tmp";
+    FILE* file = fopen(tempPath.c_str(), "wb");
+    if (!file) {
+        LOG_ERROR("Could not open trace file: " << tempPath);
+        return false;
+    }
+
+    fprintf(file, "{\"traceEvents\":[\n");
+    bool first = true;
+    for (const ThreadEvents& thread : threads) {
+        if (!thread.name.empty()) {
+            fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"",
+                    first ? "" : ",\n", thread.tid);
+            writeEscaped(file, thread.name);
+            fprintf(file, "\"}}");
+            first = false;
+        }
+        for (const TraceEvent& event : thread.events) {
+            fprintf(file, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                    first ? "" : ",\n", event.name, thread.tid, (event.start - origin) / 1000.0,
+                    event.duration / 1000.0);
+            first = false;
+        }
+    }
+    fprintf(file, "\n],\"displayTimeUnit\":\"ms\",\"otherData\":{\"droppedEvents\":%llu}}\n",
+            static_cast<unsigned long long>(dropped));
+
+    bool ok = !ferror(file);
+    ok = (fclose(file) == 0) && ok;
+    if (!ok || std::rename(tempPath.c_str(), filePath.c_str()) != 0) {
+        LOG_ERROR("Could not write trace file: " << filePath);
+        std::remove(tempPath.c_str());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,247 @@
+#include "track_mixer.h"
+#include "cpu_features.h"
+#include <algorithm>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MIDIVERSE_X86_KERNELS 1
+#elif defined(__aarch64__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define MIDIVERSE_NEON_KERNELS 1
+#endif
+
+namespace {
+    constexpr int kNumMidiChannels = 16;
+    constexpr uint8_t kVolumeController = 7;
+    constexpr uint8_t kPanController = 10;
+    constexpr uint8_t kDefaultVolume = 100;
+    constexpr uint8_t kCentrePan = 64;
+
+    bool isMixerController(uint8_t status, uint8_t data1) {
+        return (status & 0xF0) == 0xB0 && (data1 == kVolumeController || data1 == kPanController);
+    }
+
+    bool isNoteMessage(uint8_t status) {
+        uint8_t type = status & 0xF0;
+        return type == 0x80 || type == 0x90 || type == 0xA0;
+    }
+
+    TrackPart::GainChange makeGainChange(int64_t sample, uint8_t volume, uint8_t pan, int numChannels) {
+        // GM volume curve and equal-power pan, normalised so a part rendered at
+        // full volume and centre pan comes out as if the instrument had applied them
+        float gain = (volume / 127.0f) * (volume / 127.0f);
+        if (numChannels == 1) {
+            return {sample, gain, gain};
+        }
+        double angle = (pan / 127.0) * (M_PI / 2.0);
+        double centre = (kCentrePan / 127.0) * (M_PI / 2.0);
+        return {sample, static_cast<float>(gain * std::cos(angle) / std::cos(centre)),
+                static_cast<float>(gain * std::sin(angle) / std::sin(centre))};
+    }
+
+    void pushGainChange(TrackPart& part, const TrackPart::GainChange& change) {
+        // Several changes on one sample collapse into the last
+        if (!part.gainChanges.empty() && part.gainChanges.back().sample == change.sample) {
+            part.gainChanges.back() = change;
+        } else {
+            part.gainChanges.push_back(change);
+        }
+    }
+
+    //===== Mix kernels: output += input * gain =====
+
+    using MixKernel = void (*)(float* output, const float* input, float gain, int numFrames);
+
+    void mixScalar(float* output, const float* input, float gain, int numFrames) {
+        for (int i = 0; i < numFrames; ++i) {
+            output[i] += input[i] * gain;
+        }
+    }
+
+#ifdef MIDIVERSE_X86_KERNELS
+    // Multiply and add stay separate (no FMA) so every kernel rounds like the scalar one
+    __attribute__((target("avx2")))
+    void mixAvx2(float* output, const float* input, float gain, int numFrames) {
+        const __m256 g = _mm256_set1_ps(gain);
+        int i = 0;
+        for (; i + 8 <= numFrames; i += 8) {
+            __m256 sum = _mm256_add_ps(_mm256_loadu_ps(output + i), _mm256_mul_ps(_mm256_loadu_ps(input + i), g));
+            _mm256_storeu_ps(output + i, sum);
+        }
+        mixScalar(output + i, input + i, gain, numFrames - i);
+    }
+
+    __attribute__((target("sse4.1")))
+    void mixSse41(float* output, const float* input, float gain, int numFrames) {
+        const __m128 g = _mm_set1_ps(gain);
+        int i = 0;
+        for (; i + 4 <= numFrames; i += 4) {
+            __m128 sum = _mm_add_ps(_mm_loadu_ps(output + i), _mm_mul_ps(_mm_loadu_ps(input + i), g));
+            _mm_storeu_ps(output + i, sum);
+        }
+        mixScalar(output + i, input + i, gain, numFrames - i);
+    }
+#endif
+
+#ifdef MIDIVERSE_NEON_KERNELS
+    void mixNeon(float* output, const float* input, float gain, int numFrames) {
+        const float32x4_t g = vdupq_n_f32(gain);
+        int i = 0;
+        for (; i + 4 <= numFrames; i += 4) {
+            vst1q_f32(output + i, vaddq_f32(vld1q_f32(output + i), vmulq_f32(vld1q_f32(input + i), g)));
+        }
+        mixScalar(output + i, input + i, gain, numFrames - i);
+    }
+#endif
+
+    struct KernelChoice {
+        MixKernel kernel;
+        const char* name;
+    };
+
+    KernelChoice chooseKernel() {
+        const CpuFeatures& cpu = CpuFeatures::get();
+        (void)cpu;
+#ifdef MIDIVERSE_X86_KERNELS
+        if (cpu.avx2) return {mixAvx2, "avx2"};
+        if (cpu.sse41) return {mixSse41, "sse4.1"};
+#endif
+#ifdef MIDIVERSE_NEON_KERNELS
+        if (cpu.neon) return {mixNeon, "neon"};
+#endif
+        return {mixScalar, "scalar"};
+    }
+
+    const KernelChoice& getKernelChoice() {
+        static const KernelChoice choice = chooseKernel();
+        return choice;
+    }
+}
+
+void splitSequenceIntoParts(const MidiSequence& sequence, double sampleRate, int numChannels,
+                            std::vector<TrackPart>& parts) {
+    const auto& status = sequence.getStatus();
+    const auto& data1 = sequence.getData1();
+    const auto& data2 = sequence.getData2();
+    const auto& tracks = sequence.getTracks();
+    const auto& ticks = sequence.getTicks();
+    const size_t numEvents = sequence.size();
+
+    // Every channel that plays notes becomes a part. Tracks sharing a channel stay
+    // together, since a note-off or pedal on one track can end another's notes.
+    int channelPart[kNumMidiChannels];
+    std::fill(channelPart, channelPart + kNumMidiChannels, -1);
+    uint16_t channelTrack[kNumMidiChannels] = {};
+    for (size_t i = 0; i < numEvents; ++i) {
+        if (MidiSequence::isChannelEvent(status[i]) && isNoteMessage(status[i])) {
+            uint8_t channel = status[i] & 0x0F;
+            if (channelPart[channel] < 0) {
+                channelPart[channel] = 0;
+                channelTrack[channel] = tracks[i];
+            }
+        }
+    }
+
+    size_t numParts = 0;
+    for (int channel = 0; channel < kNumMidiChannels; ++channel) {
+        if (channelPart[channel] >= 0) {
+            channelPart[channel] = static_cast<int>(numParts++);
+        }
+    }
+
+    parts.resize(numParts);
+    for (int channel = 0; channel < kNumMidiChannels; ++channel) {
+        if (channelPart[channel] < 0) {
+            continue;
+        }
+        TrackPart& part = parts[channelPart[channel]];
+        part.channel = static_cast<uint8_t>(channel);
+        part.track = channelTrack[channel];
+        part.sequence.clear();
+        part.sequence.getTempoMap() = sequence.getTempoMap();
+        part.gainChanges.clear();
+
+        // The mixer owns volume and pan, so the instrument plays at full volume, centred
+        uint8_t controlStatus = static_cast<uint8_t>(0xB0 | channel);
+        part.sequence.addChannelEvent(0, part.track, controlStatus, kVolumeController, 127);
+        part.sequence.addChannelEvent(0, part.track, controlStatus, kPanController, kCentrePan);
+    }
+
+    std::vector<int64_t> eventSamples;
+    sequence.computeSampleOffsets(sampleRate, eventSamples);
+
+    uint8_t volume[kNumMidiChannels];
+    uint8_t pan[kNumMidiChannels];
+    std::fill(volume, volume + kNumMidiChannels, kDefaultVolume);
+    std::fill(pan, pan + kNumMidiChannels, kCentrePan);
+    for (TrackPart& part : parts) {
+        part.gainChanges.push_back(makeGainChange(0, kDefaultVolume, kCentrePan, numChannels));
+    }
+
+    for (size_t i = 0; i < numEvents; ++i) {
+        if (MidiSequence::isChannelEvent(status[i])) {
+            uint8_t channel = status[i] & 0x0F;
+            if (channelPart[channel] < 0) {
+                continue;
+            }
+            TrackPart& part = parts[channelPart[channel]];
+            if (isMixerController(status[i], data1[i])) {
+                (data1[i] == kVolumeController ? volume : pan)[channel] = data2[i];
+                pushGainChange(part, makeGainChange(eventSamples[i], volume[channel], pan[channel], numChannels));
+            } else {
+                part.sequence.addChannelEvent(ticks[i], tracks[i], status[i], data1[i], data2[i]);
+            }
+        } else if (status[i] == MidiSequence::kSysExStatus || status[i] == MidiSequence::kSysExEscapeStatus) {
+            // SysEx can change any part of the instrument, so every part gets it
+            for (TrackPart& part : parts) {
+                part.sequence.addSysExEvent(ticks[i], tracks[i], status[i], sequence.getPayload(i),
+                                            sequence.getPayloadSize(i));
+            }
+        }
+    }
+
+    // Every part lasts as long as the whole sequence so the buffers line up
+    for (TrackPart& part : parts) {
+        part.sequence.addMetaEvent(sequence.getEndTick(), part.track, MidiSequence::kMetaEndOfTrack, nullptr, 0);
+    }
+}
+
+void TrackMixer::clear(float* const* outputs, int numChannels, int numFrames) {
+    for (int channel = 0; channel < numChannels; ++channel) {
+        std::fill(outputs[channel], outputs[channel] + numFrames, 0.0f);
+    }
+}
+
+void TrackMixer::addPart(const TrackPart& part, const float* const* inputs, float* const* outputs, int numChannels,
+                         int64_t position, int numFrames) {
+    const std::vector<TrackPart::GainChange>& changes = part.gainChanges;
+    if (changes.empty()) {
+        return;
+    }
+    MixKernel kernel = getKernelChoice().kernel;
+
+    // Last change at or before the first frame
+    auto after = std::upper_bound(changes.begin(), changes.end(), position,
+        [](int64_t sample, const TrackPart::GainChange& change) { return sample < change.sample; });
+    size_t index = after == changes.begin() ? 0 : static_cast<size_t>(after - changes.begin()) - 1;
+
+    // Mix each stretch of constant gain in one pass
+    int offset = 0;
+    while (offset < numFrames) {
+        int64_t nextChange = index + 1 < changes.size() ? changes[index + 1].sample - position : numFrames;
+        int end = static_cast<int>(std::min<int64_t>(numFrames, std::max<int64_t>(nextChange, offset)));
+        for (int channel = 0; channel < numChannels && end > offset; ++channel) {
+            float gain = (numChannels == 1 || channel % 2 == 0) ? changes[index].left : changes[index].right;
+            if (gain != 0.0f) {
+                kernel(outputs[channel] + offset, inputs[channel] + offset, gain, end - offset);
+            }
+        }
+        offset = end;
+        ++index;
+    }
+}
+
+const char* TrackMixer::getKernelName() {
+    return getKernelChoice().name;
+}
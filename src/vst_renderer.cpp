@@ -1,5 +1,9 @@
 #include "vst_renderer.h"
-#include <iostream>
+#include "logger.h"
+#include "synth_engine.h"
+#include "trace.h"
+#include "work_stealing_pool.h"
+#include <algorithm>
 #include <stdexcept>
 #include <cmath>
 
@@ -12,272 +16,595 @@
 #include <juce_audio_utils/juce_audio_utils.h>
 #endif
 
-VstRenderer::VstRenderer() 
-#ifndef USE_JUCE
-    : vstInstance(nullptr)
-#endif
-{
-#ifdef USE_JUCE
-    // Initialize JUCE components
-    juce::MessageManager::getInstance();
-    formatManager = std::make_unique<juce::AudioPluginFormatManager>();
-    formatManager->addDefaultFormats();
-#endif
+namespace {
+    // Frames up to and including the last one above level, 0 if all are below it
+    int findSoundEnd(const float* const* channels, int numChannels, int numFrames, float level) {
+        for (int frame = numFrames; frame > 0; --frame) {
+            for (int channel = 0; channel < numChannels; ++channel) {
+                if (std::fabs(channels[channel][frame - 1]) > level) {
+                    return frame;
+                }
+            }
+        }
+        return 0;
+    }
+}
+
+VstRenderer::VstRenderer()
+    : renderSequence(nullptr), renderChannels(0),
+      renderPosition(0), renderLength(0), nextEvent(0), blockSize(kDefaultBlockSize),
+      parallelTracks(0), parallelSegments(0), tailStart(0), holdFrames(0), silenceLevel(0.0f),
+      processedFrames(0), deliveredFrames(0), tailFinished(false) {
 }
 
 VstRenderer::~VstRenderer() {
-#ifdef USE_JUCE
-    // JUCE cleanup happens automatically through unique_ptr
-    juce::MessageManager::getInstance()->deleteInstance();
-#else
-    // Clean up dummy VST instance if loaded
-    if (vstInstance) {
-        vstInstance = nullptr;
-    }
-#endif
+    releaseInstance();
+}
+
+void VstRenderer::setInstancePool(std::shared_ptr<PluginInstancePool> pool) {
+    releaseInstance();
+    instancePool = std::move(pool);
+}
+
+std::shared_ptr<PluginInstancePool> VstRenderer::getInstancePool() const {
+    return instancePool;
 }
 
-bool VstRenderer::loadVst(const std::string& vstPath) {
+bool VstRenderer::loadVst(const std::string& vstPath, float sampleRate, int numChannels) {
     this->vstPath = vstPath;
     
-#ifdef USE_JUCE
-    return loadVstWithJuce(vstPath);
-#else
-    std::cout << "Loading VST plugin (dummy mode): " << vstPath << std::endl;
-    std::cout << "Note: Built without JUCE support. Using dummy audio generation." << std::endl;
-    
-    // Simulate successful loading with a dummy pointer
-    vstInstance = reinterpret_cast<void*>(1);
-    return true;
+#ifndef USE_JUCE
+    LOG_INFO("Loading VST plugin (dummy mode): " << vstPath);
+    LOG_INFO("Note: Built without JUCE support. Using the built-in synthesizer.");
 #endif
+    
+    return acquireInstance(sampleRate, numChannels);
 }
 
-bool VstRenderer::renderMidi(const std::vector<uint8_t>& midiData, float sampleRate, int numChannels) {
-#ifdef USE_JUCE
-    return renderMidiWithJuce(midiData, sampleRate, numChannels);
-#else
+bool VstRenderer::acquireInstance(float sampleRate, int numChannels) {
+    PluginInstanceKey key;
+    key.path = vstPath;
+    key.sampleRate = sampleRate;
+    key.blockSize = blockSize;
+    key.numChannels = numChannels;
+    
+    if (vstInstance && key == instanceKey) {
+        return true;
+    }
+    
+    TRACE_SCOPE("plugin load");
+    releaseInstance();
+    vstInstance = ensureInstancePool().acquire(key);
     if (!vstInstance) {
-        std::cerr << "No VST plugin loaded" << std::endl;
         return false;
     }
     
-    std::cout << "Rendering MIDI through dummy audio generator..." << std::endl;
-    return renderDummyAudio(sampleRate, numChannels);
-#endif
+    instanceKey = key;
+    return true;
 }
 
-const std::vector<float>& VstRenderer::getAudioData() const {
-    return audioData;
+PluginInstancePool& VstRenderer::ensureInstancePool() {
+    if (!instancePool) {
+        instancePool = std::make_shared<PluginInstancePool>();
+    }
+    return *instancePool;
 }
 
-#ifdef USE_JUCE
-//===== JUCE-specific implementations =====
+void VstRenderer::releaseInstance() {
+    if (vstInstance) {
+        instancePool->release(instanceKey, std::move(vstInstance));
+    }
+}
 
-bool VstRenderer::loadVstWithJuce(const std::string& vstPath) {
-    std::cout << "Loading VST plugin with JUCE: " << vstPath << std::endl;
-    
-    juce::String errorMessage;
+bool VstRenderer::renderMidi(const MidiSequence& sequence, float sampleRate, int numChannels) {
+    audio.setSize(numChannels, 0);
     
-    // Determine plugin format based on file extension
-    juce::String pluginPath = juce::String(vstPath);
-    juce::AudioPluginFormat* format = nullptr;
+    // Reserve the expected length up front so appending blocks doesn't reallocate
+    int64_t expectedFrames = sequence.getLengthInSamples(sampleRate) + static_cast<int64_t>(2.0 * sampleRate);
+    audio.reserve(static_cast<size_t>(expectedFrames));
     
-    // Look for the appropriate format
-    for (int i = 0; i < formatManager->getNumFormats(); ++i) {
-        format = formatManager->getFormat(i);
-        if (format->fileMightContainThisPluginType(pluginPath)) {
-            break;
+    return renderMidi(sequence, sampleRate, numChannels, [this](const float* const* channels, int numFrames) {
+        audio.append(channels, static_cast<size_t>(numFrames));
+        return true;
+    });
+}
+
+bool VstRenderer::renderMidi(const MidiSequence& sequence, float sampleRate, int numChannels,
+                             const BlockCallback& onBlock) {
+    TRACE_SCOPE("render");
+    if (parallelTracks > 1 && parallelSegments <= 1) {
+        splitSequenceIntoParts(sequence, sampleRate, numChannels, trackParts);
+        if (trackParts.size() > 1) {
+            return renderTracksInParallel(sampleRate, numChannels, onBlock);
         }
     }
     
-    if (format == nullptr) {
-        std::cerr << "No suitable plugin format found for: " << vstPath << std::endl;
+    if (!beginRender(sequence, sampleRate, numChannels, blockSize)) {
         return false;
     }
     
-    // Create plugin instance
-    std::unique_ptr<juce::PluginDescription> description = std::make_unique<juce::PluginDescription>();
-    description->fileOrIdentifier = pluginPath;
+#ifndef USE_JUCE
+    if (parallelSegments > 1 && renderLength > kSegmentFrames) {
+        return renderSegmentsInParallel(sampleRate, numChannels, onBlock);
+    }
+#endif
     
-    vstInstance.reset(format->createInstanceFromDescription(*description, 44100, 512, errorMessage));
+#ifdef USE_JUCE
+    LOG_INFO("Rendering MIDI through VST plugin with JUCE...");
+    LOG_INFO("Sample rate: " << sampleRate << " Hz");
+    LOG_INFO("Channels: " << numChannels);
+#else
+    LOG_INFO("Rendering MIDI through built-in synthesizer...");
+#endif
     
-    if (vstInstance == nullptr) {
-        std::cerr << "Failed to load VST plugin: " << errorMessage.toStdString() << std::endl;
-        return false;
+    int numFrames;
+    while (!tailFinished && (numFrames = renderNext(blockBuffer.getChannels(), blockSize)) > 0) {
+        if (!deliverFrames(blockBuffer.getChannels(), numChannels, numFrames, onBlock)) {
+            LOG_ERROR("Rendering stopped: block consumer failed");
+            return false;
+        }
     }
     
-    // Initialize the plugin
-    vstInstance->prepareToPlay(44100, 512);
+#ifdef USE_JUCE
+    LOG_INFO("Rendering complete. Generated " << deliveredFrames 
+             << " samples (" << deliveredFrames / sampleRate
+             << " seconds)");
+#else
+    LOG_INFO("Rendering complete (" << vstInstance->getKernelName() << " kernel). Generated " 
+             << deliveredFrames << " samples ("
+             << deliveredFrames / sampleRate << " seconds)");
+#endif
     
-    std::cout << "Successfully loaded VST plugin: " << vstInstance->getName().toStdString() << std::endl;
     return true;
 }
 
-std::unique_ptr<juce::MidiFile> VstRenderer::parseMidiData(const std::vector<uint8_t>& midiData) {
-    // Create a memory input stream from the MIDI data
-    juce::MemoryInputStream inputStream(midiData.data(), midiData.size(), false);
-    
-    // Parse the MIDI file
-    auto midiFile = std::make_unique<juce::MidiFile>();
-    if (midiFile->readFrom(inputStream)) {
-        return midiFile;
+const AudioBuffer& VstRenderer::getAudio() const {
+    return audio;
+}
+
+AudioBuffer VstRenderer::takeAudio() {
+    return std::move(audio);
+}
+
+void VstRenderer::setBlockSize(int numFrames) {
+    blockSize = std::max(numFrames, 1);
+}
+
+int VstRenderer::getBlockSize() const {
+    return blockSize;
+}
+
+void VstRenderer::setParallelTracks(int numThreads) {
+    parallelTracks = std::max(numThreads, 0);
+}
+
+int VstRenderer::getParallelTracks() const {
+    return parallelTracks;
+}
+
+void VstRenderer::setParallelSegments(int numThreads) {
+    parallelSegments = std::max(numThreads, 0);
+}
+
+int VstRenderer::getParallelSegments() const {
+    return parallelSegments;
+}
+
+void VstRenderer::setTail(const RenderTail& tail) {
+    this->tail = tail;
+}
+
+const RenderTail& VstRenderer::getTail() const {
+    return tail;
+}
+
+WorkStealingPool& VstRenderer::getRenderPool(int numThreads) {
+    if (!renderPool || renderPool->getNumWorkers() != numThreads) {
+        renderPool = std::make_unique<WorkStealingPool>(numThreads);
     }
-    
-    return nullptr;
+    return *renderPool;
 }
 
-bool VstRenderer::renderMidiWithJuce(const std::vector<uint8_t>& midiData, float sampleRate, int numChannels) {
-    if (!vstInstance) {
-        std::cerr << "No VST plugin loaded" << std::endl;
+bool VstRenderer::beginRender(const MidiSequence& sequence, float sampleRate, int numChannels, int maxFrames) {
+    if (vstPath.empty()) {
+        LOG_ERROR("No VST plugin loaded");
         return false;
     }
     
-    std::cout << "Rendering MIDI through VST plugin with JUCE..." << std::endl;
-    std::cout << "Sample rate: " << sampleRate << " Hz" << std::endl;
-    std::cout << "Channels: " << numChannels << std::endl;
-    
-    // Parse the MIDI file
-    auto midiFile = parseMidiData(midiData);
-    if (!midiFile) {
-        std::cerr << "Failed to parse MIDI data" << std::endl;
+    if (!acquireInstance(sampleRate, numChannels)) {
+        LOG_ERROR("Failed to prepare VST plugin for " << sampleRate << " Hz, " 
+                  << numChannels << " channels");
         return false;
     }
     
-    // Prepare the plugin for playback
-    vstInstance->prepareToPlay(sampleRate, 512);
+    // Start from silence even if this instance rendered before
+    vstInstance->reset();
     
-    // Determine the length of the MIDI sequence
-    double totalTimeInSeconds = 0.0;
-    for (int track = 0; track < midiFile->getNumTracks(); ++track) {
-        const juce::MidiMessageSequence* sequence = midiFile->getTrack(track);
-        if (sequence->getEndTime() > totalTimeInSeconds) {
-            totalTimeInSeconds = sequence->getEndTime();
-        }
-    }
+    // Events are already merged and timed by the tempo map; just place them at this rate
+    sequence.computeSampleOffsets(sampleRate, eventSamples);
+    renderSequence = &sequence;
+    renderChannels = numChannels;
+    renderPosition = 0;
+    nextEvent = 0;
     
-    // Add 2 seconds for reverb/release tail
-    totalTimeInSeconds += 2.0;
+    blockBuffer.setSize(numChannels, static_cast<size_t>(maxFrames));
+    chunkChannels.resize(numChannels);
+    deliverChannels.resize(numChannels);
     
-    // Calculate total number of samples
-    int totalSamples = static_cast<int>(totalTimeInSeconds * sampleRate);
+    int64_t sequenceEnd = sequence.getLengthInSamples(sampleRate);
+    int64_t maxTail = static_cast<int64_t>(tail.maxSeconds * sampleRate);
+    beginTail(sequenceEnd, sampleRate, numChannels);
     
-    // Create audio buffer for processing
-    juce::AudioBuffer<float> tempBuffer(numChannels, 512);
-    audioData.resize(totalSamples * numChannels);
+#ifdef USE_JUCE
+    if (tail.isAdaptive()) {
+        renderLength = sequenceEnd + maxTail;
+    } else {
+        // Add 2 seconds for reverb/release tail
+        renderLength = static_cast<int64_t>((sequence.getDurationSeconds() + 2.0) * sampleRate);
+    }
     
-    // Convert MIDI file to a sequence of MIDI messages
-    juce::MidiBuffer midiBuffer;
-    for (int track = 0; track < midiFile->getNumTracks(); ++track) {
-        const juce::MidiMessageSequence* sequence = midiFile->getTrack(track);
-        for (int i = 0; i < sequence->getNumEvents(); ++i) {
-            auto event = sequence->getEventPointer(i);
-            int samplePosition = static_cast<int>(event->message.getTimeStamp() * sampleRate);
-            midiBuffer.addEvent(event->message, samplePosition);
+    if (!blockMidi) {
+        blockMidi = std::make_unique<juce::MidiBuffer>();
+        processBuffer = std::make_unique<juce::AudioBuffer<float>>();
+    }
+    processBuffer->setSize(numChannels, blockSize);
+    // Room for a dense block of events and the longest SysEx, so rendering doesn't allocate
+    blockMidi->ensureSize(4096);
+    uint32_t longestSysEx = 0;
+    for (size_t i = 0; i < sequence.size(); ++i) {
+        if (sequence.getStatus()[i] == MidiSequence::kSysExStatus) {
+            longestSysEx = std::max(longestSysEx, sequence.getPayloadSize(i));
         }
     }
+    sysExMessage.reserve(longestSysEx + 2);
+#else
+    // Render until the last released voice has faded out, or let the tail check decide
+    renderLength = sequenceEnd + (tail.isAdaptive() ? maxTail : vstInstance->getReleaseSamples());
+#endif
     
-    // Process audio in blocks
-    int samplesRemaining = totalSamples;
-    int currentPosition = 0;
-    
-    juce::MidiBuffer::Iterator it(midiBuffer);
-    juce::MidiMessage message;
-    int samplePosition = 0;
+    return true;
+}
+
+void VstRenderer::beginTail(int64_t sequenceEnd, float sampleRate, int numChannels) {
+    tailStart = sequenceEnd;
+    holdFrames = std::max<int64_t>(1, static_cast<int64_t>(tail.holdSeconds * sampleRate));
+    silenceLevel = std::pow(10.0f, tail.thresholdDb / 20.0f);
+    processedFrames = 0;
+    deliveredFrames = 0;
+    tailFinished = false;
+    
+    // The held-back run never exceeds the hold window plus one block
+    pendingSilence.setSize(numChannels, 0);
+    if (tail.isAdaptive()) {
+        pendingSilence.reserve(static_cast<size_t>(holdFrames + blockSize));
+    }
+    tailChannels.resize(numChannels);
+}
+
+bool VstRenderer::deliverFrames(const float* const* channels, int numChannels, int numFrames,
+                                const BlockCallback& onBlock) {
+    if (!tail.isAdaptive()) {
+        deliveredFrames += numFrames;
+        return deliverBlocks(channels, numChannels, numFrames, onBlock);
+    }
     
-    juce::MidiBuffer blockMidi;
+    // The sequence itself always goes out whole
+    int offset = 0;
+    if (processedFrames < tailStart) {
+        offset = static_cast<int>(std::min<int64_t>(numFrames, tailStart - processedFrames));
+        if (!deliverBlocks(channels, numChannels, offset, onBlock)) {
+            return false;
+        }
+        processedFrames += offset;
+        deliveredFrames += offset;
+    }
     
-    while (samplesRemaining > 0) {
-        // Clear the temp buffer
-        tempBuffer.clear();
-        
-        // Get number of samples to process this iteration
-        int blockSize = std::min(512, samplesRemaining);
+    while (offset < numFrames && !tailFinished) {
+        int pieceFrames = std::min(blockSize, numFrames - offset);
+        for (int channel = 0; channel < numChannels; ++channel) {
+            tailChannels[channel] = channels[channel] + offset;
+        }
         
-        // Get MIDI events for this block
-        blockMidi.clear();
-        while (it.getNextEvent(message, samplePosition) && 
-               samplePosition < currentPosition + blockSize) {
-            blockMidi.addEvent(message, samplePosition - currentPosition);
+        int soundFrames = findSoundEnd(tailChannels.data(), numChannels, pieceFrames, silenceLevel);
+        if (soundFrames > 0) {
+            // Sound resumed, so the silence held back belongs to the output after all
+            int pendingFrames = static_cast<int>(pendingSilence.getNumFrames());
+            if (!deliverBlocks(pendingSilence.getChannels(), numChannels, pendingFrames, onBlock) ||
+                !deliverBlocks(tailChannels.data(), numChannels, soundFrames, onBlock)) {
+                return false;
+            }
+            deliveredFrames += pendingFrames + soundFrames;
+            pendingSilence.clear();
         }
         
-        // Process the block
-        juce::AudioBuffer<float> inputBuffer(numChannels, blockSize);
-        juce::AudioBuffer<float> outputBuffer(numChannels, blockSize);
+        for (int channel = 0; channel < numChannels; ++channel) {
+            tailChannels[channel] += soundFrames;
+        }
+        pendingSilence.append(tailChannels.data(), static_cast<size_t>(pieceFrames - soundFrames));
+        processedFrames += pieceFrames;
+        offset += pieceFrames;
         
-        // Clear the buffers
-        inputBuffer.clear();
-        outputBuffer.clear();
+        if (static_cast<int64_t>(pendingSilence.getNumFrames()) >= holdFrames) {
+            tailFinished = true;
+        }
+    }
+    return true;
+}
+
+bool VstRenderer::deliverBlocks(const float* const* channels, int numChannels, int numFrames,
+                                const BlockCallback& onBlock) {
+    for (int offset = 0; offset < numFrames; offset += blockSize) {
+        int blockFrames = std::min(blockSize, numFrames - offset);
+        for (int channel = 0; channel < numChannels; ++channel) {
+            deliverChannels[channel] = channels[channel] + offset;
+        }
+        if (!onBlock(deliverChannels.data(), blockFrames)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool VstRenderer::renderTracksInParallel(float sampleRate, int numChannels, const BlockCallback& onBlock) {
+    size_t numParts = trackParts.size();
+    WorkStealingPool& pool = getRenderPool(parallelTracks);
+    
+    // One renderer, and so one instance, per part, all from this renderer's pool
+    ensureInstancePool();
+    while (trackRenderers.size() < numParts) {
+        trackRenderers.push_back(std::make_unique<VstRenderer>());
+    }
+    for (size_t p = 0; p < numParts; ++p) {
+        VstRenderer& part = *trackRenderers[p];
+        if (part.instancePool != instancePool) {
+            part.setInstancePool(instancePool);
+        }
+        part.vstPath = vstPath;
+        part.blockSize = blockSize;
+        part.tail = tail;
+        if (!part.beginRender(trackParts[p].sequence, sampleRate, numChannels, kPartWindow)) {
+            // The parts are kept between renders, so their instances would stay checked out
+            for (size_t q = 0; q <= p; ++q) {
+                trackRenderers[q]->releaseInstance();
+            }
+            return false;
+        }
+    }
+    
+    // The mix bus
+    blockBuffer.setSize(numChannels, kPartWindow);
+    deliverChannels.resize(numChannels);
+    
+    // Parts share the sequence's end, so they all have the same length
+    int64_t totalSamples = trackRenderers[0]->renderLength;
+    beginTail(trackRenderers[0]->tailStart, sampleRate, numChannels);
+    
+    LOG_INFO("Rendering " << numParts << " parts on " << pool.getNumWorkers() 
+             << " threads (" << TrackMixer::getKernelName() << " mixer)...");
+    
+    bool completed = true;
+    for (int64_t position = 0; position < totalSamples && !tailFinished; position += kPartWindow) {
+        int numFrames = static_cast<int>(std::min<int64_t>(kPartWindow, totalSamples - position));
         
-        // Process audio
-        juce::MidiBuffer blockMidiCopy(blockMidi);
-        vstInstance->processBlock(outputBuffer, blockMidiCopy);
+        for (size_t p = 0; p < numParts; ++p) {
+            pool.submit([this, p, numFrames](int) {
+                VstRenderer& part = *trackRenderers[p];
+                part.renderNext(part.blockBuffer.getChannels(), numFrames);
+            });
+        }
+        pool.wait();
         
-        // Copy processed audio to our output vector
-        for (int channel = 0; channel < numChannels; ++channel) {
-            const float* channelData = outputBuffer.getReadPointer(channel);
-            for (int sample = 0; sample < blockSize; ++sample) {
-                audioData[(currentPosition + sample) * numChannels + channel] = channelData[sample];
+        // Sum in part order so the result doesn't depend on thread timing
+        {
+            TRACE_SCOPE("mix parts");
+            TrackMixer::clear(blockBuffer.getChannels(), numChannels, numFrames);
+            for (size_t p = 0; p < numParts; ++p) {
+                TrackMixer::addPart(trackParts[p], trackRenderers[p]->blockBuffer.getChannels(),
+                                    blockBuffer.getChannels(), numChannels, position, numFrames);
             }
         }
         
-        // Update position
-        currentPosition += blockSize;
-        samplesRemaining -= blockSize;
+        if (!deliverFrames(blockBuffer.getChannels(), numChannels, numFrames, onBlock)) {
+            LOG_ERROR("Rendering stopped: block consumer failed");
+            completed = false;
+            break;
+        }
     }
     
-    // Clean up
-    vstInstance->releaseResources();
+    // Hand the part instances back so other renders can use them
+    for (size_t p = 0; p < numParts; ++p) {
+        trackRenderers[p]->releaseInstance();
+    }
     
-    std::cout << "Rendering complete. Generated " << audioData.size() / numChannels 
-              << " samples (" << audioData.size() / numChannels / sampleRate 
-              << " seconds)" << std::endl;
+    if (completed) {
+        LOG_INFO("Rendering complete. Generated " << deliveredFrames << " samples (" 
+                 << deliveredFrames / sampleRate << " seconds)");
+    }
+    return completed;
+}
+
+#ifdef USE_JUCE
+//===== JUCE-specific implementations =====
+
+int VstRenderer::renderNext(float* const* outputs, int maxFrames) {
+    int numFrames = static_cast<int>(std::min<int64_t>(maxFrames, renderLength - renderPosition));
+    
+    const auto& status = renderSequence->getStatus();
+    const auto& data1 = renderSequence->getData1();
+    const auto& data2 = renderSequence->getData2();
+    const size_t numEvents = renderSequence->size();
+    
+    for (int offset = 0; offset < numFrames; offset += blockSize) {
+        int blockFrames = std::min(blockSize, numFrames - offset);
+        int64_t blockStart = renderPosition + offset;
+        int64_t blockEnd = blockStart + blockFrames;
+        
+        // Take this block's events off the pre-timed list, each at its exact offset;
+        // meta events aren't sent to plugins
+        {
+            TRACE_SCOPE("slice events");
+            blockMidi->clear();
+            for (; nextEvent < numEvents && eventSamples[nextEvent] < blockEnd; ++nextEvent) {
+                int sampleOffset = static_cast<int>(eventSamples[nextEvent] - blockStart);
+                uint8_t eventStatus = status[nextEvent];
+            
+                if (MidiSequence::isChannelEvent(eventStatus)) {
+                    uint8_t type = eventStatus & 0xF0;
+                    uint8_t message[3] = {eventStatus, data1[nextEvent], data2[nextEvent]};
+                    blockMidi->addEvent(message, (type == 0xC0 || type == 0xD0) ? 2 : 3, sampleOffset);
+                } else if (eventStatus == MidiSequence::kSysExStatus) {
+                    // The SMF payload follows the F0 and normally ends with the F7
+                    const uint8_t* payload = renderSequence->getPayload(nextEvent);
+                    uint32_t size = renderSequence->getPayloadSize(nextEvent);
+                    if (size > 0 && payload[size - 1] == 0xF7) {
+                        --size;
+                    }
+                    sysExMessage.resize(size + 2);
+                    sysExMessage[0] = MidiSequence::kSysExStatus;
+                    std::copy(payload, payload + size, sysExMessage.begin() + 1);
+                    sysExMessage[size + 1] = 0xF7;
+                    blockMidi->addEvent(sysExMessage.data(), static_cast<int>(sysExMessage.size()), sampleOffset);
+                }
+            }
+        }
+        
+        processBuffer->setSize(renderChannels, blockFrames, false, false, true);
+        processBuffer->clear();
+        {
+            TRACE_SCOPE("processBlock");
+            vstInstance->processBlock(*processBuffer, *blockMidi);
+        }
+        
+        for (int channel = 0; channel < renderChannels; ++channel) {
+            const float* channelData = processBuffer->getReadPointer(channel);
+            std::copy(channelData, channelData + blockFrames, outputs[channel] + offset);
+        }
+    }
     
-    return true;
+    // The instance stays prepared so the pool can hand it to the next job
+    renderPosition += numFrames;
+    return numFrames;
 }
 
 #else
-//===== Dummy implementation (no JUCE) =====
+//===== Built-in synthesizer implementation (no JUCE) =====
+
+// Everything a segment needs to render on its own
+struct VstRenderer::RenderSegment {
+    SynthEngine engine;
+    size_t firstEvent = 0;
+    int64_t start = 0;
+    int numFrames = 0;
+    AudioBuffer audio;
+    std::vector<float*> chunkChannels;
+};
 
-bool VstRenderer::renderDummyAudio(float sampleRate, int numChannels) {
-    std::cout << "Generating dummy audio (sine wave)..." << std::endl;
+int VstRenderer::renderNext(float* const* outputs, int maxFrames) {
+    int numFrames = static_cast<int>(std::min<int64_t>(maxFrames, renderLength - renderPosition));
+    renderSynthFrames(*vstInstance, nextEvent, renderPosition, numFrames, outputs, chunkChannels);
+    renderPosition += numFrames;
+    return numFrames;
+}
+
+void VstRenderer::renderSynthFrames(SynthEngine& engine, size_t& eventIndex, int64_t start, int numFrames,
+                                    float* const* outputs, std::vector<float*>& chunkChannels) const {
+    TRACE_SCOPE("synth render");
+    const auto& status = renderSequence->getStatus();
+    const auto& data1 = renderSequence->getData1();
+    const auto& data2 = renderSequence->getData2();
+    const size_t numEvents = renderSequence->size();
+    
+    int rendered = 0;
+    while (rendered < numFrames) {
+        int64_t now = start + rendered;
+        while (eventIndex < numEvents && eventSamples[eventIndex] <= now) {
+            if (MidiSequence::isChannelEvent(status[eventIndex])) {
+                engine.handleEvent(status[eventIndex], data1[eventIndex], data2[eventIndex]);
+            }
+            ++eventIndex;
+        }
+        
+        // Chunks end at the next event or block boundary, so the engine sees the same
+        // chunks however the render is sliced and notes start on their exact sample
+        int64_t chunkEnd = std::min<int64_t>(now - now % blockSize + blockSize, start + numFrames);
+        if (eventIndex < numEvents) {
+            chunkEnd = std::min(chunkEnd, eventSamples[eventIndex]);
+        }
+        int chunk = static_cast<int>(chunkEnd - now);
+        for (int channel = 0; channel < renderChannels; ++channel) {
+            chunkChannels[channel] = outputs[channel] + rendered;
+        }
+        engine.process(chunkChannels.data(), chunk);
+        rendered += chunk;
+    }
+}
+
+bool VstRenderer::renderSegmentsInParallel(float sampleRate, int numChannels, const BlockCallback& onBlock) {
+    WorkStealingPool& pool = getRenderPool(parallelSegments);
+    // Segments start on block boundaries so their chunks line up with a serial render
+    const int segmentFrames = std::max(kSegmentFrames - kSegmentFrames % blockSize, blockSize);
+    const int64_t numSegments = (renderLength + segmentFrames - 1) / segmentFrames;
+    
+    // A couple of segments per thread in flight keeps everyone busy while bounding memory
+    size_t batchSize = static_cast<size_t>(std::min<int64_t>(numSegments, pool.getNumWorkers() * 2));
+    while (renderSegments.size() < batchSize) {
+        renderSegments.push_back(std::make_unique<RenderSegment>());
+    }
+    for (size_t s = 0; s < batchSize; ++s) {
+        RenderSegment& segment = *renderSegments[s];
+        segment.audio.setSize(numChannels, static_cast<size_t>(segmentFrames));
+        segment.chunkChannels.resize(numChannels);
+    }
     
-    // Generate 5 seconds of audio at the given sample rate
-    size_t numSamples = static_cast<size_t>(sampleRate * 5 * numChannels);
-    audioData.resize(numSamples);
+    LOG_INFO("Rendering " << numSegments << " segments on " << pool.getNumWorkers() 
+             << " threads (" << vstInstance->getKernelName() << " kernel)...");
     
-    // Simple melody using sine waves
-    const float frequencies[] = {261.63f, 293.66f, 329.63f, 349.23f, 392.00f, 440.00f, 493.88f, 523.25f};
-    const float noteDuration = 0.5f; // half second per note
-    const float amplitude = 0.5f;
+    // The renderer's own engine only chases events from one segment start to the next;
+    // each segment renders on a copy of it taken at its start
+    const auto& status = renderSequence->getStatus();
+    const auto& data1 = renderSequence->getData1();
+    const auto& data2 = renderSequence->getData2();
+    const size_t numEvents = renderSequence->size();
+    SynthEngine& chase = *vstInstance;
     
-    for (size_t i = 0; i < numSamples; i += numChannels) {
-        float timeInSeconds = static_cast<float>(i / numChannels) / sampleRate;
-        int noteIndex = static_cast<int>(timeInSeconds / noteDuration) % 8;
-        float noteTime = fmod(timeInSeconds, noteDuration);
+    for (int64_t first = 0; first < numSegments && !tailFinished; first += batchSize) {
+        size_t count = static_cast<size_t>(std::min<int64_t>(batchSize, numSegments - first));
         
-        // Apply envelope (simple attack/decay)
-        float envelope = 1.0f;
-        if (noteTime < 0.05f) {
-            // Attack
-            envelope = noteTime / 0.05f;
-        } else if (noteTime > noteDuration - 0.1f) {
-            // Release
-            envelope = (noteDuration - noteTime) / 0.1f;
+        for (size_t s = 0; s < count; ++s) {
+            RenderSegment& segment = *renderSegments[s];
+            segment.start = (first + static_cast<int64_t>(s)) * segmentFrames;
+            segment.numFrames = static_cast<int>(std::min<int64_t>(segmentFrames, renderLength - segment.start));
+            
+            while (nextEvent < numEvents && eventSamples[nextEvent] < segment.start) {
+                chase.advanceTo(eventSamples[nextEvent]);
+                if (MidiSequence::isChannelEvent(status[nextEvent])) {
+                    chase.handleEvent(status[nextEvent], data1[nextEvent], data2[nextEvent]);
+                }
+                ++nextEvent;
+            }
+            chase.advanceTo(segment.start);
+            segment.engine = chase;
+            segment.firstEvent = nextEvent;
+            
+            pool.submit([this, &segment](int) {
+                size_t eventIndex = segment.firstEvent;
+                renderSynthFrames(segment.engine, eventIndex, segment.start, segment.numFrames,
+                                  segment.audio.getChannels(), segment.chunkChannels);
+            });
         }
+        pool.wait();
         
-        float sample = amplitude * envelope * 
-                      std::sin(2.0f * 3.14159f * frequencies[noteIndex] * timeInSeconds);
-        
-        // Write to all channels
-        for (int c = 0; c < numChannels; ++c) {
-            audioData[i + c] = sample;
+        for (size_t s = 0; s < count && !tailFinished; ++s) {
+            RenderSegment& segment = *renderSegments[s];
+            if (!deliverFrames(segment.audio.getChannels(), numChannels, segment.numFrames, onBlock)) {
+                LOG_ERROR("Rendering stopped: block consumer failed");
+                return false;
+            }
         }
     }
     
-    std::cout << "Generated " << audioData.size() / numChannels 
-              << " samples (" << audioData.size() / numChannels / sampleRate 
-              << " seconds) of dummy audio" << std::endl;
-    
+    LOG_INFO("Rendering complete. Generated " << deliveredFrames << " samples (" 
+             << deliveredFrames / sampleRate << " seconds)");
     return true;
 }
-#endif
\ No newline at end of file
+#endif
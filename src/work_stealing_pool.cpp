@@ -0,0 +1,127 @@
+#include "work_stealing_pool.h"
+#include <algorithm>
+#include <string>
+#include "trace.h"
+
+WorkStealingPool::WorkStealingPool(int numWorkers)
+    : nextQueue(0), steals(0), queuedTasks(0), pendingTasks(0), stopping(false) {
+    if (numWorkers <= 0) {
+        numWorkers = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    }
+
+    for (int i = 0; i < numWorkers; i++) {
+        queues.push_back(std::make_unique<WorkerQueue>());
+    }
+    for (int i = 0; i < numWorkers; i++) {
+        threads.emplace_back(&WorkStealingPool::workerLoop, this, i);
+    }
+}
+
+WorkStealingPool::~WorkStealingPool() {
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        stopping = true;
+    }
+    workAvailable.notify_all();
+
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+}
+
+void WorkStealingPool::submit(Task task) {
+    int workerIndex = static_cast<int>(nextQueue++ % queues.size());
+    submit(workerIndex, std::move(task));
+}
+
+void WorkStealingPool::submit(int workerIndex, Task task) {
+    // Counters change together with the deque (queue lock, then state lock) so
+    // queuedTasks never disagrees with what workers can find
+    WorkerQueue& queue = *queues[workerIndex % queues.size()];
+    // Spans the task records belong to whatever the submitter is tracing
+    uint64_t context = Tracer::getContext();
+    if (context != 0 && Tracer::isEnabled()) {
+        task = [context, inner = std::move(task)](int worker) {
+            TraceContextScope scope(context);
+            inner(worker);
+        };
+    }
+    {
+        std::lock_guard<std::mutex> queueLock(queue.mutex);
+        queue.tasks.push_back(std::move(task));
+        std::lock_guard<std::mutex> stateLock(stateMutex);
+        ++queuedTasks;
+        ++pendingTasks;
+    }
+    workAvailable.notify_one();
+}
+
+void WorkStealingPool::wait() {
+    std::unique_lock<std::mutex> lock(stateMutex);
+    allDone.wait(lock, [this]() { return pendingTasks == 0; });
+}
+
+int WorkStealingPool::getNumWorkers() const {
+    return static_cast<int>(queues.size());
+}
+
+uint64_t WorkStealingPool::getStealCount() const {
+    return steals.load();
+}
+
+void WorkStealingPool::workerLoop(int workerIndex) {
+    Tracer::setThreadName("pool worker " + std::to_string(workerIndex));
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(stateMutex);
+            workAvailable.wait(lock, [this]() { return stopping || queuedTasks > 0; });
+            if (stopping && queuedTasks == 0) {
+                return;
+            }
+        }
+
+        // Another worker may take the task we were woken for; then just wait again
+        Task task;
+        if (!popLocal(workerIndex, task) && !steal(workerIndex, task)) {
+            continue;
+        }
+
+        task(workerIndex);
+
+        std::lock_guard<std::mutex> lock(stateMutex);
+        if (--pendingTasks == 0) {
+            allDone.notify_all();
+        }
+    }
+}
+
+bool WorkStealingPool::popLocal(int workerIndex, Task& task) {
+    WorkerQueue& queue = *queues[workerIndex];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.tasks.empty()) {
+        return false;
+    }
+    task = std::move(queue.tasks.front());
+    queue.tasks.pop_front();
+    std::lock_guard<std::mutex> stateLock(stateMutex);
+    --queuedTasks;
+    return true;
+}
+
+bool WorkStealingPool::steal(int workerIndex, Task& task) {
+    // Visit the other workers starting with the next one, taking from the back
+    size_t numQueues = queues.size();
+    for (size_t offset = 1; offset < numQueues; offset++) {
+        WorkerQueue& victim = *queues[(workerIndex + offset) % numQueues];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.back());
+            victim.tasks.pop_back();
+            ++steals;
+            std::lock_guard<std::mutex> stateLock(stateMutex);
+            --queuedTasks;
+            return true;
+        }
+    }
+    return false;
+}
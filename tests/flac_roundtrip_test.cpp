@@ -0,0 +1,670 @@
+// Encodes test signals to FLAC through AudioWriter and decodes them with the
+// minimal decoder below, which checks every CRC. The decoded samples must match
+// the integer PCM the WAV path would write, bit for bit, at every level and
+// thread count.
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "audio_buffer.h"
+#include "audio_writer.h"
+#include "flac_encoder.h"
+#include "pcm_converter.h"
+
+namespace {
+    class BitReader {
+    public:
+        BitReader(const uint8_t* data, size_t size) : data(data), size(size), position(0) {}
+
+        bool read(int bits, uint32_t& value) {
+            value = 0;
+            for (int i = 0; i < bits; ++i) {
+                if (position >= size * 8) {
+                    return false;
+                }
+                value = (value << 1) | ((data[position / 8] >> (7 - position % 8)) & 1);
+                ++position;
+            }
+            return true;
+        }
+
+        bool readSigned(int bits, int32_t& value) {
+            uint32_t raw;
+            if (!read(bits, raw)) {
+                return false;
+            }
+            value = bits == 0 ? 0 : static_cast<int32_t>(raw << (32 - bits)) >> (32 - bits);
+            return true;
+        }
+
+        bool readUnary(uint32_t& zeros) {
+            zeros = 0;
+            uint32_t bit;
+            while (read(1, bit)) {
+                if (bit) {
+                    return true;
+                }
+                ++zeros;
+            }
+            return false;
+        }
+
+        void alignToByte() {
+            position = (position + 7) / 8 * 8;
+        }
+
+        size_t getBytePosition() const {
+            return position / 8;
+        }
+
+    private:
+        const uint8_t* data;
+        size_t size;
+        size_t position;
+    };
+
+    uint8_t crc8(const uint8_t* data, size_t size) {
+        uint8_t crc = 0;
+        for (size_t i = 0; i < size; ++i) {
+            crc ^= data[i];
+            for (int bit = 0; bit < 8; ++bit) {
+                crc = static_cast<uint8_t>((crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1);
+            }
+        }
+        return crc;
+    }
+
+    uint16_t crc16(const uint8_t* data, size_t size) {
+        uint16_t crc = 0;
+        for (size_t i = 0; i < size; ++i) {
+            crc ^= static_cast<uint16_t>(data[i] << 8);
+            for (int bit = 0; bit < 8; ++bit) {
+                crc = static_cast<uint16_t>((crc & 0x8000) ? (crc << 1) ^ 0x8005 : crc << 1);
+            }
+        }
+        return crc;
+    }
+
+    struct StreamInfo {
+        uint32_t minBlockSize = 0;
+        uint32_t maxBlockSize = 0;
+        uint32_t minFrameSize = 0;
+        uint32_t maxFrameSize = 0;
+        uint32_t sampleRate = 0;
+        int numChannels = 0;
+        int bitsPerSample = 0;
+        uint64_t totalSamples = 0;
+    };
+
+    // Counts of what the decoder met, so the tests can check each path is covered
+    struct Coverage {
+        int subframeTypes[4] = {};      // Constant, verbatim, fixed, LPC
+        int channelAssignments[11] = {};
+    };
+
+    bool decodeResidual(BitReader& reader, int blockSize, int order, int32_t* samples) {
+        uint32_t method, partitionOrder;
+        if (!reader.read(2, method) || method > 1 || !reader.read(4, partitionOrder)) {
+            return false;
+        }
+        int parameterBits = method == 0 ? 4 : 5;
+        uint32_t escape = method == 0 ? 15 : 31;
+        int partitions = 1 << partitionOrder;
+        int partitionSize = blockSize >> partitionOrder;
+        if ((blockSize & (partitions - 1)) != 0 || partitionSize < order) {
+            return false;
+        }
+        int32_t* out = samples + order;
+        for (int p = 0; p < partitions; ++p) {
+            int count = p == 0 ? partitionSize - order : partitionSize;
+            uint32_t parameter;
+            if (!reader.read(parameterBits, parameter)) {
+                return false;
+            }
+            if (parameter == escape) {
+                uint32_t bits;
+                if (!reader.read(5, bits)) {
+                    return false;
+                }
+                for (int i = 0; i < count; ++i) {
+                    if (!reader.readSigned(static_cast<int>(bits), *out++)) {
+                        return false;
+                    }
+                }
+                continue;
+            }
+            for (int i = 0; i < count; ++i) {
+                uint32_t high, low;
+                if (!reader.readUnary(high) || !reader.read(static_cast<int>(parameter), low)) {
+                    return false;
+                }
+                uint32_t folded = (high << parameter) | low;
+                *out++ = static_cast<int32_t>(folded >> 1) ^ -static_cast<int32_t>(folded & 1);
+            }
+        }
+        return true;
+    }
+
+    bool decodeSubframe(BitReader& reader, int blockSize, int bitsPerSample, int32_t* samples, Coverage& coverage) {
+        uint32_t padding, type, wastedFlag;
+        if (!reader.read(1, padding) || padding != 0 || !reader.read(6, type) || !reader.read(1, wastedFlag) ||
+            wastedFlag != 0) {
+            return false;
+        }
+
+        if (type == 0) {
+            coverage.subframeTypes[0]++;
+            int32_t value;
+            if (!reader.readSigned(bitsPerSample, value)) {
+                return false;
+            }
+            std::fill(samples, samples + blockSize, value);
+            return true;
+        }
+        if (type == 1) {
+            coverage.subframeTypes[1]++;
+            for (int i = 0; i < blockSize; ++i) {
+                if (!reader.readSigned(bitsPerSample, samples[i])) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        bool lpc = (type & 0x20) != 0;
+        int order;
+        if (lpc) {
+            order = static_cast<int>(type & 0x1F) + 1;
+        } else if ((type & 0x38) == 0x08 && (type & 0x07) <= 4) {
+            order = static_cast<int>(type & 0x07);
+        } else {
+            return false;
+        }
+        if (order > blockSize) {
+            return false;
+        }
+        for (int i = 0; i < order; ++i) {
+            if (!reader.readSigned(bitsPerSample, samples[i])) {
+                return false;
+            }
+        }
+
+        int32_t coefficients[32];
+        uint32_t precision = 0;
+        int32_t shift = 0;
+        if (lpc) {
+            coverage.subframeTypes[3]++;
+            if (!reader.read(4, precision) || precision == 15 || !reader.readSigned(5, shift) || shift < 0) {
+                return false;
+            }
+            ++precision;
+            for (int i = 0; i < order; ++i) {
+                if (!reader.readSigned(static_cast<int>(precision), coefficients[i])) {
+                    return false;
+                }
+            }
+        } else {
+            coverage.subframeTypes[2]++;
+        }
+
+        if (!decodeResidual(reader, blockSize, order, samples)) {
+            return false;
+        }
+
+        // Residuals were decoded in place; add the prediction back
+        for (int i = order; i < blockSize; ++i) {
+            int64_t prediction = 0;
+            if (lpc) {
+                for (int j = 0; j < order; ++j) {
+                    prediction += static_cast<int64_t>(coefficients[j]) * samples[i - j - 1];
+                }
+                prediction >>= shift;
+            } else {
+                switch (order) {
+                    case 0: break;
+                    case 1: prediction = samples[i - 1]; break;
+                    case 2: prediction = 2 * static_cast<int64_t>(samples[i - 1]) - samples[i - 2]; break;
+                    case 3: prediction = 3 * static_cast<int64_t>(samples[i - 1]) - 3 * static_cast<int64_t>(samples[i - 2]) +
+                                         samples[i - 3]; break;
+                    default: prediction = 4 * static_cast<int64_t>(samples[i - 1]) - 6 * static_cast<int64_t>(samples[i - 2]) +
+                                          4 * static_cast<int64_t>(samples[i - 3]) - samples[i - 4]; break;
+                }
+            }
+            samples[i] = static_cast<int32_t>(samples[i] + prediction);
+        }
+        return true;
+    }
+
+    // Decodes a whole stream into interleaved samples; returns an error message or ""
+    std::string decodeFlac(const std::vector<uint8_t>& bytes, StreamInfo& info, std::vector<int32_t>& output,
+                           Coverage& coverage) {
+        if (bytes.size() < FlacEncoder::kHeaderSize || std::memcmp(bytes.data(), "fLaC", 4) != 0) {
+            return "missing fLaC marker";
+        }
+
+        // Metadata blocks, STREAMINFO first
+        size_t offset = 4;
+        bool last = false;
+        bool first = true;
+        while (!last) {
+            if (offset + 4 > bytes.size()) {
+                return "truncated metadata";
+            }
+            last = (bytes[offset] & 0x80) != 0;
+            int type = bytes[offset] & 0x7F;
+            size_t length = (static_cast<size_t>(bytes[offset + 1]) << 16) | (bytes[offset + 2] << 8) | bytes[offset + 3];
+            offset += 4;
+            if (offset + length > bytes.size()) {
+                return "truncated metadata block";
+            }
+            if (first) {
+                if (type != 0 || length != FlacEncoder::kStreamInfoSize) {
+                    return "first metadata block is not STREAMINFO";
+                }
+                BitReader reader(bytes.data() + offset, length);
+                uint32_t value, high, low;
+                reader.read(16, info.minBlockSize);
+                reader.read(16, info.maxBlockSize);
+                reader.read(24, info.minFrameSize);
+                reader.read(24, info.maxFrameSize);
+                reader.read(20, info.sampleRate);
+                reader.read(3, value);
+                info.numChannels = static_cast<int>(value) + 1;
+                reader.read(5, value);
+                info.bitsPerSample = static_cast<int>(value) + 1;
+                reader.read(4, high);
+                reader.read(32, low);
+                info.totalSamples = (static_cast<uint64_t>(high) << 32) | low;
+                first = false;
+            }
+            offset += length;
+        }
+
+        output.clear();
+        std::vector<int32_t> channels[8];
+        uint64_t expectedFrame = 0;
+        while (offset < bytes.size()) {
+            BitReader reader(bytes.data() + offset, bytes.size() - offset);
+            uint32_t sync, reserved, blockingStrategy, blockSizeCode, sampleRateCode, assignment, sampleSizeCode;
+            if (!reader.read(14, sync) || sync != 0x3FFE) {
+                return "lost frame sync";
+            }
+            reader.read(1, reserved);
+            reader.read(1, blockingStrategy);
+            reader.read(4, blockSizeCode);
+            reader.read(4, sampleRateCode);
+            reader.read(4, assignment);
+            reader.read(3, sampleSizeCode);
+            uint32_t reserved2;
+            reader.read(1, reserved2);
+            if (reserved || reserved2 || blockingStrategy || sampleRateCode != 0 || assignment > 10) {
+                return "unexpected frame header";
+            }
+
+            // UTF-8 coded frame number
+            uint32_t lead;
+            reader.read(8, lead);
+            uint64_t frameNumber;
+            int continuation = 0;
+            if (lead < 0x80) {
+                frameNumber = lead;
+            } else {
+                while (lead & (0x40 >> continuation)) {
+                    ++continuation;
+                }
+                frameNumber = lead & (0x3F >> continuation);
+                for (int i = 0; i < continuation; ++i) {
+                    uint32_t next;
+                    reader.read(8, next);
+                    if ((next & 0xC0) != 0x80) {
+                        return "bad frame number";
+                    }
+                    frameNumber = (frameNumber << 6) | (next & 0x3F);
+                }
+            }
+            if (frameNumber != expectedFrame) {
+                return "frame number " + std::to_string(frameNumber) + ", expected " + std::to_string(expectedFrame);
+            }
+            ++expectedFrame;
+
+            int blockSize;
+            uint32_t value;
+            if (blockSizeCode == 1) {
+                blockSize = 192;
+            } else if (blockSizeCode >= 2 && blockSizeCode <= 5) {
+                blockSize = 576 << (blockSizeCode - 2);
+            } else if (blockSizeCode == 6) {
+                reader.read(8, value);
+                blockSize = static_cast<int>(value) + 1;
+            } else if (blockSizeCode == 7) {
+                reader.read(16, value);
+                blockSize = static_cast<int>(value) + 1;
+            } else if (blockSizeCode >= 8) {
+                blockSize = 256 << (blockSizeCode - 8);
+            } else {
+                return "reserved block size";
+            }
+
+            const int sampleSizes[8] = {0, 8, 12, 0, 16, 20, 24, 32};
+            int bitsPerSample = sampleSizes[sampleSizeCode];
+            if (bitsPerSample != info.bitsPerSample) {
+                return "sample size differs from STREAMINFO";
+            }
+
+            uint32_t headerCrc;
+            size_t headerBytes = reader.getBytePosition();
+            reader.read(8, headerCrc);
+            if (crc8(bytes.data() + offset, headerBytes) != headerCrc) {
+                return "frame header CRC mismatch";
+            }
+
+            int numChannels = assignment <= 7 ? static_cast<int>(assignment) + 1 : 2;
+            if (numChannels != info.numChannels) {
+                return "channel count differs from STREAMINFO";
+            }
+            coverage.channelAssignments[assignment]++;
+            for (int c = 0; c < numChannels; ++c) {
+                // The side channel has one extra bit
+                bool side = (assignment == 8 && c == 1) || (assignment == 9 && c == 0) || (assignment == 10 && c == 1);
+                channels[c].resize(blockSize);
+                if (!decodeSubframe(reader, blockSize, bitsPerSample + (side ? 1 : 0), channels[c].data(), coverage)) {
+                    return "bad subframe in frame " + std::to_string(frameNumber);
+                }
+            }
+
+            reader.alignToByte();
+            size_t frameBytes = reader.getBytePosition();
+            uint32_t frameCrc;
+            if (!reader.read(16, frameCrc) || crc16(bytes.data() + offset, frameBytes) != frameCrc) {
+                return "frame CRC mismatch in frame " + std::to_string(frameNumber);
+            }
+            frameBytes += 2;
+            if (frameBytes < info.minFrameSize || frameBytes > info.maxFrameSize) {
+                return "frame size outside the STREAMINFO range";
+            }
+            offset += frameBytes;
+
+            for (int i = 0; i < blockSize; ++i) {
+                int32_t a = channels[0][i];
+                int32_t b = numChannels > 1 ? channels[1][i] : 0;
+                switch (assignment) {
+                    case 8: b = a - b; break;                   // Left, side
+                    case 9: a = a + b; break;                   // Side, right
+                    case 10: {                                  // Mid, side
+                        int32_t mid = static_cast<int32_t>((static_cast<uint32_t>(a) << 1) | (b & 1));
+                        a = (mid + b) >> 1;
+                        b = (mid - b) >> 1;
+                        break;
+                    }
+                    default: break;
+                }
+                output.push_back(a);
+                if (numChannels > 1) {
+                    output.push_back(b);
+                }
+                for (int c = 2; c < numChannels; ++c) {
+                    output.push_back(channels[c][i]);
+                }
+            }
+        }
+
+        if (output.size() != info.totalSamples * static_cast<uint64_t>(info.numChannels)) {
+            return "decoded " + std::to_string(output.size() / info.numChannels) + " frames, STREAMINFO says " +
+                   std::to_string(info.totalSamples);
+        }
+        return "";
+    }
+
+    // What the WAV path writes for the same audio, as integers
+    std::vector<int32_t> referencePcm(const AudioBuffer& audio, SampleFormat format) {
+        size_t numSamples = audio.getNumFrames() * audio.getNumChannels();
+        std::vector<float> interleaved(numSamples);
+        std::vector<const float*> channels(audio.getNumChannels());
+        for (int c = 0; c < audio.getNumChannels(); ++c) {
+            channels[c] = audio.getChannel(c);
+        }
+        interleaveChannels(channels.data(), audio.getNumChannels(), audio.getNumFrames(), interleaved.data());
+
+        PcmConverter converter(format);
+        std::vector<uint8_t> bytes(numSamples * converter.getBytesPerSample());
+        converter.convert(interleaved.data(), numSamples, bytes.data());
+
+        std::vector<int32_t> samples(numSamples);
+        for (size_t i = 0; i < numSamples; ++i) {
+            if (format == SampleFormat::Int16) {
+                samples[i] = static_cast<int16_t>(bytes[2 * i] | (bytes[2 * i + 1] << 8));
+            } else {
+                const uint8_t* b = &bytes[3 * i];
+                samples[i] = static_cast<int32_t>(static_cast<uint32_t>(b[0] << 8 | b[1] << 16 | b[2] << 24)) >> 8;
+            }
+        }
+        return samples;
+    }
+
+    bool encode(const AudioBuffer& audio, SampleFormat format, int level, int numThreads, std::vector<uint8_t>& bytes) {
+        AudioWriter writer;
+        writer.setFileFormat(AudioFileFormat::Flac);
+        writer.setFlacLevel(level);
+        writer.setEncoderThreads(numThreads);
+        if (!writer.openMemory(bytes, 44100, audio.getNumChannels(), format)) {
+            return false;
+        }
+        // Uneven blocks, so frames straddle appendBlock() calls
+        std::vector<const float*> channels(audio.getNumChannels());
+        size_t blockFrames = 1000;
+        for (size_t frame = 0; frame < audio.getNumFrames(); frame += blockFrames, blockFrames = blockFrames * 3 % 7919 + 1) {
+            size_t numFrames = std::min(blockFrames, audio.getNumFrames() - frame);
+            for (int c = 0; c < audio.getNumChannels(); ++c) {
+                channels[c] = audio.getChannel(c) + frame;
+            }
+            if (!writer.appendBlock(channels.data(), numFrames)) {
+                return false;
+            }
+        }
+        return writer.finalize();
+    }
+
+    struct Signal {
+        std::string name;
+        AudioBuffer audio;
+    };
+
+    uint32_t nextRandom(uint32_t& state) {
+        state = state * 1664525u + 1013904223u;
+        return state;
+    }
+
+    float noise(uint32_t& state) {
+        return static_cast<float>(nextRandom(state) >> 8) / static_cast<float>(1 << 24) * 2.0f - 1.0f;
+    }
+
+    Signal makeSignal(const std::string& name, int numChannels, size_t numFrames) {
+        Signal signal;
+        signal.name = name;
+        signal.audio.setSize(numChannels, numFrames);
+        uint32_t state = 12345;
+        for (size_t i = 0; i < numFrames; ++i) {
+            double t = static_cast<double>(i) / 44100.0;
+            float sine = static_cast<float>(0.5 * std::sin(2.0 * M_PI * 440.0 * t) + 0.2 * std::sin(2.0 * M_PI * 1234.5 * t));
+            for (int c = 0; c < numChannels; ++c) {
+                float value = 0.0f;
+                if (name == "sine" || name == "mono" || name == "short") {
+                    value = sine;
+                } else if (name == "noise") {
+                    value = noise(state);
+                } else if (name == "clipped noise") {
+                    value = 1.5f * noise(state);
+                } else if (name == "square") {
+                    value = (i / 100) % 2 ? 0.25f : -0.25f;
+                } else if (name == "correlated") {
+                    value = c == 0 ? sine : 0.9f * sine + 0.001f * noise(state);
+                } else if (name == "noisy left") {
+                    value = c == 0 ? sine + 0.05f * noise(state) : sine;
+                } else if (name == "mid side") {
+                    value = c == 0 ? sine + 0.01f * noise(state) : sine - 0.01f * noise(state);
+                } else if (name == "quiet") {
+                    value = 0.001f * sine + 0.0001f * noise(state);
+                } else if (name == "multichannel") {
+                    value = static_cast<float>(std::sin(2.0 * M_PI * 110.0 * (c + 1) * t)) * 0.3f;
+                }
+                // "silence" stays at zero
+                signal.audio.getChannel(c)[i] = value;
+            }
+        }
+        return signal;
+    }
+
+    int runCase(const Signal& signal, SampleFormat format, int level, Coverage& coverage, size_t& encodedBytes) {
+        std::vector<uint8_t> bytes;
+        if (!encode(signal.audio, format, level, 1, bytes)) {
+            std::cerr << "FAIL: " << signal.name << ": encoding failed" << std::endl;
+            return 1;
+        }
+        encodedBytes = bytes.size();
+
+        int bitsPerSample = PcmConverter::bitsPerSample(format);
+        std::string label = signal.name + ", " + std::to_string(signal.audio.getNumChannels()) + " ch, " +
+                            std::to_string(bitsPerSample) + "-bit, level " + std::to_string(level);
+
+        StreamInfo info;
+        std::vector<int32_t> decoded;
+        std::string error = decodeFlac(bytes, info, decoded, coverage);
+        if (!error.empty()) {
+            std::cerr << "FAIL: " << label << ": " << error << std::endl;
+            return 1;
+        }
+        if (info.sampleRate != 44100 || info.numChannels != signal.audio.getNumChannels() ||
+            info.bitsPerSample != bitsPerSample || info.totalSamples != signal.audio.getNumFrames()) {
+            std::cerr << "FAIL: " << label << ": wrong STREAMINFO" << std::endl;
+            return 1;
+        }
+        if (decoded != referencePcm(signal.audio, format)) {
+            std::cerr << "FAIL: " << label << ": decoded samples differ from the PCM input" << std::endl;
+            return 1;
+        }
+
+        // Threads only change who encodes which frame, never the bytes
+        std::vector<uint8_t> threaded;
+        if (!encode(signal.audio, format, level, 4, threaded) || threaded != bytes) {
+            std::cerr << "FAIL: " << label << ": multithreaded output differs" << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+}
+
+int main() {
+    int failures = 0;
+    Coverage coverage;
+    size_t encodedBytes = 0;
+
+    const size_t numFrames = 3 * 4096 + 1234;
+    const char* stereoSignals[] = {"sine", "noise", "clipped noise", "square", "silence", "correlated", "noisy left", "mid side",
+                                 "quiet"};
+    for (const char* name : stereoSignals) {
+        Signal signal = makeSignal(name, 2, numFrames);
+        for (SampleFormat format : {SampleFormat::Int16, SampleFormat::Int24}) {
+            int caseFailures = runCase(signal, format, FlacEncoder::kDefaultLevel, coverage, encodedBytes);
+            if (caseFailures == 0) {
+                size_t pcmBytes = numFrames * 2 * PcmConverter::bytesPerSample(format);
+                std::cout << "ok    " << name << ", " << PcmConverter::bitsPerSample(format) << "-bit: "
+                          << encodedBytes << " bytes (" << 100 * encodedBytes / pcmBytes << "% of PCM)" << std::endl;
+            }
+            failures += caseFailures;
+        }
+    }
+
+    // Every level, on a signal where LPC and stereo decorrelation matter
+    Signal correlated = makeSignal("correlated", 2, numFrames);
+    for (int level = FlacEncoder::kMinLevel; level <= FlacEncoder::kMaxLevel; ++level) {
+        int caseFailures = runCase(correlated, SampleFormat::Int16, level, coverage, encodedBytes);
+        if (caseFailures == 0) {
+            std::cout << "ok    level " << level << ": " << encodedBytes << " bytes" << std::endl;
+        }
+        failures += caseFailures;
+    }
+
+    // Mono, more than two channels, and streams shorter than one block (the last
+    // frame then needs an explicit block size)
+    struct Shape {
+        const char* name;
+        int numChannels;
+        size_t numFrames;
+    };
+    const Shape shapes[] = {
+        {"mono", 1, numFrames}, {"multichannel", 6, 5000}, {"short", 2, 1}, {"short", 2, 100}, {"short", 2, 300},
+        {"short", 1, 4097},
+    };
+    for (const Shape& shape : shapes) {
+        Signal signal = makeSignal(shape.name, shape.numChannels, shape.numFrames);
+        int caseFailures = 0;
+        for (SampleFormat format : {SampleFormat::Int16, SampleFormat::Int24}) {
+            for (int level : {0, 8}) {
+                caseFailures += runCase(signal, format, level, coverage, encodedBytes);
+            }
+        }
+        if (caseFailures == 0) {
+            std::cout << "ok    " << shape.name << ", " << shape.numChannels << " ch, " << shape.numFrames
+                      << " frames" << std::endl;
+        }
+        failures += caseFailures;
+    }
+
+    // The signals above should reach every subframe type and stereo mode
+    const char* typeNames[] = {"constant", "verbatim", "fixed", "LPC"};
+    for (int type = 0; type < 4; ++type) {
+        if (coverage.subframeTypes[type] == 0) {
+            std::cerr << "FAIL: no " << typeNames[type] << " subframes were produced" << std::endl;
+            failures++;
+        }
+    }
+    const char* assignmentNames[] = {"left/side", "side/right", "mid/side"};
+    for (int assignment = 8; assignment <= 10; ++assignment) {
+        if (coverage.channelAssignments[assignment] == 0) {
+            std::cerr << "FAIL: no " << assignmentNames[assignment - 8] << " frames were produced" << std::endl;
+            failures++;
+        }
+    }
+    if (failures == 0) {
+        std::cout << "ok    every subframe type and stereo mode decoded (" << FlacEncoder::getKernelName()
+                  << " kernels)" << std::endl;
+    }
+
+    // The string buffer overload writes the same bytes as the vector one
+    for (AudioFileFormat fileFormat : {AudioFileFormat::Wav, AudioFileFormat::Flac}) {
+        std::vector<uint8_t> vectorBytes;
+        std::string stringBytes;
+        AudioWriter vectorWriter;
+        AudioWriter stringWriter;
+        vectorWriter.setFileFormat(fileFormat);
+        stringWriter.setFileFormat(fileFormat);
+        std::vector<const float*> channels = {correlated.audio.getChannel(0), correlated.audio.getChannel(1)};
+        bool written = vectorWriter.openMemory(vectorBytes, 44100, 2, SampleFormat::Int16) &&
+                       stringWriter.openMemory(stringBytes, 44100, 2, SampleFormat::Int16) &&
+                       vectorWriter.appendBlock(channels.data(), correlated.audio.getNumFrames()) &&
+                       stringWriter.appendBlock(channels.data(), correlated.audio.getNumFrames()) &&
+                       vectorWriter.finalize() && stringWriter.finalize();
+        const char* name = AudioWriter::extensionFor(fileFormat);
+        if (!written || stringBytes.size() != vectorBytes.size() ||
+            memcmp(stringBytes.data(), vectorBytes.data(), vectorBytes.size()) != 0) {
+            std::cerr << "FAIL: " << name << " written to a string differs from a vector" << std::endl;
+            failures++;
+        } else {
+            std::cout << "ok    " << name << " written to a string matches a vector" << std::endl;
+        }
+    }
+
+    // Float samples have no FLAC representation
+    std::vector<uint8_t> bytes;
+    AudioWriter writer;
+    writer.setFileFormat(AudioFileFormat::Flac);
+    if (writer.openMemory(bytes, 44100, 2, SampleFormat::Float32)) {
+        std::cerr << "FAIL: FLAC output accepted float samples" << std::endl;
+        failures++;
+        writer.finalize();
+    }
+
+    return failures == 0 ? 0 : 1;
+}
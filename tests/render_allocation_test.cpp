@@ -0,0 +1,174 @@
+// Checks that VstRenderer does no heap allocation once a render is under way,
+// and that events land on the same sample whatever the block size or tail mode.
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include "audio_buffer.h"
+#include "midi_sequence.h"
+#include "vst_renderer.h"
+
+namespace {
+    std::atomic<bool> countAllocations(false);
+    std::atomic<size_t> allocationCount(0);
+
+    void* allocate(size_t size) {
+        if (countAllocations) {
+            ++allocationCount;
+        }
+        void* p = std::malloc(size ? size : 1);
+        if (!p) {
+            throw std::bad_alloc();
+        }
+        return p;
+    }
+
+    // A few bars of chords with pedal, bends and controller changes on three channels
+    void buildSequence(MidiSequence& sequence) {
+        sequence.clear();
+        sequence.getTempoMap().reset(480);
+        for (int bar = 0; bar < 8; ++bar) {
+            for (int beat = 0; beat < 4; ++beat) {
+                uint64_t tick = static_cast<uint64_t>(bar * 4 + beat) * 480 + 7 * beat;
+                for (int channel = 0; channel < 3; ++channel) {
+                    int note = 48 + channel * 7 + (bar * 5 + beat * 3) % 12;
+                    sequence.addChannelEvent(tick, 0, static_cast<uint8_t>(0x90 | channel), static_cast<uint8_t>(note), 100);
+                    sequence.addChannelEvent(tick + 300, 0, static_cast<uint8_t>(0x80 | channel), static_cast<uint8_t>(note), 0);
+                }
+                sequence.addChannelEvent(tick + 11, 0, 0xB0, 10, static_cast<uint8_t>((beat * 40) % 128));
+                sequence.addChannelEvent(tick + 13, 0, 0xE1, 0, static_cast<uint8_t>(64 + beat * 8));
+            }
+            sequence.addChannelEvent(static_cast<uint64_t>(bar) * 1920, 0, 0xB2, 64, bar % 2 ? 0 : 127);
+        }
+        sequence.sortByTick();
+        sequence.rebuildTempoMap();
+    }
+
+    bool render(VstRenderer& renderer, const MidiSequence& sequence, int blockSize, AudioBuffer& audio,
+                size_t& steadyAllocations) {
+        renderer.setBlockSize(blockSize);
+        audio.setSize(2, 0);
+        audio.reserve(static_cast<size_t>(sequence.getLengthInSamples(44100) + 44100));
+
+        // Count from the first block on (setting up the render may allocate), but
+        // not the test's own copying
+        allocationCount = 0;
+        bool ok = renderer.renderMidi(sequence, 44100, 2, [&audio](const float* const* channels, int numFrames) {
+            countAllocations = false;
+            audio.append(channels, static_cast<size_t>(numFrames));
+            countAllocations = true;
+            return true;
+        });
+        countAllocations = false;
+        steadyAllocations = allocationCount;
+        return ok;
+    }
+}
+
+void* operator new(size_t size) {
+    return allocate(size);
+}
+
+void* operator new[](size_t size) {
+    return allocate(size);
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+    std::free(p);
+}
+
+int main() {
+    MidiSequence sequence;
+    buildSequence(sequence);
+
+    VstRenderer renderer;
+    if (!renderer.loadVst("allocation_test.vst")) {
+        std::cerr << "FAIL: could not load the instrument" << std::endl;
+        return 1;
+    }
+
+    int failures = 0;
+    const int blockSizes[] = {512, 64, 1000, 37};
+    AudioBuffer reference;
+    AudioBuffer audio;
+
+    for (int blockSize : blockSizes) {
+        size_t allocations = 0;
+        AudioBuffer& output = reference.getNumFrames() == 0 ? reference : audio;
+        // Render twice so the second pass runs on warm buffers
+        if (!render(renderer, sequence, blockSize, output, allocations) ||
+            !render(renderer, sequence, blockSize, output, allocations)) {
+            std::cerr << "FAIL: render with block size " << blockSize << " failed" << std::endl;
+            failures++;
+            continue;
+        }
+
+        if (allocations != 0) {
+            std::cerr << "FAIL: block size " << blockSize << ": " << allocations
+                      << " heap allocations while rendering" << std::endl;
+            failures++;
+        } else {
+            std::cout << "ok    block size " << blockSize << ": no heap allocations while rendering" << std::endl;
+        }
+
+        if (&output == &audio) {
+            // Chunk boundaries move with the block size, so allow for float rounding only
+            float maxDifference = 0.0f;
+            if (audio.getNumFrames() != reference.getNumFrames()) {
+                maxDifference = INFINITY;
+            } else {
+                for (int channel = 0; channel < 2; ++channel) {
+                    for (size_t i = 0; i < audio.getNumFrames(); ++i) {
+                        float difference = std::fabs(audio.getChannel(channel)[i] - reference.getChannel(channel)[i]);
+                        maxDifference = std::max(maxDifference, difference);
+                    }
+                }
+            }
+            if (maxDifference > 1e-4f) {
+                std::cerr << "FAIL: block size " << blockSize << " differs from block size 512 by "
+                          << maxDifference << std::endl;
+                failures++;
+            } else {
+                std::cout << "ok    block size " << blockSize << " matches block size 512" << std::endl;
+            }
+        }
+    }
+
+    // The adaptive tail holds back silent frames; that mustn't allocate either, and
+    // what it does deliver is the start of the fixed-tail render
+    RenderTail tail;
+    tail.mode = RenderTail::Mode::Adaptive;
+    tail.holdSeconds = 0.1;
+    renderer.setTail(tail);
+    size_t allocations = 0;
+    if (!render(renderer, sequence, 64, audio, allocations) || !render(renderer, sequence, 64, audio, allocations)) {
+        std::cerr << "FAIL: render with an adaptive tail failed" << std::endl;
+        failures++;
+    } else if (allocations != 0) {
+        std::cerr << "FAIL: adaptive tail: " << allocations << " heap allocations while rendering" << std::endl;
+        failures++;
+    } else if (audio.getNumFrames() == 0 || audio.getNumFrames() > reference.getNumFrames()) {
+        std::cerr << "FAIL: adaptive tail rendered " << audio.getNumFrames() << " frames, fixed tail "
+                  << reference.getNumFrames() << std::endl;
+        failures++;
+    } else {
+        std::cout << "ok    adaptive tail: no heap allocations while rendering, " << audio.getNumFrames()
+                  << " of " << reference.getNumFrames() << " frames" << std::endl;
+    }
+
+    return failures == 0 ? 0 : 1;
+}
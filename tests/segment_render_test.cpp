@@ -0,0 +1,104 @@
+// Checks that rendering the timeline in parallel segments gives exactly the
+// samples of a serial render, for several block sizes and tail modes.
+#include <cstring>
+#include <iostream>
+#include <string>
+#include "audio_buffer.h"
+#include "midi_sequence.h"
+#include "vst_renderer.h"
+
+namespace {
+    // Long enough for several segments, with notes and a sustain pedal held across
+    // segment starts and a tempo change, so each segment depends on chased state
+    void buildSequence(MidiSequence& sequence) {
+        sequence.clear();
+        sequence.getTempoMap().reset(480);
+        // 100 BPM from bar 12
+        const uint8_t tempo[] = {0x09, 0x27, 0xC0};
+        sequence.addMetaEvent(12 * 1920, 0, MidiSequence::kMetaSetTempo, tempo, sizeof(tempo));
+        for (int bar = 0; bar < 24; ++bar) {
+            for (int beat = 0; beat < 4; ++beat) {
+                uint64_t tick = static_cast<uint64_t>(bar * 4 + beat) * 480 + 5 * beat;
+                for (int channel = 0; channel < 3; ++channel) {
+                    int note = 45 + channel * 9 + (bar * 7 + beat * 5) % 12;
+                    // Some notes ring on for several beats
+                    uint64_t length = (bar + channel) % 3 == 0 ? 2400 : 360;
+                    sequence.addChannelEvent(tick, 0, static_cast<uint8_t>(0x90 | channel), static_cast<uint8_t>(note),
+                                             static_cast<uint8_t>(60 + channel * 20));
+                    sequence.addChannelEvent(tick + length, 0, static_cast<uint8_t>(0x80 | channel),
+                                             static_cast<uint8_t>(note), 0);
+                }
+                sequence.addChannelEvent(tick + 17, 0, 0xB1, 10, static_cast<uint8_t>((bar * 16 + beat * 32) % 128));
+                sequence.addChannelEvent(tick + 23, 0, 0xE2, 0, static_cast<uint8_t>(48 + beat * 10));
+            }
+            sequence.addChannelEvent(static_cast<uint64_t>(bar) * 1920, 0, 0xB0, 64, bar % 4 < 2 ? 127 : 0);
+        }
+        sequence.sortByTick();
+        sequence.rebuildTempoMap();
+    }
+
+    bool identical(const AudioBuffer& a, const AudioBuffer& b) {
+        if (a.getNumChannels() != b.getNumChannels() || a.getNumFrames() != b.getNumFrames()) {
+            return false;
+        }
+        for (int channel = 0; channel < a.getNumChannels(); ++channel) {
+            if (std::memcmp(a.getChannel(channel), b.getChannel(channel), a.getNumFrames() * sizeof(float)) != 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool check(const MidiSequence& sequence, int blockSize, const RenderTail& tail, const std::string& name) {
+        VstRenderer serial;
+        VstRenderer segmented;
+        segmented.setParallelSegments(4);
+        for (VstRenderer* renderer : {&serial, &segmented}) {
+            renderer->setBlockSize(blockSize);
+            renderer->setTail(tail);
+            if (!renderer->loadVst("segment_test.vst") || !renderer->renderMidi(sequence, 44100, 2)) {
+                std::cerr << "FAIL: " << name << ": render failed" << std::endl;
+                return false;
+            }
+        }
+
+        const AudioBuffer& expected = serial.getAudio();
+        const AudioBuffer& actual = segmented.getAudio();
+        if (expected.getNumFrames() <= static_cast<size_t>(2 * VstRenderer::kSegmentFrames)) {
+            std::cerr << "FAIL: " << name << ": only " << expected.getNumFrames() << " frames, too short to segment"
+                      << std::endl;
+            return false;
+        }
+        if (!identical(expected, actual)) {
+            std::cerr << "FAIL: " << name << ": segmented render (" << actual.getNumFrames()
+                      << " frames) differs from serial render (" << expected.getNumFrames() << " frames)" << std::endl;
+            return false;
+        }
+        std::cout << "ok    " << name << ": " << expected.getNumFrames() << " frames identical" << std::endl;
+        return true;
+    }
+}
+
+int main() {
+    MidiSequence sequence;
+    buildSequence(sequence);
+
+    int failures = 0;
+    RenderTail fixed;
+    RenderTail adaptive;
+    adaptive.mode = RenderTail::Mode::Adaptive;
+    adaptive.holdSeconds = 0.1;
+
+    // 1000 does not divide the segment length, so segments are rounded to whole blocks
+    const int blockSizes[] = {512, 1000};
+    for (int blockSize : blockSizes) {
+        if (!check(sequence, blockSize, fixed, "block size " + std::to_string(blockSize))) {
+            failures++;
+        }
+    }
+    if (!check(sequence, 512, adaptive, "adaptive tail")) {
+        failures++;
+    }
+
+    return failures == 0 ? 0 : 1;
+}